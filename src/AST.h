@@ -1,5 +1,6 @@
 #pragma once
 
+#include <cstdint>
 #include <string>
 #include <vector>
 #include <memory>
@@ -12,10 +13,19 @@ struct VariableExpr;
 struct AssignExpr;
 struct FunctionCallExpr;
 struct UnaryExpr;
+struct IndexExpr;
+struct IndexAssignExpr;
+struct LengthExpr;
+struct EntryExpr;
+struct EntryAssignExpr;
+struct HasEntryExpr;
+struct JoinExpr;
+struct TextExpr;
 struct DeclarationStmt;
 struct ExpressionStmt;
 struct IfStmt;
 struct WhileStmt;
+struct ForStmt;
 struct BlockStmt;
 struct PrintStmt;
 struct NewlineStmt;
@@ -23,6 +33,7 @@ struct ProcedureDeclStmt;
 struct ProcedureCallStmt;
 struct ReturnStmt;
 struct BreakStmt;
+struct ImportStmt;
 
 struct Param 
 {
@@ -30,6 +41,47 @@ struct Param
     Token type;
 };
 
+// Bytes a variable of the type takes. int8, int16 and int32 keep the low 1, 2 or 4 bytes of a
+// value and read back sign-extended; a bool keeps whether the value is nonzero, in one byte, or
+// one bit of a bool array. Everything else is a full word.
+inline int typeWidth(const std::string& type) 
+{
+    if (type == "int8" || type == "bool")
+    {
+        return 1;
+    }
+    if (type == "int16")
+    {
+        return 2;
+    }
+    return type == "int32" ? 4 : 8;
+}
+
+// Whether the type holds whole 64-bit integers, as a 'for each' counts with.
+inline bool isWordInteger(const std::string& type) 
+{
+    return typeWidth(type) == 8 && type != "float" && type != "string";
+}
+
+// The value a variable of the type holds after `value` is stored in it.
+inline int64_t storedValue(const std::string& type, int64_t value) 
+{
+    if (type == "bool")
+    {
+        return value != 0;
+    }
+    int width = typeWidth(type);
+    if (width == 1)
+    {
+        return static_cast<int8_t>(value);
+    }
+    if (width == 2)
+    {
+        return static_cast<int16_t>(value);
+    }
+    return width == 4 ? static_cast<int32_t>(value) : value;
+}
+
 struct ExprVisitor 
 {
     virtual void visitBinaryExpr(const BinaryExpr& expr) = 0;
@@ -39,6 +91,14 @@ struct ExprVisitor
     virtual void visitAssignExpr(const AssignExpr& expr) = 0;
     virtual void visitFunctionCallExpr(const FunctionCallExpr& expr) = 0;
     virtual void visitUnaryExpr(const UnaryExpr& expr) = 0;
+    virtual void visitIndexExpr(const IndexExpr& expr) = 0;
+    virtual void visitIndexAssignExpr(const IndexAssignExpr& expr) = 0;
+    virtual void visitLengthExpr(const LengthExpr& expr) = 0;
+    virtual void visitEntryExpr(const EntryExpr& expr) = 0;
+    virtual void visitEntryAssignExpr(const EntryAssignExpr& expr) = 0;
+    virtual void visitHasEntryExpr(const HasEntryExpr& expr) = 0;
+    virtual void visitJoinExpr(const JoinExpr& expr) = 0;
+    virtual void visitTextExpr(const TextExpr& expr) = 0;
 };
 
 struct Expr {
@@ -117,11 +177,102 @@ struct UnaryExpr : Expr
     } 
 };
 
+// 'the element <index> of <array>'. Elements are numbered from 1.
+struct IndexExpr : Expr 
+{ 
+    Token array; 
+    std::unique_ptr<Expr> index; 
+    IndexExpr(Token a, std::unique_ptr<Expr> i) : array(a), index(std::move(i)) {} 
+    void accept(ExprVisitor& v) const override 
+    { 
+        v.visitIndexExpr(*this); 
+    } 
+};
+// 'the element <index> of <array> continues as <value>'.
+struct IndexAssignExpr : Expr 
+{ 
+    Token array; 
+    std::unique_ptr<Expr> index; 
+    std::unique_ptr<Expr> value; 
+    IndexAssignExpr(Token a, std::unique_ptr<Expr> i, std::unique_ptr<Expr> v) : array(a), index(std::move(i)), value(std::move(v)) {} 
+    void accept(ExprVisitor& v) const override 
+    { 
+        v.visitIndexAssignExpr(*this); 
+    } 
+};
+// 'the length of <array>': the number of elements it holds, a constant.
+struct LengthExpr : Expr 
+{ 
+    Token array; 
+    explicit LengthExpr(Token a) : array(a) {} 
+    void accept(ExprVisitor& v) const override 
+    { 
+        v.visitLengthExpr(*this); 
+    } 
+};
+// 'the entry <key> of <map>': the value the map holds for the key. Reading a key the map has no
+// entry for is a runtime error.
+struct EntryExpr : Expr 
+{ 
+    Token map; 
+    std::unique_ptr<Expr> key; 
+    EntryExpr(Token m, std::unique_ptr<Expr> k) : map(m), key(std::move(k)) {} 
+    void accept(ExprVisitor& v) const override 
+    { 
+        v.visitEntryExpr(*this); 
+    } 
+};
+// 'the entry <key> of <map> continues as <value>', which adds the entry if the map has none.
+struct EntryAssignExpr : Expr 
+{ 
+    Token map; 
+    std::unique_ptr<Expr> key; 
+    std::unique_ptr<Expr> value; 
+    EntryAssignExpr(Token m, std::unique_ptr<Expr> k, std::unique_ptr<Expr> v) : map(m), key(std::move(k)), value(std::move(v)) {} 
+    void accept(ExprVisitor& v) const override 
+    { 
+        v.visitEntryAssignExpr(*this); 
+    } 
+};
+// '<map> has an entry for <key>': true if the map holds a value for the key.
+struct HasEntryExpr : Expr 
+{ 
+    Token map; 
+    std::unique_ptr<Expr> key; 
+    HasEntryExpr(Token m, std::unique_ptr<Expr> k) : map(m), key(std::move(k)) {} 
+    void accept(ExprVisitor& v) const override 
+    { 
+        v.visitHasEntryExpr(*this); 
+    } 
+};
+// '<left> followed by <right>': a new string holding the text of both strings.
+struct JoinExpr : Expr 
+{ 
+    std::unique_ptr<Expr> left; 
+    std::unique_ptr<Expr> right; 
+    JoinExpr(std::unique_ptr<Expr> l, std::unique_ptr<Expr> r) : left(std::move(l)), right(std::move(r)) {} 
+    void accept(ExprVisitor& v) const override 
+    { 
+        v.visitJoinExpr(*this); 
+    } 
+};
+// 'the text of <value>': the decimal digits of an integer, as a new string.
+struct TextExpr : Expr 
+{ 
+    std::unique_ptr<Expr> value; 
+    explicit TextExpr(std::unique_ptr<Expr> v) : value(std::move(v)) {} 
+    void accept(ExprVisitor& v) const override 
+    { 
+        v.visitTextExpr(*this); 
+    } 
+};
+
 struct StmtVisitor {
     virtual void visitDeclarationStmt(const DeclarationStmt& stmt) = 0;
     virtual void visitExpressionStmt(const ExpressionStmt& stmt) = 0;
     virtual void visitIfStmt(const IfStmt& stmt) = 0;
     virtual void visitWhileStmt(const WhileStmt& stmt) = 0;
+    virtual void visitForStmt(const ForStmt& stmt) = 0;
     virtual void visitBlockStmt(const BlockStmt& stmt) = 0;
     virtual void visitPrintStmt(const PrintStmt& stmt) = 0;
     virtual void visitNewlineStmt(const NewlineStmt& stmt) = 0;
@@ -129,11 +280,14 @@ struct StmtVisitor {
     virtual void visitProcedureCallStmt(const ProcedureCallStmt& stmt) = 0;
     virtual void visitReturnStmt(const ReturnStmt& stmt) = 0;
     virtual void visitBreakStmt(const BreakStmt& stmt) = 0;
+    virtual void visitImportStmt(const ImportStmt& stmt) = 0;
 };
 
 struct Stmt {
     virtual ~Stmt() = default;
     virtual void accept(StmtVisitor& visitor) const = 0;
+    // Source line of the statement's first token; 0 when unknown.
+    int line = 0;
 };
 
 struct BlockStmt : Stmt 
@@ -151,7 +305,13 @@ struct DeclarationStmt : Stmt
     Token type; 
     std::unique_ptr<Expr> initializer;
     bool is_mutable; 
-    DeclarationStmt(Token n, Token t, std::unique_ptr<Expr> i, bool m) : name(n), type(t), initializer(std::move(i)), is_mutable(m) {} 
+    // Elements of an array declared with 'holds <length> values', each starting at the
+    // initializer's value; 0 for a single value.
+    uint64_t length = 0;
+    // The key type of a map declared 'keyed by <type>', whose entries hold values of `type` and
+    // whose initializer is the number of entries to make room for; empty for anything else.
+    Token key_type;
+    DeclarationStmt(Token n, Token t, std::unique_ptr<Expr> i, bool m, uint64_t l = 0, Token k = {}) : name(n), type(t), initializer(std::move(i)), is_mutable(m), length(l), key_type(k) {} 
     void accept(StmtVisitor& v) const override 
     { 
         v.visitDeclarationStmt(*this);
@@ -170,7 +330,9 @@ struct IfStmt : Stmt
 { 
     std::unique_ptr<Expr> condition; 
     std::unique_ptr<Stmt> then_branch; 
-    IfStmt(std::unique_ptr<Expr> c, std::unique_ptr<Stmt> t) : condition(std::move(c)), then_branch(std::move(t)) {} 
+    // The 'otherwise' clause: a block, another IfStmt for 'otherwise, if', or null.
+    std::unique_ptr<Stmt> else_branch; 
+    IfStmt(std::unique_ptr<Expr> c, std::unique_ptr<Stmt> t, std::unique_ptr<Stmt> e = nullptr) : condition(std::move(c)), then_branch(std::move(t)), else_branch(std::move(e)) {} 
     void accept(StmtVisitor& v) const override 
     { 
         v.visitIfStmt(*this); 
@@ -186,6 +348,21 @@ struct WhileStmt : Stmt
         v.visitWhileStmt(*this); 
     } 
 };
+// 'for each <variable> from <first> to <last>, tell the following story:'. Both bounds are
+// evaluated once, on entry, and the body runs for every value from first to last inclusive. The
+// variable is declared by the loop unless it already exists and cannot be assigned in the body.
+struct ForStmt : Stmt 
+{
+    Token variable; 
+    std::unique_ptr<Expr> first; 
+    std::unique_ptr<Expr> last; 
+    std::unique_ptr<Stmt> body; 
+    ForStmt(Token v, std::unique_ptr<Expr> f, std::unique_ptr<Expr> l, std::unique_ptr<Stmt> b) : variable(std::move(v)), first(std::move(f)), last(std::move(l)), body(std::move(b)) {} 
+    void accept(StmtVisitor& v) const override 
+    { 
+        v.visitForStmt(*this); 
+    } 
+};
 struct PrintStmt : Stmt 
 { 
     std::unique_ptr<Expr> expression; 
@@ -218,6 +395,8 @@ struct ProcedureDeclStmt : Stmt
     std::vector<Param> params; 
     Token return_type; 
     std::unique_ptr<Stmt> body; 
+    // The file a recalled procedure came from; empty for the program's own procedures.
+    std::string source;
     ProcedureDeclStmt(Token n, std::vector<Param> p, Token rt, std::unique_ptr<Stmt> b) : name(n), params(std::move(p)), return_type(rt), body(std::move(b)) {} 
     void accept(StmtVisitor& v) const override 
     { 
@@ -239,4 +418,13 @@ struct BreakStmt : Stmt
     { 
         v.visitBreakStmt(*this); 
     } 
+};
+struct ImportStmt : Stmt 
+{ 
+    Token path; 
+    explicit ImportStmt(Token p) : path(p) {} 
+    void accept(StmtVisitor& v) const override 
+    { 
+        v.visitImportStmt(*this); 
+    } 
 };
\ No newline at end of file
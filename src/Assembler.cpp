@@ -0,0 +1,2153 @@
+#include "Assembler.h"
+#include <stdexcept>
+#include <algorithm>
+#include <cctype>
+#include <climits>
+#include <set>
+#include <elf.h>
+#include <cstring>
+#include <unistd.h>
+
+namespace
+{
+    // The DWARF constants used by the line tables (elf.h does not define them).
+    enum : uint8_t
+    {
+        DW_TAG_COMPILE_UNIT = 0x11,
+        DW_AT_NAME = 0x03,
+        DW_AT_STMT_LIST = 0x10,
+        DW_AT_LOW_PC = 0x11,
+        DW_AT_HIGH_PC = 0x12,
+        DW_AT_LANGUAGE = 0x13,
+        DW_AT_COMP_DIR = 0x1b,
+        DW_AT_PRODUCER = 0x25,
+        DW_FORM_ADDR = 0x01,
+        DW_FORM_DATA2 = 0x05,
+        DW_FORM_DATA4 = 0x06,
+        DW_FORM_STRING = 0x08,
+        DW_LNS_COPY = 0x01,
+        DW_LNS_ADVANCE_PC = 0x02,
+        DW_LNS_ADVANCE_LINE = 0x03,
+        DW_LNS_SET_FILE = 0x04,
+        DW_LNS_OPCODE_BASE = 0x0d,
+        DW_LNE_END_SEQUENCE = 0x01,
+        DW_LNE_SET_ADDRESS = 0x02,
+    };
+    const uint16_t DW_LANG_MIPS_ASSEMBLER = 0x8001;
+
+    struct RegisterInfo
+    {
+        int number;
+        int size;
+        bool xmm;
+        bool byte_rex;
+    };
+
+    const std::unordered_map<std::string, RegisterInfo>& registers()
+    {
+        static const std::unordered_map<std::string, RegisterInfo> table = [] {
+            std::unordered_map<std::string, RegisterInfo> t;
+            const char* r64[] = {"rax", "rcx", "rdx", "rbx", "rsp", "rbp", "rsi", "rdi"};
+            const char* r32[] = {"eax", "ecx", "edx", "ebx", "esp", "ebp", "esi", "edi"};
+            const char* r16[] = {"ax", "cx", "dx", "bx", "sp", "bp", "si", "di"};
+            const char* r8[] = {"al", "cl", "dl", "bl", "spl", "bpl", "sil", "dil"};
+            for (int i = 0; i < 8; ++i)
+            {
+                t[r64[i]] = {i, 8, false, false};
+                t[r32[i]] = {i, 4, false, false};
+                t[r16[i]] = {i, 2, false, false};
+                t[r8[i]] = {i, 1, false, i >= 4};
+            }
+            for (int i = 8; i < 16; ++i)
+            {
+                std::string n = "r" + std::to_string(i);
+                t[n] = {i, 8, false, false};
+                t[n + "d"] = {i, 4, false, false};
+                t[n + "w"] = {i, 2, false, false};
+                t[n + "b"] = {i, 1, false, false};
+            }
+            for (int i = 0; i < 16; ++i)
+            {
+                t["xmm" + std::to_string(i)] = {i, 16, true, false};
+                t["ymm" + std::to_string(i)] = {i, 32, true, false};
+            }
+            return t;
+        }();
+        return table;
+    }
+
+    const std::unordered_map<std::string, int>& conditionCodes()
+    {
+        static const std::unordered_map<std::string, int> table = {
+            {"o", 0}, {"no", 1}, {"b", 2}, {"c", 2}, {"nae", 2}, {"ae", 3}, {"nb", 3}, {"nc", 3},
+            {"e", 4}, {"z", 4}, {"ne", 5}, {"nz", 5}, {"be", 6}, {"na", 6}, {"a", 7}, {"nbe", 7},
+            {"s", 8}, {"ns", 9}, {"p", 10}, {"pe", 10}, {"np", 11}, {"po", 11},
+            {"l", 12}, {"nge", 12}, {"ge", 13}, {"nl", 13}, {"le", 14}, {"ng", 14}, {"g", 15}, {"nle", 15}
+        };
+        return table;
+    }
+
+    const std::unordered_map<std::string, int>& aluOps()
+    {
+        static const std::unordered_map<std::string, int> table = {
+            {"add", 0}, {"or", 1}, {"adc", 2}, {"sbb", 3}, {"and", 4}, {"sub", 5}, {"xor", 6}, {"cmp", 7}
+        };
+        return table;
+    }
+
+    const std::unordered_map<std::string, int>& shiftOps()
+    {
+        static const std::unordered_map<std::string, int> table = {
+            {"rol", 0}, {"ror", 1}, {"rcl", 2}, {"rcr", 3}, {"shl", 4}, {"sal", 4}, {"shr", 5}, {"sar", 7}
+        };
+        return table;
+    }
+
+    std::string trim(const std::string& text)
+    {
+        size_t begin = text.find_first_not_of(" \t\r\n");
+        if (begin == std::string::npos)
+        {
+            return "";
+        }
+        size_t end = text.find_last_not_of(" \t\r\n");
+        return text.substr(begin, end - begin + 1);
+    }
+
+    std::string lower(std::string text)
+    {
+        std::transform(text.begin(), text.end(), text.begin(), [](unsigned char c) { return std::tolower(c); });
+        return text;
+    }
+
+    bool isSymbolChar(char c)
+    {
+        return std::isalnum(static_cast<unsigned char>(c)) || c == '_' || c == '.' || c == '$' || c == '@' || c == '?';
+    }
+
+    // Splits on commas that are not nested inside brackets or quotes.
+    std::vector<std::string> splitOperands(const std::string& text)
+    {
+        std::vector<std::string> parts;
+        std::string part;
+        int depth = 0;
+        char quote = 0;
+        for (char c : text)
+        {
+            if (quote)
+            {
+                if (c == quote)
+                {
+                    quote = 0;
+                }
+            }
+            else if (c == '\'' || c == '"' || c == '`')
+            {
+                quote = c;
+            }
+            else if (c == '[' || c == '(')
+            {
+                depth++;
+            }
+            else if (c == ']' || c == ')')
+            {
+                depth--;
+            }
+            else if (c == ',' && depth == 0)
+            {
+                parts.push_back(trim(part));
+                part.clear();
+                continue;
+            }
+            part += c;
+        }
+        if (!trim(part).empty() || !parts.empty())
+        {
+            parts.push_back(trim(part));
+        }
+        return parts;
+    }
+
+    std::string stripComment(const std::string& line)
+    {
+        char quote = 0;
+        for (size_t i = 0; i < line.size(); ++i)
+        {
+            char c = line[i];
+            if (quote)
+            {
+                if (c == '\\' && quote == '`')
+                {
+                    ++i;
+                }
+                else if (c == quote)
+                {
+                    quote = 0;
+                }
+            }
+            else if (c == '\'' || c == '"' || c == '`')
+            {
+                quote = c;
+            }
+            else if (c == ';')
+            {
+                return line.substr(0, i);
+            }
+        }
+        return line;
+    }
+
+    bool fitsInt8(int64_t value)
+    {
+        return value >= -128 && value <= 127;
+    }
+
+    bool fitsInt32(int64_t value)
+    {
+        return value >= INT32_MIN && value <= INT32_MAX;
+    }
+
+    std::string decodeBacktick(const std::string& body)
+    {
+        std::string out;
+        for (size_t i = 0; i < body.size(); ++i)
+        {
+            if (body[i] != '\\' || i + 1 >= body.size())
+            {
+                out += body[i];
+                continue;
+            }
+            char c = body[++i];
+            switch (c)
+            {
+                case 'n': out += '\n'; break;
+                case 't': out += '\t'; break;
+                case 'r': out += '\r'; break;
+                case 'a': out += '\a'; break;
+                case 'b': out += '\b'; break;
+                case 'f': out += '\f'; break;
+                case 'v': out += '\v'; break;
+                case 'e': out += '\x1b'; break;
+                case 'x':
+                {
+                    int value = 0;
+                    int digits = 0;
+                    while (digits < 2 && i + 1 < body.size() && std::isxdigit(static_cast<unsigned char>(body[i + 1])))
+                    {
+                        value = value * 16 + std::stoi(std::string(1, body[++i]), nullptr, 16);
+                        digits++;
+                    }
+                    out += static_cast<char>(value);
+                    break;
+                }
+                default:
+                    if (c >= '0' && c <= '7')
+                    {
+                        int value = c - '0';
+                        int digits = 1;
+                        while (digits < 3 && i + 1 < body.size() && body[i + 1] >= '0' && body[i + 1] <= '7')
+                        {
+                            value = value * 8 + (body[++i] - '0');
+                            digits++;
+                        }
+                        out += static_cast<char>(value);
+                    }
+                    else
+                    {
+                        out += c;
+                    }
+                    break;
+            }
+        }
+        return out;
+    }
+}
+
+void Assembler::error(const std::string& message) const
+{
+    throw std::runtime_error("Assembler line " + std::to_string(m_line) + ": " + message);
+}
+
+void Assembler::assemble(const std::string& source)
+{
+    size_t start = 0;
+    while (start <= source.size())
+    {
+        size_t end = source.find('\n', start);
+        if (end == std::string::npos)
+        {
+            end = source.size();
+        }
+        m_line++;
+        assembleLine(source.substr(start, end - start));
+        start = end + 1;
+    }
+}
+
+void Assembler::assembleLine(const std::string& raw)
+{
+    std::string line = trim(raw);
+    if (line.compare(0, 5, "%line") == 0 && (line.size() == 5 || std::isspace(static_cast<unsigned char>(line[5]))))
+    {
+        sourceLine(trim(line.substr(5)));
+        return;
+    }
+    line = trim(stripComment(line));
+    if (line.empty() || line[0] == '%')
+    {
+        return;
+    }
+
+    size_t word_end = 0;
+    while (word_end < line.size() && isSymbolChar(line[word_end]))
+    {
+        word_end++;
+    }
+
+    if (word_end > 0 && word_end < line.size() && line[word_end] == ':')
+    {
+        defineLabel(line.substr(0, word_end));
+        assembleLine(line.substr(word_end + 1));
+        return;
+    }
+
+    std::string first = line.substr(0, word_end);
+    std::string rest = trim(line.substr(word_end));
+
+    if (rest.compare(0, 3, "equ") == 0 && (rest.size() == 3 || std::isspace(static_cast<unsigned char>(rest[3]))))
+    {
+        m_equs[qualify(first)] = parseExpr(trim(rest.substr(3)));
+        return;
+    }
+
+    std::string mnemonic = lower(first);
+    static const std::set<std::string> directives = {
+        "section", "segment", "global", "extern", "default", "align", "alignb", "bits",
+        "db", "dw", "dd", "dq", "resb", "resw", "resd", "resq"
+    };
+    if (directives.count(mnemonic))
+    {
+        directive(mnemonic, rest);
+        return;
+    }
+
+    if (mnemonic == "rep")
+    {
+        byte(0xF3);
+        assembleLine(rest);
+        return;
+    }
+
+    std::vector<Operand> ops;
+    for (const auto& text : splitOperands(rest))
+    {
+        ops.push_back(parseOperand(text));
+    }
+    instruction(mnemonic, ops);
+}
+
+void Assembler::directive(const std::string& name, const std::string& rest)
+{
+    if (name == "section" || name == "segment")
+    {
+        size_t space = rest.find_first_of(" \t");
+        std::string section = space == std::string::npos ? rest : rest.substr(0, space);
+        std::string attributes = space == std::string::npos ? "" : rest.substr(space);
+        switchSection(section, attributes);
+        addLineRow();
+    }
+    else if (name == "global")
+    {
+        for (const auto& operand : splitOperands(rest))
+        {
+            std::string symbol = trim(operand);
+            size_t end = symbol.find_first_of(": \t");
+            std::string label = symbol.substr(0, end);
+            m_globals.insert(label);
+
+            // NASM's ELF extension: 'global name:function (end - name)'.
+            size_t colon = symbol.find(':');
+            if (colon != std::string::npos)
+            {
+                std::string type = trim(symbol.substr(colon + 1));
+                size_t open = type.find('(');
+                if (lower(trim(type.substr(0, open))) == "function")
+                {
+                    m_functions[label] = open == std::string::npos ? "" : type.substr(open);
+                }
+            }
+        }
+    }
+    else if (name == "align" || name == "alignb")
+    {
+        align(std::stoull(trim(splitOperands(rest)[0]), nullptr, 0));
+    }
+    else if (name == "db")
+    {
+        defineData(1, rest);
+    }
+    else if (name == "dw")
+    {
+        defineData(2, rest);
+    }
+    else if (name == "dd")
+    {
+        defineData(4, rest);
+    }
+    else if (name == "dq")
+    {
+        defineData(8, rest);
+    }
+    else if (name == "resb" || name == "resw" || name == "resd" || name == "resq")
+    {
+        int64_t count = 0;
+        if (!constantValue(parseExpr(rest), count) || count < 0)
+        {
+            error("'" + name + "' requires a constant count.");
+        }
+        int width = name == "resb" ? 1 : name == "resw" ? 2 : name == "resd" ? 4 : 8;
+        reserve(static_cast<uint64_t>(count) * width);
+    }
+}
+
+void Assembler::switchSection(const std::string& name, const std::string& attributes)
+{
+    for (size_t i = 0; i < m_sections.size(); ++i)
+    {
+        if (m_sections[i].name == name)
+        {
+            m_current_section = static_cast<int>(i);
+            return;
+        }
+    }
+
+    AsmSection section;
+    section.name = name;
+    std::string attrs = lower(attributes);
+    section.executable = (name.compare(0, 5, ".text") == 0 && attrs.find("noexec") == std::string::npos) ||
+        (attrs.find(" exec") != std::string::npos);
+    section.nobits = name == ".bss" || name.compare(0, 5, ".bss.") == 0 || attrs.find("nobits") != std::string::npos;
+    m_sections.push_back(section);
+    m_current_section = static_cast<int>(m_sections.size()) - 1;
+}
+
+// '%line <n>[+<step>] <file>': the lines that follow were generated from line n of the file.
+void Assembler::sourceLine(const std::string& rest)
+{
+    size_t end = rest.find_first_of(" \t");
+    std::string number = rest.substr(0, end);
+    number = number.substr(0, number.find('+'));
+    int line = 0;
+    try
+    {
+        line = std::stoi(number);
+    }
+    catch (const std::exception&)
+    {
+        error("'%line' requires a line number.");
+    }
+    std::string file = end == std::string::npos ? "" : trim(rest.substr(end));
+    if (file.empty())
+    {
+        file = m_line_files.empty() ? "-" : m_line_files[m_source_file];
+    }
+
+    auto known = std::find(m_line_files.begin(), m_line_files.end(), file);
+    m_source_file = static_cast<uint32_t>(known - m_line_files.begin());
+    if (known == m_line_files.end())
+    {
+        m_line_files.push_back(file);
+    }
+    m_source_line = line;
+    addLineRow();
+}
+
+// Starts a line table row at the current position of a code section. The source line carries
+// over section switches, as it does in NASM.
+void Assembler::addLineRow()
+{
+    if (m_source_line <= 0 || m_current_section < 0 || !m_sections[m_current_section].executable)
+    {
+        return;
+    }
+    uint64_t offset = m_sections[m_current_section].size();
+    if (!m_line_rows.empty() && m_line_rows.back().section == m_current_section && m_line_rows.back().offset == offset)
+    {
+        m_line_rows.pop_back();
+    }
+    m_line_rows.push_back({m_current_section, offset, m_source_line, m_source_file});
+}
+
+AsmSection& Assembler::current()
+{
+    if (m_current_section < 0)
+    {
+        switchSection(".text", "");
+    }
+    return m_sections[m_current_section];
+}
+
+std::string Assembler::qualify(const std::string& name) const
+{
+    if (!name.empty() && name[0] == '.' && name.compare(0, 2, "..") != 0)
+    {
+        return m_last_global_label + name;
+    }
+    return name;
+}
+
+void Assembler::defineLabel(const std::string& name)
+{
+    if (name[0] != '.')
+    {
+        m_last_global_label = name;
+    }
+    std::string full = qualify(name);
+    if (m_symbols.count(full) || m_equs.count(full))
+    {
+        error("Symbol '" + full + "' redefined.");
+    }
+    AsmSection& section = current();
+    m_symbols[full] = {m_current_section, section.size()};
+}
+
+void Assembler::byte(uint8_t value)
+{
+    AsmSection& section = current();
+    if (section.nobits)
+    {
+        error("Cannot emit code or data into a nobits section.");
+    }
+    section.bytes.push_back(value);
+}
+
+void Assembler::reserve(uint64_t count)
+{
+    AsmSection& section = current();
+    if (section.nobits)
+    {
+        section.reserved += count;
+    }
+    else
+    {
+        section.bytes.insert(section.bytes.end(), count, 0);
+    }
+}
+
+void Assembler::align(uint64_t boundary)
+{
+    if (boundary == 0 || (boundary & (boundary - 1)) != 0)
+    {
+        error("Alignment must be a power of two.");
+    }
+    AsmSection& section = current();
+    section.alignment = std::max(section.alignment, boundary);
+    uint64_t padding = (boundary - section.size() % boundary) % boundary;
+    if (section.nobits)
+    {
+        section.reserved += padding;
+    }
+    else
+    {
+        section.bytes.insert(section.bytes.end(), padding, section.executable ? 0x90 : 0);
+    }
+}
+
+void Assembler::defineData(int width, const std::string& rest)
+{
+    for (const auto& item : splitOperands(rest))
+    {
+        if (item.size() >= 2 && (item[0] == '`' || item[0] == '"' || (item[0] == '\'' && item.size() > 3)) && item.back() == item[0])
+        {
+            std::string body = item.substr(1, item.size() - 2);
+            std::string bytes = item[0] == '`' ? decodeBacktick(body) : body;
+            for (char c : bytes)
+            {
+                byte(static_cast<uint8_t>(c));
+            }
+            size_t padding = (width - bytes.size() % width) % width;
+            for (size_t i = 0; i < padding; ++i)
+            {
+                byte(0);
+            }
+            continue;
+        }
+        imm(parseExpr(item), width);
+    }
+}
+
+Assembler::Expr Assembler::parseExpr(const std::string& text) const
+{
+    Expr expr;
+    size_t i = 0;
+    int sign = 1;
+    bool expect_term = true;
+
+    while (i < text.size())
+    {
+        char c = text[i];
+        if (std::isspace(static_cast<unsigned char>(c)))
+        {
+            i++;
+            continue;
+        }
+        if (c == '+' || c == '-')
+        {
+            if (c == '-')
+            {
+                sign = -sign;
+            }
+            expect_term = true;
+            i++;
+            continue;
+        }
+        if (!expect_term)
+        {
+            error("Unsupported expression '" + text + "'.");
+        }
+
+        int64_t value = 0;
+        if (c == '\'' || c == '"' || c == '`')
+        {
+            size_t close = text.find(c, i + 1);
+            if (close == std::string::npos)
+            {
+                error("Unterminated character constant in '" + text + "'.");
+            }
+            std::string chars = text.substr(i + 1, close - i - 1);
+            if (c == '`')
+            {
+                chars = decodeBacktick(chars);
+            }
+            for (size_t k = 0; k < chars.size() && k < 8; ++k)
+            {
+                value |= static_cast<int64_t>(static_cast<unsigned char>(chars[k])) << (8 * k);
+            }
+            i = close + 1;
+        }
+        else if (std::isdigit(static_cast<unsigned char>(c)))
+        {
+            size_t end = i;
+            while (end < text.size() && std::isalnum(static_cast<unsigned char>(text[end])))
+            {
+                end++;
+            }
+            std::string digits = lower(text.substr(i, end - i));
+            if (digits.size() > 1 && digits.back() == 'h')
+            {
+                value = static_cast<int64_t>(std::stoull(digits.substr(0, digits.size() - 1), nullptr, 16));
+            }
+            else if (digits.compare(0, 2, "0b") == 0)
+            {
+                value = static_cast<int64_t>(std::stoull(digits.substr(2), nullptr, 2));
+            }
+            else
+            {
+                value = static_cast<int64_t>(std::stoull(digits, nullptr, digits.compare(0, 2, "0x") == 0 ? 16 : 10));
+            }
+            i = end;
+        }
+        else if (isSymbolChar(c))
+        {
+            size_t end = i;
+            while (end < text.size() && isSymbolChar(text[end]))
+            {
+                end++;
+            }
+            std::string name = qualify(text.substr(i, end - i));
+            i = end;
+
+            int64_t constant = 0;
+            if (constantValue({name, 0}, constant))
+            {
+                value = constant;
+            }
+            else
+            {
+                if (!expr.symbol.empty() || sign < 0)
+                {
+                    error("Unsupported relocatable expression '" + text + "'.");
+                }
+                expr.symbol = name;
+                sign = 1;
+                expect_term = false;
+                continue;
+            }
+        }
+        else
+        {
+            error("Unexpected character in expression '" + text + "'.");
+        }
+
+        expr.value += sign * value;
+        sign = 1;
+        expect_term = false;
+    }
+
+    return expr;
+}
+
+bool Assembler::constantValue(const Expr& expr, int64_t& value) const
+{
+    if (expr.symbol.empty())
+    {
+        value = expr.value;
+        return true;
+    }
+    auto equ = m_equs.find(expr.symbol);
+    if (equ != m_equs.end() && equ->second.symbol != expr.symbol)
+    {
+        int64_t inner = 0;
+        if (constantValue(equ->second, inner))
+        {
+            value = inner + expr.value;
+            return true;
+        }
+    }
+    return false;
+}
+
+Assembler::Operand Assembler::parseOperand(const std::string& raw) const
+{
+    Operand op;
+    std::string text = trim(raw);
+
+    static const std::unordered_map<std::string, int> sizes = {
+        {"byte", 1}, {"word", 2}, {"dword", 4}, {"qword", 8}, {"oword", 16}, {"xmmword", 16}, {"yword", 32}, {"ymmword", 32}
+    };
+    for (;;)
+    {
+        size_t space = text.find_first_of(" \t[");
+        if (space == std::string::npos)
+        {
+            break;
+        }
+        std::string word = lower(text.substr(0, space));
+        if (sizes.count(word))
+        {
+            op.size = sizes.at(word);
+            text = trim(text.substr(space));
+        }
+        else if (word == "strict")
+        {
+            text = trim(text.substr(space));
+        }
+        else
+        {
+            break;
+        }
+    }
+
+    auto reg = registers().find(lower(text));
+    if (reg != registers().end())
+    {
+        op.kind = Operand::REG;
+        op.reg = reg->second.number;
+        op.size = reg->second.size;
+        op.xmm = reg->second.xmm;
+        op.byte_rex = reg->second.byte_rex;
+        return op;
+    }
+
+    if (!text.empty() && text[0] == '[')
+    {
+        if (text.back() != ']')
+        {
+            error("Malformed memory operand '" + text + "'.");
+        }
+        op.kind = Operand::MEM;
+        std::string inner = text.substr(1, text.size() - 2);
+        std::string displacement;
+        size_t i = 0;
+        while (i < inner.size())
+        {
+            size_t start = i;
+            char sign = '+';
+            while (start < inner.size() && (std::isspace(static_cast<unsigned char>(inner[start])) || inner[start] == '+' || inner[start] == '-'))
+            {
+                if (inner[start] == '-')
+                {
+                    sign = sign == '-' ? '+' : '-';
+                }
+                start++;
+            }
+            size_t end = start;
+            char quote = 0;
+            while (end < inner.size())
+            {
+                char c = inner[end];
+                if (quote)
+                {
+                    if (c == quote)
+                    {
+                        quote = 0;
+                    }
+                }
+                else if (c == '\'' || c == '"')
+                {
+                    quote = c;
+                }
+                else if (c == '+' || c == '-')
+                {
+                    break;
+                }
+                end++;
+            }
+            std::string term = trim(inner.substr(start, end - start));
+            i = end;
+            if (term.empty())
+            {
+                continue;
+            }
+
+            std::string reg_name = lower(term);
+            int scale = 1;
+            size_t star = term.find('*');
+            if (star != std::string::npos)
+            {
+                std::string a = lower(trim(term.substr(0, star)));
+                std::string b = lower(trim(term.substr(star + 1)));
+                if (registers().count(a))
+                {
+                    reg_name = a;
+                    scale = std::stoi(b);
+                }
+                else
+                {
+                    reg_name = b;
+                    scale = std::stoi(a);
+                }
+            }
+
+            auto r = registers().find(reg_name);
+            if (r != registers().end() && r->second.size == 8 && !r->second.xmm)
+            {
+                if (sign == '-')
+                {
+                    error("Cannot subtract a register in '" + text + "'.");
+                }
+                if (star == std::string::npos && op.base < 0)
+                {
+                    op.base = r->second.number;
+                }
+                else if (op.index < 0)
+                {
+                    op.index = r->second.number;
+                    op.scale = scale;
+                }
+                else
+                {
+                    error("Too many registers in '" + text + "'.");
+                }
+                continue;
+            }
+
+            displacement += std::string(1, sign) + term;
+        }
+        if (op.index == 4)
+        {
+            error("rsp cannot be used as an index register.");
+        }
+        op.expr = parseExpr(displacement);
+        return op;
+    }
+
+    op.kind = Operand::IMM;
+    op.expr = parseExpr(text);
+    return op;
+}
+
+void Assembler::imm(const Expr& expr, int width)
+{
+    int64_t value = 0;
+    if (constantValue(expr, value))
+    {
+        for (int i = 0; i < width; ++i)
+        {
+            byte(static_cast<uint8_t>(static_cast<uint64_t>(value) >> (8 * i)));
+        }
+        return;
+    }
+    if (width != 4 && width != 8)
+    {
+        error("Symbol '" + expr.symbol + "' cannot be encoded in a " + std::to_string(width) + "-byte field.");
+    }
+    m_fixups.push_back({m_current_section, current().size(), width == 8 ? FixupKind::Abs64 : FixupKind::Abs32, expr, m_line});
+    for (int i = 0; i < width; ++i)
+    {
+        byte(0);
+    }
+}
+
+void Assembler::rel32(const Expr& target)
+{
+    m_fixups.push_back({m_current_section, current().size(), FixupKind::Rel32, target, m_line});
+    for (int i = 0; i < 4; ++i)
+    {
+        byte(0);
+    }
+}
+
+void Assembler::opReg(uint8_t opcode, int reg, bool rex_w, bool byte_rex)
+{
+    uint8_t rex = 0x40 | (rex_w ? 0x08 : 0) | (reg >= 8 ? 0x01 : 0);
+    if (rex != 0x40 || byte_rex)
+    {
+        byte(rex);
+    }
+    byte(static_cast<uint8_t>(opcode + (reg & 7)));
+}
+
+void Assembler::encode(uint8_t prefix, bool rex_w, std::initializer_list<uint8_t> opcode, int reg, bool reg_byte_rex, const Operand& rm)
+{
+    if (prefix)
+    {
+        byte(prefix);
+    }
+    uint8_t rex = 0x40 | (rex_w ? 0x08 : 0) | (reg >= 8 ? 0x04 : 0);
+    if (rm.kind == Operand::REG)
+    {
+        rex |= rm.reg >= 8 ? 0x01 : 0;
+    }
+    else
+    {
+        rex |= rm.index >= 8 ? 0x02 : 0;
+        rex |= rm.base >= 8 ? 0x01 : 0;
+    }
+    if (rex != 0x40 || reg_byte_rex || (rm.kind == Operand::REG && rm.byte_rex))
+    {
+        byte(rex);
+    }
+    for (uint8_t b : opcode)
+    {
+        byte(b);
+    }
+    modrm(reg, rm);
+}
+
+void Assembler::modrm(int reg, const Operand& rm)
+{
+    int r = (reg & 7) << 3;
+    if (rm.kind == Operand::REG)
+    {
+        byte(static_cast<uint8_t>(0xC0 | r | (rm.reg & 7)));
+        return;
+    }
+
+    int scale_bits = rm.scale == 1 ? 0 : rm.scale == 2 ? 1 : rm.scale == 4 ? 2 : rm.scale == 8 ? 3 : -1;
+    if (scale_bits < 0)
+    {
+        error("Invalid scale factor.");
+    }
+
+    if (rm.base < 0)
+    {
+        byte(static_cast<uint8_t>(0x04 | r));
+        int index = rm.index < 0 ? 4 : (rm.index & 7);
+        byte(static_cast<uint8_t>((rm.index < 0 ? 0 : scale_bits << 6) | (index << 3) | 5));
+        imm(rm.expr, 4);
+        return;
+    }
+
+    int64_t disp = 0;
+    bool constant = constantValue(rm.expr, disp);
+    int mod = 2;
+    if (constant && disp == 0 && (rm.base & 7) != 5)
+    {
+        mod = 0;
+    }
+    else if (constant && fitsInt8(disp))
+    {
+        mod = 1;
+    }
+
+    if (rm.index >= 0 || (rm.base & 7) == 4)
+    {
+        byte(static_cast<uint8_t>((mod << 6) | r | 4));
+        int index = rm.index < 0 ? 4 : (rm.index & 7);
+        byte(static_cast<uint8_t>((rm.index < 0 ? 0 : scale_bits << 6) | (index << 3) | (rm.base & 7)));
+    }
+    else
+    {
+        byte(static_cast<uint8_t>((mod << 6) | r | (rm.base & 7)));
+    }
+
+    if (mod == 1)
+    {
+        byte(static_cast<uint8_t>(disp));
+    }
+    else if (mod == 2)
+    {
+        imm(rm.expr, 4);
+    }
+}
+
+int Assembler::operandSize(const Operand& a, const Operand& b) const
+{
+    if (a.kind == Operand::REG)
+    {
+        return a.size;
+    }
+    if (b.kind == Operand::REG && !b.xmm)
+    {
+        return b.size;
+    }
+    if (a.size)
+    {
+        return a.size;
+    }
+    error("Operation size not specified.");
+}
+
+void Assembler::instruction(const std::string& m, const std::vector<Operand>& ops)
+{
+    auto expect = [&](size_t count) {
+        if (ops.size() != count)
+        {
+            error("'" + m + "' expects " + std::to_string(count) + " operand(s).");
+        }
+    };
+    auto is = [&](size_t i, Operand::Kind kind) { return i < ops.size() && ops[i].kind == kind; };
+    auto constant = [&](const Operand& op, int64_t& value) { return op.kind == Operand::IMM && constantValue(op.expr, value); };
+
+    static const std::unordered_map<std::string, std::vector<uint8_t>> simple = {
+        {"ret", {0xC3}}, {"leave", {0xC9}}, {"syscall", {0x0F, 0x05}}, {"cqo", {0x48, 0x99}},
+        {"cdq", {0x99}}, {"nop", {0x90}}, {"rdtsc", {0x0F, 0x31}}, {"int3", {0xCC}}, {"ud2", {0x0F, 0x0B}},
+        {"pause", {0xF3, 0x90}}, {"lfence", {0x0F, 0xAE, 0xE8}}, {"mfence", {0x0F, 0xAE, 0xF0}},
+        {"stosb", {0xAA}}, {"stosq", {0x48, 0xAB}}, {"movsb", {0xA4}}, {"movsq", {0x48, 0xA5}},
+        {"vzeroupper", {0xC5, 0xF8, 0x77}}, {"cpuid", {0x0F, 0xA2}}, {"xgetbv", {0x0F, 0x01, 0xD0}}
+    };
+    auto s = simple.find(m);
+    if (s != simple.end())
+    {
+        expect(0);
+        for (uint8_t b : s->second)
+        {
+            byte(b);
+        }
+        return;
+    }
+
+    if (m == "mov")
+    {
+        expect(2);
+        const Operand& dst = ops[0];
+        const Operand& src = ops[1];
+        int size = operandSize(dst, src);
+        if (src.kind == Operand::REG && dst.kind != Operand::IMM)
+        {
+            encode(size == 2 ? 0x66 : 0, size == 8, {static_cast<uint8_t>(size == 1 ? 0x88 : 0x89)}, src.reg, src.byte_rex, dst);
+        }
+        else if (dst.kind == Operand::REG && src.kind == Operand::MEM)
+        {
+            encode(size == 2 ? 0x66 : 0, size == 8, {static_cast<uint8_t>(size == 1 ? 0x8A : 0x8B)}, dst.reg, dst.byte_rex, src);
+        }
+        else if (dst.kind == Operand::REG && src.kind == Operand::IMM)
+        {
+            int64_t value = 0;
+            bool known = constantValue(src.expr, value);
+            if (size == 8 && known && fitsInt32(value))
+            {
+                encode(0, true, {0xC7}, 0, false, dst);
+                imm(src.expr, 4);
+            }
+            else if (size == 1)
+            {
+                opReg(0xB0, dst.reg, false, dst.byte_rex);
+                imm(src.expr, 1);
+            }
+            else
+            {
+                if (size == 2)
+                {
+                    byte(0x66);
+                }
+                opReg(0xB8, dst.reg, size == 8, false);
+                imm(src.expr, size);
+            }
+        }
+        else if (dst.kind == Operand::MEM && src.kind == Operand::IMM)
+        {
+            encode(size == 2 ? 0x66 : 0, size == 8, {static_cast<uint8_t>(size == 1 ? 0xC6 : 0xC7)}, 0, false, dst);
+            imm(src.expr, size == 8 ? 4 : size);
+        }
+        else
+        {
+            error("Unsupported operands for 'mov'.");
+        }
+        return;
+    }
+
+    auto alu = aluOps().find(m);
+    if (alu != aluOps().end())
+    {
+        expect(2);
+        int n = alu->second;
+        const Operand& dst = ops[0];
+        const Operand& src = ops[1];
+        int size = operandSize(dst, src);
+        uint8_t prefix = size == 2 ? 0x66 : 0;
+        if (src.kind == Operand::REG && dst.kind != Operand::IMM)
+        {
+            encode(prefix, size == 8, {static_cast<uint8_t>(n * 8 + (size == 1 ? 0 : 1))}, src.reg, src.byte_rex, dst);
+        }
+        else if (dst.kind == Operand::REG && src.kind == Operand::MEM)
+        {
+            encode(prefix, size == 8, {static_cast<uint8_t>(n * 8 + (size == 1 ? 2 : 3))}, dst.reg, dst.byte_rex, src);
+        }
+        else if (src.kind == Operand::IMM && dst.kind != Operand::IMM)
+        {
+            int64_t value = 0;
+            if (size == 1)
+            {
+                encode(prefix, false, {0x80}, n, false, dst);
+                imm(src.expr, 1);
+            }
+            else if (constant(src, value) && fitsInt8(value))
+            {
+                encode(prefix, size == 8, {0x83}, n, false, dst);
+                imm(src.expr, 1);
+            }
+            else
+            {
+                encode(prefix, size == 8, {0x81}, n, false, dst);
+                imm(src.expr, size == 2 ? 2 : 4);
+            }
+        }
+        else
+        {
+            error("Unsupported operands for '" + m + "'.");
+        }
+        return;
+    }
+
+    if (m == "test")
+    {
+        expect(2);
+        Operand dst = ops[0];
+        Operand src = ops[1];
+        if (dst.kind == Operand::REG && src.kind == Operand::MEM)
+        {
+            std::swap(dst, src);
+        }
+        int size = operandSize(dst, src);
+        uint8_t prefix = size == 2 ? 0x66 : 0;
+        if (src.kind == Operand::REG)
+        {
+            encode(prefix, size == 8, {static_cast<uint8_t>(size == 1 ? 0x84 : 0x85)}, src.reg, src.byte_rex, dst);
+        }
+        else
+        {
+            encode(prefix, size == 8, {static_cast<uint8_t>(size == 1 ? 0xF6 : 0xF7)}, 0, false, dst);
+            imm(src.expr, size == 8 ? 4 : size);
+        }
+        return;
+    }
+
+    static const std::unordered_map<std::string, int> group3 = {
+        {"not", 2}, {"neg", 3}, {"mul", 4}, {"div", 6}, {"idiv", 7}
+    };
+    auto g3 = group3.find(m);
+    if (g3 != group3.end() || (m == "imul" && ops.size() == 1))
+    {
+        expect(1);
+        int n = g3 != group3.end() ? g3->second : 5;
+        int size = operandSize(ops[0], ops[0]);
+        encode(size == 2 ? 0x66 : 0, size == 8, {static_cast<uint8_t>(size == 1 ? 0xF6 : 0xF7)}, n, false, ops[0]);
+        return;
+    }
+
+    if (m == "imul")
+    {
+        if (ops.size() == 2)
+        {
+            int size = ops[0].size;
+            encode(size == 2 ? 0x66 : 0, size == 8, {0x0F, 0xAF}, ops[0].reg, false, ops[1]);
+        }
+        else
+        {
+            expect(3);
+            int size = ops[0].size;
+            int64_t value = 0;
+            bool small = constant(ops[2], value) && fitsInt8(value);
+            encode(size == 2 ? 0x66 : 0, size == 8, {static_cast<uint8_t>(small ? 0x6B : 0x69)}, ops[0].reg, false, ops[1]);
+            imm(ops[2].expr, small ? 1 : (size == 2 ? 2 : 4));
+        }
+        return;
+    }
+
+    if (m == "inc" || m == "dec")
+    {
+        expect(1);
+        int size = operandSize(ops[0], ops[0]);
+        encode(size == 2 ? 0x66 : 0, size == 8, {static_cast<uint8_t>(size == 1 ? 0xFE : 0xFF)}, m == "inc" ? 0 : 1, false, ops[0]);
+        return;
+    }
+
+    auto shift = shiftOps().find(m);
+    if (shift != shiftOps().end())
+    {
+        expect(2);
+        int size = operandSize(ops[0], ops[0]);
+        uint8_t prefix = size == 2 ? 0x66 : 0;
+        int64_t value = 0;
+        if (ops[1].kind == Operand::REG && ops[1].reg == 1 && ops[1].size == 1)
+        {
+            encode(prefix, size == 8, {static_cast<uint8_t>(size == 1 ? 0xD2 : 0xD3)}, shift->second, false, ops[0]);
+        }
+        else if (constant(ops[1], value) && value == 1)
+        {
+            encode(prefix, size == 8, {static_cast<uint8_t>(size == 1 ? 0xD0 : 0xD1)}, shift->second, false, ops[0]);
+        }
+        else if (ops[1].kind == Operand::IMM)
+        {
+            encode(prefix, size == 8, {static_cast<uint8_t>(size == 1 ? 0xC0 : 0xC1)}, shift->second, false, ops[0]);
+            imm(ops[1].expr, 1);
+        }
+        else
+        {
+            error("Unsupported shift count.");
+        }
+        return;
+    }
+
+    if (m == "push" || m == "pop")
+    {
+        expect(1);
+        bool push = m == "push";
+        if (is(0, Operand::REG))
+        {
+            opReg(push ? 0x50 : 0x58, ops[0].reg, false, false);
+        }
+        else if (is(0, Operand::MEM))
+        {
+            encode(0, false, {static_cast<uint8_t>(push ? 0xFF : 0x8F)}, push ? 6 : 0, false, ops[0]);
+        }
+        else if (push)
+        {
+            int64_t value = 0;
+            if (constant(ops[0], value) && fitsInt8(value))
+            {
+                byte(0x6A);
+                imm(ops[0].expr, 1);
+            }
+            else
+            {
+                byte(0x68);
+                imm(ops[0].expr, 4);
+            }
+        }
+        else
+        {
+            error("Unsupported operand for 'pop'.");
+        }
+        return;
+    }
+
+    if (m == "lea")
+    {
+        expect(2);
+        encode(0, ops[0].size == 8, {0x8D}, ops[0].reg, false, ops[1]);
+        return;
+    }
+
+    if (m == "movzx" || m == "movsx")
+    {
+        expect(2);
+        int src_size = ops[1].size;
+        if (src_size != 1 && src_size != 2)
+        {
+            error("'" + m + "' needs a byte or word source.");
+        }
+        uint8_t op = static_cast<uint8_t>((m == "movzx" ? 0xB6 : 0xBE) + (src_size == 2 ? 1 : 0));
+        encode(ops[0].size == 2 ? 0x66 : 0, ops[0].size == 8, {0x0F, op}, ops[0].reg, false, ops[1]);
+        return;
+    }
+
+    if (m == "movsxd")
+    {
+        expect(2);
+        encode(0, true, {0x63}, ops[0].reg, false, ops[1]);
+        return;
+    }
+
+    if (m == "bsr" || m == "bsf")
+    {
+        expect(2);
+        encode(0, ops[0].size == 8, {0x0F, static_cast<uint8_t>(m == "bsr" ? 0xBD : 0xBC)}, ops[0].reg, false, ops[1]);
+        return;
+    }
+
+    if (m == "jmp" || m == "call")
+    {
+        expect(1);
+        if (ops[0].kind == Operand::IMM)
+        {
+            byte(m == "jmp" ? 0xE9 : 0xE8);
+            rel32(ops[0].expr);
+        }
+        else
+        {
+            encode(0, false, {0xFF}, m == "jmp" ? 4 : 2, false, ops[0]);
+        }
+        return;
+    }
+
+    if (m.size() > 1 && m[0] == 'j' && conditionCodes().count(m.substr(1)))
+    {
+        expect(1);
+        byte(0x0F);
+        byte(static_cast<uint8_t>(0x80 + conditionCodes().at(m.substr(1))));
+        rel32(ops[0].expr);
+        return;
+    }
+
+    if (m.size() > 3 && m.compare(0, 3, "set") == 0 && conditionCodes().count(m.substr(3)))
+    {
+        expect(1);
+        encode(0, false, {0x0F, static_cast<uint8_t>(0x90 + conditionCodes().at(m.substr(3)))}, 0, false, ops[0]);
+        return;
+    }
+
+    if (m.size() > 4 && m.compare(0, 4, "cmov") == 0 && conditionCodes().count(m.substr(4)))
+    {
+        expect(2);
+        int size = ops[0].size;
+        encode(size == 2 ? 0x66 : 0, size == 8, {0x0F, static_cast<uint8_t>(0x40 + conditionCodes().at(m.substr(4)))}, ops[0].reg, false, ops[1]);
+        return;
+    }
+
+    if (floatInstruction(m, ops) || vectorInstruction(m, ops))
+    {
+        return;
+    }
+
+    error("Unsupported instruction '" + m + "'.");
+}
+
+// The SSE2 scalar double instructions used by float arithmetic: an xmm destination and an xmm
+// or memory source, except for stores with movsd and the conversions to and from integer
+// registers.
+bool Assembler::floatInstruction(const std::string& m, const std::vector<Operand>& ops)
+{
+    auto vector = [&](size_t i) { return i < ops.size() && ops[i].kind == Operand::REG && ops[i].xmm; };
+    auto vectorOrMemory = [&](size_t i) { return vector(i) || (i < ops.size() && ops[i].kind == Operand::MEM); };
+    auto integer = [&](size_t i) { return i < ops.size() && ops[i].kind == Operand::REG && !ops[i].xmm && ops[i].size == 8; };
+    auto expect = [&](bool valid) {
+        if (ops.size() != 2 || !valid)
+        {
+            error("Unsupported operands for '" + m + "'.");
+        }
+    };
+
+    static const std::unordered_map<std::string, std::pair<uint8_t, uint8_t>> arithmetic = {
+        {"addsd", {0xF2, 0x58}}, {"mulsd", {0xF2, 0x59}}, {"subsd", {0xF2, 0x5C}}, {"divsd", {0xF2, 0x5E}},
+        {"movapd", {0x66, 0x28}}, {"ucomisd", {0x66, 0x2E}}
+    };
+    auto op = arithmetic.find(m);
+    if (op != arithmetic.end())
+    {
+        expect(vector(0) && vectorOrMemory(1));
+        encode(op->second.first, false, {0x0F, op->second.second}, ops[0].reg, false, ops[1]);
+        return true;
+    }
+    if (m == "movsd" && !ops.empty())
+    {
+        expect(vector(0) || vector(1));
+        if (vector(0))
+        {
+            encode(0xF2, false, {0x0F, 0x10}, ops[0].reg, false, ops[1]);
+        }
+        else
+        {
+            encode(0xF2, false, {0x0F, 0x11}, ops[1].reg, false, ops[0]);
+        }
+        return true;
+    }
+    if (m == "cvtsi2sd")
+    {
+        expect(vector(0) && (integer(1) || ops[1].kind == Operand::MEM));
+        encode(0xF2, true, {0x0F, 0x2A}, ops[0].reg, false, ops[1]);
+        return true;
+    }
+    if (m == "cvttsd2si")
+    {
+        expect(integer(0) && vectorOrMemory(1));
+        encode(0xF2, true, {0x0F, 0x2C}, ops[0].reg, false, ops[1]);
+        return true;
+    }
+    return false;
+}
+
+// The SSE2 and AVX2 integer instructions used by vectorized loops and the string runtime. Legacy SSE forms take an
+// xmm destination and an xmm or memory source; VEX forms add a separate first source and work
+// on ymm registers as well, the register size selecting the vector length.
+bool Assembler::vectorInstruction(const std::string& m, const std::vector<Operand>& ops)
+{
+    auto vector = [&](size_t i) { return i < ops.size() && ops[i].kind == Operand::REG && ops[i].xmm; };
+    auto vectorOrMemory = [&](size_t i) { return vector(i) || (i < ops.size() && ops[i].kind == Operand::MEM); };
+    auto expect = [&](size_t count, bool valid) {
+        if (ops.size() != count || !valid)
+        {
+            error("Unsupported operands for '" + m + "'.");
+        }
+    };
+
+    static const std::unordered_map<std::string, uint8_t> packed = {
+        {"paddq", 0xD4}, {"psubq", 0xFB}, {"pmuludq", 0xF4}, {"pand", 0xDB}, {"pandn", 0xDF}, {"por", 0xEB},
+        {"pxor", 0xEF}, {"pcmpeqd", 0x76}, {"pcmpgtd", 0x66}, {"punpcklqdq", 0x6C}, {"punpckhqdq", 0x6D},
+        {"pcmpeqb", 0x74}, {"pminub", 0xDA}
+    };
+    // Shifts by an immediate: opcode 73 with the operation in the ModRM reg field.
+    static const std::unordered_map<std::string, int> shifts = {
+        {"psrlq", 2}, {"psrldq", 3}, {"psllq", 6}, {"pslldq", 7}
+    };
+
+    auto sse = packed.find(m);
+    if (sse != packed.end())
+    {
+        expect(2, vector(0) && vectorOrMemory(1));
+        encode(0x66, false, {0x0F, sse->second}, ops[0].reg, false, ops[1]);
+        return true;
+    }
+    auto shift = shifts.find(m);
+    if (shift != shifts.end())
+    {
+        expect(2, vector(0) && ops[1].kind == Operand::IMM);
+        encode(0x66, false, {0x0F, 0x73}, shift->second, false, ops[0]);
+        imm(ops[1].expr, 1);
+        return true;
+    }
+    if (m == "movdqu" || m == "movdqa")
+    {
+        uint8_t prefix = m == "movdqu" ? 0xF3 : 0x66;
+        expect(2, vector(0) || vector(1));
+        if (vector(0))
+        {
+            encode(prefix, false, {0x0F, 0x6F}, ops[0].reg, false, ops[1]);
+        }
+        else
+        {
+            encode(prefix, false, {0x0F, 0x7F}, ops[1].reg, false, ops[0]);
+        }
+        return true;
+    }
+    if (m == "movq")
+    {
+        expect(2, vector(0) != vector(1));
+        if (vector(0))
+        {
+            encode(0x66, true, {0x0F, 0x6E}, ops[0].reg, false, ops[1]);
+        }
+        else
+        {
+            encode(0x66, true, {0x0F, 0x7E}, ops[1].reg, false, ops[0]);
+        }
+        return true;
+    }
+    if (m == "pshufd")
+    {
+        expect(3, vector(0) && vectorOrMemory(1) && ops[2].kind == Operand::IMM);
+        encode(0x66, false, {0x0F, 0x70}, ops[0].reg, false, ops[1]);
+        imm(ops[2].expr, 1);
+        return true;
+    }
+    // The top bit of each byte, into a general register.
+    if (m == "pmovmskb")
+    {
+        expect(2, !vector(0) && ops[0].kind == Operand::REG && vector(1));
+        encode(0x66, false, {0x0F, 0xD7}, ops[0].reg, false, ops[1]);
+        return true;
+    }
+
+    if (m.size() < 2 || m[0] != 'v')
+    {
+        return false;
+    }
+    std::string base = m.substr(1);
+    const uint8_t PP_66 = 1;
+    const uint8_t PP_F3 = 2;
+    const uint8_t MAP_0F = 1;
+    const uint8_t MAP_0F38 = 2;
+    const uint8_t MAP_0F3A = 3;
+
+    static const std::unordered_map<std::string, uint8_t> packed38 = {
+        {"pcmpeqq", 0x29}, {"pcmpgtq", 0x37}
+    };
+    sse = packed.find(base);
+    auto sse38 = packed38.find(base);
+    if (sse != packed.end() || sse38 != packed38.end())
+    {
+        expect(3, vector(0) && vector(1) && vectorOrMemory(2));
+        bool map38 = sse == packed.end();
+        vex(PP_66, map38 ? MAP_0F38 : MAP_0F, false, ops[0].size == 32, map38 ? sse38->second : sse->second, ops[0].reg, ops[1].reg, ops[2]);
+        return true;
+    }
+    shift = shifts.find(base);
+    if (shift != shifts.end())
+    {
+        expect(3, vector(0) && vector(1) && ops[2].kind == Operand::IMM);
+        vex(PP_66, MAP_0F, false, ops[0].size == 32, 0x73, shift->second, ops[0].reg, ops[1]);
+        imm(ops[2].expr, 1);
+        return true;
+    }
+    if (base == "movdqu" || base == "movdqa")
+    {
+        uint8_t pp = base == "movdqu" ? PP_F3 : PP_66;
+        expect(2, vector(0) || vector(1));
+        if (vector(0))
+        {
+            vex(pp, MAP_0F, false, ops[0].size == 32, 0x6F, ops[0].reg, 0, ops[1]);
+        }
+        else
+        {
+            vex(pp, MAP_0F, false, ops[1].size == 32, 0x7F, ops[1].reg, 0, ops[0]);
+        }
+        return true;
+    }
+    if (base == "movq")
+    {
+        expect(2, vector(0) != vector(1));
+        if (vector(0))
+        {
+            vex(PP_66, MAP_0F, true, false, 0x6E, ops[0].reg, 0, ops[1]);
+        }
+        else
+        {
+            vex(PP_66, MAP_0F, true, false, 0x7E, ops[1].reg, 0, ops[0]);
+        }
+        return true;
+    }
+    if (base == "pshufd")
+    {
+        expect(3, vector(0) && vectorOrMemory(1) && ops[2].kind == Operand::IMM);
+        vex(PP_66, MAP_0F, false, ops[0].size == 32, 0x70, ops[0].reg, 0, ops[1]);
+        imm(ops[2].expr, 1);
+        return true;
+    }
+    if (base == "pmovmskb")
+    {
+        expect(2, !vector(0) && ops[0].kind == Operand::REG && vector(1));
+        vex(PP_66, MAP_0F, false, ops[1].size == 32, 0xD7, ops[0].reg, 0, ops[1]);
+        return true;
+    }
+    if (base == "pbroadcastq")
+    {
+        expect(2, vector(0) && vectorOrMemory(1));
+        vex(PP_66, MAP_0F38, false, ops[0].size == 32, 0x59, ops[0].reg, 0, ops[1]);
+        return true;
+    }
+    if (base == "extracti128")
+    {
+        expect(3, vectorOrMemory(0) && vector(1) && ops[1].size == 32 && ops[2].kind == Operand::IMM);
+        vex(PP_66, MAP_0F3A, false, true, 0x39, ops[1].reg, 0, ops[0]);
+        imm(ops[2].expr, 1);
+        return true;
+    }
+    return false;
+}
+
+// Three-byte VEX prefix, opcode and ModRM. An unused vvvv field is passed as 0 and encodes as 1111.
+void Assembler::vex(uint8_t pp, uint8_t map, bool w, bool l, uint8_t opcode, int reg, int vvvv, const Operand& rm)
+{
+    bool r = reg >= 8;
+    bool x = rm.kind == Operand::MEM && rm.index >= 8;
+    bool b = rm.kind == Operand::REG ? rm.reg >= 8 : rm.base >= 8;
+    byte(0xC4);
+    byte(static_cast<uint8_t>((r ? 0 : 0x80) | (x ? 0 : 0x40) | (b ? 0 : 0x20) | map));
+    byte(static_cast<uint8_t>((w ? 0x80 : 0) | ((~vvvv & 0xF) << 3) | (l ? 0x04 : 0) | pp));
+    byte(opcode);
+    modrm(reg, rm);
+}
+
+bool Assembler::hasSymbol(const std::string& name) const
+{
+    return m_symbols.count(name) || m_equs.count(name);
+}
+
+std::vector<std::string> Assembler::undefinedSymbols() const
+{
+    std::set<std::string> names;
+    for (const auto& fixup : m_fixups)
+    {
+        if (!fixup.target.symbol.empty() && !hasSymbol(fixup.target.symbol))
+        {
+            names.insert(fixup.target.symbol);
+        }
+    }
+    for (const auto& equ : m_equs)
+    {
+        if (!equ.second.symbol.empty() && !hasSymbol(equ.second.symbol))
+        {
+            names.insert(equ.second.symbol);
+        }
+    }
+    return std::vector<std::string>(names.begin(), names.end());
+}
+
+uint64_t Assembler::symbolAddress(const std::string& name, const std::vector<uint64_t>& section_addresses) const
+{
+    auto it = m_symbols.find(name);
+    if (it == m_symbols.end())
+    {
+        throw std::runtime_error("Undefined symbol '" + name + "'.");
+    }
+    return section_addresses[it->second.section] + it->second.offset;
+}
+
+int64_t Assembler::resolve(const Expr& expr, const std::vector<uint64_t>& section_addresses, const ExternResolver& resolve_extern, int depth) const
+{
+    if (expr.symbol.empty())
+    {
+        return expr.value;
+    }
+    if (depth > 32)
+    {
+        throw std::runtime_error("Recursive definition of '" + expr.symbol + "'.");
+    }
+    auto symbol = m_symbols.find(expr.symbol);
+    if (symbol != m_symbols.end())
+    {
+        return static_cast<int64_t>(section_addresses[symbol->second.section] + symbol->second.offset) + expr.value;
+    }
+    auto equ = m_equs.find(expr.symbol);
+    if (equ != m_equs.end())
+    {
+        return resolve(equ->second, section_addresses, resolve_extern, depth + 1) + expr.value;
+    }
+    return static_cast<int64_t>(resolve_extern(expr.symbol)) + expr.value;
+}
+
+void Assembler::link(const std::vector<uint64_t>& section_addresses, const ExternResolver& resolve_extern)
+{
+    for (const auto& fixup : m_fixups)
+    {
+        int64_t value = resolve(fixup.target, section_addresses, resolve_extern);
+        int width = fixup.kind == FixupKind::Abs64 ? 8 : 4;
+        if (fixup.kind == FixupKind::Rel32)
+        {
+            value -= static_cast<int64_t>(section_addresses[fixup.section] + fixup.offset + 4);
+        }
+        if (width == 4 && !fitsInt32(value) && !(fixup.kind == FixupKind::Abs32 && value >= 0 && value <= UINT32_MAX))
+        {
+            throw std::runtime_error("Assembler line " + std::to_string(fixup.line) + ": '" + fixup.target.symbol + "' is out of range for a 32-bit field.");
+        }
+        std::vector<uint8_t>& bytes = m_sections[fixup.section].bytes;
+        for (int i = 0; i < width; ++i)
+        {
+            bytes[fixup.offset + i] = static_cast<uint8_t>(static_cast<uint64_t>(value) >> (8 * i));
+        }
+    }
+}
+
+// Follows 'equ' definitions down to a label or an external name. Returns false for constants.
+bool Assembler::relocationTarget(const Expr& expr, std::string& symbol, int64_t& addend, int depth) const
+{
+    if (expr.symbol.empty())
+    {
+        addend += expr.value;
+        return false;
+    }
+    if (depth > 32)
+    {
+        throw std::runtime_error("Recursive definition of '" + expr.symbol + "'.");
+    }
+    auto equ = m_equs.find(expr.symbol);
+    if (equ != m_equs.end())
+    {
+        addend += expr.value;
+        return relocationTarget(equ->second, symbol, addend, depth + 1);
+    }
+    symbol = expr.symbol;
+    addend += expr.value;
+    return true;
+}
+
+// A 'global' size expression: a constant or the distance between two labels of one section.
+bool Assembler::symbolSize(const std::string& text, uint64_t& size) const
+{
+    std::string expr = trim(text);
+    if (expr.size() >= 2 && expr.front() == '(' && expr.back() == ')')
+    {
+        expr = trim(expr.substr(1, expr.size() - 2));
+    }
+    size_t minus = expr.find('-');
+    if (minus != std::string::npos && minus > 0)
+    {
+        auto end = m_symbols.find(trim(expr.substr(0, minus)));
+        auto start = m_symbols.find(trim(expr.substr(minus + 1)));
+        if (end == m_symbols.end() || start == m_symbols.end() || end->second.section != start->second.section ||
+            end->second.offset < start->second.offset)
+        {
+            return false;
+        }
+        size = end->second.offset - start->second.offset;
+        return true;
+    }
+    int64_t value = 0;
+    if (!constantValue(parseExpr(expr), value) || value < 0)
+    {
+        return false;
+    }
+    size = static_cast<uint64_t>(value);
+    return true;
+}
+
+namespace
+{
+    void put(std::string& out, uint64_t value, int width)
+    {
+        for (int i = 0; i < width; ++i)
+        {
+            out += static_cast<char>(value >> (8 * i));
+        }
+    }
+
+    void putUleb(std::string& out, uint64_t value)
+    {
+        do
+        {
+            uint8_t byte = value & 0x7f;
+            value >>= 7;
+            out += static_cast<char>(value ? byte | 0x80 : byte);
+        }
+        while (value);
+    }
+
+    void putSleb(std::string& out, int64_t value)
+    {
+        while (true)
+        {
+            uint8_t byte = value & 0x7f;
+            value >>= 7;
+            if ((value == 0 && !(byte & 0x40)) || (value == -1 && (byte & 0x40)))
+            {
+                out += static_cast<char>(byte);
+                return;
+            }
+            out += static_cast<char>(byte | 0x80);
+        }
+    }
+
+    void putString(std::string& out, const std::string& text)
+    {
+        out += text;
+        out += '\0';
+    }
+
+    void patch32(std::string& out, size_t at, uint64_t value)
+    {
+        for (int i = 0; i < 4; ++i)
+        {
+            out[at + i] = static_cast<char>(value >> (8 * i));
+        }
+    }
+
+    AsmSection debugSection(const std::string& name, const std::string& bytes)
+    {
+        AsmSection section;
+        section.name = name;
+        section.alignment = 1;
+        section.bytes.assign(bytes.begin(), bytes.end());
+        return section;
+    }
+}
+
+// DWARF 3 .debug_line, .debug_info and .debug_abbrev for the '%line' rows: every code section
+// with rows gets a compile unit covering the section and a line program of its own.
+void Assembler::addDebugSections(std::vector<AsmSection>& sections, std::vector<std::vector<Relocation>>& relocations) const
+{
+    const uint32_t line_section = static_cast<uint32_t>(sections.size());
+    const uint32_t abbrev_section = line_section + 2;
+    std::vector<Relocation> line_relocations;
+    std::vector<Relocation> info_relocations;
+
+    char cwd[4096];
+    std::string comp_dir = getcwd(cwd, sizeof(cwd)) ? cwd : ".";
+
+    std::string abbrev;
+    putUleb(abbrev, 1);
+    putUleb(abbrev, DW_TAG_COMPILE_UNIT);
+    abbrev += '\0';
+    const uint8_t attributes[][2] = {
+        {DW_AT_NAME, DW_FORM_STRING}, {DW_AT_COMP_DIR, DW_FORM_STRING}, {DW_AT_PRODUCER, DW_FORM_STRING},
+        {DW_AT_LANGUAGE, DW_FORM_DATA2}, {DW_AT_STMT_LIST, DW_FORM_DATA4}, {DW_AT_LOW_PC, DW_FORM_ADDR},
+        {DW_AT_HIGH_PC, DW_FORM_ADDR}, {0, 0}
+    };
+    for (const auto& attribute : attributes)
+    {
+        putUleb(abbrev, attribute[0]);
+        putUleb(abbrev, attribute[1]);
+    }
+    abbrev += '\0';
+
+    std::string line;
+    std::string info;
+    for (size_t s = 0; s < m_sections.size(); ++s)
+    {
+        std::vector<LineRow> rows;
+        for (const auto& row : m_line_rows)
+        {
+            if (row.section == static_cast<int>(s))
+            {
+                rows.push_back(row);
+            }
+        }
+        if (rows.empty())
+        {
+            continue;
+        }
+        const uint32_t code_symbol = static_cast<uint32_t>(1 + s);
+        const uint64_t code_size = m_sections[s].size();
+
+        // Line program header. Only standard opcodes are used, so the special opcode
+        // parameters are the conventional ones.
+        size_t program = line.size();
+        put(line, 0, 4);
+        put(line, 3, 2);
+        size_t header_length = line.size();
+        put(line, 0, 4);
+        line += '\x01';
+        line += '\x01';
+        line += static_cast<char>(-5);
+        line += '\x0e';
+        line += static_cast<char>(DW_LNS_OPCODE_BASE);
+        const char standard_lengths[] = {0, 1, 1, 1, 1, 0, 0, 0, 1, 0, 0, 1};
+        line.append(standard_lengths, sizeof(standard_lengths));
+        line += '\0';
+        for (const auto& file : m_line_files)
+        {
+            putString(line, file);
+            putUleb(line, 0);
+            putUleb(line, 0);
+            putUleb(line, 0);
+        }
+        line += '\0';
+        patch32(line, header_length, line.size() - header_length - 4);
+
+        line += '\0';
+        putUleb(line, 9);
+        line += static_cast<char>(DW_LNE_SET_ADDRESS);
+        line_relocations.push_back({line.size(), code_symbol, R_X86_64_64, static_cast<int64_t>(rows[0].offset)});
+        put(line, 0, 8);
+        uint64_t address = rows[0].offset;
+        int64_t current_line = 1;
+        uint32_t current_file = 1;
+        for (const auto& row : rows)
+        {
+            if (row.file + 1 != current_file)
+            {
+                current_file = row.file + 1;
+                line += static_cast<char>(DW_LNS_SET_FILE);
+                putUleb(line, current_file);
+            }
+            if (row.line != current_line)
+            {
+                line += static_cast<char>(DW_LNS_ADVANCE_LINE);
+                putSleb(line, row.line - current_line);
+                current_line = row.line;
+            }
+            if (row.offset != address)
+            {
+                line += static_cast<char>(DW_LNS_ADVANCE_PC);
+                putUleb(line, row.offset - address);
+                address = row.offset;
+            }
+            line += static_cast<char>(DW_LNS_COPY);
+        }
+        if (code_size != address)
+        {
+            line += static_cast<char>(DW_LNS_ADVANCE_PC);
+            putUleb(line, code_size - address);
+        }
+        line += '\0';
+        putUleb(line, 1);
+        line += static_cast<char>(DW_LNE_END_SEQUENCE);
+        patch32(line, program, line.size() - program - 4);
+
+        size_t unit = info.size();
+        put(info, 0, 4);
+        put(info, 3, 2);
+        info_relocations.push_back({info.size(), 1 + abbrev_section, R_X86_64_32, 0});
+        put(info, 0, 4);
+        info += '\x08';
+        putUleb(info, 1);
+        putString(info, m_line_files[rows[0].file]);
+        putString(info, comp_dir);
+        putString(info, "lostrecordc");
+        put(info, DW_LANG_MIPS_ASSEMBLER, 2);
+        info_relocations.push_back({info.size(), 1 + line_section, R_X86_64_32, static_cast<int64_t>(program)});
+        put(info, 0, 4);
+        info_relocations.push_back({info.size(), code_symbol, R_X86_64_64, 0});
+        put(info, 0, 8);
+        info_relocations.push_back({info.size(), code_symbol, R_X86_64_64, static_cast<int64_t>(code_size)});
+        put(info, 0, 8);
+        patch32(info, unit, info.size() - unit - 4);
+    }
+
+    sections.push_back(debugSection(".debug_line", line));
+    sections.push_back(debugSection(".debug_info", info));
+    sections.push_back(debugSection(".debug_abbrev", abbrev));
+    relocations.push_back(line_relocations);
+    relocations.push_back(info_relocations);
+    relocations.emplace_back();
+}
+
+void Assembler::writeObject(std::ostream& out) const
+{
+    std::vector<AsmSection> sections = m_sections;
+    std::vector<std::vector<Relocation>> relocations(sections.size());
+    if (!m_line_rows.empty())
+    {
+        addDebugSections(sections, relocations);
+    }
+
+    // Symbol table: null, one STT_SECTION per section, local labels, then globals and externs.
+    std::string strtab(1, '\0');
+    std::vector<Elf64_Sym> symbols(1 + sections.size());
+    std::memset(symbols.data(), 0, symbols.size() * sizeof(Elf64_Sym));
+    for (size_t i = 0; i < sections.size(); ++i)
+    {
+        symbols[1 + i].st_info = ELF64_ST_INFO(STB_LOCAL, STT_SECTION);
+        symbols[1 + i].st_shndx = static_cast<uint16_t>(1 + i);
+    }
+    auto addSymbol = [&](const std::string& name, unsigned char bind, uint16_t section, uint64_t value) 
+    {
+        Elf64_Sym sym;
+        std::memset(&sym, 0, sizeof(sym));
+        sym.st_name = static_cast<uint32_t>(strtab.size());
+        sym.st_info = ELF64_ST_INFO(bind, STT_NOTYPE);
+        sym.st_shndx = section;
+        sym.st_value = value;
+        auto function = m_functions.find(name);
+        if (function != m_functions.end())
+        {
+            uint64_t size = 0;
+            sym.st_info = ELF64_ST_INFO(bind, STT_FUNC);
+            if (!function->second.empty() && !symbolSize(function->second, size))
+            {
+                throw std::runtime_error("Cannot evaluate the size of '" + name + "'.");
+            }
+            sym.st_size = size;
+        }
+        strtab += name;
+        strtab += '\0';
+        symbols.push_back(sym);
+        return static_cast<uint32_t>(symbols.size() - 1);
+    };
+
+    std::vector<std::string> names;
+    for (const auto& entry : m_symbols)
+    {
+        names.push_back(entry.first);
+    }
+    std::sort(names.begin(), names.end(), [&](const std::string& a, const std::string& b) 
+    {
+        const Symbol& x = m_symbols.at(a);
+        const Symbol& y = m_symbols.at(b);
+        return x.section != y.section ? x.section < y.section : x.offset != y.offset ? x.offset < y.offset : a < b;
+    });
+    for (const auto& name : names)
+    {
+        if (!m_globals.count(name))
+        {
+            const Symbol& sym = m_symbols.at(name);
+            addSymbol(name, STB_LOCAL, static_cast<uint16_t>(1 + sym.section), sym.offset);
+        }
+    }
+    size_t first_global = symbols.size();
+    std::unordered_map<std::string, uint32_t> global_indices;
+    for (const auto& name : names)
+    {
+        if (m_globals.count(name))
+        {
+            const Symbol& sym = m_symbols.at(name);
+            global_indices[name] = addSymbol(name, STB_GLOBAL, static_cast<uint16_t>(1 + sym.section), sym.offset);
+        }
+    }
+    for (const auto& name : undefinedSymbols())
+    {
+        global_indices[name] = addSymbol(name, STB_GLOBAL, SHN_UNDEF, 0);
+    }
+
+    for (const auto& fixup : m_fixups)
+    {
+        std::string name;
+        int64_t addend = 0;
+        int width = fixup.kind == FixupKind::Abs64 ? 8 : 4;
+        auto patch = [&](int64_t value) 
+        {
+            for (int i = 0; i < width; ++i)
+            {
+                sections[fixup.section].bytes[fixup.offset + i] = static_cast<uint8_t>(static_cast<uint64_t>(value) >> (8 * i));
+            }
+        };
+
+        if (!relocationTarget(fixup.target, name, addend))
+        {
+            patch(fixup.kind == FixupKind::Rel32 ? addend - static_cast<int64_t>(fixup.offset + 4) : addend);
+            continue;
+        }
+
+        uint32_t symbol_index = 0;
+        auto local = m_symbols.find(name);
+        if (local != m_symbols.end() && !m_globals.count(name))
+        {
+            if (fixup.kind == FixupKind::Rel32 && local->second.section == fixup.section)
+            {
+                patch(static_cast<int64_t>(local->second.offset) + addend - static_cast<int64_t>(fixup.offset + 4));
+                continue;
+            }
+            symbol_index = static_cast<uint32_t>(1 + local->second.section);
+            addend += static_cast<int64_t>(local->second.offset);
+        }
+        else
+        {
+            symbol_index = global_indices.at(name);
+        }
+
+        uint32_t type = fixup.kind == FixupKind::Abs64 ? R_X86_64_64 : fixup.kind == FixupKind::Abs32 ? R_X86_64_32S : R_X86_64_PC32;
+        if (fixup.kind == FixupKind::Rel32)
+        {
+            addend -= 4;
+        }
+        relocations[fixup.section].push_back({fixup.offset, symbol_index, type, addend});
+    }
+
+    // Section headers: null, the assembled sections, their .rela companions, then the tables.
+    std::string shstrtab(1, '\0');
+    auto sectionName = [&](const std::string& name) 
+    {
+        uint32_t offset = static_cast<uint32_t>(shstrtab.size());
+        shstrtab += name;
+        shstrtab += '\0';
+        return offset;
+    };
+
+    std::vector<Elf64_Shdr> headers(1);
+    std::vector<std::string> payloads(1);
+    std::memset(&headers[0], 0, sizeof(Elf64_Shdr));
+    for (size_t i = 0; i < sections.size(); ++i)
+    {
+        const AsmSection& section = sections[i];
+        Elf64_Shdr header;
+        std::memset(&header, 0, sizeof(header));
+        header.sh_name = sectionName(section.name);
+        header.sh_type = section.nobits ? SHT_NOBITS : SHT_PROGBITS;
+        header.sh_flags = section.name.compare(0, 6, ".debug") == 0 ? 0 : SHF_ALLOC;
+        if (section.executable)
+        {
+            header.sh_flags |= SHF_EXECINSTR;
+        }
+        else if (section.nobits || section.name.compare(0, 5, ".data") == 0)
+        {
+            header.sh_flags |= SHF_WRITE;
+        }
+        header.sh_size = section.size();
+        header.sh_addralign = section.alignment;
+        headers.push_back(header);
+        payloads.push_back(section.nobits ? std::string() : std::string(section.bytes.begin(), section.bytes.end()));
+    }
+
+    size_t symtab_index = 1 + sections.size();
+    for (size_t i = 0; i < sections.size(); ++i)
+    {
+        if (!relocations[i].empty())
+        {
+            symtab_index++;
+        }
+    }
+    for (size_t i = 0; i < sections.size(); ++i)
+    {
+        if (relocations[i].empty())
+        {
+            continue;
+        }
+        std::string data;
+        for (const auto& rela : relocations[i])
+        {
+            Elf64_Rela entry;
+            entry.r_offset = rela.offset;
+            entry.r_info = ELF64_R_INFO(rela.symbol, rela.type);
+            entry.r_addend = rela.addend;
+            data.append(reinterpret_cast<const char*>(&entry), sizeof(entry));
+        }
+        Elf64_Shdr header;
+        std::memset(&header, 0, sizeof(header));
+        header.sh_name = sectionName(".rela" + sections[i].name);
+        header.sh_type = SHT_RELA;
+        header.sh_flags = SHF_INFO_LINK;
+        header.sh_size = data.size();
+        header.sh_link = static_cast<uint32_t>(symtab_index);
+        header.sh_info = static_cast<uint32_t>(1 + i);
+        header.sh_addralign = 8;
+        header.sh_entsize = sizeof(Elf64_Rela);
+        headers.push_back(header);
+        payloads.push_back(data);
+    }
+
+    Elf64_Shdr symtab;
+    std::memset(&symtab, 0, sizeof(symtab));
+    symtab.sh_name = sectionName(".symtab");
+    symtab.sh_type = SHT_SYMTAB;
+    symtab.sh_size = symbols.size() * sizeof(Elf64_Sym);
+    symtab.sh_link = static_cast<uint32_t>(symtab_index + 1);
+    symtab.sh_info = static_cast<uint32_t>(first_global);
+    symtab.sh_addralign = 8;
+    symtab.sh_entsize = sizeof(Elf64_Sym);
+    headers.push_back(symtab);
+    payloads.emplace_back(reinterpret_cast<const char*>(symbols.data()), symbols.size() * sizeof(Elf64_Sym));
+
+    Elf64_Shdr strings;
+    std::memset(&strings, 0, sizeof(strings));
+    strings.sh_name = sectionName(".strtab");
+    strings.sh_type = SHT_STRTAB;
+    strings.sh_size = strtab.size();
+    strings.sh_addralign = 1;
+    headers.push_back(strings);
+    payloads.push_back(strtab);
+
+    Elf64_Shdr names_header;
+    std::memset(&names_header, 0, sizeof(names_header));
+    names_header.sh_name = sectionName(".shstrtab");
+    names_header.sh_type = SHT_STRTAB;
+    names_header.sh_addralign = 1;
+    headers.push_back(names_header);
+    payloads.push_back(shstrtab);
+    headers.back().sh_size = shstrtab.size();
+
+    // Layout: ELF header, section payloads (8-byte aligned), section header table.
+    std::string body;
+    uint64_t offset = sizeof(Elf64_Ehdr);
+    for (size_t i = 1; i < headers.size(); ++i)
+    {
+        offset = (offset + 7) & ~uint64_t(7);
+        body.resize(offset - sizeof(Elf64_Ehdr), '\0');
+        headers[i].sh_offset = offset;
+        body += payloads[i];
+        offset += payloads[i].size();
+    }
+    offset = (offset + 7) & ~uint64_t(7);
+    body.resize(offset - sizeof(Elf64_Ehdr), '\0');
+
+    Elf64_Ehdr elf;
+    std::memset(&elf, 0, sizeof(elf));
+    std::memcpy(elf.e_ident, ELFMAG, SELFMAG);
+    elf.e_ident[EI_CLASS] = ELFCLASS64;
+    elf.e_ident[EI_DATA] = ELFDATA2LSB;
+    elf.e_ident[EI_VERSION] = EV_CURRENT;
+    elf.e_ident[EI_OSABI] = ELFOSABI_SYSV;
+    elf.e_type = ET_REL;
+    elf.e_machine = EM_X86_64;
+    elf.e_version = EV_CURRENT;
+    elf.e_shoff = offset;
+    elf.e_ehsize = sizeof(Elf64_Ehdr);
+    elf.e_shentsize = sizeof(Elf64_Shdr);
+    elf.e_shnum = static_cast<uint16_t>(headers.size());
+    elf.e_shstrndx = static_cast<uint16_t>(headers.size() - 1);
+
+    out.write(reinterpret_cast<const char*>(&elf), sizeof(elf));
+    out.write(body.data(), body.size());
+    out.write(reinterpret_cast<const char*>(headers.data()), headers.size() * sizeof(Elf64_Shdr));
+}
+
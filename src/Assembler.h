@@ -0,0 +1,154 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <functional>
+#include <ostream>
+#include <set>
+
+// Encodes the NASM subset produced by CodeGenerator into x86-64 machine code.
+
+struct AsmSection
+{
+    std::string name;
+    bool executable = false;
+    bool nobits = false;
+    uint64_t alignment = 16;
+    std::vector<uint8_t> bytes;
+    uint64_t reserved = 0;
+
+    uint64_t size() const
+    {
+        return nobits ? reserved : bytes.size();
+    }
+};
+
+enum class FixupKind
+{
+    Abs64,
+    Abs32,
+    Rel32,
+};
+
+class Assembler
+{
+public:
+    using ExternResolver = std::function<uint64_t(const std::string&)>;
+
+    void assemble(const std::string& source);
+    void link(const std::vector<uint64_t>& section_addresses, const ExternResolver& resolve_extern);
+    // Writes an ELF64 relocatable object. Labels named by 'global' are exported and every
+    // undefined symbol becomes an external reference for the linker. Source positions given by
+    // '%line' directives are written as DWARF line tables, one compile unit per code section.
+    void writeObject(std::ostream& out) const;
+
+    std::vector<AsmSection>& sections()
+    {
+        return m_sections;
+    }
+    std::vector<std::string> undefinedSymbols() const;
+    bool hasSymbol(const std::string& name) const;
+    uint64_t symbolAddress(const std::string& name, const std::vector<uint64_t>& section_addresses) const;
+
+private:
+    struct Expr
+    {
+        std::string symbol;
+        int64_t value = 0;
+    };
+
+    struct Operand
+    {
+        enum Kind { REG, MEM, IMM } kind = IMM;
+        int size = 0;
+        int reg = -1;
+        bool xmm = false;
+        bool byte_rex = false;
+        int base = -1;
+        int index = -1;
+        int scale = 1;
+        Expr expr;
+    };
+
+    struct Symbol
+    {
+        int section;
+        uint64_t offset;
+    };
+
+    struct Fixup
+    {
+        int section;
+        uint64_t offset;
+        FixupKind kind;
+        Expr target;
+        int line;
+    };
+
+    // The source line that code from `offset` on was generated from.
+    struct LineRow
+    {
+        int section;
+        uint64_t offset;
+        int line;
+        uint32_t file;
+    };
+
+    struct Relocation
+    {
+        uint64_t offset;
+        uint32_t symbol;
+        uint32_t type;
+        int64_t addend;
+    };
+
+    std::vector<AsmSection> m_sections;
+    std::unordered_map<std::string, Symbol> m_symbols;
+    std::unordered_map<std::string, Expr> m_equs;
+    std::vector<Fixup> m_fixups;
+    std::set<std::string> m_globals;
+    // 'global name:function (size)': symbols typed as functions, with their size expressions.
+    std::unordered_map<std::string, std::string> m_functions;
+    std::vector<LineRow> m_line_rows;
+    std::vector<std::string> m_line_files;
+    int m_source_line = 0;
+    uint32_t m_source_file = 0;
+    int m_current_section = -1;
+    std::string m_last_global_label;
+    int m_line = 0;
+
+    void assembleLine(const std::string& line);
+    void directive(const std::string& name, const std::string& rest);
+    void instruction(const std::string& mnemonic, const std::vector<Operand>& ops);
+    bool vectorInstruction(const std::string& mnemonic, const std::vector<Operand>& ops);
+    bool floatInstruction(const std::string& mnemonic, const std::vector<Operand>& ops);
+    void switchSection(const std::string& name, const std::string& attributes);
+    void sourceLine(const std::string& rest);
+    void addLineRow();
+    bool symbolSize(const std::string& text, uint64_t& size) const;
+    void addDebugSections(std::vector<AsmSection>& sections, std::vector<std::vector<Relocation>>& relocations) const;
+    void defineLabel(const std::string& name);
+    void defineData(int width, const std::string& rest);
+    void reserve(uint64_t count);
+    void align(uint64_t boundary);
+
+    std::string qualify(const std::string& name) const;
+    Expr parseExpr(const std::string& text) const;
+    Operand parseOperand(const std::string& text) const;
+    bool constantValue(const Expr& expr, int64_t& value) const;
+    bool relocationTarget(const Expr& expr, std::string& symbol, int64_t& addend, int depth = 0) const;
+    int64_t resolve(const Expr& expr, const std::vector<uint64_t>& section_addresses, const ExternResolver& resolve_extern, int depth = 0) const;
+
+    AsmSection& current();
+    void byte(uint8_t value);
+    void imm(const Expr& expr, int width);
+    void rel32(const Expr& target);
+    void opReg(uint8_t opcode, int reg, bool rex_w, bool byte_rex);
+    void encode(uint8_t prefix, bool rex_w, std::initializer_list<uint8_t> opcode, int reg, bool reg_byte_rex, const Operand& rm);
+    void vex(uint8_t pp, uint8_t map, bool w, bool l, uint8_t opcode, int reg, int vvvv, const Operand& rm);
+    void modrm(int reg, const Operand& rm);
+    int operandSize(const Operand& a, const Operand& b) const;
+    [[noreturn]] void error(const std::string& message) const;
+};
@@ -0,0 +1,449 @@
+#include "Build.h"
+#include "Assembler.h"
+#include "CodeGenerator.h"
+#include "Module.h"
+#include "ModuleFormat.h"
+#include "ThreadPool.h"
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <set>
+#include <sstream>
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace
+{
+    // Collects the procedures a module calls, with the first line each is called from.
+    class CallFinder : public StmtVisitor, public ExprVisitor
+    {
+    public:
+        std::map<std::string, int> callees;
+
+        void visitDeclarationStmt(const DeclarationStmt& stmt) override 
+        { 
+            stmt.initializer->accept(*this); 
+        }
+        void visitExpressionStmt(const ExpressionStmt& stmt) override 
+        { 
+            stmt.expression->accept(*this); 
+        }
+        void visitIfStmt(const IfStmt& stmt) override 
+        { 
+            stmt.condition->accept(*this); 
+            stmt.then_branch->accept(*this); 
+            if (stmt.else_branch)
+            {
+                stmt.else_branch->accept(*this);
+            }
+        }
+        void visitWhileStmt(const WhileStmt& stmt) override 
+        { 
+            stmt.condition->accept(*this); 
+            stmt.body->accept(*this); 
+        }
+        void visitForStmt(const ForStmt& stmt) override 
+        { 
+            stmt.first->accept(*this); 
+            stmt.last->accept(*this); 
+            stmt.body->accept(*this); 
+        }
+        void visitBlockStmt(const BlockStmt& stmt) override 
+        { 
+            for (const auto& s : stmt.statements) 
+            {
+                s->accept(*this);
+            }
+        }
+        void visitPrintStmt(const PrintStmt& stmt) override 
+        { 
+            stmt.expression->accept(*this); 
+        }
+        void visitNewlineStmt(const NewlineStmt& /*stmt*/) override {}
+        void visitProcedureDeclStmt(const ProcedureDeclStmt& stmt) override 
+        { 
+            stmt.body->accept(*this); 
+        }
+        void visitProcedureCallStmt(const ProcedureCallStmt& stmt) override 
+        { 
+            callees.emplace(stmt.callee_name.text, stmt.callee_name.line);
+            for (const auto& arg : stmt.arguments) 
+            {
+                arg->accept(*this);
+            }
+        }
+        void visitReturnStmt(const ReturnStmt& stmt) override 
+        { 
+            stmt.value->accept(*this); 
+        }
+        void visitBreakStmt(const BreakStmt& /*stmt*/) override {}
+        void visitImportStmt(const ImportStmt& /*stmt*/) override {}
+
+        void visitBinaryExpr(const BinaryExpr& expr) override 
+        { 
+            expr.left->accept(*this); 
+            expr.right->accept(*this); 
+        }
+        void visitComparisonExpr(const ComparisonExpr& expr) override 
+        { 
+            expr.left->accept(*this); 
+            expr.right->accept(*this); 
+        }
+        void visitLiteralExpr(const LiteralExpr& /*expr*/) override {}
+        void visitVariableExpr(const VariableExpr& /*expr*/) override {}
+        void visitAssignExpr(const AssignExpr& expr) override 
+        { 
+            expr.value->accept(*this); 
+        }
+        void visitFunctionCallExpr(const FunctionCallExpr& expr) override 
+        { 
+            callees.emplace(expr.callee_name.text, expr.callee_name.line);
+            for (const auto& arg : expr.arguments) 
+            {
+                arg->accept(*this);
+            }
+        }
+        void visitUnaryExpr(const UnaryExpr& expr) override 
+        { 
+            expr.right->accept(*this); 
+        }
+        void visitIndexExpr(const IndexExpr& expr) override 
+        { 
+            expr.index->accept(*this); 
+        }
+        void visitIndexAssignExpr(const IndexAssignExpr& expr) override 
+        { 
+            expr.index->accept(*this); 
+            expr.value->accept(*this); 
+        }
+        void visitLengthExpr(const LengthExpr& /*expr*/) override {}
+        void visitEntryExpr(const EntryExpr& expr) override 
+        { 
+            expr.key->accept(*this); 
+        }
+        void visitEntryAssignExpr(const EntryAssignExpr& expr) override 
+        { 
+            expr.key->accept(*this); 
+            expr.value->accept(*this); 
+        }
+        void visitHasEntryExpr(const HasEntryExpr& expr) override 
+        { 
+            expr.key->accept(*this); 
+        }
+        void visitJoinExpr(const JoinExpr& expr) override 
+        { 
+            expr.left->accept(*this); 
+            expr.right->accept(*this); 
+        }
+        void visitTextExpr(const TextExpr& expr) override 
+        { 
+            expr.value->accept(*this); 
+        }
+    };
+
+    struct Unit
+    {
+        std::unique_ptr<Module> module;
+        std::map<std::string, const ProcedureDeclStmt*> procedures;
+        bool listed = false;
+        bool has_story = false;
+        bool recalled = false;
+    };
+
+    std::string objectPath(const std::string& source)
+    {
+        size_t slash = source.rfind('/');
+        size_t dot = source.rfind('.');
+        if (dot == std::string::npos || (slash != std::string::npos && dot < slash))
+        {
+            return source + ".o";
+        }
+        return source.substr(0, dot) + ".o";
+    }
+
+    int runLinker(const std::vector<std::string>& objects, const std::string& output)
+    {
+        std::vector<std::string> args = {"ld", "-o", output};
+        args.insert(args.end(), objects.begin(), objects.end());
+        std::vector<char*> argv;
+        for (auto& arg : args)
+        {
+            argv.push_back(&arg[0]);
+        }
+        argv.push_back(nullptr);
+
+        pid_t pid = fork();
+        if (pid == 0)
+        {
+            execvp("ld", argv.data());
+            _exit(127);
+        }
+        int status = 0;
+        if (pid < 0 || waitpid(pid, &status, 0) < 0)
+        {
+            std::cerr << "Error: Could not run the linker." << std::endl;
+            return 1;
+        }
+        if (WIFEXITED(status) && WEXITSTATUS(status) == 127)
+        {
+            std::cerr << "Error: Could not run 'ld'." << std::endl;
+        }
+        return WIFEXITED(status) ? WEXITSTATUS(status) : 1;
+    }
+}
+
+int buildModules(const BuildOptions& options)
+{
+    // Load the listed modules and, transitively, everything they recall.
+    std::vector<Unit> units;
+    // Keyed by moduleKey(), so a module recalled under two spellings of its path is one unit.
+    std::map<std::string, size_t> index;
+    std::vector<std::string> pending;
+    for (const auto& source : options.sources)
+    {
+        pending.push_back(resolveImport("", source));
+    }
+    for (size_t next = 0; next < pending.size(); ++next)
+    {
+        if (index.count(moduleKey(pending[next])))
+        {
+            continue;
+        }
+        Unit unit;
+        try
+        {
+            unit.module = loadModule(pending[next], options.jobs);
+        }
+        catch (const std::runtime_error& e)
+        {
+            std::cerr << "Error: " << e.what() << std::endl;
+            return 1;
+        }
+        unit.listed = next < options.sources.size();
+        for (const auto& stmt : unit.module->statements)
+        {
+            if (auto proc = dynamic_cast<const ProcedureDeclStmt*>(stmt.get()))
+            {
+                unit.procedures.emplace(proc->name.text, proc);
+            }
+            else if (!dynamic_cast<const ImportStmt*>(stmt.get()))
+            {
+                unit.has_story = true;
+            }
+        }
+        pending.insert(pending.end(), unit.module->imports.begin(), unit.module->imports.end());
+        index[moduleKey(pending[next])] = units.size();
+        units.push_back(std::move(unit));
+    }
+
+    bool failed = false;
+    for (const auto& unit : units)
+    {
+        failed = failed || unit.module->had_error;
+        for (const auto& path : unit.module->imports)
+        {
+            units[index.at(moduleKey(path))].recalled = true;
+        }
+    }
+    if (failed)
+    {
+        return 1;
+    }
+
+    std::vector<size_t> targets;
+    for (size_t i = 0; i < units.size(); ++i)
+    {
+        if (!options.compile_only || units[i].listed)
+        {
+            targets.push_back(i);
+        }
+    }
+
+    if (!options.compile_only)
+    {
+        std::map<std::string, size_t> owners;
+        std::vector<size_t> entries;
+        for (size_t i : targets)
+        {
+            for (const auto& procedure : units[i].procedures)
+            {
+                const std::string& name = procedure.first;
+                auto owner = owners.emplace(name, i);
+                if (!owner.second)
+                {
+                    std::cerr << "Error: procedure '" << name << "' is defined in both " << units[owner.first->second].module->path 
+                              << " and " << units[i].module->path << "." << std::endl;
+                    failed = true;
+                }
+            }
+            if (units[i].has_story && !units[i].recalled)
+            {
+                entries.push_back(i);
+            }
+        }
+        if (entries.size() > 1)
+        {
+            std::cerr << "Error: " << units[entries[0]].module->path << " and " << units[entries[1]].module->path 
+                      << " both have a top-level story; only one module can be the program." << std::endl;
+            failed = true;
+        }
+        if (entries.empty())
+        {
+            std::cerr << "Error: no module that is not recalled by another has a top-level story to run." << std::endl;
+            failed = true;
+        }
+        if (failed)
+        {
+            return 1;
+        }
+    }
+
+    // Every call must reach a procedure of the module itself or of a module it recalls.
+    std::vector<std::vector<const ProcedureDeclStmt*>> externs(units.size());
+    for (size_t i : targets)
+    {
+        std::map<std::string, const ProcedureDeclStmt*> visible;
+        std::set<size_t> seen = {i};
+        std::vector<size_t> stack = {i};
+        while (!stack.empty())
+        {
+            size_t current = stack.back();
+            stack.pop_back();
+            for (const auto& path : units[current].module->imports)
+            {
+                size_t imported = index.at(moduleKey(path));
+                if (seen.insert(imported).second)
+                {
+                    visible.insert(units[imported].procedures.begin(), units[imported].procedures.end());
+                    stack.push_back(imported);
+                }
+            }
+        }
+
+        CallFinder finder;
+        for (const auto& stmt : units[i].module->statements)
+        {
+            stmt->accept(finder);
+        }
+        for (const auto& callee : finder.callees)
+        {
+            if (units[i].procedures.count(callee.first))
+            {
+                continue;
+            }
+            if (!visible.count(callee.first))
+            {
+                std::cerr << units[i].module->path << ": Line " << callee.second << ": Error: procedure '" << callee.first 
+                          << "' is not defined in this module or any module it recalls." << std::endl;
+                failed = true;
+                continue;
+            }
+            externs[i].push_back(visible.at(callee.first));
+        }
+    }
+    if (failed)
+    {
+        return 1;
+    }
+
+    std::vector<std::string> errors(targets.size());
+    ThreadPool pool(options.jobs);
+    pool.parallelFor(targets.size(), [&](size_t t) 
+    {
+        const Unit& unit = units[targets[t]];
+        CodegenOptions codegen_options;
+        codegen_options.jobs = 1;
+        codegen_options.module = true;
+        codegen_options.cache = options.cache;
+        codegen_options.profile = options.profile;
+        codegen_options.profile_generate = options.profile_generate;
+        codegen_options.profile_use = options.profile_use;
+        codegen_options.debug_info = options.debug_info;
+        codegen_options.fold_pure_calls = options.fold_pure_calls;
+        codegen_options.memoize = options.memoize;
+        codegen_options.memoize_only = options.memoize_only;
+        codegen_options.memo_entries = options.memo_entries;
+        codegen_options.unroll_factor = options.unroll_factor;
+        codegen_options.vectorize = options.vectorize;
+        codegen_options.avx2 = options.avx2;
+        codegen_options.source_path = unit.module->path;
+        codegen_options.entry = unit.has_story && !unit.recalled;
+        codegen_options.imported_procedures = externs[targets[t]];
+        try
+        {
+            std::ostringstream assembly;
+            CodeGenerator(codegen_options, assembly).generate(unit.module->statements);
+            Assembler assembler;
+            assembler.assemble(assembly.str());
+
+            std::string path = objectPath(unit.module->path);
+            std::ofstream object(path, std::ios::binary);
+            if (!object)
+            {
+                throw std::runtime_error("Could not write " + path);
+            }
+            assembler.writeObject(object);
+        }
+        catch (const std::exception& e)
+        {
+            errors[t] = e.what();
+        }
+    });
+
+    std::vector<std::string> objects;
+    for (size_t t = 0; t < targets.size(); ++t)
+    {
+        if (!errors[t].empty())
+        {
+            std::cerr << units[targets[t]].module->path << ": Error: " << errors[t] << std::endl;
+            failed = true;
+        }
+        objects.push_back(objectPath(units[targets[t]].module->path));
+    }
+    if (failed)
+    {
+        return 1;
+    }
+
+    return options.compile_only ? 0 : runLinker(objects, options.output);
+}
+
+int emitModules(const BuildOptions& options)
+{
+    std::vector<std::string> errors(options.sources.size());
+    ThreadPool pool(options.jobs);
+    pool.parallelFor(options.sources.size(), [&](size_t i) 
+    {
+        const std::string& path = options.sources[i];
+        try
+        {
+            ModuleSource source;
+            if (!statSource(path, source))
+            {
+                throw std::runtime_error("Could not open file " + path);
+            }
+            std::unique_ptr<Module> module = loadModule(path, 1);
+            if (module->had_error)
+            {
+                errors[i] = "not saved because of parse errors.";
+                return;
+            }
+            writeModuleFile(modulePathFor(path), module->statements, source);
+        }
+        catch (const std::runtime_error& e)
+        {
+            errors[i] = e.what();
+        }
+    });
+
+    int status = 0;
+    for (size_t i = 0; i < errors.size(); ++i)
+    {
+        if (!errors[i].empty())
+        {
+            std::cerr << options.sources[i] << ": Error: " << errors[i] << std::endl;
+            status = 1;
+        }
+    }
+    return status;
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include "CompileCache.h"
+#include "ProfileData.h"
+#include <string>
+#include <vector>
+
+struct BuildOptions
+{
+    std::vector<std::string> sources;
+    // Executable to link; ignored with compile_only.
+    std::string output = "a.out";
+    // Stop after writing the objects (lostrecordc -c).
+    bool compile_only = false;
+    // Modules compiled at once; 0 uses every hardware core.
+    size_t jobs = 0;
+    CompileCache* cache = nullptr;
+    // Instrument procedures for the cycle profiler (lostrecordc --profile).
+    bool profile = false;
+    // Training profile output (-fprofile-generate) and input (-fprofile-use).
+    std::string profile_generate;
+    const ProfileData* profile_use = nullptr;
+    // DWARF line tables in the objects (lostrecordc -g).
+    bool debug_info = false;
+    // Compile-time evaluation of pure calls (off with -fno-fold-pure-calls).
+    bool fold_pure_calls = true;
+    // Memo tables for pure recursive procedures, or the listed ones (-fmemoize[=<names>]).
+    bool memoize = false;
+    std::vector<std::string> memoize_only;
+    size_t memo_entries = 4096;
+    // Counted loop unrolling (-funroll-loops=<factor>, -fno-unroll-loops).
+    int unroll_factor = 4;
+    // Vectorized counted loops (off with -fno-vectorize), with AVX2 instead of SSE2 (-mavx2).
+    bool vectorize = true;
+    bool avx2 = false;
+};
+
+// Separate compilation driver. Every listed module, and with linking every module they recall,
+// is compiled to its own ELF object next to its source (story.lr -> story.o) and the objects
+// are linked with ld. Procedures are exported as global proc_* symbols and calls to procedures
+// of recalled modules become extern references. A module that no other module recalls and that
+// has a top-level story is the program and gets the _start entry point.
+int buildModules(const BuildOptions& options);
+
+// Parses every listed module and saves it as a .lrm next to its source (lostrecordc --emit-lrm),
+// so later builds that recall it skip lexing and parsing.
+int emitModules(const BuildOptions& options);
@@ -0,0 +1,1101 @@
+#include "Bytecode.h"
+#include <climits>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+
+namespace
+{
+    class AssignmentFinder : public ExprVisitor
+    {
+    public:
+        bool found = false;
+
+        void visitBinaryExpr(const BinaryExpr& expr) override
+        {
+            expr.left->accept(*this);
+            expr.right->accept(*this);
+        }
+        void visitComparisonExpr(const ComparisonExpr& expr) override
+        {
+            expr.left->accept(*this);
+            expr.right->accept(*this);
+        }
+        void visitLiteralExpr(const LiteralExpr& /*expr*/) override {}
+        void visitVariableExpr(const VariableExpr& /*expr*/) override {}
+        void visitAssignExpr(const AssignExpr& /*expr*/) override
+        {
+            found = true;
+        }
+        void visitFunctionCallExpr(const FunctionCallExpr& expr) override
+        {
+            for (const auto& arg : expr.arguments)
+            {
+                arg->accept(*this);
+            }
+        }
+        void visitUnaryExpr(const UnaryExpr& expr) override
+        {
+            expr.right->accept(*this);
+        }
+        void visitIndexExpr(const IndexExpr& expr) override
+        {
+            expr.index->accept(*this);
+        }
+        void visitIndexAssignExpr(const IndexAssignExpr& /*expr*/) override
+        {
+            found = true;
+        }
+        void visitLengthExpr(const LengthExpr& /*expr*/) override {}
+        void visitEntryExpr(const EntryExpr& expr) override
+        {
+            expr.key->accept(*this);
+        }
+        void visitEntryAssignExpr(const EntryAssignExpr& /*expr*/) override
+        {
+            found = true;
+        }
+        void visitHasEntryExpr(const HasEntryExpr& expr) override
+        {
+            expr.key->accept(*this);
+        }
+        void visitJoinExpr(const JoinExpr& expr) override
+        {
+            expr.left->accept(*this);
+            expr.right->accept(*this);
+        }
+        void visitTextExpr(const TextExpr& expr) override
+        {
+            expr.value->accept(*this);
+        }
+    };
+
+    bool containsAssignment(const Expr& expr)
+    {
+        AssignmentFinder finder;
+        expr.accept(finder);
+        return finder.found;
+    }
+
+    // Finds whether code builds strings itself or stores values anywhere, and the procedures it
+    // calls, which may build strings too.
+    class StringScanner : public StmtVisitor, public ExprVisitor
+    {
+    public:
+        bool builds = false;
+        bool stores = false;
+        std::vector<std::string> callees;
+
+        void visitDeclarationStmt(const DeclarationStmt& stmt) override
+        {
+            stmt.initializer->accept(*this);
+        }
+        void visitExpressionStmt(const ExpressionStmt& stmt) override
+        {
+            stmt.expression->accept(*this);
+        }
+        void visitIfStmt(const IfStmt& stmt) override
+        {
+            stmt.condition->accept(*this);
+            stmt.then_branch->accept(*this);
+            if (stmt.else_branch)
+            {
+                stmt.else_branch->accept(*this);
+            }
+        }
+        void visitWhileStmt(const WhileStmt& stmt) override
+        {
+            stmt.condition->accept(*this);
+            stmt.body->accept(*this);
+        }
+        void visitForStmt(const ForStmt& stmt) override
+        {
+            stmt.first->accept(*this);
+            stmt.last->accept(*this);
+            stmt.body->accept(*this);
+        }
+        void visitBlockStmt(const BlockStmt& stmt) override
+        {
+            for (const auto& s : stmt.statements)
+            {
+                s->accept(*this);
+            }
+        }
+        void visitPrintStmt(const PrintStmt& stmt) override
+        {
+            stmt.expression->accept(*this);
+        }
+        void visitNewlineStmt(const NewlineStmt& /*stmt*/) override {}
+        void visitProcedureDeclStmt(const ProcedureDeclStmt& /*stmt*/) override {}
+        void visitProcedureCallStmt(const ProcedureCallStmt& stmt) override
+        {
+            call(stmt.callee_name.text, stmt.arguments);
+        }
+        void visitReturnStmt(const ReturnStmt& stmt) override
+        {
+            stmt.value->accept(*this);
+        }
+        void visitBreakStmt(const BreakStmt& /*stmt*/) override {}
+        void visitImportStmt(const ImportStmt& /*stmt*/) override {}
+
+        void visitBinaryExpr(const BinaryExpr& expr) override
+        {
+            expr.left->accept(*this);
+            expr.right->accept(*this);
+        }
+        void visitComparisonExpr(const ComparisonExpr& expr) override
+        {
+            expr.left->accept(*this);
+            expr.right->accept(*this);
+        }
+        void visitLiteralExpr(const LiteralExpr& /*expr*/) override {}
+        void visitVariableExpr(const VariableExpr& /*expr*/) override {}
+        void visitAssignExpr(const AssignExpr& expr) override
+        {
+            stores = true;
+            expr.value->accept(*this);
+        }
+        void visitFunctionCallExpr(const FunctionCallExpr& expr) override
+        {
+            call(expr.callee_name.text, expr.arguments);
+        }
+        void visitUnaryExpr(const UnaryExpr& expr) override
+        {
+            expr.right->accept(*this);
+        }
+        void visitIndexExpr(const IndexExpr& expr) override
+        {
+            expr.index->accept(*this);
+        }
+        void visitIndexAssignExpr(const IndexAssignExpr& expr) override
+        {
+            stores = true;
+            expr.index->accept(*this);
+            expr.value->accept(*this);
+        }
+        void visitLengthExpr(const LengthExpr& /*expr*/) override {}
+        void visitEntryExpr(const EntryExpr& expr) override
+        {
+            expr.key->accept(*this);
+        }
+        void visitEntryAssignExpr(const EntryAssignExpr& expr) override
+        {
+            stores = true;
+            expr.key->accept(*this);
+            expr.value->accept(*this);
+        }
+        void visitHasEntryExpr(const HasEntryExpr& expr) override
+        {
+            expr.key->accept(*this);
+        }
+        void visitJoinExpr(const JoinExpr& /*expr*/) override
+        {
+            builds = true;
+        }
+        void visitTextExpr(const TextExpr& /*expr*/) override
+        {
+            builds = true;
+        }
+
+    private:
+        void call(const std::string& callee, const std::vector<std::unique_ptr<Expr>>& arguments)
+        {
+            callees.push_back(callee);
+            for (const auto& arg : arguments)
+            {
+                arg->accept(*this);
+            }
+        }
+    };
+}
+
+BytecodeProgram BytecodeCompiler::compile(const std::vector<std::unique_ptr<Stmt>>& statements)
+{
+    m_program = BytecodeProgram();
+    m_program.functions.push_back({"main", 0, 0, 0});
+
+    for (const auto& stmt : statements)
+    {
+        if (auto proc_decl = dynamic_cast<const ProcedureDeclStmt*>(stmt.get()))
+        {
+            m_function_indices[proc_decl->name.text] = static_cast<uint16_t>(m_program.functions.size());
+            m_procedures[proc_decl->name.text] = proc_decl;
+            m_program.functions.push_back({proc_decl->name.text, static_cast<uint16_t>(proc_decl->params.size()), 0, 0});
+        }
+    }
+
+    for (const auto& stmt : statements)
+    {
+        if (auto proc_decl = dynamic_cast<const ProcedureDeclStmt*>(stmt.get()))
+        {
+            compileProcedure(*proc_decl);
+        }
+    }
+
+    m_function = 0;
+    m_in_procedure = false;
+    m_return_type = "int";
+    m_string_mark = -1;
+    m_variables.clear();
+    m_next_register = 0;
+    m_max_registers = 0;
+    m_array_words = 0;
+    m_program.functions[0].entry = static_cast<uint32_t>(m_program.code.size());
+
+    for (const auto& stmt : statements)
+    {
+        if (!dynamic_cast<const ProcedureDeclStmt*>(stmt.get()))
+        {
+            stmt->accept(*this);
+        }
+    }
+
+    emit(OpCode::HALT);
+    m_program.functions[0].registers = static_cast<uint16_t>(m_max_registers);
+    m_program.functions[0].array_words = m_array_words;
+
+    return std::move(m_program);
+}
+
+void BytecodeCompiler::compileProcedure(const ProcedureDeclStmt& stmt)
+{
+    if (stmt.params.size() > 6)
+    {
+        throw std::runtime_error("More than 6 arguments are not supported.");
+    }
+
+    m_function = m_function_indices.at(stmt.name.text);
+    m_in_procedure = true;
+    m_return_type = stmt.return_type.text;
+    m_variables.clear();
+    m_next_register = 0;
+    m_max_registers = 0;
+    m_array_words = 0;
+    m_program.functions[m_function].entry = static_cast<uint32_t>(m_program.code.size());
+
+    for (const auto& param : stmt.params)
+    {
+        m_variables[param.name.text] = {allocateRegister(), param.type.text};
+        emitNarrow(param.type.text, m_variables[param.name.text].reg);
+    }
+    m_string_mark = -1;
+    if (m_return_type != "string" && buildsStrings(*stmt.body))
+    {
+        m_string_mark = allocateRegister();
+        emit(OpCode::MARK, static_cast<uint16_t>(m_string_mark));
+    }
+
+    stmt.body->accept(*this);
+
+    uint16_t result = allocateRegister();
+    emitBx(OpCode::LOADI, result, 0);
+    emitReturn(result);
+    m_string_mark = -1;
+    m_program.functions[m_function].registers = static_cast<uint16_t>(m_max_registers);
+    m_program.functions[m_function].array_words = m_array_words;
+}
+
+size_t BytecodeCompiler::emit(OpCode op, uint16_t a, uint16_t b, uint16_t c)
+{
+    Instruction instruction;
+    instruction.op = op;
+    instruction.a = a;
+    instruction.b = b;
+    instruction.c = c;
+    m_program.code.push_back(instruction);
+
+    return m_program.code.size() - 1;
+}
+
+size_t BytecodeCompiler::emitBx(OpCode op, uint16_t a, int32_t bx)
+{
+    size_t at = emit(op, a);
+    m_program.code[at].setBx(bx);
+
+    return at;
+}
+
+void BytecodeCompiler::emitNarrow(const std::string& type, uint16_t reg)
+{
+    if (type == "bool" || typeWidth(type) != 8)
+    {
+        emit(OpCode::NARROW, reg, static_cast<uint16_t>(type == "bool" ? 0 : typeWidth(type)));
+    }
+}
+
+void BytecodeCompiler::emitReturn(uint16_t value)
+{
+    if (m_string_mark >= 0)
+    {
+        emit(OpCode::RESET, static_cast<uint16_t>(m_string_mark));
+    }
+    emit(OpCode::RET, value);
+}
+
+void BytecodeCompiler::patchJump(size_t at)
+{
+    m_program.code[at].setBx(static_cast<int32_t>(m_program.code.size()));
+}
+
+uint16_t BytecodeCompiler::allocateRegister()
+{
+    if (m_next_register >= UINT16_MAX)
+    {
+        throw std::runtime_error("Too many registers required by '" + m_program.functions[m_function].name + "'.");
+    }
+    int reg = m_next_register++;
+    m_max_registers = std::max(m_max_registers, m_next_register);
+
+    return static_cast<uint16_t>(reg);
+}
+
+BytecodeVariable* BytecodeCompiler::findVariable(const std::string& name)
+{
+    auto it = m_variables.find(name);
+    return it == m_variables.end() ? nullptr : &it->second;
+}
+
+BytecodeVariable* BytecodeCompiler::findScalar(const std::string& name)
+{
+    BytecodeVariable* var = findVariable(name);
+    if (var && var->length != 0)
+    {
+        throw std::runtime_error("'" + name + "' is an array; name one of its elements.");
+    }
+    if (var && !var->key_type.empty())
+    {
+        throw std::runtime_error("'" + name + "' is a map; name one of its entries.");
+    }
+    return var;
+}
+
+const BytecodeVariable& BytecodeCompiler::findArray(const Token& name)
+{
+    BytecodeVariable* var = findVariable(name.text);
+    if (!var)
+    {
+        throw std::runtime_error("Undeclared array '" + name.text + "'.");
+    }
+    if (var->length == 0)
+    {
+        throw std::runtime_error("'" + name.text + "' is not an array.");
+    }
+    return *var;
+}
+
+const BytecodeVariable& BytecodeCompiler::findMap(const Token& name)
+{
+    BytecodeVariable* var = findVariable(name.text);
+    if (!var)
+    {
+        throw std::runtime_error("Undeclared map '" + name.text + "'.");
+    }
+    if (var->key_type.empty())
+    {
+        throw std::runtime_error("'" + name.text + "' is not a map.");
+    }
+    return *var;
+}
+
+void BytecodeCompiler::compileInto(const Expr& expr, uint16_t target)
+{
+    uint16_t saved = m_target;
+    m_target = target;
+    expr.accept(*this);
+    m_target = saved;
+}
+
+// Returns a register holding the value of expr. Variables are read in place unless the
+// caller needs a snapshot that later side effects cannot change.
+uint16_t BytecodeCompiler::operand(const Expr& expr, bool copy)
+{
+    if (!copy)
+    {
+        if (auto var_expr = dynamic_cast<const VariableExpr*>(&expr))
+        {
+            BytecodeVariable* var = findScalar(var_expr->name.text);
+            if (!var)
+            {
+                throw std::runtime_error("Undeclared variable '" + var_expr->name.text + "'.");
+            }
+            return var->reg;
+        }
+    }
+
+    uint16_t reg = allocateRegister();
+    compileInto(expr, reg);
+
+    return reg;
+}
+
+// The same typing as native code: arithmetic with a float on either side is done in floats.
+bool BytecodeCompiler::isFloat(const Expr& expr)
+{
+    if (auto literal = dynamic_cast<const LiteralExpr*>(&expr))
+    {
+        return literal->value.type == TokenType::FLOAT_LITERAL;
+    }
+    if (auto variable = dynamic_cast<const VariableExpr*>(&expr))
+    {
+        BytecodeVariable* var = findScalar(variable->name.text);
+        return var && var->type == "float";
+    }
+    if (auto assign = dynamic_cast<const AssignExpr*>(&expr))
+    {
+        BytecodeVariable* var = findScalar(assign->name.text);
+        return var && var->type == "float";
+    }
+    if (auto index = dynamic_cast<const IndexExpr*>(&expr))
+    {
+        return findArray(index->array).type == "float";
+    }
+    if (auto index = dynamic_cast<const IndexAssignExpr*>(&expr))
+    {
+        return findArray(index->array).type == "float";
+    }
+    if (auto binary = dynamic_cast<const BinaryExpr*>(&expr))
+    {
+        const std::string& op = binary->op.text;
+        bool arithmetic = op == "plus" || op == "minus" || op == "multiplied" || op == "divided";
+        return arithmetic && (isFloat(*binary->left) || isFloat(*binary->right));
+    }
+    if (auto call = dynamic_cast<const FunctionCallExpr*>(&expr))
+    {
+        auto procedure = m_procedures.find(call->callee_name.text);
+        return procedure != m_procedures.end() && procedure->second->return_type.text == "float";
+    }
+    return false;
+}
+
+// The same typing as native code: only these expressions are known to be strings.
+bool BytecodeCompiler::isString(const Expr& expr)
+{
+    if (auto literal = dynamic_cast<const LiteralExpr*>(&expr))
+    {
+        return literal->value.type == TokenType::STRING_LITERAL;
+    }
+    if (auto variable = dynamic_cast<const VariableExpr*>(&expr))
+    {
+        BytecodeVariable* var = findScalar(variable->name.text);
+        return var && var->type == "string";
+    }
+    if (auto assign = dynamic_cast<const AssignExpr*>(&expr))
+    {
+        BytecodeVariable* var = findScalar(assign->name.text);
+        return var && var->type == "string";
+    }
+    if (auto index = dynamic_cast<const IndexExpr*>(&expr))
+    {
+        return findArray(index->array).type == "string";
+    }
+    if (auto index = dynamic_cast<const IndexAssignExpr*>(&expr))
+    {
+        return findArray(index->array).type == "string";
+    }
+    if (auto entry = dynamic_cast<const EntryExpr*>(&expr))
+    {
+        return findMap(entry->map).type == "string";
+    }
+    if (auto entry = dynamic_cast<const EntryAssignExpr*>(&expr))
+    {
+        return findMap(entry->map).type == "string";
+    }
+    if (auto call = dynamic_cast<const FunctionCallExpr*>(&expr))
+    {
+        return yieldsString({call->callee_name.text});
+    }
+    return dynamic_cast<const JoinExpr*>(&expr) || dynamic_cast<const TextExpr*>(&expr);
+}
+
+bool BytecodeCompiler::buildsStrings(const Stmt& stmt)
+{
+    StringScanner scanner;
+    stmt.accept(scanner);
+    return scanner.builds || yieldsString(scanner.callees);
+}
+
+// Whether any of the procedures yields a string, which it may have built.
+bool BytecodeCompiler::yieldsString(const std::vector<std::string>& procedures) const
+{
+    for (const auto& name : procedures)
+    {
+        auto procedure = m_procedures.find(name);
+        if (procedure != m_procedures.end() && procedure->second->return_type.text == "string")
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Compiles expr into target as a value of the type, converting between float and integer.
+void BytecodeCompiler::compileAs(const Expr& expr, const std::string& type, uint16_t target)
+{
+    bool is_float = isFloat(expr);
+    compileInto(expr, target);
+    if (type == "float" && !is_float)
+    {
+        emit(OpCode::ITOF, target, target);
+    }
+    else if (type != "float" && is_float)
+    {
+        emit(OpCode::FTOI, target, target);
+    }
+}
+
+// operand() for a value of the type; one that needs converting is always copied.
+uint16_t BytecodeCompiler::operandAs(const Expr& expr, const std::string& type, bool copy)
+{
+    if ((type == "float") == isFloat(expr))
+    {
+        return operand(expr, copy);
+    }
+    uint16_t reg = allocateRegister();
+    compileAs(expr, type, reg);
+    return reg;
+}
+
+void BytecodeCompiler::compileCall(const Token& callee, const std::vector<std::unique_ptr<Expr>>& arguments, uint16_t target)
+{
+    if (arguments.size() > 6)
+    {
+        throw std::runtime_error("More than 6 arguments are not supported.");
+    }
+    auto function = m_function_indices.find(callee.text);
+    if (function == m_function_indices.end())
+    {
+        throw std::runtime_error("Undefined procedure '" + callee.text + "'.");
+    }
+
+    int mark = m_next_register;
+    size_t slots = std::max<size_t>(arguments.size(), m_program.functions[function->second].params);
+    uint16_t base = static_cast<uint16_t>(m_next_register);
+    for (size_t i = 0; i < slots; ++i)
+    {
+        allocateRegister();
+    }
+    const ProcedureDeclStmt& procedure = *m_procedures.at(callee.text);
+    for (size_t i = 0; i < arguments.size(); ++i)
+    {
+        std::string type = isFloat(*arguments[i]) ? "float" : "int";
+        if (i < procedure.params.size())
+        {
+            type = procedure.params[i].type.text;
+        }
+        compileAs(*arguments[i], type, static_cast<uint16_t>(base + i));
+    }
+
+    emit(OpCode::CALL, target, function->second, base);
+    m_next_register = mark;
+}
+
+void BytecodeCompiler::visitProcedureDeclStmt(const ProcedureDeclStmt& stmt)
+{
+    throw std::runtime_error("Procedure '" + stmt.name.text + "' must be declared at the top level of the story.");
+}
+
+void BytecodeCompiler::visitProcedureCallStmt(const ProcedureCallStmt& stmt)
+{
+    int mark = m_next_register;
+    compileCall(stmt.callee_name, stmt.arguments, allocateRegister());
+    m_next_register = mark;
+}
+
+void BytecodeCompiler::visitBlockStmt(const BlockStmt& stmt)
+{
+    for (const auto& statement : stmt.statements)
+    {
+        statement->accept(*this);
+    }
+}
+
+void BytecodeCompiler::visitIfStmt(const IfStmt& stmt)
+{
+    int mark = m_next_register;
+    uint16_t condition = operandAs(*stmt.condition, "int", false);
+    size_t jump = emitBx(OpCode::JMPF, condition, 0);
+    m_next_register = mark;
+
+    stmt.then_branch->accept(*this);
+    if (stmt.else_branch)
+    {
+        size_t skip = emitBx(OpCode::JMP, 0, 0);
+        patchJump(jump);
+        stmt.else_branch->accept(*this);
+        patchJump(skip);
+        return;
+    }
+    patchJump(jump);
+}
+
+void BytecodeCompiler::visitWhileStmt(const WhileStmt& stmt)
+{
+    int32_t start = static_cast<int32_t>(m_program.code.size());
+    m_break_jumps.emplace_back();
+
+    int mark = m_next_register;
+    uint16_t condition = operandAs(*stmt.condition, "int", false);
+    size_t exit_jump = emitBx(OpCode::JMPF, condition, 0);
+    m_next_register = mark;
+
+    stmt.body->accept(*this);
+    emitBx(OpCode::JMP, 0, start);
+    patchJump(exit_jump);
+
+    for (size_t jump : m_break_jumps.back())
+    {
+        patchJump(jump);
+    }
+    m_break_jumps.pop_back();
+}
+
+// The trip count is taken on entry and counted down in its own register, as in native code.
+// It and the constant one stay allocated: variables declared in the body are placed above them.
+void BytecodeCompiler::visitForStmt(const ForStmt& stmt)
+{
+    BytecodeVariable* var = findScalar(stmt.variable.text);
+    if (!var)
+    {
+        uint16_t reg = allocateRegister();
+        var = &(m_variables[stmt.variable.text] = {reg, "int"});
+    }
+    else if (!isWordInteger(var->type))
+    {
+        throw std::runtime_error("The counted value '" + stmt.variable.text + "' of a 'for each' has to be a full int.");
+    }
+    uint16_t counter = var->reg;
+    compileAs(*stmt.first, "int", counter);
+    uint16_t trips = allocateRegister();
+    compileAs(*stmt.last, "int", trips);
+    uint16_t one = allocateRegister();
+    emitBx(OpCode::LOADI, one, 1);
+
+    int mark = m_next_register;
+    uint16_t entered = allocateRegister();
+    emit(OpCode::LT, entered, trips, counter);
+    emit(OpCode::NOT, entered, entered);
+    size_t skip = emitBx(OpCode::JMPF, entered, 0);
+    m_next_register = mark;
+    emit(OpCode::SUB, trips, trips, counter);
+    emit(OpCode::ADD, trips, trips, one);
+
+    int32_t start = static_cast<int32_t>(m_program.code.size());
+    m_break_jumps.emplace_back();
+    stmt.body->accept(*this);
+    emit(OpCode::ADD, counter, counter, one);
+    emit(OpCode::SUB, trips, trips, one);
+    size_t done = emitBx(OpCode::JMPF, trips, 0);
+    emitBx(OpCode::JMP, 0, start);
+    patchJump(skip);
+    patchJump(done);
+
+    for (size_t jump : m_break_jumps.back())
+    {
+        patchJump(jump);
+    }
+    m_break_jumps.pop_back();
+}
+
+void BytecodeCompiler::visitPrintStmt(const PrintStmt& stmt)
+{
+    std::string expr_type = isFloat(*stmt.expression) ? "float" : "int";
+    if (auto lit_expr = dynamic_cast<const LiteralExpr*>(stmt.expression.get()))
+    {
+        if (lit_expr->value.type == TokenType::STRING_LITERAL) expr_type = "string";
+        else if (lit_expr->value.type == TokenType::BOOL_LITERAL) expr_type = "bool";
+    }
+    else if (auto var_expr = dynamic_cast<const VariableExpr*>(stmt.expression.get()))
+    {
+        BytecodeVariable* var = findScalar(var_expr->name.text);
+        if (var)
+        {
+            expr_type = var->type;
+        }
+        else
+        {
+            throw std::runtime_error("Undeclared variable '" + var_expr->name.text + "' in print statement.");
+        }
+    }
+    else if (auto index_expr = dynamic_cast<const IndexExpr*>(stmt.expression.get()))
+    {
+        expr_type = findArray(index_expr->array).type;
+    }
+    else if (auto entry_expr = dynamic_cast<const EntryExpr*>(stmt.expression.get()))
+    {
+        expr_type = findMap(entry_expr->map).type;
+    }
+    else if (isString(*stmt.expression))
+    {
+        expr_type = "string";
+    }
+
+    // The strings built for the print are dropped once it is done, unless one was stored.
+    StringScanner scanner;
+    stmt.expression->accept(scanner);
+    bool reset = (scanner.builds || yieldsString(scanner.callees)) && !scanner.stores;
+    int mark = m_next_register;
+    uint16_t arena = 0;
+    if (reset)
+    {
+        arena = allocateRegister();
+        emit(OpCode::MARK, arena);
+    }
+    uint16_t value = operand(*stmt.expression, false);
+    emit(expr_type == "string" ? OpCode::PRINTS : expr_type == "float" ? OpCode::PRINTF : OpCode::PRINTI, value);
+    if (reset)
+    {
+        emit(OpCode::RESET, arena);
+    }
+    m_next_register = mark;
+}
+
+void BytecodeCompiler::visitNewlineStmt(const NewlineStmt& /*stmt*/)
+{
+    emit(OpCode::NEWLINE);
+}
+
+void BytecodeCompiler::visitDeclarationStmt(const DeclarationStmt& stmt)
+{
+    if (m_variables.count(stmt.name.text))
+    {
+        throw std::runtime_error("Variable '" + stmt.name.text + "' already declared in this scope.");
+    }
+    if (!stmt.key_type.text.empty())
+    {
+        uint16_t reg = allocateRegister();
+        BytecodeVariable map{reg, stmt.type.text};
+        map.key_type = stmt.key_type.text;
+        m_variables[stmt.name.text] = map;
+
+        int mark = m_next_register;
+        uint16_t room = operandAs(*stmt.initializer, "int", false);
+        emit(OpCode::MAPNEW, reg, room, stmt.key_type.text == "string" ? 1 : 0);
+        m_next_register = mark;
+        return;
+    }
+    if (stmt.length != 0)
+    {
+        if (m_program.arrays.size() > UINT16_MAX)
+        {
+            throw std::runtime_error("Too many arrays in the story.");
+        }
+        BytecodeVariable array{0, stmt.type.text, stmt.length, static_cast<uint32_t>(m_program.arrays.size())};
+        m_program.arrays.push_back({m_array_words, stmt.length});
+        m_array_words += stmt.length;
+        m_variables[stmt.name.text] = array;
+
+        int mark = m_next_register;
+        uint16_t value = allocateRegister();
+        compileAs(*stmt.initializer, stmt.type.text, value);
+        emitNarrow(stmt.type.text, value);
+        emitBx(OpCode::FILL, value, static_cast<int32_t>(array.array));
+        m_next_register = mark;
+        return;
+    }
+    uint16_t reg = allocateRegister();
+    m_variables[stmt.name.text] = {reg, stmt.type.text};
+
+    int mark = m_next_register;
+    compileAs(*stmt.initializer, stmt.type.text, reg);
+    emitNarrow(stmt.type.text, reg);
+    m_next_register = mark;
+}
+
+void BytecodeCompiler::visitExpressionStmt(const ExpressionStmt& stmt)
+{
+    int mark = m_next_register;
+    compileInto(*stmt.expression, allocateRegister());
+    m_next_register = mark;
+}
+
+void BytecodeCompiler::visitReturnStmt(const ReturnStmt& stmt)
+{
+    int mark = m_next_register;
+    uint16_t value = operandAs(*stmt.value, m_return_type, false);
+    if (m_in_procedure)
+    {
+        emitReturn(value);
+    }
+    else
+    {
+        emit(OpCode::HALT, value);
+    }
+    m_next_register = mark;
+}
+
+void BytecodeCompiler::visitBreakStmt(const BreakStmt& /*stmt*/)
+{
+    if (m_break_jumps.empty())
+    {
+        throw std::runtime_error("'the story ends at this moment' can only be used inside a loop.");
+    }
+    m_break_jumps.back().push_back(emitBx(OpCode::JMP, 0, 0));
+}
+
+void BytecodeCompiler::visitImportStmt(const ImportStmt& /*stmt*/)
+{
+    throw std::runtime_error("'the story recalls' is only allowed at the top level of a module.");
+}
+
+void BytecodeCompiler::visitAssignExpr(const AssignExpr& expr)
+{
+    BytecodeVariable* var = findScalar(expr.name.text);
+    if (!var)
+    {
+        throw std::runtime_error("Undeclared variable '" + expr.name.text + "'.");
+    }
+    uint16_t target = m_target;
+    compileAs(*expr.value, var->type, var->reg);
+    emitNarrow(var->type, var->reg);
+    if (target != var->reg)
+    {
+        emit(OpCode::MOV, target, var->reg);
+    }
+}
+
+void BytecodeCompiler::visitBinaryExpr(const BinaryExpr& expr)
+{
+    if (isFloat(expr))
+    {
+        OpCode op;
+        if (expr.op.text == "plus") op = OpCode::FADD;
+        else if (expr.op.text == "minus") op = OpCode::FSUB;
+        else if (expr.op.text == "multiplied") op = OpCode::FMUL;
+        else op = OpCode::FDIV;
+
+        uint16_t target = m_target;
+        int mark = m_next_register;
+        uint16_t left = operandAs(*expr.left, "float", containsAssignment(*expr.right));
+        uint16_t right = operandAs(*expr.right, "float", false);
+        emit(op, target, left, right);
+        m_next_register = mark;
+        return;
+    }
+
+    OpCode op;
+    if (expr.op.text == "plus") op = OpCode::ADD;
+    else if (expr.op.text == "minus") op = OpCode::SUB;
+    else if (expr.op.text == "multiplied") op = OpCode::MUL;
+    else if (expr.op.text == "divided") op = OpCode::DIV;
+    else if (expr.op.text == "and") op = OpCode::AND;
+    else if (expr.op.text == "or") op = OpCode::OR;
+    else throw std::runtime_error("Unsupported binary operator '" + expr.op.text + "'.");
+
+    uint16_t target = m_target;
+    int mark = m_next_register;
+    uint16_t left = operandAs(*expr.left, "int", containsAssignment(*expr.right));
+    uint16_t right = operandAs(*expr.right, "int", false);
+    emit(op, target, left, right);
+    m_next_register = mark;
+}
+
+void BytecodeCompiler::visitComparisonExpr(const ComparisonExpr& expr)
+{
+    if (isString(*expr.left) || isString(*expr.right) || expr.op.text == "starts with" || expr.op.text == "contains")
+    {
+        if (!isString(*expr.left) || !isString(*expr.right) || expr.op.text == "is greater than" || expr.op.text == "is less than")
+        {
+            throw std::runtime_error("Strings are compared only with strings, by 'is equal to', 'starts with' or 'contains'.");
+        }
+        OpCode op = expr.op.text == "is equal to" ? OpCode::STREQ : expr.op.text == "starts with" ? OpCode::STARTS : OpCode::CONTAINS;
+        uint16_t target = m_target;
+        int mark = m_next_register;
+        uint16_t left = operand(*expr.left, containsAssignment(*expr.right));
+        uint16_t right = operand(*expr.right, false);
+        emit(op, target, left, right);
+        m_next_register = mark;
+        return;
+    }
+
+    bool floats = isFloat(*expr.left) || isFloat(*expr.right);
+    OpCode op;
+    if (expr.op.text == "is equal to") op = floats ? OpCode::FEQ : OpCode::EQ;
+    else if (expr.op.text == "is greater than") op = floats ? OpCode::FGT : OpCode::GT;
+    else if (expr.op.text == "is less than") op = floats ? OpCode::FLT : OpCode::LT;
+    else throw std::runtime_error("Unsupported comparison operator.");
+
+    uint16_t target = m_target;
+    int mark = m_next_register;
+    std::string type = floats ? "float" : "int";
+    uint16_t left = operandAs(*expr.left, type, containsAssignment(*expr.right));
+    uint16_t right = operandAs(*expr.right, type, false);
+    emit(op, target, left, right);
+    m_next_register = mark;
+}
+
+void BytecodeCompiler::visitUnaryExpr(const UnaryExpr& expr)
+{
+    uint16_t target = m_target;
+    int mark = m_next_register;
+    uint16_t value = operandAs(*expr.right, "int", false);
+    if (expr.op.text == "not")
+    {
+        emit(OpCode::NOT, target, value);
+    }
+    else if (value != target)
+    {
+        emit(OpCode::MOV, target, value);
+    }
+    m_next_register = mark;
+}
+
+void BytecodeCompiler::visitFunctionCallExpr(const FunctionCallExpr& expr)
+{
+    compileCall(expr.callee_name, expr.arguments, m_target);
+}
+
+void BytecodeCompiler::visitLiteralExpr(const LiteralExpr& expr)
+{
+    if (expr.value.type == TokenType::STRING_LITERAL)
+    {
+        auto it = m_string_indices.find(expr.value.literal_value);
+        uint16_t index;
+        if (it == m_string_indices.end())
+        {
+            index = static_cast<uint16_t>(m_program.strings.size());
+            m_string_indices[expr.value.literal_value] = index;
+            m_program.strings.push_back(expr.value.literal_value);
+        }
+        else
+        {
+            index = it->second;
+        }
+        emitBx(OpCode::LOADS, m_target, index);
+        return;
+    }
+
+    int64_t value = 0;
+    if (expr.value.type == TokenType::INT_LITERAL)
+    {
+        value = static_cast<int64_t>(std::stoull(expr.value.literal_value));
+    }
+    else if (expr.value.type == TokenType::BOOL_LITERAL)
+    {
+        value = expr.value.text == "true" ? 1 : 0;
+    }
+    else if (expr.value.type == TokenType::FLOAT_LITERAL)
+    {
+        double number = std::strtod(expr.value.literal_value.c_str(), nullptr);
+        std::memcpy(&value, &number, sizeof(value));
+    }
+
+    if (value >= INT32_MIN && value <= INT32_MAX)
+    {
+        emitBx(OpCode::LOADI, m_target, static_cast<int32_t>(value));
+    }
+    else
+    {
+        emitBx(OpCode::LOADK, m_target, static_cast<int32_t>(m_program.constants.size()));
+        m_program.constants.push_back(value);
+    }
+}
+
+void BytecodeCompiler::visitVariableExpr(const VariableExpr& expr)
+{
+    BytecodeVariable* var = findScalar(expr.name.text);
+    if (!var)
+    {
+        throw std::runtime_error("Undeclared variable '" + expr.name.text + "'.");
+    }
+    if (var->reg != m_target)
+    {
+        emit(OpCode::MOV, m_target, var->reg);
+    }
+}
+
+void BytecodeCompiler::visitIndexExpr(const IndexExpr& expr)
+{
+    const BytecodeVariable& array = findArray(expr.array);
+    uint16_t target = m_target;
+    int mark = m_next_register;
+    uint16_t index = operandAs(*expr.index, "int", false);
+    emit(OpCode::LOADX, target, static_cast<uint16_t>(array.array), index);
+    m_next_register = mark;
+}
+
+void BytecodeCompiler::visitIndexAssignExpr(const IndexAssignExpr& expr)
+{
+    const BytecodeVariable& array = findArray(expr.array);
+    uint16_t target = m_target;
+    int mark = m_next_register;
+    uint16_t index = operandAs(*expr.index, "int", containsAssignment(*expr.value));
+    if (index == target)
+    {
+        index = allocateRegister();
+        emit(OpCode::MOV, index, target);
+    }
+    compileAs(*expr.value, array.type, target);
+    emitNarrow(array.type, target);
+    emit(OpCode::STOREX, target, static_cast<uint16_t>(array.array), index);
+    m_next_register = mark;
+}
+
+void BytecodeCompiler::visitLengthExpr(const LengthExpr& expr)
+{
+    uint64_t length = findArray(expr.array).length;
+    emitBx(OpCode::LOADI, m_target, static_cast<int32_t>(length));
+}
+
+void BytecodeCompiler::compileEntry(OpCode op, const Token& map, const Expr& key)
+{
+    const BytecodeVariable& table = findMap(map);
+    uint16_t target = m_target;
+    int mark = m_next_register;
+    uint16_t reg = operandAs(key, table.key_type, false);
+    emit(op, target, table.reg, reg);
+    m_next_register = mark;
+}
+
+void BytecodeCompiler::visitEntryExpr(const EntryExpr& expr)
+{
+    compileEntry(OpCode::MAPGET, expr.map, *expr.key);
+}
+
+void BytecodeCompiler::visitEntryAssignExpr(const EntryAssignExpr& expr)
+{
+    const BytecodeVariable& table = findMap(expr.map);
+    uint16_t target = m_target;
+    int mark = m_next_register;
+    uint16_t key = operandAs(*expr.key, table.key_type, containsAssignment(*expr.value));
+    if (key == target)
+    {
+        key = allocateRegister();
+        emit(OpCode::MOV, key, target);
+    }
+    compileAs(*expr.value, table.type, target);
+    emitNarrow(table.type, target);
+    emit(OpCode::MAPSET, target, table.reg, key);
+    m_next_register = mark;
+}
+
+void BytecodeCompiler::visitHasEntryExpr(const HasEntryExpr& expr)
+{
+    compileEntry(OpCode::MAPHAS, expr.map, *expr.key);
+}
+
+void BytecodeCompiler::visitJoinExpr(const JoinExpr& expr)
+{
+    if (!isString(*expr.left) || !isString(*expr.right))
+    {
+        throw std::runtime_error("'followed by' joins strings; write 'the text of' before a number to join its digits.");
+    }
+    uint16_t target = m_target;
+    int mark = m_next_register;
+    uint16_t left = operand(*expr.left, containsAssignment(*expr.right));
+    uint16_t right = operand(*expr.right, false);
+    emit(OpCode::JOIN, target, left, right);
+    m_next_register = mark;
+}
+
+void BytecodeCompiler::visitTextExpr(const TextExpr& expr)
+{
+    if (isString(*expr.value) || isFloat(*expr.value))
+    {
+        throw std::runtime_error("'the text of' takes an integer.");
+    }
+    uint16_t target = m_target;
+    int mark = m_next_register;
+    uint16_t value = operand(*expr.value, false);
+    emit(OpCode::TEXT, target, value);
+    m_next_register = mark;
+}
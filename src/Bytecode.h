@@ -0,0 +1,210 @@
+#pragma once
+
+#include "AST.h"
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+enum class OpCode : uint8_t
+{
+    LOADI,
+    LOADK,
+    LOADS,
+    MOV,
+    ADD,
+    SUB,
+    MUL,
+    DIV,
+    AND,
+    OR,
+    EQ,
+    LT,
+    GT,
+    NOT,
+    JMP,
+    JMPF,
+    PRINTI,
+    PRINTS,
+    NEWLINE,
+    CALL,
+    RET,
+    FILL,
+    LOADX,
+    STOREX,
+    // NARROW a, b brings R[a] to the value a variable b bytes wide holds; b is 0 for a bool.
+    // Only the values are narrowed: every variable still has a whole register.
+    NARROW,
+    // Floats are kept in the registers as the bits of a double. ITOF a, b and FTOI a, b convert
+    // R[b], FTOI truncating toward zero and giving INT64_MIN for NaN and values out of range,
+    // as cvttsd2si does.
+    FADD,
+    FSUB,
+    FMUL,
+    FDIV,
+    FEQ,
+    FLT,
+    FGT,
+    ITOF,
+    FTOI,
+    PRINTF,
+    // Maps are held in a register as a pointer to their MapTable. MAPNEW a, b, c makes an empty
+    // one with room for R[b] entries, keyed by strings if c is 1; MAPGET a, b, c reads the entry
+    // for key R[c] of map R[b] into R[a], MAPSET a, b, c writes R[a] to it, adding it if needed,
+    // and MAPHAS a, b, c sets R[a] to whether there is one.
+    MAPNEW,
+    MAPGET,
+    MAPSET,
+    MAPHAS,
+    // Strings are held in a register as a pointer to their text; LOADS a, bx loads the program's
+    // string bx. JOIN a, b, c sets R[a] to a new string holding R[b] then R[c], and TEXT a, b to
+    // the digits of R[b]. MARK a saves the position of the string arena in R[a] and RESET a drops
+    // every string built since. STREQ a, b, c sets R[a] to 1 if R[b] and R[c] hold the same text,
+    // STARTS if R[b] starts with R[c] and CONTAINS if R[c] is found in R[b], and to 0 otherwise.
+    JOIN,
+    TEXT,
+    MARK,
+    RESET,
+    STREQ,
+    STARTS,
+    CONTAINS,
+    HALT,
+};
+
+// Every instruction is 8 bytes: an opcode and three 16-bit register operands. Jumps, constant
+// and string indices use b and c together as one 32-bit operand.
+struct Instruction
+{
+    OpCode op;
+    uint8_t unused = 0;
+    uint16_t a = 0;
+    uint16_t b = 0;
+    uint16_t c = 0;
+
+    int32_t bx() const
+    {
+        return static_cast<int32_t>(static_cast<uint32_t>(b) | (static_cast<uint32_t>(c) << 16));
+    }
+    void setBx(int32_t value)
+    {
+        b = static_cast<uint16_t>(static_cast<uint32_t>(value) & 0xFFFF);
+        c = static_cast<uint16_t>(static_cast<uint32_t>(value) >> 16);
+    }
+};
+
+static_assert(sizeof(Instruction) == 8, "Instructions must stay fixed-width.");
+
+struct BytecodeFunction
+{
+    std::string name;
+    uint16_t params = 0;
+    uint16_t registers = 0;
+    uint32_t entry = 0;
+    // Elements of the arrays the function declares, kept apart from its registers.
+    uint64_t array_words = 0;
+};
+
+// An array's place among its function's elements. FILL a, bx sets every element to R[a];
+// LOADX a, b, c and STOREX a, b, c read element R[c] of array b into R[a] and write R[a] to it.
+struct BytecodeArray
+{
+    uint64_t offset;
+    uint64_t length;
+};
+
+struct BytecodeProgram
+{
+    std::vector<Instruction> code;
+    std::vector<int64_t> constants;
+    std::vector<std::string> strings;
+    std::vector<BytecodeArray> arrays;
+    // functions[0] is the main program.
+    std::vector<BytecodeFunction> functions;
+};
+
+struct BytecodeVariable
+{
+    uint16_t reg;
+    std::string type;
+    // Arrays: the number of elements and the index into BytecodeProgram::arrays.
+    uint64_t length = 0;
+    uint32_t array = 0;
+    // Maps: the type of their keys; `type` is that of their values.
+    std::string key_type;
+};
+
+class BytecodeCompiler : public ExprVisitor, public StmtVisitor
+{
+public:
+    BytecodeProgram compile(const std::vector<std::unique_ptr<Stmt>>& statements);
+
+    void visitBinaryExpr(const BinaryExpr& expr) override;
+    void visitComparisonExpr(const ComparisonExpr& expr) override;
+    void visitLiteralExpr(const LiteralExpr& expr) override;
+    void visitVariableExpr(const VariableExpr& expr) override;
+    void visitAssignExpr(const AssignExpr& expr) override;
+    void visitFunctionCallExpr(const FunctionCallExpr& expr) override;
+    void visitUnaryExpr(const UnaryExpr& expr) override;
+    void visitIndexExpr(const IndexExpr& expr) override;
+    void visitIndexAssignExpr(const IndexAssignExpr& expr) override;
+    void visitLengthExpr(const LengthExpr& expr) override;
+    void visitEntryExpr(const EntryExpr& expr) override;
+    void visitEntryAssignExpr(const EntryAssignExpr& expr) override;
+    void visitHasEntryExpr(const HasEntryExpr& expr) override;
+    void visitJoinExpr(const JoinExpr& expr) override;
+    void visitTextExpr(const TextExpr& expr) override;
+
+    void visitDeclarationStmt(const DeclarationStmt& stmt) override;
+    void visitExpressionStmt(const ExpressionStmt& stmt) override;
+    void visitIfStmt(const IfStmt& stmt) override;
+    void visitWhileStmt(const WhileStmt& stmt) override;
+    void visitForStmt(const ForStmt& stmt) override;
+    void visitBlockStmt(const BlockStmt& stmt) override;
+    void visitPrintStmt(const PrintStmt& stmt) override;
+    void visitNewlineStmt(const NewlineStmt& stmt) override;
+    void visitProcedureDeclStmt(const ProcedureDeclStmt& stmt) override;
+    void visitProcedureCallStmt(const ProcedureCallStmt& stmt) override;
+    void visitReturnStmt(const ReturnStmt& stmt) override;
+    void visitBreakStmt(const BreakStmt& stmt) override;
+    void visitImportStmt(const ImportStmt& stmt) override;
+
+private:
+    BytecodeProgram m_program;
+    std::unordered_map<std::string, uint16_t> m_function_indices;
+    std::unordered_map<std::string, const ProcedureDeclStmt*> m_procedures;
+    std::unordered_map<std::string, uint16_t> m_string_indices;
+    std::unordered_map<std::string, BytecodeVariable> m_variables;
+    std::vector<std::vector<size_t>> m_break_jumps;
+    uint16_t m_function = 0;
+    int m_next_register = 0;
+    int m_max_registers = 0;
+    uint64_t m_array_words = 0;
+    uint16_t m_target = 0;
+    bool m_in_procedure = false;
+    std::string m_return_type = "int";
+    // The register holding the string arena's position when the procedure was entered, which
+    // every return resets it to; -1 if the procedure leaves the arena alone.
+    int m_string_mark = -1;
+
+    size_t emit(OpCode op, uint16_t a = 0, uint16_t b = 0, uint16_t c = 0);
+    size_t emitBx(OpCode op, uint16_t a, int32_t bx);
+    void emitNarrow(const std::string& type, uint16_t reg);
+    void patchJump(size_t at);
+    uint16_t allocateRegister();
+    void compileInto(const Expr& expr, uint16_t target);
+    uint16_t operand(const Expr& expr, bool copy);
+    bool isFloat(const Expr& expr);
+    bool isString(const Expr& expr);
+    bool buildsStrings(const Stmt& stmt);
+    bool yieldsString(const std::vector<std::string>& procedures) const;
+    void emitReturn(uint16_t value);
+    void compileAs(const Expr& expr, const std::string& type, uint16_t target);
+    uint16_t operandAs(const Expr& expr, const std::string& type, bool copy);
+    void compileCall(const Token& callee, const std::vector<std::unique_ptr<Expr>>& arguments, uint16_t target);
+    void compileProcedure(const ProcedureDeclStmt& stmt);
+    BytecodeVariable* findVariable(const std::string& name);
+    BytecodeVariable* findScalar(const std::string& name);
+    const BytecodeVariable& findArray(const Token& name);
+    const BytecodeVariable& findMap(const Token& name);
+    void compileEntry(OpCode op, const Token& map, const Expr& key);
+};
@@ -1,9 +1,80 @@
 #include "CodeGenerator.h"
+#include "MapTable.h"
+#include "StringArena.h"
+#include "ThreadPool.h"
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <sstream>
+#include <unordered_set>
 
+// Trip counters of counted loops, outermost first. Callee-saved, so calls in a loop body leave
+// them alone; the runtime helpers only touch them in the exit-time profile writers. Loops nested
+// deeper count in a frame word of their own.
+static const int COUNTER_REGISTER_COUNT = 4;
+static const char* const COUNTER_REGISTERS[COUNTER_REGISTER_COUNT] = {"r12", "r13", "r14", "r15"};
+
+// Words an array takes: one bit per element of a bool array, the type's width per element of
+// any other.
+static uint64_t arrayWords(const std::string& type, uint64_t length)
+{
+    if (type == "bool")
+    {
+        return (length + 63) / 64;
+    }
+    return (length * typeWidth(type) + 7) / 8;
+}
+
+static std::string sizeKeyword(int width)
+{
+    return width == 1 ? "byte" : width == 2 ? "word" : width == 4 ? "dword" : "qword";
+}
+
+// The part of a 64-bit register that holds the low `width` bytes (rax and the argument registers).
+static std::string subRegister(const std::string& reg, int width)
+{
+    static const std::unordered_map<std::string, std::vector<std::string>> names = {
+        {"rax", {"al", "ax", "eax"}}, {"rdi", {"dil", "di", "edi"}}, {"rsi", {"sil", "si", "esi"}},
+        {"rdx", {"dl", "dx", "edx"}}, {"rcx", {"cl", "cx", "ecx"}}, {"r8", {"r8b", "r8w", "r8d"}},
+        {"r9", {"r9b", "r9w", "r9d"}},
+    };
+    return width == 8 ? reg : names.at(reg)[width == 1 ? 0 : width == 2 ? 1 : 2];
+}
+
+// Loads a value of the type from `address` into rax, widening it to 64 bits, or a float into xmm0.
+static std::string loadInstruction(const std::string& type, const std::string& address)
+{
+    int width = typeWidth(type);
+    if (type == "float")
+    {
+        return "movsd xmm0, " + address;
+    }
+    if (type == "bool")
+    {
+        return "movzx eax, byte " + address;
+    }
+    if (width == 4)
+    {
+        return "movsxd rax, dword " + address;
+    }
+    if (width < 4)
+    {
+        return "movsx rax, " + sizeKeyword(width) + " " + address;
+    }
+    return "mov rax, " + address;
+}
+
+// Counts the frame words of a scope: `count` full words, and the variables narrower than a word
+// by width (1, 2 and 4 bytes), which share words with others of their width.
 class StackSizeCalculator : public StmtVisitor
 {
 public:
     int count = 0;
+    int packed[3] = {0, 0, 0};
+    // How many counted loops the statement being counted is in.
+    int depth = 0;
 
     void calculate(const std::vector<std::unique_ptr<Stmt>>& statements) 
     { 
@@ -16,18 +87,61 @@ public:
     { 
         stmt.accept(*this); 
     }
-    void visitDeclarationStmt(const DeclarationStmt& /*stmt*/) override 
+    void add(const std::string& type) 
+    { 
+        int width = typeWidth(type);
+        if (width == 8)
+        {
+            count++;
+        }
+        else
+        {
+            packed[width / 2]++;
+        }
+    }
+    int words() const 
+    { 
+        return count + (packed[0] + 7) / 8 + (packed[1] + 3) / 4 + (packed[2] + 1) / 2; 
+    }
+    // Off for the main program, whose arrays are not kept in the frame.
+    bool frame_arrays = true;
+
+    void visitDeclarationStmt(const DeclarationStmt& stmt) override 
     { 
-        count++; 
+        if (!stmt.key_type.text.empty())
+        {
+            count++;
+        }
+        else if (stmt.length == 0)
+        {
+            add(stmt.type.text);
+        }
+        else if (frame_arrays)
+        {
+            count += arrayWords(stmt.type.text, stmt.length);
+        }
     }
     void visitIfStmt(const IfStmt& stmt) override 
     { 
         stmt.then_branch->accept(*this); 
+        if (stmt.else_branch)
+        {
+            stmt.else_branch->accept(*this);
+        }
     }
     void visitWhileStmt(const WhileStmt& stmt) override 
     { 
         stmt.body->accept(*this); 
     }
+    void visitForStmt(const ForStmt& stmt) override 
+    { 
+        // The counted value and the trip count, and the trip counter of a loop nested too deep
+        // to keep it in a register.
+        count += depth < COUNTER_REGISTER_COUNT ? 2 : 3; 
+        depth++;
+        stmt.body->accept(*this); 
+        depth--;
+    }
     void visitBlockStmt(const BlockStmt& stmt) override 
     { 
         for(const auto& s : stmt.statements) 
@@ -42,356 +156,4551 @@ public:
     void visitProcedureCallStmt(const ProcedureCallStmt& /*stmt*/) override {}
     void visitReturnStmt(const ReturnStmt& /*stmt*/) override {}
     void visitBreakStmt(const BreakStmt& /*stmt*/) override {}
+    void visitImportStmt(const ImportStmt& /*stmt*/) override {}
 };
 
-class StringFinder : public StmtVisitor, public ExprVisitor 
+// Sizes up the statements of a scope or loop body: how deeply counted loops nest, how many
+// statements there are, and whether any of them declares something, which rules out emitting
+// the statements more than once.
+class LoopScanner : public StmtVisitor
 {
 public:
-    std::vector<std::string> string_literals;
+    int depth = 0;
+    int max_depth = 0;
+    int statements = 0;
+    bool declares = false;
 
-    void find(const std::vector<std::unique_ptr<Stmt>>& statements) 
-    {
-        for (const auto& stmt : statements) 
+    void visitDeclarationStmt(const DeclarationStmt& /*stmt*/) override 
+    { 
+        statements++; 
+        declares = true; 
+    }
+    void visitIfStmt(const IfStmt& stmt) override 
+    { 
+        statements++; 
+        stmt.then_branch->accept(*this); 
+        if (stmt.else_branch)
         {
-            stmt->accept(*this);
+            stmt.else_branch->accept(*this);
         }
     }
-
-    void visitPrintStmt(const PrintStmt& stmt) override 
+    void visitWhileStmt(const WhileStmt& stmt) override 
     { 
-        stmt.expression->accept(*this); 
+        statements++; 
+        stmt.body->accept(*this); 
     }
-    void visitDeclarationStmt(const DeclarationStmt& stmt) override 
+    void visitForStmt(const ForStmt& stmt) override 
     { 
-        stmt.initializer->accept(*this); 
+        statements++; 
+        depth++;
+        max_depth = std::max(max_depth, depth);
+        stmt.body->accept(*this); 
+        depth--;
     }
-    void visitExpressionStmt(const ExpressionStmt& stmt) override 
+    void visitBlockStmt(const BlockStmt& stmt) override 
     { 
-        stmt.expression->accept(*this); 
+        for (const auto& s : stmt.statements) 
+        {
+            s->accept(*this); 
+        }
     }
-    void visitIfStmt(const IfStmt& stmt) override 
+    void visitProcedureDeclStmt(const ProcedureDeclStmt& /*stmt*/) override 
     { 
-        stmt.condition->accept(*this); stmt.then_branch->accept(*this); 
+        statements++; 
+        declares = true; 
     }
-    void visitWhileStmt(const WhileStmt& stmt) override 
+    void visitExpressionStmt(const ExpressionStmt& /*stmt*/) override 
     { 
-        stmt.condition->accept(*this); stmt.body->accept(*this); 
+        statements++; 
     }
-    void visitBlockStmt(const BlockStmt& stmt) override 
+    void visitPrintStmt(const PrintStmt& /*stmt*/) override 
     { 
-        for(const auto& s : stmt.statements)
-        { 
-            s->accept(*this);
-        } 
+        statements++; 
     }
-    void visitNewlineStmt(const NewlineStmt& /*stmt*/) override {}
-    void visitProcedureDeclStmt(const ProcedureDeclStmt& stmt) override 
+    void visitNewlineStmt(const NewlineStmt& /*stmt*/) override 
     { 
-        stmt.body->accept(*this); 
+        statements++; 
     }
-    void visitProcedureCallStmt(const ProcedureCallStmt& stmt) override 
+    void visitProcedureCallStmt(const ProcedureCallStmt& /*stmt*/) override 
+    { 
+        statements++; 
+    }
+    void visitReturnStmt(const ReturnStmt& /*stmt*/) override 
+    { 
+        statements++; 
+    }
+    void visitBreakStmt(const BreakStmt& /*stmt*/) override 
+    { 
+        statements++; 
+    }
+    void visitImportStmt(const ImportStmt& /*stmt*/) override 
+    { 
+        statements++; 
+    }
+};
+
+// Finds whether code builds strings itself or stores values anywhere, and the procedures it
+// calls, which may build strings too.
+class StringScanner : public StmtVisitor, public ExprVisitor
+{
+public:
+    bool builds = false;
+    bool stores = false;
+    std::vector<std::string> callees;
+
+    void visitDeclarationStmt(const DeclarationStmt& stmt) override
     {
-        for(const auto& arg : stmt.arguments) 
+        stmt.initializer->accept(*this);
+    }
+    void visitExpressionStmt(const ExpressionStmt& stmt) override
+    {
+        stmt.expression->accept(*this);
+    }
+    void visitIfStmt(const IfStmt& stmt) override
+    {
+        stmt.condition->accept(*this);
+        stmt.then_branch->accept(*this);
+        if (stmt.else_branch)
         {
-            arg->accept(*this);
+            stmt.else_branch->accept(*this);
         }
     }
-    void visitReturnStmt(const ReturnStmt& stmt) override 
+    void visitWhileStmt(const WhileStmt& stmt) override
     {
-        stmt.value->accept(*this);
+        stmt.condition->accept(*this);
+        stmt.body->accept(*this);
     }
-    void visitBreakStmt(const BreakStmt& /*stmt*/) override {}
-
-    void visitLiteralExpr(const LiteralExpr& expr) override 
+    void visitForStmt(const ForStmt& stmt) override
     {
-        if (expr.value.type == TokenType::STRING_LITERAL) 
+        stmt.first->accept(*this);
+        stmt.last->accept(*this);
+        stmt.body->accept(*this);
+    }
+    void visitBlockStmt(const BlockStmt& stmt) override
+    {
+        for (const auto& s : stmt.statements)
         {
-            if (std::find(string_literals.begin(), string_literals.end(), expr.value.literal_value) == string_literals.end()) 
-            {
-                string_literals.push_back(expr.value.literal_value);
-            }
+            s->accept(*this);
         }
     }
-    void visitBinaryExpr(const BinaryExpr& expr) override 
-    { 
-        expr.left->accept(*this); 
-        expr.right->accept(*this); 
+    void visitPrintStmt(const PrintStmt& stmt) override
+    {
+        stmt.expression->accept(*this);
     }
-    void visitComparisonExpr(const ComparisonExpr& expr) override 
-    { 
-        expr.left->accept(*this); 
-        expr.right->accept(*this); 
+    void visitNewlineStmt(const NewlineStmt& /*stmt*/) override {}
+    void visitProcedureDeclStmt(const ProcedureDeclStmt& /*stmt*/) override {}
+    void visitProcedureCallStmt(const ProcedureCallStmt& stmt) override
+    {
+        call(stmt.callee_name.text, stmt.arguments);
+    }
+    void visitReturnStmt(const ReturnStmt& stmt) override
+    {
+        stmt.value->accept(*this);
+    }
+    void visitBreakStmt(const BreakStmt& /*stmt*/) override {}
+    void visitImportStmt(const ImportStmt& /*stmt*/) override {}
+
+    void visitBinaryExpr(const BinaryExpr& expr) override
+    {
+        expr.left->accept(*this);
+        expr.right->accept(*this);
+    }
+    void visitComparisonExpr(const ComparisonExpr& expr) override
+    {
+        expr.left->accept(*this);
+        expr.right->accept(*this);
     }
+    void visitLiteralExpr(const LiteralExpr& /*expr*/) override {}
     void visitVariableExpr(const VariableExpr& /*expr*/) override {}
-    void visitAssignExpr(const AssignExpr& expr) override 
-    { 
-        expr.value->accept(*this); 
+    void visitAssignExpr(const AssignExpr& expr) override
+    {
+        stores = true;
+        expr.value->accept(*this);
     }
-    void visitFunctionCallExpr(const FunctionCallExpr& expr) override 
+    void visitFunctionCallExpr(const FunctionCallExpr& expr) override
     {
-        for (const auto& arg : expr.arguments) 
-        {
-            arg->accept(*this);
-        }
+        call(expr.callee_name.text, expr.arguments);
     }
-    void visitUnaryExpr(const UnaryExpr& expr) override 
+    void visitUnaryExpr(const UnaryExpr& expr) override
     {
         expr.right->accept(*this);
     }
-};
-
-void CodeGenerator::emit(const std::string& code) 
-{ 
-    std::cout << "    " << code << std::endl; 
-}
-void CodeGenerator::emitLabel(const std::string& label) 
-{ 
-    std::cout << label << ":" << std::endl; 
-}
-std::string CodeGenerator::newLabel() 
-{ 
-    return "L" + std::to_string(m_label_counter++); 
-}
-
-void CodeGenerator::enterScope() 
-{
-    m_scope_level++;
-    m_symbol_scopes.emplace_back();
-}
-
-void CodeGenerator::exitScope() 
-{
-    m_scope_level--;
-    m_symbol_scopes.pop_back();
-}
+    void visitIndexExpr(const IndexExpr& expr) override
+    {
+        expr.index->accept(*this);
+    }
+    void visitIndexAssignExpr(const IndexAssignExpr& expr) override
+    {
+        stores = true;
+        expr.index->accept(*this);
+        expr.value->accept(*this);
+    }
+    void visitLengthExpr(const LengthExpr& /*expr*/) override {}
+    void visitEntryExpr(const EntryExpr& expr) override
+    {
+        expr.key->accept(*this);
+    }
+    void visitEntryAssignExpr(const EntryAssignExpr& expr) override
+    {
+        stores = true;
+        expr.key->accept(*this);
+        expr.value->accept(*this);
+    }
+    void visitHasEntryExpr(const HasEntryExpr& expr) override
+    {
+        expr.key->accept(*this);
+    }
+    void visitJoinExpr(const JoinExpr& /*expr*/) override
+    {
+        builds = true;
+    }
+    void visitTextExpr(const TextExpr& /*expr*/) override
+    {
+        builds = true;
+    }
 
-VariableInfo* CodeGenerator::findVariable(const std::string& name) 
-{
-    for (int i = m_symbol_scopes.size() - 1; i >= 0; --i) 
+private:
+    void call(const std::string& callee, const std::vector<std::unique_ptr<Expr>>& arguments)
     {
-        if (m_symbol_scopes[i].count(name))
+        callees.push_back(callee);
+        for (const auto& arg : arguments)
         {
-            return &m_symbol_scopes[i].at(name);
+            arg->accept(*this);
         }
     }
+};
 
-    return nullptr;
-}
-
-void CodeGenerator::findStringLiterals(const std::vector<std::unique_ptr<Stmt>>& statements) 
+// Compiles the expression of a counted loop over arrays into code that handles a whole vector of
+// elements per trip, or sets `ok` to false if it cannot. Elements may only be read at the loop's
+// own index, which the loop keeps in rcx; everything else the expression uses is loop-invariant
+// and is broadcast once, before the loop, into registers taken from the top (`setup`). A node's
+// lanes end up in the register numbered by its depth in the expression, or, for an invariant,
+// in that invariant's register. SSE2 has no 64-bit lane compares or multiply, so those are
+// built from 32-bit ones.
+class VectorExprCompiler : public ExprVisitor
 {
-    StringFinder finder;
-    finder.find(statements);
-    m_string_literals = finder.string_literals;
-}
+public:
+    bool ok = true;
+    std::vector<std::string> setup;
+    std::vector<std::string> body;
+    // The shortest array the loop touches; its index range has to lie within it.
+    uint64_t min_length = UINT64_MAX;
 
-void CodeGenerator::generate(const std::vector<std::unique_ptr<Stmt>>& statements) 
-{
-    findStringLiterals(statements);
-    std::cout << "section .rodata" << std::endl;
-    emitLabel("NL");
-    emit("db 10");
-    for (size_t i = 0; i < m_string_literals.size(); ++i) 
-    {
-        std::cout << "  str" << i << ": db `" << m_string_literals[i] << "`, 0" << std::endl;
-    }
-    
-    std::cout << "\nsection .bss" << std::endl;
-    emitLabel("int_buffer");
-    emit("resb 21");
+    VectorExprCompiler(bool avx2, const std::string& index, std::function<VariableInfo*(const std::string&)> find) 
+        : m_avx2(avx2), m_index(index), m_find(find) {}
 
-    std::cout << "\nsection .text" << std::endl;
-    std::cout << "; --- Helper Functions ---" << std::endl;
-    emitLabel("_print_integer");
-    emit("mov rdi, int_buffer + 20"); 
-    emit("mov byte [rdi], 0"); 
-    emit("dec rdi"); 
-    emit("test rax, rax");
-    emit("jns .utoa_loop"); 
-    emit("neg rax"); 
-    emit("mov r11, 1");
-    emitLabel(".utoa_loop");
-    emit("mov rdx, 0"); 
-    emit("mov rbx, 10"); 
-    emit("div rbx"); 
-    emit("add dl, '0'");
-    emit("mov [rdi], dl"); 
-    emit("dec rdi"); 
-    emit("test rax, rax"); 
-    emit("jnz .utoa_loop");
-    emit("cmp r11, 1"); 
-    emit("jne .skip_minus"); 
-    emit("mov byte [rdi], '-'"); 
-    emit("dec rdi");
-    emitLabel(".skip_minus");
-    emit("inc rdi"); 
-    emit("mov rsi, rdi"); 
-    emit("mov rdx, int_buffer + 21"); 
-    emit("sub rdx, rsi");
-    emit("mov rax, 1"); 
-    emit("mov rdi, 1"); 
-    emit("syscall"); 
-    emit("ret");
-    
-    emitLabel("_strlen");
-    emit("xor rcx, rcx");
-    emitLabel(".strlen_loop");
-    emit("cmp byte [rdi + rcx], 0"); 
-    emit("je .strlen_end"); 
-    emit("inc rcx"); 
-    emit("jmp .strlen_loop");
-    emitLabel(".strlen_end");
-    emit("mov rax, rcx"); 
-    emit("ret");
-    
-    std::cout << "\n; --- Procedures ---" << std::endl;
-    for (const auto& stmt : statements) 
+    int lanes() const 
+    { 
+        return m_avx2 ? 4 : 2; 
+    }
+    std::string reg(int n) const 
+    { 
+        return (m_avx2 ? "ymm" : "xmm") + std::to_string(n); 
+    }
+    // Takes the highest free register for a value that lives across the loop.
+    int reserve() 
+    { 
+        return 15 - m_reserved++; 
+    }
+    // The scalar the loop adds into, which the expression may not read.
+    void accumulate(const std::string& name) 
+    { 
+        m_accumulator = name; 
+    }
+    // Compiles the expression into the lowest registers; the result register is returned.
+    int compile(const Expr& expr) 
     {
-        if (auto proc_decl = dynamic_cast<const ProcedureDeclStmt*>(stmt.get())) 
+        m_depth = 0;
+        expr.accept(*this);
+        if (m_highest >= 16 - m_reserved)
         {
-            proc_decl->accept(*this);
+            ok = false;
         }
+        return m_result;
+    }
+    // The address of the element of `array` at the loop index, or "" if it cannot be vectorized.
+    std::string element(const Token& array) 
+    {
+        VariableInfo* var = m_find(array.text);
+        if (!var || var->length == 0 || !isWordInteger(var->type))
+        {
+            ok = false;
+            return "";
+        }
+        min_length = std::min(min_length, var->length);
+        if (var->symbol.empty())
+        {
+            return "[rbp + rcx*8 - " + std::to_string(var->offset + 8) + "]";
+        }
+        static const char* const BASE_REGISTERS[] = {"rbx", "rdx", "rsi", "rdi", "r8", "r9", "r10", "r11"};
+        auto base = m_bases.find(var->symbol);
+        if (base == m_bases.end())
+        {
+            if (m_bases.size() == sizeof(BASE_REGISTERS) / sizeof(BASE_REGISTERS[0]))
+            {
+                ok = false;
+                return "";
+            }
+            base = m_bases.emplace(var->symbol, BASE_REGISTERS[m_bases.size()]).first;
+            setup.push_back("mov " + base->second + ", " + var->symbol);
+        }
+        return "[" + base->second + " + rcx*8 - 8]";
+    }
+    void load(int d, const std::string& address) 
+    {
+        body.push_back((m_avx2 ? "vmovdqu " : "movdqu ") + reg(d) + ", " + address);
+    }
+    void store(const std::string& address, int r) 
+    {
+        body.push_back((m_avx2 ? "vmovdqu " : "movdqu ") + address + ", " + reg(r));
+    }
+    // d = a <op> b. SSE2 instructions overwrite their first operand, so a is copied to d first.
+    void op(std::vector<std::string>& code, const std::string& name, int d, int a, int b) 
+    {
+        if (m_avx2)
+        {
+            code.push_back("v" + name + " " + reg(d) + ", " + reg(a) + ", " + reg(b));
+            return;
+        }
+        if (d != a)
+        {
+            code.push_back("movdqa " + reg(d) + ", " + reg(a));
+        }
+        code.push_back(name + " " + reg(d) + ", " + reg(b));
+    }
+    void op(const std::string& name, int d, int a, int b) 
+    { 
+        op(body, name, d, a, b); 
+    }
+    void shift(std::vector<std::string>& code, const std::string& name, int d, int a, int bits) 
+    {
+        if (m_avx2)
+        {
+            code.push_back("v" + name + " " + reg(d) + ", " + reg(a) + ", " + std::to_string(bits));
+            return;
+        }
+        if (d != a)
+        {
+            code.push_back("movdqa " + reg(d) + ", " + reg(a));
+        }
+        code.push_back(name + " " + reg(d) + ", " + std::to_string(bits));
+    }
+    void shift(const std::string& name, int d, int a, int bits) 
+    { 
+        shift(body, name, d, a, bits); 
+    }
+    // 'shuffle' only has the three operand form, with or without VEX.
+    void shuffle(int d, int a, int order) 
+    {
+        body.push_back(std::string(m_avx2 ? "vpshufd " : "pshufd ") + reg(d) + ", " + reg(a) + ", " + std::to_string(order));
     }
 
-    std::cout << "\n; --- Main Program ---" << std::endl;
-    std::cout << "global _start" << std::endl;
-    emitLabel("_start");
-    enterScope();
-    m_stack_offset = 0;
-    emit("push rbp");
-    emit("mov rbp, rsp");
-
-    StackSizeCalculator main_stack_calc;
-    main_stack_calc.calculate(statements);
-    int total_stack_size = main_stack_calc.count * 8;
+    void visitLiteralExpr(const LiteralExpr& expr) override 
+    {
+        if (expr.value.type == TokenType::INT_LITERAL)
+        {
+            broadcast("literal " + expr.value.literal_value, "mov rax, " + expr.value.literal_value);
+        }
+        else if (expr.value.type == TokenType::BOOL_LITERAL)
+        {
+            broadcast("literal " + expr.value.text, std::string("mov rax, ") + (expr.value.text == "true" ? "1" : "0"));
+        }
+        else
+        {
+            ok = false;
+        }
+    }
+    void visitVariableExpr(const VariableExpr& expr) override 
+    {
+        VariableInfo* var = m_find(expr.name.text);
+        if (!var || var->length != 0 || !var->key_type.empty() || var->type == "string" || var->type == "float" || expr.name.text == m_index || expr.name.text == m_accumulator)
+        {
+            ok = false;
+            return;
+        }
+        broadcast("variable " + expr.name.text, loadInstruction(var->type, "[rbp - " + std::to_string(var->offset) + "]"));
+    }
+    void visitLengthExpr(const LengthExpr& expr) override 
+    {
+        VariableInfo* var = m_find(expr.array.text);
+        if (!var || var->length == 0)
+        {
+            ok = false;
+            return;
+        }
+        broadcast("literal " + std::to_string(var->length), "mov rax, " + std::to_string(var->length));
+    }
+    void visitIndexExpr(const IndexExpr& expr) override 
+    {
+        auto index = dynamic_cast<const VariableExpr*>(expr.index.get());
+        if (!index || index->name.text != m_index)
+        {
+            ok = false;
+            return;
+        }
+        std::string address = element(expr.array);
+        if (ok)
+        {
+            load(use(m_depth), address);
+            m_result = m_depth;
+        }
+    }
+    void visitBinaryExpr(const BinaryExpr& expr) override 
+    {
+        const std::string& name = expr.op.text;
+        int d = use(m_depth);
+        if (name == "multiplied")
+        {
+            // Multiplying by a power of two is a shift.
+            for (int side = 0; side < 2; ++side)
+            {
+                int bits = powerOfTwo(side == 0 ? *expr.right : *expr.left);
+                if (bits >= 0)
+                {
+                    int a = operand(side == 0 ? *expr.left : *expr.right, m_depth);
+                    if (bits > 0)
+                    {
+                        shift("psllq", d, a, bits);
+                        a = d;
+                    }
+                    m_result = a;
+                    return;
+                }
+            }
+        }
+        int a = operand(*expr.left, m_depth);
+        int b = operand(*expr.right, m_depth + 1);
+        if (name == "plus")
+        {
+            op("paddq", d, a, b);
+        }
+        else if (name == "minus")
+        {
+            op("psubq", d, a, b);
+        }
+        else if (name == "and")
+        {
+            op("pand", d, a, b);
+        }
+        else if (name == "or")
+        {
+            op("por", d, a, b);
+        }
+        else if (name == "multiplied")
+        {
+            // a * b = lo(a) * lo(b) + ((hi(a) * lo(b) + lo(a) * hi(b)) << 32), each product from pmuludq.
+            int t = use(m_depth + 2);
+            int u = use(m_depth + 3);
+            shift("psrlq", t, a, 32);
+            op("pmuludq", t, t, b);
+            shift("psrlq", u, b, 32);
+            op("pmuludq", u, u, a);
+            op("paddq", t, t, u);
+            shift("psllq", t, t, 32);
+            op("pmuludq", d, a, b);
+            op("paddq", d, d, t);
+        }
+        else
+        {
+            ok = false;
+        }
+        m_result = d;
+    }
+    void visitComparisonExpr(const ComparisonExpr& expr) override 
+    {
+        int d = use(m_depth);
+        int a = operand(*expr.left, m_depth);
+        int b = operand(*expr.right, m_depth + 1);
+        const std::string& name = expr.op.text;
+        if (name == "is equal to" && m_avx2)
+        {
+            op("pcmpeqq", d, a, b);
+        }
+        else if (name == "is equal to")
+        {
+            // Both halves of a lane have to be equal.
+            int t = use(m_depth + 1);
+            op("pcmpeqd", d, a, b);
+            shuffle(t, d, 0xB1);
+            op("pand", d, d, t);
+        }
+        else if ((name == "is greater than" || name == "is less than") && m_avx2)
+        {
+            op("pcmpgtq", d, name == "is greater than" ? a : b, name == "is greater than" ? b : a);
+        }
+        else if (name == "is greater than" || name == "is less than")
+        {
+            // Signed high halves, then unsigned low halves when the high ones are equal; flipping
+            // the sign bit of the low halves makes pcmpgtd compare those unsigned.
+            if (name == "is less than")
+            {
+                std::swap(a, b);
+            }
+            int y = use(m_depth + 1);
+            int t = use(m_depth + 2);
+            int mask = constant("low sign", [&](int r)
+            {
+                op(setup, "pcmpeqd", r, r, r);
+                shift(setup, "psllq", r, r, 63);
+                shift(setup, "psrlq", r, r, 32);
+            });
+            op("pxor", t, a, mask);
+            op("pxor", y, b, mask);
+            op("pcmpgtd", d, t, y);
+            op("pcmpeqd", t, t, y);
+            shuffle(y, d, 0xA0);
+            op("pand", t, t, y);
+            op("por", t, t, d);
+            shuffle(d, t, 0xF5);
+        }
+        else
+        {
+            ok = false;
+            return;
+        }
+        shift("psrlq", d, d, 63);
+        m_result = d;
+    }
+    void visitUnaryExpr(const UnaryExpr& expr) override 
+    {
+        int d = use(m_depth);
+        int a = operand(*expr.right, m_depth);
+        if (expr.op.text != "not")
+        {
+            m_result = a;
+            return;
+        }
+        op("pxor", d, a, ones());
+        m_result = d;
+    }
+    void visitAssignExpr(const AssignExpr& /*expr*/) override 
+    { 
+        ok = false; 
+    }
+    void visitIndexAssignExpr(const IndexAssignExpr& /*expr*/) override 
+    { 
+        ok = false; 
+    }
+    void visitFunctionCallExpr(const FunctionCallExpr& /*expr*/) override 
+    { 
+        ok = false; 
+    }
+    void visitEntryExpr(const EntryExpr& /*expr*/) override 
+    { 
+        ok = false; 
+    }
+    void visitEntryAssignExpr(const EntryAssignExpr& /*expr*/) override 
+    { 
+        ok = false; 
+    }
+    void visitHasEntryExpr(const HasEntryExpr& /*expr*/) override 
+    { 
+        ok = false; 
+    }
+    void visitJoinExpr(const JoinExpr& /*expr*/) override 
+    { 
+        ok = false; 
+    }
+    void visitTextExpr(const TextExpr& /*expr*/) override 
+    { 
+        ok = false; 
+    }
 
-    if (total_stack_size > 0) 
+private:
+    bool m_avx2;
+    std::string m_index;
+    std::string m_accumulator;
+    std::function<VariableInfo*(const std::string&)> m_find;
+    std::unordered_map<std::string, int> m_constants;
+    std::unordered_map<std::string, std::string> m_bases;
+    int m_reserved = 0;
+    int m_depth = 0;
+    int m_highest = -1;
+    int m_result = 0;
+
+    int use(int r) 
     {
-        int aligned_size = (total_stack_size + 15) & ~15;
-        emit("sub rsp, " + std::to_string(aligned_size));
+        m_highest = std::max(m_highest, r);
+        return r;
+    }
+    int operand(const Expr& expr, int depth) 
+    {
+        int saved = m_depth;
+        m_depth = depth;
+        expr.accept(*this);
+        m_depth = saved;
+        return m_result;
+    }
+    // The register holding the invariant `key`, loaded on first use by `fill`.
+    int constant(const std::string& key, const std::function<void(int)>& fill) 
+    {
+        auto found = m_constants.find(key);
+        if (found == m_constants.end())
+        {
+            found = m_constants.emplace(key, reserve()).first;
+            fill(found->second);
+        }
+        return found->second;
+    }
+    void broadcast(const std::string& key, const std::string& load) 
+    {
+        m_result = constant(key, [&](int r)
+        {
+            setup.push_back(load);
+            if (m_avx2)
+            {
+                setup.push_back("vmovq xmm" + std::to_string(r) + ", rax");
+                setup.push_back("vpbroadcastq " + reg(r) + ", xmm" + std::to_string(r));
+            }
+            else
+            {
+                setup.push_back("movq " + reg(r) + ", rax");
+                setup.push_back("punpcklqdq " + reg(r) + ", " + reg(r));
+            }
+        });
+    }
+    int ones() 
+    {
+        return constant("literal 1", [&](int r)
+        {
+            op(setup, "pcmpeqd", r, r, r);
+            shift(setup, "psrlq", r, r, 63);
+        });
+    }
+    static int powerOfTwo(const Expr& expr) 
+    {
+        auto literal = dynamic_cast<const LiteralExpr*>(&expr);
+        if (!literal || literal->value.type != TokenType::INT_LITERAL || literal->value.literal_value.size() > 18)
+        {
+            return -1;
+        }
+        uint64_t value = std::stoull(literal->value.literal_value);
+        if (value == 0 || (value & (value - 1)) != 0)
+        {
+            return -1;
+        }
+        int bits = 0;
+        while ((uint64_t(1) << bits) < value)
+        {
+            ++bits;
+        }
+        return bits;
     }
+};
 
-    for (const auto& stmt : statements) 
+class StringFinder : public StmtVisitor, public ExprVisitor 
+{
+public:
+    std::vector<std::string> string_literals;
+    std::unordered_set<std::string> seen;
+
+    void find(const std::vector<std::unique_ptr<Stmt>>& statements) 
     {
-        if (!dynamic_cast<const ProcedureDeclStmt*>(stmt.get())) 
+        for (const auto& stmt : statements) 
         {
             stmt->accept(*this);
         }
     }
 
-    emit("\n; Exit program");
-    emit("mov rsp, rbp");
-    emit("pop rbp");
-    emit("mov rax, 60");
-    emit("xor rdi, rdi");
-    emit("syscall");
-    exitScope();
+    void visitPrintStmt(const PrintStmt& stmt) override 
+    { 
+        stmt.expression->accept(*this); 
+    }
+    void visitDeclarationStmt(const DeclarationStmt& stmt) override 
+    { 
+        stmt.initializer->accept(*this); 
+    }
+    void visitExpressionStmt(const ExpressionStmt& stmt) override 
+    { 
+        stmt.expression->accept(*this); 
+    }
+    void visitIfStmt(const IfStmt& stmt) override 
+    { 
+        stmt.condition->accept(*this);
+        stmt.then_branch->accept(*this);
+        if (stmt.else_branch)
+        {
+            stmt.else_branch->accept(*this);
+        }
+    }
+    void visitWhileStmt(const WhileStmt& stmt) override 
+    { 
+        stmt.condition->accept(*this); stmt.body->accept(*this); 
+    }
+    void visitForStmt(const ForStmt& stmt) override 
+    { 
+        stmt.first->accept(*this);
+        stmt.last->accept(*this);
+        stmt.body->accept(*this); 
+    }
+    void visitBlockStmt(const BlockStmt& stmt) override 
+    { 
+        for(const auto& s : stmt.statements)
+        { 
+            s->accept(*this);
+        } 
+    }
+    void visitNewlineStmt(const NewlineStmt& /*stmt*/) override {}
+    void visitProcedureDeclStmt(const ProcedureDeclStmt& stmt) override 
+    { 
+        stmt.body->accept(*this); 
+    }
+    void visitProcedureCallStmt(const ProcedureCallStmt& stmt) override 
+    {
+        for(const auto& arg : stmt.arguments) 
+        {
+            arg->accept(*this);
+        }
+    }
+    void visitReturnStmt(const ReturnStmt& stmt) override 
+    {
+        stmt.value->accept(*this);
+    }
+    void visitBreakStmt(const BreakStmt& /*stmt*/) override {}
+    void visitImportStmt(const ImportStmt& /*stmt*/) override {}
+
+    void visitLiteralExpr(const LiteralExpr& expr) override 
+    {
+        if (expr.value.type == TokenType::STRING_LITERAL) 
+        {
+            if (seen.insert(expr.value.literal_value).second) 
+            {
+                string_literals.push_back(expr.value.literal_value);
+            }
+        }
+    }
+    void visitBinaryExpr(const BinaryExpr& expr) override 
+    { 
+        expr.left->accept(*this); 
+        expr.right->accept(*this); 
+    }
+    void visitComparisonExpr(const ComparisonExpr& expr) override 
+    { 
+        expr.left->accept(*this); 
+        expr.right->accept(*this); 
+    }
+    void visitVariableExpr(const VariableExpr& /*expr*/) override {}
+    void visitAssignExpr(const AssignExpr& expr) override 
+    { 
+        expr.value->accept(*this); 
+    }
+    void visitFunctionCallExpr(const FunctionCallExpr& expr) override 
+    {
+        for (const auto& arg : expr.arguments) 
+        {
+            arg->accept(*this);
+        }
+    }
+    void visitUnaryExpr(const UnaryExpr& expr) override 
+    {
+        expr.right->accept(*this);
+    }
+    void visitIndexExpr(const IndexExpr& expr) override 
+    {
+        expr.index->accept(*this);
+    }
+    void visitIndexAssignExpr(const IndexAssignExpr& expr) override 
+    {
+        expr.index->accept(*this);
+        expr.value->accept(*this);
+    }
+    void visitLengthExpr(const LengthExpr& /*expr*/) override {}
+    void visitEntryExpr(const EntryExpr& expr) override 
+    {
+        expr.key->accept(*this);
+    }
+    void visitEntryAssignExpr(const EntryAssignExpr& expr) override 
+    {
+        expr.key->accept(*this);
+        expr.value->accept(*this);
+    }
+    void visitHasEntryExpr(const HasEntryExpr& expr) override 
+    {
+        expr.key->accept(*this);
+    }
+    void visitJoinExpr(const JoinExpr& expr) override 
+    {
+        expr.left->accept(*this);
+        expr.right->accept(*this);
+    }
+    void visitTextExpr(const TextExpr& expr) override 
+    {
+        expr.value->accept(*this);
+    }
+};
+
+// Feeds the exact shape of a procedure into a ContentHash and records the procedures it calls.
+class ProcedureHasher : public StmtVisitor, public ExprVisitor 
+{
+public:
+    // With `lines`, statement source lines are part of the hash too (code generated with -g).
+    explicit ProcedureHasher(ContentHash& hash, bool lines = false) : m_hash(hash), m_lines(lines) {}
+
+    std::vector<std::string> callees;
+    // Calls evaluated at compile time, whose values are part of the generated code.
+    const FoldedCalls* folded = nullptr;
+
+    void visitDeclarationStmt(const DeclarationStmt& stmt) override 
+    { 
+        tag("decl", stmt);
+        token(stmt.name);
+        token(stmt.type);
+        m_hash.add(stmt.is_mutable ? 1 : 0);
+        m_hash.add(stmt.length);
+        token(stmt.key_type);
+        stmt.initializer->accept(*this); 
+    }
+    void visitExpressionStmt(const ExpressionStmt& stmt) override 
+    { 
+        tag("expr", stmt);
+        stmt.expression->accept(*this); 
+    }
+    void visitIfStmt(const IfStmt& stmt) override 
+    { 
+        tag("if", stmt);
+        m_hash.add(stmt.else_branch ? 1 : 0);
+        stmt.condition->accept(*this); 
+        stmt.then_branch->accept(*this); 
+        if (stmt.else_branch)
+        {
+            stmt.else_branch->accept(*this);
+        }
+    }
+    void visitWhileStmt(const WhileStmt& stmt) override 
+    { 
+        tag("while", stmt);
+        stmt.condition->accept(*this); 
+        stmt.body->accept(*this); 
+    }
+    void visitForStmt(const ForStmt& stmt) override 
+    { 
+        tag("for", stmt);
+        token(stmt.variable);
+        stmt.first->accept(*this); 
+        stmt.last->accept(*this); 
+        stmt.body->accept(*this); 
+    }
+    void visitBlockStmt(const BlockStmt& stmt) override 
+    { 
+        tag("block", stmt);
+        m_hash.add(stmt.statements.size());
+        for (const auto& s : stmt.statements) 
+        {
+            s->accept(*this);
+        }
+    }
+    void visitPrintStmt(const PrintStmt& stmt) override 
+    { 
+        tag("print", stmt);
+        stmt.expression->accept(*this); 
+    }
+    void visitNewlineStmt(const NewlineStmt& stmt) override 
+    { 
+        tag("newline", stmt); 
+    }
+    void visitProcedureDeclStmt(const ProcedureDeclStmt& stmt) override 
+    { 
+        tag("proc", stmt);
+        token(stmt.name);
+        m_hash.add(stmt.params.size());
+        for (const auto& param : stmt.params) 
+        {
+            token(param.name);
+            token(param.type);
+        }
+        token(stmt.return_type);
+        stmt.body->accept(*this); 
+    }
+    void visitProcedureCallStmt(const ProcedureCallStmt& stmt) override 
+    { 
+        tag("perform", stmt);
+        if (folded && folded->removed.count(&stmt))
+        {
+            tag("removed");
+        }
+        call(stmt.callee_name, stmt.arguments);
+    }
+    void visitReturnStmt(const ReturnStmt& stmt) override 
+    { 
+        tag("return", stmt);
+        stmt.value->accept(*this); 
+    }
+    void visitBreakStmt(const BreakStmt& stmt) override 
+    { 
+        tag("break", stmt); 
+    }
+    void visitImportStmt(const ImportStmt& stmt) override 
+    { 
+        tag("import", stmt);
+        token(stmt.path);
+    }
+
+    void visitBinaryExpr(const BinaryExpr& expr) override 
+    { 
+        tag("binary");
+        token(expr.op);
+        expr.left->accept(*this); 
+        expr.right->accept(*this); 
+    }
+    void visitComparisonExpr(const ComparisonExpr& expr) override 
+    { 
+        tag("compare");
+        token(expr.op);
+        expr.left->accept(*this); 
+        expr.right->accept(*this); 
+    }
+    void visitLiteralExpr(const LiteralExpr& expr) override 
+    { 
+        tag("literal");
+        token(expr.value);
+    }
+    void visitVariableExpr(const VariableExpr& expr) override 
+    { 
+        tag("variable");
+        token(expr.name);
+    }
+    void visitAssignExpr(const AssignExpr& expr) override 
+    { 
+        tag("assign");
+        token(expr.name);
+        expr.value->accept(*this); 
+    }
+    void visitFunctionCallExpr(const FunctionCallExpr& expr) override 
+    { 
+        tag("call");
+        if (folded && folded->values.count(&expr))
+        {
+            tag("folded");
+            m_hash.add(static_cast<uint64_t>(folded->values.at(&expr)));
+        }
+        call(expr.callee_name, expr.arguments);
+    }
+    void visitUnaryExpr(const UnaryExpr& expr) override 
+    { 
+        tag("unary");
+        token(expr.op);
+        expr.right->accept(*this); 
+    }
+    void visitIndexExpr(const IndexExpr& expr) override 
+    { 
+        tag("index");
+        token(expr.array);
+        expr.index->accept(*this); 
+    }
+    void visitIndexAssignExpr(const IndexAssignExpr& expr) override 
+    { 
+        tag("index-assign");
+        token(expr.array);
+        expr.index->accept(*this); 
+        expr.value->accept(*this); 
+    }
+    void visitLengthExpr(const LengthExpr& expr) override 
+    { 
+        tag("length");
+        token(expr.array);
+    }
+    void visitEntryExpr(const EntryExpr& expr) override 
+    { 
+        tag("entry");
+        token(expr.map);
+        expr.key->accept(*this); 
+    }
+    void visitEntryAssignExpr(const EntryAssignExpr& expr) override 
+    { 
+        tag("entry-assign");
+        token(expr.map);
+        expr.key->accept(*this); 
+        expr.value->accept(*this); 
+    }
+    void visitHasEntryExpr(const HasEntryExpr& expr) override 
+    { 
+        tag("has-entry");
+        token(expr.map);
+        expr.key->accept(*this); 
+    }
+    void visitJoinExpr(const JoinExpr& expr) override 
+    { 
+        tag("join");
+        expr.left->accept(*this); 
+        expr.right->accept(*this); 
+    }
+    void visitTextExpr(const TextExpr& expr) override 
+    { 
+        tag("text");
+        expr.value->accept(*this); 
+    }
+
+private:
+    ContentHash& m_hash;
+    bool m_lines;
+
+    void tag(const char* name) 
+    { 
+        m_hash.add(std::string(name)); 
+    }
+    void tag(const char* name, const Stmt& stmt) 
+    { 
+        tag(name);
+        if (m_lines)
+        {
+            m_hash.add(static_cast<uint64_t>(stmt.line));
+        }
+    }
+    void token(const Token& token) 
+    {
+        m_hash.add(static_cast<uint64_t>(token.type));
+        m_hash.add(token.text);
+        m_hash.add(token.literal_value);
+    }
+    void call(const Token& callee, const std::vector<std::unique_ptr<Expr>>& arguments) 
+    {
+        token(callee);
+        callees.push_back(callee.text);
+        m_hash.add(arguments.size());
+        for (const auto& arg : arguments) 
+        {
+            arg->accept(*this);
+        }
+    }
+};
+
+namespace
+{
+    // Changes whenever the compiler is rebuilt, so cached code never outlives the code generator
+    // that produced it.
+    const char* const COMPILER_BUILD_ID = __DATE__ " " __TIME__;
+
+    std::string signatureOf(const ProcedureDeclStmt& proc)
+    {
+        std::string signature = "(";
+        for (const auto& param : proc.params) 
+        {
+            signature += param.type.text + ",";
+        }
+        return signature + ")" + proc.return_type.text;
+    }
+
+    ProcedureSignature signatureTypes(const ProcedureDeclStmt& proc)
+    {
+        ProcedureSignature signature;
+        for (const auto& param : proc.params) 
+        {
+            signature.params.push_back(param.type.text);
+        }
+        signature.result = proc.return_type.text;
+        return signature;
+    }
+
+    // Identifies a version of a scope's code in training profiles. For the main story only the
+    // statements outside procedures count.
+    std::string shapeOf(const std::vector<const Stmt*>& statements)
+    {
+        ContentHash hash;
+        ProcedureHasher hasher(hash);
+        for (const Stmt* stmt : statements)
+        {
+            stmt->accept(hasher);
+        }
+        return hash.hex();
+    }
+
+    std::string mainShapeOf(const std::vector<std::unique_ptr<Stmt>>& statements)
+    {
+        std::vector<const Stmt*> story;
+        for (const auto& stmt : statements)
+        {
+            if (!dynamic_cast<const ProcedureDeclStmt*>(stmt.get()) && !dynamic_cast<const ImportStmt*>(stmt.get()))
+            {
+                story.push_back(stmt.get());
+            }
+        }
+        return shapeOf(story);
+    }
+
+    // The parts of the runtime that are only emitted into programs that call them.
+    enum RuntimePart : unsigned
+    {
+        FLOAT_RUNTIME = 1,
+        MAP_RUNTIME = 2,
+        STRING_BUILDING = 4,
+        STRING_COMPARISON = 8,
+        STRING_LENGTH = 16,
+    };
+
+    // The runtime parts that `code`, an instruction or a procedure's worth of them, calls into.
+    unsigned runtimeCalls(const std::string& code)
+    {
+        static const std::pair<std::string, unsigned> CALLEES[] =
+        {
+            {"call _print_float", FLOAT_RUNTIME},
+            {"call _map_", MAP_RUNTIME},
+            {"call _string_join", STRING_BUILDING},
+            {"call _string_text", STRING_BUILDING},
+            {"call _string_mark", STRING_BUILDING},
+            {"call _string_reset", STRING_BUILDING},
+            {"call _string_equal", STRING_COMPARISON},
+            {"call _string_starts", STRING_COMPARISON},
+            {"call _string_contains", STRING_COMPARISON},
+            {"call _strlen", STRING_LENGTH},
+        };
+        unsigned parts = 0;
+        for (size_t at = code.find("call _"); at != std::string::npos; at = code.find("call _", at + 6))
+        {
+            for (const auto& callee : CALLEES)
+            {
+                if (code.compare(at, callee.first.size(), callee.first) == 0)
+                {
+                    parts |= callee.second;
+                }
+            }
+        }
+        return parts;
+    }
+
+    // Qwords per memo table entry: the valid flag, the arguments and the result, rounded up to a
+    // power of two so an entry never straddles more cache lines than it must.
+    size_t memoStride(size_t keys)
+    {
+        size_t stride = 1;
+        while (stride < keys + 2)
+        {
+            stride *= 2;
+        }
+        return stride;
+    }
+
+    // The procedures to memoize: every pure recursive one, or the listed ones, which must be pure.
+    // Names not declared here may belong to another module of the build. A table keys and keeps
+    // strings by address, and the string arena hands the same addresses out again after a reset,
+    // so procedures that take or yield a string are left out.
+    std::unordered_set<std::string> memoizedProcedures(const PureCalls& purity, const std::vector<const ProcedureDeclStmt*>& procedures, const std::vector<std::string>& only)
+    {
+        std::unordered_set<std::string> memoized;
+        for (const ProcedureDeclStmt* proc : procedures)
+        {
+            const std::string& name = proc->name.text;
+            bool strings = proc->return_type.text == "string" || std::any_of(proc->params.begin(), proc->params.end(), [](const Param& param) { return param.type.text == "string"; });
+            bool memoizable = purity.isPure(name) && !proc->params.empty() && proc->params.size() <= 6 && !strings;
+            if (only.empty())
+            {
+                if (memoizable && purity.isRecursive(name))
+                {
+                    memoized.insert(name);
+                }
+            }
+            else if (std::find(only.begin(), only.end(), name) != only.end())
+            {
+                if (!memoizable)
+                {
+                    throw std::runtime_error("Cannot memoize '" + name + "': only pure procedures with 1 to 6 parameters and no strings can be memoized.");
+                }
+                memoized.insert(name);
+            }
+        }
+        return memoized;
+    }
+}
+
+CodeGenerator::CodeGenerator(const CodegenOptions& options, std::ostream& out) : m_options(options), m_out(out) {}
+
+void CodeGenerator::emit(const std::string& code) 
+{ 
+    if (code.compare(0, 6, "call _") == 0)
+    {
+        m_runtime_parts |= runtimeCalls(code);
+    }
+    *m_text << "    " << code << "\n"; 
+}
+void CodeGenerator::emitLabel(const std::string& label) 
+{ 
+    *m_text << label << ":\n"; 
+}
+std::string CodeGenerator::newLabel() 
+{ 
+    return m_label_prefix + std::to_string(m_label_counter++); 
+}
+
+void CodeGenerator::enterScope() 
+{
+    m_scope_level++;
+    m_symbol_scopes.emplace_back();
+}
+
+void CodeGenerator::exitScope() 
+{
+    m_scope_level--;
+    m_symbol_scopes.pop_back();
+}
+
+VariableInfo* CodeGenerator::findVariable(const std::string& name) 
+{
+    for (int i = m_symbol_scopes.size() - 1; i >= 0; --i) 
+    {
+        if (m_symbol_scopes[i].count(name))
+        {
+            return &m_symbol_scopes[i].at(name);
+        }
+    }
+
+    return nullptr;
+}
+
+// A variable used as a single value, which an array or a map cannot be.
+VariableInfo* CodeGenerator::findScalar(const std::string& name) 
+{
+    VariableInfo* var = findVariable(name);
+    if (var && var->length != 0)
+    {
+        throw std::runtime_error("'" + name + "' is an array; name one of its elements.");
+    }
+    if (var && !var->key_type.empty())
+    {
+        throw std::runtime_error("'" + name + "' is a map; name one of its entries.");
+    }
+    return var;
+}
+
+const VariableInfo& CodeGenerator::findArray(const Token& name) 
+{
+    VariableInfo* var = findVariable(name.text);
+    if (!var)
+    {
+        throw std::runtime_error("Undeclared array '" + name.text + "'.");
+    }
+    if (var->length == 0)
+    {
+        throw std::runtime_error("'" + name.text + "' is not an array.");
+    }
+    return *var;
+}
+
+const VariableInfo& CodeGenerator::findMap(const Token& name)
+{
+    VariableInfo* var = findVariable(name.text);
+    if (!var)
+    {
+        throw std::runtime_error("Undeclared map '" + name.text + "'.");
+    }
+    if (var->key_type.empty())
+    {
+        throw std::runtime_error("'" + name.text + "' is not a map.");
+    }
+    return *var;
+}
+
+// The operand for the `scale`-byte unit of `array` numbered r11, counting from 0. May use r10.
+// Whether the expression's value is a float, which is computed in xmm0 instead of rax.
+// Arithmetic with a float on either side is done in floats; a call is a float if its procedure
+// yields one.
+bool CodeGenerator::isFloat(const Expr& expr)
+{
+    if (auto literal = dynamic_cast<const LiteralExpr*>(&expr))
+    {
+        return literal->value.type == TokenType::FLOAT_LITERAL;
+    }
+    if (auto variable = dynamic_cast<const VariableExpr*>(&expr))
+    {
+        VariableInfo* var = findScalar(variable->name.text);
+        return var && var->type == "float";
+    }
+    if (auto assign = dynamic_cast<const AssignExpr*>(&expr))
+    {
+        VariableInfo* var = findScalar(assign->name.text);
+        return var && var->type == "float";
+    }
+    if (auto index = dynamic_cast<const IndexExpr*>(&expr))
+    {
+        return findArray(index->array).type == "float";
+    }
+    if (auto index = dynamic_cast<const IndexAssignExpr*>(&expr))
+    {
+        return findArray(index->array).type == "float";
+    }
+    if (auto binary = dynamic_cast<const BinaryExpr*>(&expr))
+    {
+        const std::string& op = binary->op.text;
+        bool arithmetic = op == "plus" || op == "minus" || op == "multiplied" || op == "divided";
+        return arithmetic && (isFloat(*binary->left) || isFloat(*binary->right));
+    }
+    if (auto call = dynamic_cast<const FunctionCallExpr*>(&expr))
+    {
+        auto signature = m_signatures->find(call->callee_name.text);
+        return signature != m_signatures->end() && signature->second.result == "float";
+    }
+    return false;
+}
+
+// Whether the expression is a string: a literal, a string variable, element or entry, a string
+// built with 'followed by' or 'the text of', or the result of a procedure yielding one.
+bool CodeGenerator::isString(const Expr& expr)
+{
+    if (auto literal = dynamic_cast<const LiteralExpr*>(&expr))
+    {
+        return literal->value.type == TokenType::STRING_LITERAL;
+    }
+    if (auto variable = dynamic_cast<const VariableExpr*>(&expr))
+    {
+        VariableInfo* var = findScalar(variable->name.text);
+        return var && var->type == "string";
+    }
+    if (auto assign = dynamic_cast<const AssignExpr*>(&expr))
+    {
+        VariableInfo* var = findScalar(assign->name.text);
+        return var && var->type == "string";
+    }
+    if (auto index = dynamic_cast<const IndexExpr*>(&expr))
+    {
+        return findArray(index->array).type == "string";
+    }
+    if (auto index = dynamic_cast<const IndexAssignExpr*>(&expr))
+    {
+        return findArray(index->array).type == "string";
+    }
+    if (auto entry = dynamic_cast<const EntryExpr*>(&expr))
+    {
+        return findMap(entry->map).type == "string";
+    }
+    if (auto entry = dynamic_cast<const EntryAssignExpr*>(&expr))
+    {
+        return findMap(entry->map).type == "string";
+    }
+    if (auto call = dynamic_cast<const FunctionCallExpr*>(&expr))
+    {
+        return yieldsString({call->callee_name.text});
+    }
+    return dynamic_cast<const JoinExpr*>(&expr) || dynamic_cast<const TextExpr*>(&expr);
+}
+
+bool CodeGenerator::buildsStrings(const Stmt& stmt)
+{
+    StringScanner scanner;
+    stmt.accept(scanner);
+    return scanner.builds || yieldsString(scanner.callees);
+}
+
+// Whether any of the procedures yields a string, which it may have built.
+bool CodeGenerator::yieldsString(const std::vector<std::string>& procedures) const
+{
+    for (const auto& name : procedures)
+    {
+        auto signature = m_signatures->find(name);
+        if (signature != m_signatures->end() && signature->second.result == "string")
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Evaluates the expression as a value of the type: into xmm0 for a float, converting an integer
+// with cvtsi2sd, and into rax otherwise, truncating a float toward zero.
+void CodeGenerator::emitValue(const Expr& expr, const std::string& type)
+{
+    bool is_float = isFloat(expr);
+    expr.accept(*this);
+    if (type == "float" && !is_float)
+    {
+        emit("cvtsi2sd xmm0, rax");
+    }
+    else if (type != "float" && is_float)
+    {
+        emit("cvttsd2si rax, xmm0");
+    }
+}
+
+std::string CodeGenerator::emitElementAddress(const VariableInfo& array, int scale) 
+{
+    if (array.symbol.empty())
+    {
+        return "[rbp + r11*" + std::to_string(scale) + " - " + std::to_string(array.offset) + "]";
+    }
+    emit("mov r10, " + array.symbol);
+    return "[r10 + r11*" + std::to_string(scale) + "]";
+}
+
+void CodeGenerator::findStringLiterals(const std::vector<std::unique_ptr<Stmt>>& statements) 
+{
+    TimeReport::Scope timer(m_options.time_report, TimeReport::STRING_WALK, true);
+    StringFinder finder;
+    finder.find(statements);
+    m_string_literals = finder.string_literals;
+    m_string_table.clear();
+    for (size_t i = 0; i < m_string_literals.size(); ++i) 
+    {
+        m_string_table[m_string_literals[i]] = i;
+    }
+    m_string_indices = &m_string_table;
+}
+
+void CodeGenerator::generate(const std::vector<std::unique_ptr<Stmt>>& statements) 
+{
+    findStringLiterals(statements);
+    m_out << "section .rodata\n";
+    emitLabel("NL");
+    emit("db 10");
+    for (size_t i = 0; i < m_string_literals.size(); ++i) 
+    {
+        m_out << "  str" << i << ": db `" << m_string_literals[i] << "`, 0\n";
+    }
+    
+    if (m_options.host_runtime)
+    {
+        m_out << "\nextern _print_integer, _print_float, _strlen, _map_new, _map_slot, _string_join, _string_text, _string_mark, _string_reset, _string_equal, _string_starts, _string_contains, exit\n";
+        m_out << "\nsection .text\n";
+    }
+
+    emitInstrumentation();
+
+    if (!m_options.imported_procedures.empty())
+    {
+        m_out << "\nextern ";
+        for (size_t i = 0; i < m_options.imported_procedures.size(); ++i)
+        {
+            m_out << (i ? ", proc_" : "proc_") << m_options.imported_procedures[i]->name.text;
+        }
+        m_out << "\n";
+    }
+    
+    std::vector<const ProcedureDeclStmt*> procedures;
+    std::unordered_map<std::string, std::string> signatures;
+    for (const ProcedureDeclStmt* proc_decl : m_options.imported_procedures)
+    {
+        m_signature_table[proc_decl->name.text] = signatureTypes(*proc_decl);
+        if (m_options.cache)
+        {
+            signatures[proc_decl->name.text] = signatureOf(*proc_decl);
+        }
+    }
+    for (const auto& stmt : statements) 
+    {
+        if (auto proc_decl = dynamic_cast<const ProcedureDeclStmt*>(stmt.get())) 
+        {
+            procedures.push_back(proc_decl);
+            m_signature_table[proc_decl->name.text] = signatureTypes(*proc_decl);
+            if (m_options.cache)
+            {
+                signatures[proc_decl->name.text] = signatureOf(*proc_decl);
+            }
+        }
+    }
+
+    if (m_options.fold_pure_calls || m_options.memoize)
+    {
+        TimeReport::Scope timer(m_options.time_report, TimeReport::PURE_EVAL, true);
+        PureCalls purity(statements);
+        if (m_options.fold_pure_calls)
+        {
+            m_folded_calls = purity.fold(statements);
+            m_folded = &m_folded_calls;
+        }
+        if (m_options.memoize)
+        {
+            m_memoized_procedures = memoizedProcedures(purity, procedures, m_options.memoize_only);
+            m_memoized = &m_memoized_procedures;
+        }
+    }
+
+    // Every procedure, and the main program after them, is generated by its own CodeGenerator
+    // into a private buffer. Labels are local to the enclosing proc_* or _start symbol, so the
+    // buffers are independent and are written out in source order.
+    std::vector<std::ostringstream> buffers(procedures.size() + (m_options.entry ? 1 : 0));
+    std::vector<std::exception_ptr> failures(buffers.size());
+    std::vector<unsigned> runtime_parts(buffers.size(), 0);
+    ThreadPool pool(buffers.size() > 1 ? m_options.jobs : 1);
+    pool.parallelFor(buffers.size(), [&](size_t i) 
+    {
+        CodeGenerator worker(m_options, buffers[i]);
+        worker.m_string_indices = m_string_indices;
+        worker.m_signatures = m_signatures;
+        worker.m_folded = m_folded;
+        worker.m_memoized = m_memoized;
+        try 
+        {
+            if (i < procedures.size() && m_options.cache) 
+            {
+                buffers[i] << worker.generateProcedure(*procedures[i], signatures);
+            }
+            else if (i < procedures.size()) 
+            {
+                procedures[i]->accept(worker);
+            }
+            else 
+            {
+                worker.generateMain(statements);
+            }
+            runtime_parts[i] = worker.m_runtime_parts;
+        } 
+        catch (...) 
+        {
+            failures[i] = std::current_exception();
+        }
+    });
+
+    // Only now is it known which parts of the runtime the program calls.
+    for (unsigned parts : runtime_parts)
+    {
+        m_runtime_parts |= parts;
+    }
+    if (!m_options.host_runtime)
+    {
+        emitRuntimeHelpers();
+    }
+    emitRuntimeErrors();
+
+    // With a training profile the procedures are laid out hottest first, so the code that runs
+    // most shares cache lines and pages; procedures that never ran go last in source order.
+    std::vector<size_t> order(buffers.size());
+    for (size_t i = 0; i < order.size(); ++i)
+    {
+        order[i] = i;
+    }
+    if (m_options.profile_use)
+    {
+        std::vector<uint64_t> calls(procedures.size(), 0);
+        for (size_t i = 0; i < procedures.size(); ++i)
+        {
+            const ScopeProfile* counts = m_options.profile_use->find("proc_" + procedures[i]->name.text, shapeOf({procedures[i]}));
+            calls[i] = counts ? counts->calls : 0;
+        }
+        std::stable_sort(order.begin(), order.begin() + procedures.size(), [&](size_t a, size_t b) { return calls[a] > calls[b]; });
+    }
+
+    m_out << "\n; --- Procedures ---\n";
+    for (size_t i : order) 
+    {
+        m_out << buffers[i].str();
+        if (failures[i]) 
+        {
+            std::rethrow_exception(failures[i]);
+        }
+    }
+}
+
+// Looks the procedure up in the compile cache by its shape, the signatures of its callees and
+// the code generation flags, generating and storing it on a miss. Cached code refers to string
+// literals by placeholder; they are mapped onto this program's string table on the way out.
+std::string CodeGenerator::generateProcedure(const ProcedureDeclStmt& stmt, const std::unordered_map<std::string, std::string>& signatures)
+{
+    ContentHash hash;
+    hash.add(std::string(COMPILER_BUILD_ID));
+    hash.add(m_options.host_runtime ? 1 : 0);
+    hash.add(m_options.module ? 1 : 0);
+    hash.add(m_options.profile ? 1 : 0);
+    hash.add(m_options.profile_generate.empty() ? 0 : 1);
+    hash.add(m_options.debug_info ? 1 : 0);
+    if (m_options.debug_info)
+    {
+        hash.add(stmt.source.empty() ? m_options.source_path : stmt.source);
+    }
+    if (const ScopeProfile* counts = m_options.profile_use ? m_options.profile_use->find("proc_" + stmt.name.text, shapeOf({&stmt})) : nullptr)
+    {
+        for (uint64_t counter : counts->counters)
+        {
+            hash.add(counter);
+        }
+    }
+    hash.add(m_memoized && m_memoized->count(stmt.name.text) ? m_options.memo_entries : 0);
+    hash.add(static_cast<uint64_t>(m_options.unroll_factor));
+    hash.add(m_options.vectorize ? (m_options.avx2 ? 2 : 1) : 0);
+    ProcedureHasher hasher(hash, m_options.debug_info);
+    hasher.folded = m_folded;
+    stmt.accept(hasher);
+    std::sort(hasher.callees.begin(), hasher.callees.end());
+    hasher.callees.erase(std::unique(hasher.callees.begin(), hasher.callees.end()), hasher.callees.end());
+    for (const auto& callee : hasher.callees)
+    {
+        auto signature = signatures.find(callee);
+        hash.add(callee);
+        hash.add(signature == signatures.end() ? std::string("extern") : signature->second);
+    }
+
+    StringFinder finder;
+    stmt.accept(finder);
+
+    std::string code;
+    if (!m_options.cache->lookup(hash.hex(), code))
+    {
+        std::unordered_map<std::string, size_t> local_strings;
+        for (size_t i = 0; i < finder.string_literals.size(); ++i)
+        {
+            local_strings[finder.string_literals[i]] = i;
+        }
+        std::ostringstream out;
+        CodeGenerator worker(m_options, out);
+        worker.m_string_indices = &local_strings;
+        worker.m_signatures = m_signatures;
+        worker.m_folded = m_folded;
+        worker.m_memoized = m_memoized;
+        worker.m_string_placeholders = true;
+        stmt.accept(worker);
+        code = out.str();
+        m_options.cache->store(hash.hex(), code);
+    }
+
+    std::string result;
+    result.reserve(code.size());
+    size_t position = 0;
+    for (size_t open = code.find("{str"); open != std::string::npos; open = code.find("{str", position))
+    {
+        size_t close = code.find('}', open);
+        size_t local = close == std::string::npos ? SIZE_MAX : std::stoul(code.substr(open + 4, close - open - 4));
+        if (local >= finder.string_literals.size())
+        {
+            throw std::runtime_error("Internal compiler error: corrupt compile cache entry.");
+        }
+        result.append(code, position, open - position);
+        result += "str" + std::to_string(m_string_indices->at(finder.string_literals[local]));
+        position = close + 1;
+    }
+    result.append(code, position, std::string::npos);
+    m_runtime_parts |= runtimeCalls(result);
+    return result;
+}
+
+void CodeGenerator::generateMain(const std::vector<std::unique_ptr<Stmt>>& statements) 
+{
+    m_out << "\n; --- Main Program ---\n";
+    m_out << "global _start:function (_start.end - _start)\n";
+    beginMainLines();
+    emitLabel("_start");
+    m_scope_symbol = "_start";
+    m_counter_registers = COUNTER_REGISTER_COUNT;
+    m_static_arrays = true;
+    enterScope();
+    m_stack_offset = 0;
+    std::fill(std::begin(m_packed_words), std::end(m_packed_words), std::make_pair(0, 8));
+    emit("push rbp");
+    emit("mov rbp, rsp");
+    if (m_options.profile)
+    {
+        emit("call _prof_start");
+    }
+
+    StackSizeCalculator main_stack_calc;
+    main_stack_calc.frame_arrays = false;
+    {
+        TimeReport::Scope timer(m_options.time_report, TimeReport::STACK_WALK, true);
+        main_stack_calc.calculate(statements);
+    }
+    int total_stack_size = main_stack_calc.words() * 8;
+
+    if (total_stack_size > 0) 
+    {
+        int aligned_size = (total_stack_size + 15) & ~15;
+        emit("sub rsp, " + std::to_string(aligned_size));
+    }
+    if (!m_options.profile_generate.empty() || m_options.profile_use)
+    {
+        beginPgoScope("_start", mainShapeOf(statements));
+    }
+
+    for (const auto& stmt : statements) 
+    {
+        if (!dynamic_cast<const ProcedureDeclStmt*>(stmt.get()) && !dynamic_cast<const ImportStmt*>(stmt.get())) 
+        {
+            emitLine(*stmt);
+            stmt->accept(*this);
+        }
+    }
+
+    emitExit();
+    flushColdBlocks();
+    flushJumpTables();
+    flushFloatConstants();
+    flushArrays();
+    emitLabel(".end");
+    endPgoScope();
+    exitScope();
+}
+
+void CodeGenerator::emitExit()
+{
+    emit("\n; Exit program");
+    if (m_options.profile)
+    {
+        emit("call _prof_dump");
+    }
+    if (!m_options.profile_generate.empty())
+    {
+        emit("call _pgo_dump");
+    }
+    emit("mov rsp, rbp");
+    emit("pop rbp");
+    if (m_options.host_runtime)
+    {
+        emit("xor rdi, rdi");
+        emit("call exit");
+    }
+    else
+    {
+        emit("mov rax, 60");
+        emit("xor rdi, rdi");
+        emit("syscall");
+    }
+}
+
+void CodeGenerator::switchSection(const std::string& section)
+{
+    if (m_section != section)
+    {
+        m_out << "\nsection " << section << "\n";
+        m_section = section;
+    }
+}
+
+void CodeGenerator::beginStream()
+{
+    m_string_literals.clear();
+    m_string_table.clear();
+    m_string_indices = &m_string_table;
+
+    m_out << "section .rodata\n";
+    emitLabel("NL");
+    emit("db 10");
+
+    if (m_options.host_runtime)
+    {
+        m_out << "\nextern _print_integer, _print_float, _strlen, _map_new, _map_slot, _string_join, _string_text, _string_mark, _string_reset, _string_equal, _string_starts, _string_contains, exit\n";
+    }
+    emitInstrumentation();
+
+    // Procedures interleave with the main program in the output, so main gets its own section
+    // and its labels are qualified by hand instead of relying on the last non-local label.
+    m_out << "\nsection .text.main progbits alloc exec nowrite align=16\n";
+    m_section = ".text.main";
+    m_label_prefix = "_start.L";
+    m_out << "; --- Main Program ---\n";
+    m_out << "global _start:function (_start.end - _start)\n";
+    beginMainLines();
+    emitLabel("_start");
+    m_scope_symbol = "_start";
+    m_counter_registers = COUNTER_REGISTER_COUNT;
+    m_static_arrays = true;
+    enterScope();
+    m_stack_offset = 0;
+    std::fill(std::begin(m_packed_words), std::end(m_packed_words), std::make_pair(0, 8));
+    emit("push rbp");
+    emit("mov rbp, rsp");
+    if (m_options.profile)
+    {
+        emit("call _prof_start");
+    }
+    emit("sub rsp, main_frame_size");
+}
+
+void CodeGenerator::streamStatement(const Stmt& stmt)
+{
+    StringFinder finder;
+    stmt.accept(finder);
+    for (const auto& literal : finder.string_literals)
+    {
+        if (m_string_table.emplace(literal, m_string_table.size()).second)
+        {
+            switchSection(".rodata");
+            m_out << "  str" << m_string_table.size() - 1 << ": db `" << literal << "`, 0\n";
+        }
+    }
+
+    if (auto proc_decl = dynamic_cast<const ProcedureDeclStmt*>(&stmt))
+    {
+        m_signature_table[proc_decl->name.text] = signatureTypes(*proc_decl);
+        switchSection(".text");
+        CodeGenerator worker(m_options, m_out);
+        worker.m_string_indices = m_string_indices;
+        worker.m_signatures = m_signatures;
+        stmt.accept(worker);
+        m_runtime_parts |= worker.m_runtime_parts;
+        // '%line' is not per section, so main has to restate its position.
+        m_source_line = 0;
+    }
+    else if (!dynamic_cast<const ImportStmt*>(&stmt))
+    {
+        switchSection(".text.main");
+        emitLine(stmt);
+        stmt.accept(*this);
+        flushJumpTables();
+        flushFloatConstants();
+        flushArrays();
+    }
+}
+
+void CodeGenerator::endStream()
+{
+    switchSection(".text.main");
+    emitExit();
+    emitLabel("_start.end");
+    exitScope();
+    m_out << "main_frame_size equ " << ((m_stack_offset + 15) & ~15) << "\n";
+
+    // The runtime goes last, once the whole program has said which parts of it it calls.
+    if (!m_options.host_runtime)
+    {
+        emitRuntimeHelpers();
+    }
+    emitRuntimeErrors();
+}
+
+void CodeGenerator::emitRuntimeHelpers()
+{
+    m_out << "\nsection .bss\n";
+    emitLabel("int_buffer");
+    emit("resb 21");
+
+    m_out << "\nsection .text\n";
+    m_out << "; --- Helper Functions ---\n";
+    emitLabel("_print_integer");
+    emit("mov rdi, int_buffer + 20"); 
+    emit("mov byte [rdi], 0"); 
+    emit("dec rdi"); 
+    emit("test rax, rax");
+    emit("jns .utoa_loop"); 
+    emit("neg rax"); 
+    emit("mov r11, 1");
+    emitLabel(".utoa_loop");
+    emit("mov rdx, 0"); 
+    emit("mov rbx, 10"); 
+    emit("div rbx"); 
+    emit("add dl, '0'");
+    emit("mov [rdi], dl"); 
+    emit("dec rdi"); 
+    emit("test rax, rax"); 
+    emit("jnz .utoa_loop");
+    emit("cmp r11, 1"); 
+    emit("jne .skip_minus"); 
+    emit("mov byte [rdi], '-'"); 
+    emit("dec rdi");
+    emitLabel(".skip_minus");
+    emit("inc rdi"); 
+    emit("mov rsi, rdi"); 
+    emit("mov rdx, int_buffer + 20"); 
+    emit("sub rdx, rsi");
+    emit("mov rax, 1"); 
+    emit("mov rdi, 1"); 
+    emit("syscall"); 
+    emit("ret");
+
+    if (m_runtime_parts & FLOAT_RUNTIME)
+    {
+        emitFloatPrinter();
+    }
+
+    // Maps and built strings take their memory from here: rsi bytes of fresh, zeroed memory in
+    // rax, or the program stops. Clobbers rcx, rdx, rdi and r8-r11.
+    if (m_runtime_parts & (MAP_RUNTIME | STRING_BUILDING))
+    {
+        emitRuntimeError("_memory_error", "Runtime Error: out of memory.");
+        emitLabel("_mmap");
+        emit("mov rax, 9");
+        emit("xor edi, edi");
+        emit("mov rdx, 3");
+        emit("mov r10, 0x22");
+        emit("mov r8, -1");
+        emit("xor r9d, r9d");
+        emit("syscall");
+        emit("cmp rax, -4096");
+        emit("ja _memory_error");
+        emit("ret");
+    }
+
+    if (m_runtime_parts & MAP_RUNTIME)
+    {
+        emitMapRuntime();
+    }
+    if (m_runtime_parts & STRING_BUILDING)
+    {
+        emitStringRuntime();
+    }
+    // _string_join measures both strings with _strlen.
+    bool compare = m_runtime_parts & STRING_COMPARISON;
+    bool length = m_runtime_parts & (STRING_LENGTH | STRING_BUILDING);
+    if (compare || length)
+    {
+        emitStringSearch(compare, length);
+    }
+}
+
+// Maps as MapTable lays them out, from memory the program maps itself. _map_new takes rdi = 1 for
+// string keys and the number of entries to make room for in rsi, and returns the table in rax.
+// _map_slot takes the table in rdi, the key in rsi and rdx = 1 to add a missing entry, and
+// returns the address of the entry's value in rax, or 0. Tables are cut from map_arena, a bump
+// allocator refilled a chunk at a time, except for those big enough to get a mapping of their
+// own, which are unmapped again when the table outgrows them. Both leave r12-r15 and rbp alone.
+void CodeGenerator::emitMapRuntime()
+{
+    auto field = [](size_t offset) { return "[rdi + " + std::to_string(offset) + "]"; };
+    const std::string ENTRIES = field(offsetof(MapTable, entries));
+    const std::string CONTROL = field(offsetof(MapTable, control));
+    const std::string MASK = field(offsetof(MapTable, mask));
+    const std::string COUNT = field(offsetof(MapTable, count));
+    const std::string STRING_KEYS = field(offsetof(MapTable, string_keys));
+    const std::string LIMIT = field(offsetof(MapTable, limit));
+    const std::string CHUNK = std::to_string(MapArena::CHUNK);
+    const std::string LARGE_BLOCK = std::to_string(MapArena::LARGE_BLOCK);
+
+    m_out << "\nsection .bss\n";
+    // The next free byte of the current chunk, and its end.
+    emitLabel("map_arena");
+    emit("resq 2");
+
+    m_out << "\nsection .text\n";
+    // rax bytes of zeroed, 16-byte aligned memory in rax. Keeps every other register.
+    emitLabel("_map_alloc");
+    for (const char* reg : {"rcx", "rdx", "rsi", "rdi", "r8", "r9", "r10", "r11"})
+    {
+        emit(std::string("push ") + reg);
+    }
+    emit("add rax, 15");
+    emit("and rax, -16");
+    emit("mov rsi, rax");
+    emit("cmp rax, " + LARGE_BLOCK);
+    emit("jae .map_alloc_own");
+    emit("mov rdi, map_arena");
+    emit("mov rcx, [rdi]");
+    emit("add rax, rcx");
+    emit("cmp rax, [rdi + 8]");
+    emit("jbe .map_alloc_cut");
+    emit("push rsi");
+    emit("mov rsi, " + CHUNK);
+    emit("call _mmap");
+    emit("pop rsi");
+    emit("mov rdi, map_arena");
+    emit("lea rdx, [rax + " + CHUNK + "]");
+    emit("mov [rdi + 8], rdx");
+    emit("mov rcx, rax");
+    emit("add rax, rsi");
+    emitLabel(".map_alloc_cut");
+    emit("mov [rdi], rax");
+    emit("mov rax, rcx");
+    emit("jmp .map_alloc_done");
+    emitLabel(".map_alloc_own");
+    emit("call _mmap");
+    emitLabel(".map_alloc_done");
+    for (const char* reg : {"r11", "r10", "r9", "r8", "rdi", "rsi", "rdx", "rcx"})
+    {
+        emit(std::string("pop ") + reg);
+    }
+    emit("ret");
+
+    // Gives the table in rdi rcx empty slots (a power of two). Keeps every register but rax.
+    emitLabel("_map_table");
+    emit("mov rax, rcx");
+    emit("shl rax, 4");
+    emit("add rax, rcx");
+    emit("call _map_alloc");
+    emit("mov " + ENTRIES + ", rax");
+    emit("push rdx");
+    emit("mov rdx, rcx");
+    emit("shl rdx, 4");
+    emit("add rdx, rax");
+    emit("mov " + CONTROL + ", rdx");
+    emit("lea rdx, [rcx - 1]");
+    emit("mov " + MASK + ", rdx");
+    emit("mov rdx, rcx");
+    emit("shr rdx, 2");
+    emit("lea rdx, [rdx + rdx*2]");
+    emit("mov " + LIMIT + ", rdx");
+    emit("pop rdx");
+    emit("ret");
+
+    // The hash of the key rsi of the table in rdi, in r8. Keeps every register but rax.
+    emitLabel("_map_hash");
+    emit("mov r8, rsi");
+    emit("cmp qword " + STRING_KEYS + ", 0");
+    emit("je .map_hash_mix");
+    emit("push rsi");
+    emit("push r10");
+    emit("mov r8, 0xcbf29ce484222325");
+    emit("mov r10, 0x100000001b3");
+    emitLabel(".map_hash_text");
+    emit("movzx eax, byte [rsi]");
+    emit("test eax, eax");
+    emit("jz .map_hash_texted");
+    emit("xor r8, rax");
+    emit("imul r8, r10");
+    emit("inc rsi");
+    emit("jmp .map_hash_text");
+    emitLabel(".map_hash_texted");
+    emit("pop r10");
+    emit("pop rsi");
+    emitLabel(".map_hash_mix");
+    emit("mov rax, 0x9e3779b97f4a7c15");
+    emit("imul r8, rax");
+    emit("mov rax, r8");
+    emit("shr rax, 32");
+    emit("xor r8, rax");
+    emit("ret");
+
+    // Sets ZF if the strings at r10 and r11 are the same text. Clobbers both.
+    emitLabel("_map_same_text");
+    emit("push rax");
+    emitLabel(".map_same_loop");
+    emit("mov al, [r10]");
+    emit("cmp al, [r11]");
+    emit("jne .map_same_done");
+    emit("inc r10");
+    emit("inc r11");
+    emit("test al, al");
+    emit("jnz .map_same_loop");
+    emitLabel(".map_same_done");
+    emit("pop rax");
+    emit("ret");
+
+    // Moves the entries of the table in rdi into twice as many slots. Keeps rdi, rsi, rdx, r8
+    // and r9.
+    emitLabel("_map_grow");
+    emit("push rsi");
+    emit("push rdx");
+    emit("push r8");
+    emit("push r9");
+    emit("mov r9, " + MASK);
+    emit("inc r9");
+    emit("mov r10, " + ENTRIES);
+    emit("mov r11, " + CONTROL);
+    emit("lea rcx, [r9 + r9]");
+    emit("call _map_table");
+    emit("xor edx, edx");
+    emitLabel(".map_grow_entry");
+    emit("cmp byte [r11 + rdx], 0");
+    emit("je .map_grow_next");
+    emit("mov rcx, rdx");
+    emit("shl rcx, 4");
+    emit("mov rsi, [r10 + rcx]");
+    emit("call _map_hash");
+    emit("mov rcx, r8");
+    emit("mov rax, " + CONTROL);
+    emitLabel(".map_grow_probe");
+    emit("and rcx, " + MASK);
+    emit("cmp byte [rax + rcx], 0");
+    emit("je .map_grow_place");
+    emit("inc rcx");
+    emit("jmp .map_grow_probe");
+    emitLabel(".map_grow_place");
+    emit("mov r8b, [r11 + rdx]");
+    emit("mov [rax + rcx], r8b");
+    emit("shl rcx, 4");
+    emit("add rcx, " + ENTRIES);
+    emit("mov [rcx], rsi");
+    emit("mov rax, rdx");
+    emit("shl rax, 4");
+    emit("mov rax, [r10 + rax + 8]");
+    emit("mov [rcx + 8], rax");
+    emitLabel(".map_grow_next");
+    emit("inc rdx");
+    emit("cmp rdx, r9");
+    emit("jb .map_grow_entry");
+    // The old slots go back if they had a mapping of their own.
+    emit("mov rsi, r9");
+    emit("shl rsi, 4");
+    emit("add rsi, r9");
+    emit("add rsi, 15");
+    emit("and rsi, -16");
+    emit("cmp rsi, " + LARGE_BLOCK);
+    emit("jb .map_grow_done");
+    emit("push rdi");
+    emit("mov rdi, r10");
+    emit("mov rax, 11");
+    emit("syscall");
+    emit("pop rdi");
+    emitLabel(".map_grow_done");
+    emit("pop r9");
+    emit("pop r8");
+    emit("pop rdx");
+    emit("pop rsi");
+    emit("ret");
+
+    emitLabel("_map_new");
+    emit("test rsi, rsi");
+    emit("jns .map_new_room");
+    emit("xor esi, esi");
+    emitLabel(".map_new_room");
+    emit("mov rax, " + std::to_string(uint64_t(1) << 40));
+    emit("cmp rsi, rax");
+    emit("cmova rsi, rax");
+    emit("mov rcx, 8");
+    emitLabel(".map_new_size");
+    emit("mov rax, rcx");
+    emit("shr rax, 2");
+    emit("lea rax, [rax + rax*2]");
+    emit("cmp rax, rsi");
+    emit("jae .map_new_sized");
+    emit("add rcx, rcx");
+    emit("jmp .map_new_size");
+    emitLabel(".map_new_sized");
+    emit("mov rdx, rdi");
+    emit("mov rax, " + std::to_string(sizeof(MapTable)));
+    emit("call _map_alloc");
+    emit("mov rdi, rax");
+    emit("mov " + STRING_KEYS + ", rdx");
+    emit("call _map_table");
+    emit("mov rax, rdi");
+    emit("ret");
+
+    // Probes from the slot the hash picks; a slot's control byte is checked before its key.
+    emitLabel("_map_slot");
+    emit("call _map_hash");
+    emit("mov r9, r8");
+    emit("shr r9, 57");
+    emit("or r9, 0x80");
+    emitLabel(".map_slot_probe");
+    emit("mov rcx, r8");
+    emitLabel(".map_slot_next");
+    emit("and rcx, " + MASK);
+    emit("mov r11, " + CONTROL);
+    emit("movzx eax, byte [r11 + rcx]");
+    emit("test eax, eax");
+    emit("jz .map_slot_empty");
+    emit("cmp rax, r9");
+    emit("jne .map_slot_skip");
+    emit("mov rax, rcx");
+    emit("shl rax, 4");
+    emit("add rax, " + ENTRIES);
+    emit("cmp [rax], rsi");
+    emit("je .map_slot_found");
+    emit("cmp qword " + STRING_KEYS + ", 0");
+    emit("je .map_slot_skip");
+    emit("mov r10, [rax]");
+    emit("mov r11, rsi");
+    emit("call _map_same_text");
+    emit("je .map_slot_found");
+    emitLabel(".map_slot_skip");
+    emit("inc rcx");
+    emit("jmp .map_slot_next");
+    emitLabel(".map_slot_found");
+    emit("add rax, 8");
+    emit("ret");
+    emitLabel(".map_slot_empty");
+    emit("test rdx, rdx");
+    emit("jnz .map_slot_add");
+    emit("ret");
+    emitLabel(".map_slot_add");
+    emit("mov rax, " + COUNT);
+    emit("cmp rax, " + LIMIT);
+    emit("jae .map_slot_grow");
+    emit("inc rax");
+    emit("mov " + COUNT + ", rax");
+    emit("mov [r11 + rcx], r9b");
+    emit("mov rax, rcx");
+    emit("shl rax, 4");
+    emit("add rax, " + ENTRIES);
+    emit("mov [rax], rsi");
+    emit("add rax, 8");
+    emit("ret");
+    emitLabel(".map_slot_grow");
+    emit("call _map_grow");
+    emit("jmp .map_slot_probe");
+}
+
+// Built strings, cut from string_arena as StringArena does: _string_join takes the strings in
+// rdi and rsi, _string_text the integer in rdi, and both return the new string in rax.
+// _string_mark returns the arena's position in rax and _string_reset takes one in rdi. They keep
+// r12-r15 and rbp. The arena holds the chunk being cut from, the next free byte and the end of
+// that chunk, and a spare chunk; each chunk starts with the one before it and its own size.
+void CodeGenerator::emitStringRuntime()
+{
+    const std::string CHUNK = std::to_string(StringArena::CHUNK);
+
+    m_out << "\nsection .bss\n";
+    emitLabel("string_arena");
+    emit("resq 4");
+
+    m_out << "\nsection .text\n";
+    // rax bytes in rax. Keeps every other register.
+    emitLabel("_string_alloc");
+    for (const char* reg : {"rcx", "rdx", "rsi", "rdi", "r8", "r9", "r10", "r11"})
+    {
+        emit(std::string("push ") + reg);
+    }
+    emit("mov rdi, string_arena");
+    emit("mov rcx, [rdi + 8]");
+    emit("lea rdx, [rcx + rax]");
+    emit("cmp rdx, [rdi + 16]");
+    emit("jbe .string_alloc_cut");
+    // A new chunk of CHUNK bytes, or one of its own for a longer string; the spare chunk if it
+    // is big enough.
+    emit("lea rsi, [rax + 16]");
+    emit("mov rdx, " + CHUNK);
+    emit("cmp rsi, rdx");
+    emit("cmovb rsi, rdx");
+    emit("mov rcx, [rdi + 24]");
+    emit("test rcx, rcx");
+    emit("jz .string_alloc_map");
+    emit("cmp rsi, [rcx + 8]");
+    emit("ja .string_alloc_map");
+    emit("mov qword [rdi + 24], 0");
+    emit("jmp .string_alloc_link");
+    emitLabel(".string_alloc_map");
+    emit("push rax");
+    emit("call _mmap");
+    emit("mov rcx, rax");
+    emit("pop rax");
+    emit("mov rdi, string_arena");
+    emit("mov [rcx + 8], rsi");
+    emitLabel(".string_alloc_link");
+    emit("mov rdx, [rdi]");
+    emit("mov [rcx], rdx");
+    emit("mov [rdi], rcx");
+    emit("mov rdx, [rcx + 8]");
+    emit("add rdx, rcx");
+    emit("mov [rdi + 16], rdx");
+    emit("add rcx, 16");
+    emit("lea rdx, [rcx + rax]");
+    emitLabel(".string_alloc_cut");
+    emit("mov [rdi + 8], rdx");
+    emit("mov rax, rcx");
+    for (const char* reg : {"r11", "r10", "r9", "r8", "rdi", "rsi", "rdx", "rcx"})
+    {
+        emit(std::string("pop ") + reg);
+    }
+    emit("ret");
+
+    emitLabel("_string_join");
+    emit("push rdi");
+    emit("push rsi");
+    emit("call _strlen");
+    emit("mov r8, rax");
+    emit("mov rdi, [rsp]");
+    emit("call _strlen");
+    emit("mov r9, rax");
+    emit("lea rax, [r8 + r9 + 1]");
+    emit("call _string_alloc");
+    emit("mov rdx, rax");
+    emit("mov rdi, rax");
+    emit("mov rsi, [rsp + 8]");
+    emit("mov rcx, r8");
+    emit("rep movsb");
+    emit("pop rsi");
+    emit("lea rcx, [r9 + 1]");
+    emit("rep movsb");
+    emit("add rsp, 8");
+    emit("mov rax, rdx");
+    emit("ret");
+
+    // The digits are written backwards into a buffer on the stack, then copied out.
+    emitLabel("_string_text");
+    emit("sub rsp, 24");
+    emit("lea r8, [rsp + 23]");
+    emit("mov byte [r8], 0");
+    emit("mov rax, rdi");
+    emit("test rax, rax");
+    emit("jns .string_text_digit");
+    emit("neg rax");
+    emitLabel(".string_text_digit");
+    emit("mov r9, 10");
+    emitLabel(".string_text_loop");
+    emit("xor edx, edx");
+    emit("div r9");
+    emit("add dl, '0'");
+    emit("dec r8");
+    emit("mov [r8], dl");
+    emit("test rax, rax");
+    emit("jnz .string_text_loop");
+    emit("test rdi, rdi");
+    emit("jns .string_text_copy");
+    emit("dec r8");
+    emit("mov byte [r8], '-'");
+    emitLabel(".string_text_copy");
+    emit("lea rax, [rsp + 24]");
+    emit("sub rax, r8");
+    emit("mov rcx, rax");
+    emit("call _string_alloc");
+    emit("mov rdi, rax");
+    emit("mov rsi, r8");
+    emit("rep movsb");
+    emit("add rsp, 24");
+    emit("ret");
+
+    emitLabel("_string_mark");
+    emit("mov rax, string_arena");
+    emit("mov rax, [rax + 8]");
+    emit("ret");
+
+    // Drops the chunks after the one the mark is in, keeping the first as the spare if there is
+    // none, then moves the next free byte back to the mark.
+    emitLabel("_string_reset");
+    emit("mov r8, string_arena");
+    emitLabel(".string_reset_chunk");
+    emit("mov rax, [r8]");
+    emit("test rax, rax");
+    emit("jz .string_reset_done");
+    emit("lea rdx, [rax + 16]");
+    emit("cmp rdi, rdx");
+    emit("jb .string_reset_drop");
+    emit("cmp rdi, [r8 + 16]");
+    emit("jbe .string_reset_done");
+    emitLabel(".string_reset_drop");
+    emit("mov rdx, [rax]");
+    emit("mov [r8], rdx");
+    emit("xor ecx, ecx");
+    emit("test rdx, rdx");
+    emit("jz .string_reset_end");
+    emit("mov rcx, [rdx + 8]");
+    emit("add rcx, rdx");
+    emitLabel(".string_reset_end");
+    emit("mov [r8 + 16], rcx");
+    emit("cmp qword [r8 + 24], 0");
+    emit("jne .string_reset_unmap");
+    emit("mov [r8 + 24], rax");
+    emit("jmp .string_reset_chunk");
+    emitLabel(".string_reset_unmap");
+    emit("push rdi");
+    emit("mov rdi, rax");
+    emit("mov rsi, [rax + 8]");
+    emit("mov rax, 11");
+    emit("syscall");
+    emit("pop rdi");
+    emit("jmp .string_reset_chunk");
+    emitLabel(".string_reset_done");
+    emit("mov [r8 + 8], rdi");
+    emit("ret");
+}
+
+// Compares and measures strings as StringSearch does. _string_equal, _string_starts and
+// _string_contains take the strings in rdi and rsi and return 1 or 0 in rax, and _strlen returns
+// the length of the string in rdi. They work through two kernels: _string_differ_<isa> gives in
+// rax the offset of the first byte where the strings at rdi and rsi differ or the one at rsi
+// ends, and _string_find_<isa> the address of the first byte of the string at rdi that is sil
+// or ends it. Each comes in an SSE2 and an AVX2 version, and string_differ and string_find hold
+// the ones in use. They start out at stubs that have _string_cpu pick them on the first call.
+// Only what the program calls is emitted: the comparisons if `compare`, _strlen if `length`,
+// and the kernels those need. _strlen only
+// clobbers rcx, rdx, rsi and xmm0-xmm2, which _string_join relies on; _string_contains also
+// clobbers r8-r10.
+void CodeGenerator::emitStringSearch(bool compare, bool length)
+{
+    m_out << "\nsection .data\n";
+    if (compare)
+    {
+        emitLabel("string_differ");
+        emit("dq _string_differ_pick");
+    }
+    emitLabel("string_find");
+    emit("dq _string_find_pick");
+
+    m_out << "\nsection .text\n";
+    for (bool avx2 : {false, true})
+    {
+        const std::string isa = avx2 ? "avx2" : "sse2";
+        const int width = avx2 ? 32 : 16;
+        auto vector = [&](int n) { return (avx2 ? "ymm" : "xmm") + std::to_string(n); };
+        // `d` = `d` <op> `source`, in the two operand SSE form or the three operand VEX one.
+        auto op = [&](const std::string& name, int d, const std::string& source)
+        {
+            emit(avx2 ? "v" + name + " " + vector(d) + ", " + vector(d) + ", " + source : name + " " + vector(d) + ", " + source);
+        };
+        auto load = [&](const std::string& name, int d, const std::string& address)
+        {
+            emit((avx2 ? "v" : "") + name + " " + vector(d) + ", " + address);
+        };
+        auto mask = [&](const std::string& reg, int source)
+        {
+            emit((avx2 ? "vpmovmskb " : "pmovmskb ") + reg + ", " + vector(source));
+        };
+        auto leave = [&]()
+        {
+            if (avx2)
+            {
+                emit("vzeroupper");
+            }
+            emit("ret");
+        };
+
+        if (compare)
+        {
+            // Equal bytes compare to all ones, so their minimum with the byte of rsi is zero
+            // exactly where the strings differ or rsi's ends. Both strings may be anywhere in
+            // their page: near its end a block would run into the next one, so those bytes are
+            // done one at a time.
+            emitLabel("_string_differ_" + isa);
+            emit("xor eax, eax");
+            emitLabel(".differ_block");
+            for (const char* reg : {"rdi", "rsi"})
+            {
+                emit(std::string("lea rcx, [") + reg + " + rax]");
+                emit("and ecx, 4095");
+                emit("cmp ecx, " + std::to_string(4096 - width));
+                emit("ja .differ_byte");
+            }
+            load("movdqu", 0, "[rdi + rax]");
+            load("movdqu", 1, "[rsi + rax]");
+            op("pcmpeqb", 0, vector(1));
+            op("pminub", 0, vector(1));
+            op("pxor", 2, vector(2));
+            op("pcmpeqb", 0, vector(2));
+            mask("ecx", 0);
+            emit("test ecx, ecx");
+            emit("jnz .differ_found");
+            emit("add rax, " + std::to_string(width));
+            emit("jmp .differ_block");
+            emitLabel(".differ_byte");
+            emit("movzx ecx, byte [rsi + rax]");
+            emit("test ecx, ecx");
+            emit("jz .differ_done");
+            emit("cmp cl, [rdi + rax]");
+            emit("jne .differ_done");
+            emit("inc rax");
+            emit("jmp .differ_block");
+            emitLabel(".differ_found");
+            emit("bsf ecx, ecx");
+            emit("add rax, rcx");
+            emitLabel(".differ_done");
+            leave();
+        }
+
+        // Aligned blocks never cross a page. The first is the one rdi is in, with the bits of
+        // the bytes before rdi shifted out.
+        emitLabel("_string_find_" + isa);
+        emit("movzx eax, sil");
+        emit("mov rcx, 0x0101010101010101");
+        emit("imul rax, rcx");
+        emit("movq xmm2, rax");
+        emit(avx2 ? "vpbroadcastq ymm2, xmm2" : "punpcklqdq xmm2, xmm2");
+        emit("mov rax, rdi");
+        emit("and rax, -" + std::to_string(width));
+        emit("mov ecx, edi");
+        emit("and ecx, " + std::to_string(width - 1));
+        auto hits = [&]()
+        {
+            load("movdqa", 0, "[rax]");
+            op("pxor", 1, vector(1));
+            op("pcmpeqb", 1, vector(0));
+            op("pcmpeqb", 0, vector(2));
+            op("por", 0, vector(1));
+            mask("edx", 0);
+        };
+        hits();
+        emit("shr edx, cl");
+        emit("test edx, edx");
+        emit("jz .find_block");
+        emit("bsf edx, edx");
+        emit("lea rax, [rdi + rdx]");
+        leave();
+        emitLabel(".find_block");
+        emit("add rax, " + std::to_string(width));
+        hits();
+        emit("test edx, edx");
+        emit("jz .find_block");
+        emit("bsf edx, edx");
+        emit("add rax, rdx");
+        leave();
+    }
+
+    // Uses the AVX2 kernels if the processor has AVX2 and the system saves the ymm registers,
+    // the SSE2 ones otherwise. Keeps every register.
+    emitLabel("_string_cpu");
+    for (const char* reg : {"rax", "rbx", "rcx", "rdx"})
+    {
+        emit(std::string("push ") + reg);
+    }
+    if (compare)
+    {
+        emit("mov rax, _string_differ_sse2");
+        emit("mov [string_differ], rax");
+    }
+    emit("mov rax, _string_find_sse2");
+    emit("mov [string_find], rax");
+    emit("xor eax, eax");
+    emit("cpuid");
+    emit("cmp eax, 7");
+    emit("jb .cpu_done");
+    // OSXSAVE and AVX, then the xmm and ymm state enabled in XCR0, then AVX2.
+    emit("mov eax, 1");
+    emit("cpuid");
+    emit("and ecx, 0x18000000");
+    emit("cmp ecx, 0x18000000");
+    emit("jne .cpu_done");
+    emit("xor ecx, ecx");
+    emit("xgetbv");
+    emit("and eax, 6");
+    emit("cmp eax, 6");
+    emit("jne .cpu_done");
+    emit("mov eax, 7");
+    emit("xor ecx, ecx");
+    emit("cpuid");
+    emit("test ebx, 0x20");
+    emit("jz .cpu_done");
+    if (compare)
+    {
+        emit("mov rax, _string_differ_avx2");
+        emit("mov [string_differ], rax");
+    }
+    emit("mov rax, _string_find_avx2");
+    emit("mov [string_find], rax");
+    emitLabel(".cpu_done");
+    for (const char* reg : {"rdx", "rcx", "rbx", "rax"})
+    {
+        emit(std::string("pop ") + reg);
+    }
+    emit("ret");
+
+    if (compare)
+    {
+        emitLabel("_string_differ_pick");
+        emit("call _string_cpu");
+        emit("jmp [string_differ]");
+    }
+    emitLabel("_string_find_pick");
+    emit("call _string_cpu");
+    emit("jmp [string_find]");
+
+    if (length)
+    {
+        emitLabel("_strlen");
+        emit("xor esi, esi");
+        emit("call [string_find]");
+        emit("sub rax, rdi");
+        emit("ret");
+    }
+    if (!compare)
+    {
+        return;
+    }
+
+    emitLabel("_string_equal");
+    emit("mov eax, 1");
+    emit("cmp rdi, rsi");
+    emit("je .string_equal_done");
+    emit("call [string_differ]");
+    emit("movzx ecx, byte [rdi + rax]");
+    emit("cmp cl, [rsi + rax]");
+    emit("sete al");
+    emit("movzx eax, al");
+    emitLabel(".string_equal_done");
+    emit("ret");
+
+    emitLabel("_string_starts");
+    emit("call [string_differ]");
+    emit("cmp byte [rsi + rax], 0");
+    emit("sete al");
+    emit("movzx eax, al");
+    emit("ret");
+
+    // Every place the first byte of rsi turns up is checked for the rest of it: r8 is where the
+    // search goes on, r9 the string looked for and r10 its first byte.
+    emitLabel("_string_contains");
+    emit("mov r8, rdi");
+    emit("mov r9, rsi");
+    emit("movzx r10d, byte [rsi]");
+    emit("test r10d, r10d");
+    emit("jz .string_contains_yes");
+    emitLabel(".string_contains_next");
+    emit("mov rdi, r8");
+    emit("mov esi, r10d");
+    emit("call [string_find]");
+    emit("cmp byte [rax], 0");
+    emit("je .string_contains_no");
+    emit("lea r8, [rax + 1]");
+    emit("mov rdi, r8");
+    emit("lea rsi, [r9 + 1]");
+    emit("call [string_differ]");
+    emit("cmp byte [r9 + rax + 1], 0");
+    emit("jne .string_contains_next");
+    emitLabel(".string_contains_yes");
+    emit("mov eax, 1");
+    emit("ret");
+    emitLabel(".string_contains_no");
+    emit("xor eax, eax");
+    emit("ret");
+}
+
+// Prints xmm0 as formatFloat does, with the Burger-Dybvig free-format algorithm on exact
+// bignums: the value and the half-way points to its neighbours are scaled to R / S, M+ / S and
+// M- / S, and decimal digits of R / S are produced until the digits so far fall within a
+// half-way point of the value. Each number is 20 little-endian limbs in flt_big (R, S, M+, M-,
+// and T for sums), enough for the widest, those of the smallest subnormal; once the scaling is
+// done only the limbs S can reach are worked on. Keeps the callee-saved registers: r12 points at
+// flt_big, r13 is the working limb count, r14 the decimal exponent k, r15 the output cursor, and
+// rbp 1 if the bounds count as inside (the significand is even).
+void CodeGenerator::emitFloatPrinter()
+{
+    const int LIMBS = 20;
+    const int BIG = LIMBS * 8;
+    const std::string R = "r12";
+    const std::string S = "r12 + " + std::to_string(BIG);
+    const std::string M_PLUS = "r12 + " + std::to_string(2 * BIG);
+    const std::string M_MINUS = "r12 + " + std::to_string(3 * BIG);
+    const std::string T = "r12 + " + std::to_string(4 * BIG);
+    // Scratch words after the numbers: the boundary shift u, then p and q.
+    const std::string U = "[r12 + " + std::to_string(5 * BIG) + "]";
+    const std::string P = "[r12 + " + std::to_string(5 * BIG + 8) + "]";
+    const std::string Q = "[r12 + " + std::to_string(5 * BIG + 16) + "]";
+    // Calls a helper on numbers in flt_big, or on one and a scalar.
+    auto numbers = [&](const std::string& helper, const std::string& rdi, const std::string& rsi, const std::string& rdx = "")
+    {
+        emit("lea rdi, [" + rdi + "]");
+        emit("lea rsi, [" + rsi + "]");
+        if (!rdx.empty())
+        {
+            emit("lea rdx, [" + rdx + "]");
+        }
+        emit("call " + helper);
+    };
+    auto scalar = [&](const std::string& helper, const std::string& rdi, const std::string& rsi)
+    {
+        emit("lea rdi, [" + rdi + "]");
+        if (rsi != "rsi")
+        {
+            emit("mov rsi, " + rsi);
+        }
+        emit("call " + helper);
+    };
+    auto character = [&](char c)
+    {
+        emit(std::string("mov byte [r15], '") + c + "'");
+        emit("inc r15");
+    };
+
+    m_out << "\nsection .bss\n";
+    emitLabel("flt_big");
+    emit("resq " + std::to_string(5 * LIMBS + 3));
+    emitLabel("flt_digits");
+    emit("resb 24");
+    emitLabel("flt_out");
+    emit("resb 40");
+
+    m_out << "\nsection .text\n";
+    emitLabel("_print_float");
+    emit("push rbx");
+    emit("push rbp");
+    emit("push r12");
+    emit("push r13");
+    emit("push r14");
+    emit("push r15");
+    emit("mov r12, flt_big");
+    emit("mov r15, flt_out");
+    emit("mov r13, " + std::to_string(LIMBS));
+    emit("movq rax, xmm0");
+    emit("test rax, rax");
+    emit("jns .flt_positive");
+    character('-');
+    emit("shl rax, 1");
+    emit("shr rax, 1");
+    emitLabel(".flt_positive");
+    emit("mov rdx, rax");
+    emit("shr rdx, 52");
+    emit("mov rbx, 0xFFFFFFFFFFFFF");
+    emit("and rbx, rax");
+    emit("cmp rdx, 0x7FF");
+    emit("jne .flt_finite");
+    emit("test rbx, rbx");
+    emit("jz .flt_infinity");
+    emit("mov r15, flt_out");
+    character('n');
+    character('a');
+    character('n');
+    emit("jmp .flt_write");
+    emitLabel(".flt_infinity");
+    character('i');
+    character('n');
+    character('f');
+    emit("jmp .flt_write");
+    emitLabel(".flt_finite");
+    emit("test rax, rax");
+    emit("jnz .flt_nonzero");
+    character('0');
+    character('.');
+    character('0');
+    emit("jmp .flt_write");
+
+    // v = f * 2^e. The gap to the next value down is half the usual one when f is a power of
+    // two above the smallest normal exponent, which u accounts for: R = f * 2^(p+1+u),
+    // S = 2^(q+1+u), M+ = 2^(p+u), M- = 2^p, with p = max(e, 0) and q = max(-e, 0).
+    emitLabel(".flt_nonzero");
+    emit("mov r14, -1074");
+    emit("test rdx, rdx");
+    emit("jz .flt_decoded");
+    emit("lea r14, [rdx - 1075]");
+    emit("mov rax, 0x10000000000000");
+    emit("or rbx, rax");
+    emitLabel(".flt_decoded");
+    emit("mov ebp, 1");
+    emit("test rbx, 1");
+    emit("jz .flt_even");
+    emit("xor ebp, ebp");
+    emitLabel(".flt_even");
+    emit("xor eax, eax");
+    emit("mov rcx, 0x10000000000000");
+    emit("cmp rbx, rcx");
+    emit("jne .flt_no_u");
+    emit("cmp rdx, 1");
+    emit("jbe .flt_no_u");
+    emit("mov eax, 1");
+    emitLabel(".flt_no_u");
+    emit("mov " + U + ", rax");
+    emit("xor eax, eax");
+    emit("xor ecx, ecx");
+    emit("test r14, r14");
+    emit("js .flt_negative_e");
+    emit("mov rax, r14");
+    emit("jmp .flt_shifts");
+    emitLabel(".flt_negative_e");
+    emit("mov rcx, r14");
+    emit("neg rcx");
+    emitLabel(".flt_shifts");
+    emit("mov " + P + ", rax");
+    emit("mov " + Q + ", rcx");
+    emit("add rax, " + U);
+    emit("lea rsi, [rax + 1]");
+    scalar("_flt_pow2", R, "rsi");
+    scalar("_flt_mul", R, "rbx");
+    emit("mov rsi, " + Q);
+    emit("add rsi, " + U);
+    emit("inc rsi");
+    scalar("_flt_pow2", S, "rsi");
+    emit("mov rsi, " + P);
+    emit("add rsi, " + U);
+    scalar("_flt_pow2", M_PLUS, "rsi");
+    emit("mov rsi, " + P);
+    scalar("_flt_pow2", M_MINUS, "rsi");
+
+    // k = ceil(log10(2^x)) for x = floor(log2(v)) is the decimal exponent or one below it.
+    // floor(x * log10(2)) is (x * 78913) >> 18 over the whole exponent range.
+    emit("bsr rax, rbx");
+    emit("add rax, r14");
+    emit("xor r14, r14");
+    emit("test rax, rax");
+    emit("jz .flt_estimated");
+    emit("mov rcx, 78913");
+    emit("imul rax, rcx");
+    emit("sar rax, 18");
+    emit("lea r14, [rax + 1]");
+    emitLabel(".flt_estimated");
+    emit("test r14, r14");
+    emit("js .flt_scale_up");
+    scalar("_flt_pow10", S, "r14");
+    emit("jmp .flt_scaled");
+    emitLabel(".flt_scale_up");
+    emit("mov rbx, r14");
+    emit("neg rbx");
+    scalar("_flt_pow10", R, "rbx");
+    scalar("_flt_pow10", M_PLUS, "rbx");
+    scalar("_flt_pow10", M_MINUS, "rbx");
+    emitLabel(".flt_scaled");
+    numbers("_flt_add", T, R, M_PLUS);
+    numbers("_flt_cmp", T, S);
+    emit("add rax, rbp");
+    emit("jle .flt_fixed_up");
+    scalar("_flt_mul", S, "10");
+    emit("inc r14");
+    emitLabel(".flt_fixed_up");
+    // Every number now fits two limbs above the top one of S.
+    emit("lea rcx, [" + S + "]");
+    emit("mov rax, " + std::to_string(LIMBS - 1));
+    emitLabel(".flt_top");
+    emit("cmp qword [rcx + rax*8], 0");
+    emit("jne .flt_top_found");
+    emit("dec rax");
+    emit("jmp .flt_top");
+    emitLabel(".flt_top_found");
+    emit("add rax, 3");
+    emit("mov r13, " + std::to_string(LIMBS));
+    emit("cmp rax, r13");
+    emit("cmovb r13, rax");
+
+    emit("mov rbx, flt_digits");
+    emitLabel(".flt_digit");
+    scalar("_flt_mul", R, "10");
+    scalar("_flt_mul", M_PLUS, "10");
+    scalar("_flt_mul", M_MINUS, "10");
+    emit("mov byte [rbx], '0'");
+    emitLabel(".flt_divide");
+    numbers("_flt_cmp", R, S);
+    emit("test rax, rax");
+    emit("js .flt_divided");
+    numbers("_flt_sub", R, R, S);
+    emit("inc byte [rbx]");
+    emit("jmp .flt_divide");
+    emitLabel(".flt_divided");
+    // Low: R < M- (or <=), the digits so far are within the lower half-way point. High:
+    // R + M+ > S (or >=), the next digit up is within the upper one.
+    numbers("_flt_cmp", R, M_MINUS);
+    emit("sub rax, rbp");
+    emit("mov " + U + ", rax");
+    numbers("_flt_add", T, R, M_PLUS);
+    numbers("_flt_cmp", T, S);
+    emit("add rax, rbp");
+    emit("jg .flt_high");
+    emit("cmp qword " + U + ", 0");
+    emit("jl .flt_last");
+    emit("inc rbx");
+    emit("jmp .flt_digit");
+    emitLabel(".flt_high");
+    emit("cmp qword " + U + ", 0");
+    emit("jl .flt_nearest");
+    emit("inc byte [rbx]");
+    emit("jmp .flt_last");
+    // Both digits are close enough; take the nearer, and the even one on a tie.
+    emitLabel(".flt_nearest");
+    numbers("_flt_add", T, R, R);
+    numbers("_flt_cmp", T, S);
+    emit("test rax, rax");
+    emit("js .flt_last");
+    emit("jnz .flt_round_up");
+    emit("test byte [rbx], 1");
+    emit("jz .flt_last");
+    emitLabel(".flt_round_up");
+    emit("inc byte [rbx]");
+    emitLabel(".flt_last");
+    emit("inc rbx");
+
+    // The digits are 0.ddd * 10^k. Exponents of the first digit (k - 1) from -4 to 15 are
+    // written out in full, the others in scientific notation.
+    emit("mov rdx, rbx");
+    emit("mov rsi, flt_digits");
+    emit("sub rdx, rsi");
+    emit("mov rdi, r15");
+    emit("lea rax, [r14 - 1]");
+    emit("cmp rax, -4");
+    emit("jl .flt_scientific");
+    emit("cmp rax, 16");
+    emit("jge .flt_scientific");
+    emit("test r14, r14");
+    emit("jg .flt_whole");
+    emit("mov byte [rdi], '0'");
+    emit("mov byte [rdi + 1], '.'");
+    emit("add rdi, 2");
+    emit("mov rcx, r14");
+    emit("neg rcx");
+    emit("mov al, '0'");
+    emit("rep stosb");
+    emit("mov rcx, rdx");
+    emit("rep movsb");
+    emit("jmp .flt_written");
+    emitLabel(".flt_whole");
+    emit("cmp r14, rdx");
+    emit("jl .flt_point");
+    emit("mov rcx, rdx");
+    emit("rep movsb");
+    emit("mov rcx, r14");
+    emit("sub rcx, rdx");
+    emit("mov al, '0'");
+    emit("rep stosb");
+    emit("mov byte [rdi], '.'");
+    emit("mov byte [rdi + 1], '0'");
+    emit("add rdi, 2");
+    emit("jmp .flt_written");
+    emitLabel(".flt_point");
+    emit("mov rcx, r14");
+    emit("rep movsb");
+    emit("mov byte [rdi], '.'");
+    emit("inc rdi");
+    emit("mov rcx, rdx");
+    emit("sub rcx, r14");
+    emit("rep movsb");
+    emit("jmp .flt_written");
+    emitLabel(".flt_scientific");
+    emit("movsb");
+    emit("lea rcx, [rdx - 1]");
+    emit("test rcx, rcx");
+    emit("jz .flt_exponent");
+    emit("mov byte [rdi], '.'");
+    emit("inc rdi");
+    emit("rep movsb");
+    emitLabel(".flt_exponent");
+    emit("mov byte [rdi], 'e'");
+    emit("mov byte [rdi + 1], '+'");
+    emit("test rax, rax");
+    emit("jns .flt_exponent_sign");
+    emit("mov byte [rdi + 1], '-'");
+    emit("neg rax");
+    emitLabel(".flt_exponent_sign");
+    emit("add rdi, 2");
+    emit("mov rcx, 10");
+    emit("cmp rax, 100");
+    emit("jb .flt_two_digits");
+    emit("xor edx, edx");
+    emit("mov r8, 100");
+    emit("div r8");
+    emit("add al, '0'");
+    emit("mov [rdi], al");
+    emit("inc rdi");
+    emit("mov rax, rdx");
+    emitLabel(".flt_two_digits");
+    emit("xor edx, edx");
+    emit("div rcx");
+    emit("add al, '0'");
+    emit("add dl, '0'");
+    emit("mov [rdi], al");
+    emit("mov [rdi + 1], dl");
+    emit("add rdi, 2");
+    emitLabel(".flt_written");
+    emit("mov r15, rdi");
+    emitLabel(".flt_write");
+    emit("mov rsi, flt_out");
+    emit("mov rdx, r15");
+    emit("sub rdx, rsi");
+    emit("mov rax, 1");
+    emit("mov rdi, 1");
+    emit("syscall");
+    emit("pop r15");
+    emit("pop r14");
+    emit("pop r13");
+    emit("pop r12");
+    emit("pop rbp");
+    emit("pop rbx");
+    emit("ret");
+
+    // The bignum helpers work on the low r13 limbs. [rdi] *= rsi:
+    emitLabel("_flt_mul");
+    emit("xor ecx, ecx");
+    emit("xor r8d, r8d");
+    emitLabel(".mul_loop");
+    emit("mov rax, [rdi + rcx*8]");
+    emit("mul rsi");
+    emit("add rax, r8");
+    emit("adc rdx, 0");
+    emit("mov [rdi + rcx*8], rax");
+    emit("mov r8, rdx");
+    emit("inc rcx");
+    emit("cmp rcx, r13");
+    emit("jb .mul_loop");
+    emit("ret");
+
+    // [rdi] = [rsi] + [rdx] and [rdi] = [rsi] - [rdx]; inc and dec leave the carry alone.
+    for (const char* op : {"add", "sub"})
+    {
+        emitLabel(std::string("_flt_") + op);
+        emit("mov rcx, r13");
+        emit("xor r8d, r8d");
+        emitLabel(std::string(".") + op + "_loop");
+        emit("mov rax, [rsi + r8*8]");
+        emit(std::string(op == std::string("add") ? "adc" : "sbb") + " rax, [rdx + r8*8]");
+        emit("mov [rdi + r8*8], rax");
+        emit("inc r8");
+        emit("dec rcx");
+        emit(std::string("jnz .") + op + "_loop");
+        emit("ret");
+    }
+
+    // rax = -1, 0 or 1 as [rdi] is below, equal to or above [rsi].
+    emitLabel("_flt_cmp");
+    emit("mov rcx, r13");
+    emitLabel(".cmp_loop");
+    emit("mov rax, [rdi + rcx*8 - 8]");
+    emit("cmp rax, [rsi + rcx*8 - 8]");
+    emit("jne .cmp_differ");
+    emit("dec rcx");
+    emit("jnz .cmp_loop");
+    emit("xor eax, eax");
+    emit("ret");
+    emitLabel(".cmp_differ");
+    emit("sbb rax, rax");
+    emit("or rax, 1");
+    emit("ret");
+
+    // [rdi] = 2^rsi, over all the limbs.
+    emitLabel("_flt_pow2");
+    emit("mov rdx, rdi");
+    emit("xor eax, eax");
+    emit("mov rcx, " + std::to_string(LIMBS));
+    emit("rep stosq");
+    emit("mov rcx, rsi");
+    emit("shr rsi, 6");
+    emit("and rcx, 63");
+    emit("mov eax, 1");
+    emit("shl rax, cl");
+    emit("mov [rdx + rsi*8], rax");
+    emit("ret");
+
+    // [rdi] *= 10^rsi, 10^18 at a time.
+    emitLabel("_flt_pow10");
+    emit("mov r10, rsi");
+    emitLabel(".pow10_chunk");
+    emit("cmp r10, 18");
+    emit("jb .pow10_rest");
+    emit("mov rsi, 1000000000000000000");
+    emit("call _flt_mul");
+    emit("sub r10, 18");
+    emit("jmp .pow10_chunk");
+    emitLabel(".pow10_rest");
+    emit("mov esi, 1");
+    emitLabel(".pow10_power");
+    emit("test r10, r10");
+    emit("jz .pow10_last");
+    emit("lea rsi, [rsi + rsi*4]");
+    emit("add rsi, rsi");
+    emit("dec r10");
+    emit("jmp .pow10_power");
+    emitLabel(".pow10_last");
+    emit("jmp _flt_mul");
+}
+
+// Reached from every out of range array access and every read of a key a map has no entry for.
+void CodeGenerator::emitRuntimeErrors()
+{
+    emitRuntimeError("_index_error", "Runtime Error: array index out of range.");
+    if (m_runtime_parts & MAP_RUNTIME)
+    {
+        emitRuntimeError("_map_key_error", "Runtime Error: the map has no entry for the key.");
+    }
+}
+
+// Emits `label`, which reports the message on stderr and exits with status 1.
+void CodeGenerator::emitRuntimeError(const std::string& label, const std::string& message)
+{
+    m_out << "\nsection .rodata\n";
+    emitLabel(label + "_message");
+    emit("db `" + message + "\\n`");
+
+    m_out << "\nsection .text\n";
+    emitLabel(label);
+    emit("mov rax, 1");
+    emit("mov rdi, 2");
+    emit("mov rsi, " + label + "_message");
+    emit("mov rdx, " + std::to_string(message.size() + 1));
+    emit("syscall");
+    if (m_options.host_runtime)
+    {
+        emit("and rsp, -16");
+        emit("mov rdi, 1");
+        emit("call exit");
+    }
+    else
+    {
+        emit("mov rax, 60");
+        emit("mov rdi, 1");
+        emit("syscall");
+    }
+}
+
+// Runtimes for --profile and -fprofile-generate. They live in the entry module; the procedures
+// of other modules reach them as externs.
+void CodeGenerator::emitInstrumentation()
+{
+    bool pgo = !m_options.profile_generate.empty();
+    if (!m_options.profile && !pgo)
+    {
+        return;
+    }
+    if (m_options.module && !m_options.entry)
+    {
+        m_out << "\nextern " << (m_options.profile ? "_prof_enter, _prof_exit" : "") << (m_options.profile && pgo ? ", " : "") << (pgo ? "_pgo_enter" : "") << "\n";
+        return;
+    }
+    emitReportWriter();
+    if (m_options.profile)
+    {
+        emitProfileRuntime();
+    }
+    if (pgo)
+    {
+        emitPgoRuntime();
+    }
+}
+
+// Buffered file output for the instrumentation runtimes, which write their reports at exit.
+void CodeGenerator::emitReportWriter()
+{
+    m_out << "\nsection .rodata\n";
+    emitLabel("prof_space");
+    emit("db ` `, 0");
+    emitLabel("prof_eol");
+    emit("db 10, 0");
+
+    m_out << "\nsection .bss\n";
+    emitLabel("prof_fd");
+    emit("resq 1");
+    emitLabel("prof_out_len");
+    emit("resq 1");
+    emitLabel("prof_digits");
+    emit("resb 32");
+    emitLabel("prof_out");
+    emit("resb 4096");
+
+    m_out << "\nsection .text\n";
+    // Buffered output to prof_fd: al = one character, rsi = zero-terminated string,
+    // rax = unsigned number right-aligned to rcx columns.
+    emitLabel("_prof_putc");
+    emit("mov rdx, [prof_out_len]");
+    emit("mov rdi, prof_out");
+    emit("mov [rdi + rdx], al");
+    emit("inc rdx");
+    emit("mov [prof_out_len], rdx");
+    emit("cmp rdx, 4096");
+    emit("je _prof_flush");
+    emit("ret");
+
+    emitLabel("_prof_flush");
+    emit("mov rax, 1");
+    emit("mov rdi, [prof_fd]");
+    emit("mov rsi, prof_out");
+    emit("mov rdx, [prof_out_len]");
+    emit("syscall");
+    emit("mov qword [prof_out_len], 0");
+    emit("ret");
+
+    emitLabel("_prof_puts");
+    emit("movzx eax, byte [rsi]");
+    emit("test al, al");
+    emit("jz .end");
+    emit("push rsi");
+    emit("call _prof_putc");
+    emit("pop rsi");
+    emit("inc rsi");
+    emit("jmp _prof_puts");
+    emitLabel(".end");
+    emit("ret");
+
+    emitLabel("_prof_putu");
+    emit("mov r9, prof_digits + 31");
+    emit("mov byte [r9], 0");
+    emit("mov rsi, r9");
+    emit("mov r10, 10");
+    emitLabel(".digit");
+    emit("xor rdx, rdx");
+    emit("div r10");
+    emit("add dl, '0'");
+    emit("dec rsi");
+    emit("mov [rsi], dl");
+    emit("test rax, rax");
+    emit("jnz .digit");
+    emit("sub r9, rsi");
+    emitLabel(".pad");
+    emit("cmp r9, rcx");
+    emit("jae _prof_puts");
+    emit("push rcx");
+    emit("push rsi");
+    emit("push r9");
+    emit("mov al, ' '");
+    emit("call _prof_putc");
+    emit("pop r9");
+    emit("pop rsi");
+    emit("pop rcx");
+    emit("inc r9");
+    emit("jmp .pad");
+
+    // rdi = path.
+    emitLabel("_prof_open");
+    emit("mov rax, 2");
+    emit("mov rsi, 577");
+    emit("mov rdx, 420");
+    emit("syscall");
+    emit("mov [prof_fd], rax");
+    emit("mov qword [prof_out_len], 0");
+    emit("ret");
+
+    emitLabel("_prof_close");
+    emit("call _prof_flush");
+    emit("mov rax, 3");
+    emit("mov rdi, [prof_fd]");
+    emit("syscall");
+    emit("ret");
+}
+
+// Runtime for --profile. Each call enters a node of a calling-context tree (parent, first
+// child, next sibling, self cycles, calls, depth: 64 bytes) and pushes the previous node, its
+// procedure record and the rdtsc start onto a shadow stack. On return the elapsed cycles are
+// added to the node and the record and taken off the caller's, which leaves self time behind;
+// inclusive time is only counted when the outermost activation of a procedure returns. Direct
+// recursion stays in one node and the tree is capped in depth and size, so the collapsed stacks
+// stay small. At exit the records are written sorted by self time to lostrecord.prof and the
+// tree to lostrecord.folded.
+void CodeGenerator::emitProfileRuntime()
+{
+    const int nodes = 1 << 16;
+    const int node_size = 64;
+    const int max_depth = 256;
+    // Every call takes at least 16 bytes of an 8 MiB stack, so this many entries cannot overflow first.
+    const int stack_entries = 1 << 19;
+
+    m_out << "\nsection .rodata\n";
+    emitLabel("prof_flat_path");
+    emit("db `lostrecord.prof`, 0");
+    emitLabel("prof_folded_path");
+    emit("db `lostrecord.folded`, 0");
+    emitLabel("prof_flat_header");
+    emit("db `# flat profile in rdtsc cycles, sorted by self time\\n# total cycles: `, 0");
+    emitLabel("prof_flat_columns");
+    emit("db `\\n#      calls          self cycles   self%     inclusive cycles  procedure\\n`, 0");
+    emitLabel("prof_story_name");
+    emit("db `story`, 0");
+    emitLabel("prof_dot");
+    emit("db `.`, 0");
+    emitLabel("prof_gap");
+    emit("db `  `, 0");
+    emitLabel("prof_semicolon");
+    emit("db `;`, 0");
+    emitLabel("prof_memo_hits");
+    emit("db `  (memo: `, 0");
+    emitLabel("prof_memo_misses");
+    emit("db ` hits, `, 0");
+    emitLabel("prof_memo_end");
+    emit("db ` misses)`, 0");
+
+    m_out << "\nsection .bss\n";
+    emitLabel("prof_current");
+    emit("resq 1");
+    emitLabel("prof_next");
+    emit("resq 1");
+    emitLabel("prof_sp");
+    emit("resq 1");
+    emitLabel("prof_records");
+    emit("resq 1");
+    emitLabel("prof_start_tsc");
+    emit("resq 1");
+    emitLabel("prof_story");
+    emit("resq 8");
+    emitLabel("prof_stack");
+    emit("resq " + std::to_string(stack_entries * 3));
+    emitLabel("prof_nodes");
+    emit("resb " + std::to_string(nodes * node_size));
+    emitLabel("prof_nodes_end");
+    emit("resq 1");
+
+    m_out << "\nsection .text\n";
+    m_out << "; --- Profiler ---\n";
+    if (m_options.module)
+    {
+        m_out << "global _prof_enter, _prof_exit\n";
+    }
+    emitLabel("_prof_start");
+    emit("mov rax, prof_stack");
+    emit("mov [prof_sp], rax");
+    emit("mov rax, prof_nodes");
+    emit("mov [prof_current], rax");
+    emit("add rax, " + std::to_string(node_size));
+    emit("mov [prof_next], rax");
+    emit("rdtsc");
+    emit("shl rdx, 32");
+    emit("or rax, rdx");
+    emit("mov [prof_start_tsc], rax");
+    emit("ret");
+
+    // rax = the procedure's record. Preserves the argument registers.
+    emitLabel("_prof_enter");
+    emit("push rdx");
+    emit("push rbx");
+    emit("cmp qword [rax], 0");
+    emit("jne .linked");
+    emit("mov rbx, [prof_records]");
+    emit("mov [rax + 40], rbx");
+    emit("mov [prof_records], rax");
+    emitLabel(".linked");
+    emit("inc qword [rax]");
+    emit("inc qword [rax + 24]");
+    emit("mov r10, [prof_current]");
+    emit("mov r11, r10");
+    emit("cmp [r10], rax");
+    emit("je .found");
+    emit("mov r11, [r10 + 16]");
+    emitLabel(".find");
+    emit("test r11, r11");
+    emit("jz .alloc");
+    emit("cmp [r11], rax");
+    emit("je .found");
+    emit("mov r11, [r11 + 24]");
+    emit("jmp .find");
+    emitLabel(".alloc");
+    emit("mov r11, r10");
+    emit("cmp qword [r10 + 48], " + std::to_string(max_depth));
+    emit("jae .found");
+    emit("mov r11, [prof_next]");
+    emit("mov rbx, prof_nodes_end");
+    emit("cmp r11, rbx");
+    emit("jb .new_node");
+    emit("mov r11, r10");
+    emit("jmp .found");
+    emitLabel(".new_node");
+    emit("lea rbx, [r11 + " + std::to_string(node_size) + "]");
+    emit("mov [prof_next], rbx");
+    emit("mov [r11], rax");
+    emit("mov [r11 + 8], r10");
+    emit("mov rbx, [r10 + 16]");
+    emit("mov [r11 + 24], rbx");
+    emit("mov [r10 + 16], r11");
+    emit("mov rbx, [r10 + 48]");
+    emit("inc rbx");
+    emit("mov [r11 + 48], rbx");
+    emitLabel(".found");
+    emit("inc qword [r11 + 40]");
+    emit("mov [prof_current], r11");
+    emit("mov rbx, [prof_sp]");
+    emit("mov [rbx], r10");
+    emit("mov [rbx + 8], rax");
+    emit("rdtsc");
+    emit("shl rdx, 32");
+    emit("or rax, rdx");
+    emit("mov [rbx + 16], rax");
+    emit("add rbx, 24");
+    emit("mov [prof_sp], rbx");
+    emit("pop rbx");
+    emit("pop rdx");
+    emit("ret");
+
+    // Preserves rax, the procedure's result.
+    emitLabel("_prof_exit");
+    emit("push rax");
+    emit("push rbx");
+    emit("rdtsc");
+    emit("shl rdx, 32");
+    emit("or rax, rdx");
+    emit("mov r10, [prof_sp]");
+    emit("sub r10, 24");
+    emit("mov [prof_sp], r10");
+    emit("sub rax, [r10 + 16]");
+    emit("mov r11, [prof_current]");
+    emit("add [r11 + 32], rax");
+    emit("mov rbx, [r10]");
+    emit("mov [prof_current], rbx");
+    emit("sub [rbx + 32], rax");
+    emit("mov r11, [r10 + 8]");
+    emit("add [r11 + 8], rax");
+    emit("dec qword [r11 + 24]");
+    emit("jnz .nested");
+    emit("add [r11 + 16], rax");
+    emitLabel(".nested");
+    emit("mov rbx, prof_stack");
+    emit("cmp r10, rbx");
+    emit("je .done");
+    emit("mov r11, [r10 - 16]");
+    emit("sub [r11 + 8], rax");
+    emitLabel(".done");
+    emit("pop rbx");
+    emit("pop rax");
+    emit("ret");
+
+    // rbx = node. Writes the procedure names from the root down to the node.
+    emitLabel("_prof_path");
+    emit("cmp qword [rbx + 8], 0");
+    emit("jne .child");
+    emit("mov rsi, prof_story_name");
+    emit("jmp _prof_puts");
+    emitLabel(".child");
+    emit("push rbx");
+    emit("mov rbx, [rbx + 8]");
+    emit("call _prof_path");
+    emit("pop rbx");
+    emit("mov rsi, prof_semicolon");
+    emit("call _prof_puts");
+    emit("mov rsi, [rbx]");
+    emit("mov rsi, [rsi + 32]");
+    emit("jmp _prof_puts");
+
+    emitLabel("_prof_dump");
+    emit("rdtsc");
+    emit("shl rdx, 32");
+    emit("or rax, rdx");
+    emit("sub rax, [prof_start_tsc]");
+    emit("mov r15, rax");
+    emit("test r15, r15");
+    emit("jnz .timed");
+    emit("inc r15");
+    emitLabel(".timed");
+    // The main story's self time is what its callees left of the total.
+    emit("mov rbx, prof_nodes");
+    emit("add [rbx + 32], r15");
+    emit("mov rax, [rbx + 32]");
+    emit("mov rbx, prof_story");
+    emit("mov qword [rbx], 1");
+    emit("mov [rbx + 8], rax");
+    emit("mov [rbx + 16], r15");
+    emit("mov rax, prof_story_name");
+    emit("mov [rbx + 32], rax");
+    emit("mov rax, [prof_records]");
+    emit("mov [rbx + 40], rax");
+    emit("mov [prof_records], rbx");
+
+    emit("mov rdi, prof_flat_path");
+    emit("call _prof_open");
+    emit("mov rsi, prof_flat_header");
+    emit("call _prof_puts");
+    emit("mov rax, r15");
+    emit("xor rcx, rcx");
+    emit("call _prof_putu");
+    emit("mov rsi, prof_flat_columns");
+    emit("call _prof_puts");
+    // Selection sort by self cycles; a printed record is marked by setting its active count.
+    emitLabel(".flat_next");
+    emit("xor r12, r12");
+    emit("mov r13, [prof_records]");
+    emitLabel(".flat_scan");
+    emit("test r13, r13");
+    emit("jz .flat_pick");
+    emit("cmp qword [r13 + 24], 0");
+    emit("jne .flat_skip");
+    emit("test r12, r12");
+    emit("jz .flat_take");
+    emit("mov rax, [r13 + 8]");
+    emit("cmp rax, [r12 + 8]");
+    emit("jle .flat_skip");
+    emitLabel(".flat_take");
+    emit("mov r12, r13");
+    emitLabel(".flat_skip");
+    emit("mov r13, [r13 + 40]");
+    emit("jmp .flat_scan");
+    emitLabel(".flat_pick");
+    emit("test r12, r12");
+    emit("jz .flat_done");
+    emit("mov qword [r12 + 24], -1");
+    emit("mov rax, [r12]");
+    emit("mov rcx, 12");
+    emit("call _prof_putu");
+    emit("mov r14, [r12 + 8]");
+    emit("test r14, r14");
+    emit("jns .self_positive");
+    emit("xor r14, r14");
+    emitLabel(".self_positive");
+    emit("mov rax, r14");
+    emit("mov rcx, 21");
+    emit("call _prof_putu");
+    emit("mov rax, r14");
+    emit("mov rcx, 1000");
+    emit("mul rcx");
+    emit("div r15");
+    emit("xor rdx, rdx");
+    emit("mov rcx, 10");
+    emit("div rcx");
+    emit("push rdx");
+    emit("mov rcx, 6");
+    emit("call _prof_putu");
+    emit("mov rsi, prof_dot");
+    emit("call _prof_puts");
+    emit("pop rax");
+    emit("mov rcx, 1");
+    emit("call _prof_putu");
+    emit("mov rax, [r12 + 16]");
+    emit("mov rcx, 21");
+    emit("call _prof_putu");
+    emit("mov rsi, prof_gap");
+    emit("call _prof_puts");
+    emit("mov rsi, [r12 + 32]");
+    emit("call _prof_puts");
+    emit("mov rax, [r12 + 48]");
+    emit("or rax, [r12 + 56]");
+    emit("jz .flat_eol");
+    emit("mov rsi, prof_memo_hits");
+    emit("call _prof_puts");
+    emit("mov rax, [r12 + 48]");
+    emit("xor rcx, rcx");
+    emit("call _prof_putu");
+    emit("mov rsi, prof_memo_misses");
+    emit("call _prof_puts");
+    emit("mov rax, [r12 + 56]");
+    emit("xor rcx, rcx");
+    emit("call _prof_putu");
+    emit("mov rsi, prof_memo_end");
+    emit("call _prof_puts");
+    emitLabel(".flat_eol");
+    emit("mov rsi, prof_eol");
+    emit("call _prof_puts");
+    emit("jmp .flat_next");
+    emitLabel(".flat_done");
+    emit("call _prof_close");
+
+    emit("mov rdi, prof_folded_path");
+    emit("call _prof_open");
+    emit("mov r12, prof_nodes");
+    emitLabel(".folded_next");
+    emit("cmp r12, [prof_next]");
+    emit("jae .folded_done");
+    emit("cmp qword [r12 + 32], 0");
+    emit("jle .folded_skip");
+    emit("mov rbx, r12");
+    emit("call _prof_path");
+    emit("mov rsi, prof_space");
+    emit("call _prof_puts");
+    emit("mov rax, [r12 + 32]");
+    emit("xor rcx, rcx");
+    emit("call _prof_putu");
+    emit("mov rsi, prof_eol");
+    emit("call _prof_puts");
+    emitLabel(".folded_skip");
+    emit("add r12, " + std::to_string(node_size));
+    emit("jmp .folded_next");
+    emitLabel(".folded_done");
+    emit("call _prof_close");
+    emit("ret");
+}
+
+// Runtime for -fprofile-generate. Every instrumented scope owns a record (next, name, shape,
+// counter count, calls, counters) that links itself into a list on its first call; at exit
+// the list is written one line per scope, the format ProfileData reads back.
+void CodeGenerator::emitPgoRuntime()
+{
+    std::string path;
+    for (char c : m_options.profile_generate)
+    {
+        path += c == '`' || c == '\\' ? std::string("\\") + c : std::string(1, c);
+    }
+    m_out << "\nsection .rodata\n";
+    emitLabel("pgo_path");
+    emit("db `" + path + "`, 0");
+    emitLabel("pgo_header");
+    emit("db `# lostrecord profile: symbol shape calls counters...\\n`, 0");
+
+    m_out << "\nsection .bss\n";
+    emitLabel("pgo_records");
+    emit("resq 1");
+
+    m_out << "\nsection .text\n";
+    m_out << "; --- Training profile ---\n";
+    if (m_options.module)
+    {
+        m_out << "global _pgo_enter\n";
+    }
+    // rax = the scope's record. Preserves the argument registers.
+    emitLabel("_pgo_enter");
+    emit("cmp qword [rax + 32], 0");
+    emit("jne .linked");
+    emit("mov r10, [pgo_records]");
+    emit("mov [rax], r10");
+    emit("mov [pgo_records], rax");
+    emitLabel(".linked");
+    emit("inc qword [rax + 32]");
+    emit("ret");
+
+    emitLabel("_pgo_dump");
+    emit("mov rdi, pgo_path");
+    emit("call _prof_open");
+    emit("mov rsi, pgo_header");
+    emit("call _prof_puts");
+    emit("mov r12, [pgo_records]");
+    emitLabel(".record");
+    emit("test r12, r12");
+    emit("jz .done");
+    emit("mov rsi, [r12 + 8]");
+    emit("call _prof_puts");
+    emit("mov rsi, prof_space");
+    emit("call _prof_puts");
+    emit("mov rsi, [r12 + 16]");
+    emit("call _prof_puts");
+    emit("mov rsi, prof_space");
+    emit("call _prof_puts");
+    emit("mov rax, [r12 + 32]");
+    emit("xor rcx, rcx");
+    emit("call _prof_putu");
+    emit("mov rsi, prof_space");
+    emit("call _prof_puts");
+    emit("mov rax, [r12 + 24]");
+    emit("xor rcx, rcx");
+    emit("call _prof_putu");
+    emit("mov r13, [r12 + 40]");
+    emit("mov r14, [r12 + 24]");
+    emitLabel(".counter");
+    emit("test r14, r14");
+    emit("jz .line_end");
+    emit("mov rsi, prof_space");
+    emit("call _prof_puts");
+    emit("mov rax, [r13]");
+    emit("xor rcx, rcx");
+    emit("call _prof_putu");
+    emit("add r13, 8");
+    emit("dec r14");
+    emit("jmp .counter");
+    emitLabel(".line_end");
+    emit("mov rsi, prof_eol");
+    emit("call _prof_puts");
+    emit("mov r12, [r12]");
+    emit("jmp .record");
+    emitLabel(".done");
+    emit("call _prof_close");
+    emit("ret");
+}
+
+// Starts a procedure or the main story for -fprofile-generate and -fprofile-use: counts the
+// call and looks up the scope's training counts.
+void CodeGenerator::beginPgoScope(const std::string& symbol, const std::string& shape)
+{
+    m_pgo_scope = symbol;
+    m_pgo_shape = shape;
+    m_pgo_sites = 0;
+    m_pgo_counts = m_options.profile_use ? m_options.profile_use->find(symbol, shape) : nullptr;
+    if (!m_options.profile_generate.empty())
+    {
+        emit("mov rax, pgo_" + symbol);
+        emit("call _pgo_enter");
+    }
+}
+
+// Places the scope's cold blocks after its last instruction.
+void CodeGenerator::flushColdBlocks()
+{
+    for (const auto& block : m_cold_blocks)
+    {
+        *m_text << block;
+    }
+    m_cold_blocks.clear();
+}
+
+// Ends a scope started by beginPgoScope, emitting its record when training.
+void CodeGenerator::endPgoScope()
+{
+    if (!m_options.profile_generate.empty())
+    {
+        const std::string& symbol = m_pgo_scope;
+        m_out << "\nsection .bss\n";
+        emitLabel("pgo_counts_" + symbol);
+        emit("resq " + std::to_string(std::max(2 * m_pgo_sites, 1)));
+        m_out << "\nsection .rodata\n";
+        emitLabel("pgo_name_" + symbol);
+        emit("db `" + symbol + "`, 0");
+        emitLabel("pgo_shape_" + symbol);
+        emit("db `" + m_pgo_shape + "`, 0");
+        m_out << "\nsection .data\n";
+        emitLabel("pgo_" + symbol);
+        emit("dq 0, pgo_name_" + symbol + ", pgo_shape_" + symbol + ", " + std::to_string(2 * m_pgo_sites) + ", 0, pgo_counts_" + symbol);
+        m_out << "\nsection .text\n";
+    }
+    m_pgo_scope.clear();
+    m_pgo_counts = nullptr;
+}
+
+// Numbers the next if or while statement of the scope; -1 outside an instrumented scope.
+int CodeGenerator::nextPgoSite()
+{
+    return m_pgo_scope.empty() ? -1 : m_pgo_sites++;
+}
+
+void CodeGenerator::countPgoSite(int site, int counter)
+{
+    if (site >= 0 && !m_options.profile_generate.empty())
+    {
+        emit("inc qword [pgo_counts_" + m_pgo_scope + " + " + std::to_string((2 * site + counter) * 8) + "]");
+    }
+}
+
+// The training counts of a site, or false without a usable profile.
+bool CodeGenerator::pgoCounts(int site, uint64_t& first, uint64_t& second) const
+{
+    if (site < 0 || !m_pgo_counts || m_pgo_counts->counters.size() < static_cast<size_t>(2 * site + 2))
+    {
+        return false;
+    }
+    first = m_pgo_counts->counters[2 * site];
+    second = m_pgo_counts->counters[2 * site + 1];
+    return true;
+}
+
+void CodeGenerator::visitProcedureDeclStmt(const ProcedureDeclStmt& stmt) 
+{
+    enterScope();
+    if (m_options.profile)
+    {
+        // The procedure's profile record: calls, self cycles, inclusive cycles, active
+        // activations, name, the link to the next record that has been called, and memo table
+        // hits and misses.
+        m_out << "\nsection .data\n";
+        emitLabel("prof_" + stmt.name.text);
+        emit("dq 0, 0, 0, 0, prof_name_" + stmt.name.text + ", 0, 0, 0");
+        m_out << "\nsection .rodata\n";
+        emitLabel("prof_name_" + stmt.name.text);
+        emit("db `" + stmt.name.text + "`, 0");
+        m_out << "\nsection .text\n";
+    }
+    bool memoized = m_memoized && m_memoized->count(stmt.name.text);
+    if (memoized)
+    {
+        m_out << "\nsection .bss\n";
+        emitLabel("memo_" + stmt.name.text);
+        emit("resq " + std::to_string(m_options.memo_entries * memoStride(stmt.params.size())));
+        m_out << "\nsection .text\n";
+    }
+    m_out << "global proc_" << stmt.name.text << ":function (proc_" << stmt.name.text << ".end - proc_" << stmt.name.text << ")\n";
+    m_source_file = stmt.source.empty() ? m_options.source_path : stmt.source;
+    m_source_line = 0;
+    emitLine(stmt);
+    emitLabel("proc_" + stmt.name.text);
+    m_scope_symbol = "proc_" + stmt.name.text;
+    m_return_type = stmt.return_type.text;
+    emit("push rbp");
+    emit("mov rbp, rsp");
+
+    StackSizeCalculator proc_stack_calc;
+    for (const auto& param : stmt.params)
+    {
+        proc_stack_calc.add(param.type.text);
+    }
+    {
+        TimeReport::Scope timer(m_options.time_report, TimeReport::STACK_WALK, true);
+        proc_stack_calc.calculate(*stmt.body);
+    }
+    // A memoized procedure also keeps its table entry and a copy of its arguments, which the
+    // body may reassign before the result is stored.
+    int memo_size = memoized ? (stmt.params.size() + 1) * 8 : 0;
+    // Callee-saved registers the procedure's counted loops use are kept in the frame too.
+    LoopScanner loops;
+    stmt.body->accept(loops);
+    m_counter_registers = std::min(loops.max_depth, COUNTER_REGISTER_COUNT);
+    // A procedure that builds strings but does not yield one drops them when it returns.
+    bool marks_strings = !memoized && m_return_type != "string" && buildsStrings(*stmt.body);
+    int local_stack_size = (proc_stack_calc.words() + m_counter_registers + (marks_strings ? 1 : 0)) * 8 + memo_size;
+    
+    if (local_stack_size > 0) 
+    {
+        int aligned_size = (local_stack_size + 15) & ~15;
+        emit("sub rsp, " + std::to_string(aligned_size));
+    }
+    
+    const char* arg_regs[] = {"rdi", "rsi", "rdx", "rcx", "r8", "r9"};
+    m_stack_offset = 0;
+    std::fill(std::begin(m_packed_words), std::end(m_packed_words), std::make_pair(0, 8));
+    for(size_t i = 0; i < stmt.params.size(); ++i) 
+    {
+        const std::string& type = stmt.params[i].type.text;
+        int offset = allocateSlot(typeWidth(type));
+        m_symbol_scopes.back()[stmt.params[i].name.text] = {offset, type};
+        if (type == "bool")
+        {
+            emit("test " + std::string(arg_regs[i]) + ", " + arg_regs[i]);
+            emit("setnz byte [rbp - " + std::to_string(offset) + "]");
+        }
+        else
+        {
+            emit("mov [rbp - " + std::to_string(offset) + "], " + subRegister(arg_regs[i], typeWidth(type)));
+        }
+    }
+    for (int i = 0; i < m_counter_registers; ++i)
+    {
+        m_stack_offset += 8;
+        m_saved_registers.emplace_back(COUNTER_REGISTERS[i], m_stack_offset);
+        emit("mov [rbp - " + std::to_string(m_stack_offset) + "], " + COUNTER_REGISTERS[i]);
+    }
+    if (memoized)
+    {
+        m_memo_keys = stmt.params.size();
+        m_memo_slot = m_stack_offset + 8;
+        for (size_t i = 0; i < stmt.params.size(); ++i)
+        {
+            emit("mov [rbp - " + std::to_string(m_memo_slot + 8 * (i + 1)) + "], " + arg_regs[i]);
+        }
+        m_stack_offset += memo_size;
+    }
+    if (marks_strings)
+    {
+        m_stack_offset += 8;
+        m_string_mark = m_stack_offset;
+        emit("call _string_mark");
+        emit("mov [rbp - " + std::to_string(m_string_mark) + "], rax");
+    }
+    if (m_options.profile)
+    {
+        emit("mov rax, prof_" + stmt.name.text);
+        emit("call _prof_enter");
+        m_profiled_procedure = true;
+    }
+    if (!m_options.profile_generate.empty() || m_options.profile_use)
+    {
+        beginPgoScope("proc_" + stmt.name.text, shapeOf({&stmt}));
+    }
+    if (memoized)
+    {
+        emitMemoLookup(stmt);
+    }
+    
+    stmt.body->accept(*this);
+
+    // Falling off the end leaves no result worth remembering, so only 'the result shall be' stores.
+    emitReturn();
+    m_profiled_procedure = false;
+    m_memo_keys = 0;
+    m_memo_slot = 0;
+    m_string_mark = 0;
+    m_counter_registers = 0;
+    m_saved_registers.clear();
+    m_return_type = "int";
+    flushColdBlocks();
+    flushJumpTables();
+    flushFloatConstants();
+    emitLabel(".end");
+    endPgoScope();
+    exitScope();
+}
+
+void CodeGenerator::emitReturn()
+{
+    if (m_string_mark)
+    {
+        emit("push rax");
+        emit("mov rdi, [rbp - " + std::to_string(m_string_mark) + "]");
+        emit("call _string_reset");
+        emit("pop rax");
+    }
+    if (m_profiled_procedure)
+    {
+        emit("call _prof_exit");
+    }
+    for (const auto& saved : m_saved_registers)
+    {
+        emit("mov " + saved.first + ", [rbp - " + std::to_string(saved.second) + "]");
+    }
+    emit("mov rsp, rbp");
+    emit("pop rbp");
+    emit("ret");
+}
+
+// Hashes the arguments into the procedure's direct-mapped table (Fibonacci hashing) and returns
+// the stored result if the entry holds the same arguments. On a miss the entry's address is
+// kept for emitMemoStore, which overwrites whatever the entry held.
+void CodeGenerator::emitMemoLookup(const ProcedureDeclStmt& stmt)
+{
+    auto key = [&](size_t i) { return "[rbp - " + std::to_string(m_memo_slot + 8 * (i + 1)) + "]"; };
+    int bits = 0;
+    while ((size_t(1) << bits) < m_options.memo_entries)
+    {
+        ++bits;
+    }
+    int stride_bits = 3;
+    while ((size_t(1) << (stride_bits - 3)) < memoStride(m_memo_keys))
+    {
+        ++stride_bits;
+    }
+    std::string miss = newLabel();
+    emit("mov rax, " + key(0));
+    emit("mov r11, -7046029254386353131");
+    for (size_t i = 1; i < m_memo_keys; ++i)
+    {
+        emit("imul rax, r11");
+        emit("xor rax, " + key(i));
+    }
+    if (bits > 0)
+    {
+        emit("imul rax, r11");
+        emit("shr rax, " + std::to_string(64 - bits));
+        emit("shl rax, " + std::to_string(stride_bits));
+    }
+    else
+    {
+        emit("xor rax, rax");
+    }
+    emit("mov r10, memo_" + stmt.name.text);
+    emit("add rax, r10");
+    emit("mov [rbp - " + std::to_string(m_memo_slot) + "], rax");
+    emit("cmp qword [rax], 0");
+    emit("je " + miss);
+    for (size_t i = 0; i < m_memo_keys; ++i)
+    {
+        emit("mov r10, " + key(i));
+        emit("cmp r10, [rax + " + std::to_string(8 * (i + 1)) + "]");
+        emit("jne " + miss);
+    }
+    if (m_options.profile)
+    {
+        emit("inc qword [prof_" + stmt.name.text + " + 48]");
+    }
+    emit("mov rax, [rax + " + std::to_string(8 * (m_memo_keys + 1)) + "]");
+    emitReturn();
+    emitLabel(miss);
+    if (m_options.profile)
+    {
+        emit("inc qword [prof_" + stmt.name.text + " + 56]");
+    }
+}
+
+// rax = the result. Fills the entry found by emitMemoLookup: valid flag, arguments, result.
+void CodeGenerator::emitMemoStore()
+{
+    emit("mov r10, [rbp - " + std::to_string(m_memo_slot) + "]");
+    for (size_t i = 0; i < m_memo_keys; ++i)
+    {
+        emit("mov r11, [rbp - " + std::to_string(m_memo_slot + 8 * (i + 1)) + "]");
+        emit("mov [r10 + " + std::to_string(8 * (i + 1)) + "], r11");
+    }
+    emit("mov [r10 + " + std::to_string(8 * (m_memo_keys + 1)) + "], rax");
+    emit("mov qword [r10], 1");
+}
+
+void CodeGenerator::visitProcedureCallStmt(const ProcedureCallStmt& stmt) 
+{
+    if (m_folded && m_folded->removed.count(&stmt))
+    {
+        return;
+    }
+    emitCall(stmt.callee_name, stmt.arguments);
+}
+
+// Arguments are pushed as they are evaluated and popped into the argument registers. A float
+// goes in its integer register as raw bits, converted first if the parameter is an integer (or
+// an integer argument to a float parameter); the result comes back the same way in rax.
+void CodeGenerator::emitCall(const Token& callee, const std::vector<std::unique_ptr<Expr>>& arguments)
+{
+    const char* arg_regs[] = {"rdi", "rsi", "rdx", "rcx", "r8", "r9"};
+    if (arguments.size() > 6) 
+    {
+        throw std::runtime_error("More than 6 arguments are not supported.");
+    }
+    
+    auto signature = m_signatures->find(callee.text);
+    for (size_t i = 0; i < arguments.size(); ++i) 
+    {
+        std::string type = isFloat(*arguments[i]) ? "float" : "int";
+        if (signature != m_signatures->end() && i < signature->second.params.size())
+        {
+            type = signature->second.params[i];
+        }
+        emitValue(*arguments[i], type);
+        if (type == "float")
+        {
+            emit("movq rax, xmm0");
+        }
+        emit("push rax");
+    }
+    for (size_t i = arguments.size(); i-- > 0; ) 
+    {
+        emit("pop " + std::string(arg_regs[i]));
+    }
+
+    emit("call proc_" + callee.text);
+}
+
+void CodeGenerator::visitBlockStmt(const BlockStmt& stmt) 
+{
+    for (const auto& statement : stmt.statements) 
+    {
+        emitLine(*statement);
+        statement->accept(*this);
+    }
+}
+
+// The main story's prologue is attributed to the top of the program's file.
+void CodeGenerator::beginMainLines()
+{
+    m_source_file = m_options.source_path;
+    m_source_line = 1;
+    if (m_options.debug_info)
+    {
+        *m_text << "%line 1+0 " << m_source_file << "\n";
+    }
+}
+
+// Under -g, attributes the code that follows to the statement's source line.
+void CodeGenerator::emitLine(const Stmt& stmt)
+{
+    if (!m_options.debug_info || stmt.line <= 0 || stmt.line == m_source_line)
+    {
+        return;
+    }
+    m_source_line = stmt.line;
+    *m_text << "%line " << stmt.line << "+0 " << m_source_file << "\n";
+}
+
+void CodeGenerator::visitIfStmt(const IfStmt& stmt) 
+{
+    if (emitSwitch(stmt))
+    {
+        return;
+    }
+
+    std::string endIfLabel = newLabel();
+    int site = nextPgoSite();
+    countPgoSite(site, 0);
+
+    emitValue(*stmt.condition, "int");
+    
+    emit("cmp rax, 0");
+
+    // A branch taken at most one time in eight in training is moved past the end of the scope,
+    // so the usual path falls through instead of jumping over it.
+    uint64_t executions = 0;
+    uint64_t taken = 0;
+    if (pgoCounts(site, executions, taken) && taken * 8 <= executions)
+    {
+        std::string coldLabel = newLabel();
+        emit("jne " + coldLabel);
+        if (stmt.else_branch)
+        {
+            emitLine(*stmt.else_branch);
+            stmt.else_branch->accept(*this);
+        }
+        emitLabel(endIfLabel);
+
+        std::ostringstream cold;
+        std::ostream* text = m_text;
+        int source_line = m_source_line;
+        m_text = &cold;
+        m_source_line = 0;
+        emitLabel(coldLabel);
+        emitLine(stmt);
+        countPgoSite(site, 1);
+        stmt.then_branch->accept(*this);
+        emit("jmp " + endIfLabel);
+        m_text = text;
+        m_source_line = source_line;
+        m_cold_blocks.push_back(cold.str());
+        return;
+    }
+
+    if (!stmt.else_branch)
+    {
+        emit("je " + endIfLabel);
+        countPgoSite(site, 1);
+        stmt.then_branch->accept(*this);
+        emitLabel(endIfLabel);
+        return;
+    }
+
+    std::string elseLabel = newLabel();
+    emit("je " + elseLabel);
+    countPgoSite(site, 1);
+    stmt.then_branch->accept(*this);
+    emit("jmp " + endIfLabel);
+    emitLabel(elseLabel);
+    emitLine(*stmt.else_branch);
+    stmt.else_branch->accept(*this);
+    emitLabel(endIfLabel);
+}
+
+// An if / otherwise-if chain that compares one variable for equality with integer constants is
+// a switch. With at least SWITCH_MIN_CASES cases it dispatches on the variable once, through a
+// jump table in .rodata when at least a third of the range between the smallest and largest
+// constant is covered and by binary search otherwise, instead of testing each case in turn.
+// The first case of a repeated constant wins, as it does in the chain. Returns false, having
+// emitted nothing, for any other if.
+bool CodeGenerator::emitSwitch(const IfStmt& stmt)
+{
+    const size_t SWITCH_MIN_CASES = 4;
+
+    std::vector<std::pair<int64_t, const Stmt*>> cases;
+    const Stmt* otherwise = nullptr;
+    std::string variable;
+    for (const IfStmt* link = &stmt; link; )
+    {
+        auto comparison = dynamic_cast<const ComparisonExpr*>(link->condition.get());
+        const VariableExpr* name = nullptr;
+        const LiteralExpr* constant = nullptr;
+        if (comparison && comparison->op.text == "is equal to")
+        {
+            name = dynamic_cast<const VariableExpr*>(comparison->left.get());
+            constant = dynamic_cast<const LiteralExpr*>(comparison->right.get());
+            if (!name)
+            {
+                name = dynamic_cast<const VariableExpr*>(comparison->right.get());
+                constant = dynamic_cast<const LiteralExpr*>(comparison->left.get());
+            }
+        }
+        int64_t value = 0;
+        bool matches = name && constant && constant->value.type == TokenType::INT_LITERAL && (variable.empty() || name->name.text == variable);
+        if (matches)
+        {
+            try
+            {
+                value = std::stoll(constant->value.literal_value);
+            }
+            catch (const std::exception&)
+            {
+                matches = false;
+            }
+        }
+        if (!matches)
+        {
+            otherwise = link;
+            break;
+        }
+        variable = name->name.text;
+        cases.emplace_back(value, link->then_branch.get());
+        otherwise = link->else_branch.get();
+        link = dynamic_cast<const IfStmt*>(otherwise);
+    }
+    VariableInfo* var = variable.empty() ? nullptr : findScalar(variable);
+    if (cases.size() < SWITCH_MIN_CASES || !var || var->type == "float")
+    {
+        return false;
+    }
+
+    std::string endLabel = newLabel();
+    std::string defaultLabel = otherwise ? newLabel() : endLabel;
+    std::vector<std::string> caseLabels;
+    std::vector<std::pair<int64_t, std::string>> targets;
+    std::unordered_set<int64_t> seen;
+    for (const auto& entry : cases)
+    {
+        caseLabels.push_back(newLabel());
+        if (seen.insert(entry.first).second)
+        {
+            targets.emplace_back(entry.first, caseLabels.back());
+        }
+    }
+    std::sort(targets.begin(), targets.end());
+
+    // 'cmp' and 'sub' take a sign-extended 32-bit immediate; larger constants go through r10.
+    auto immediate = [&](const std::string& op, int64_t value)
+    {
+        if (value >= INT32_MIN && value <= INT32_MAX)
+        {
+            emit(op + " rax, " + std::to_string(value));
+        }
+        else
+        {
+            emit("mov r10, " + std::to_string(value));
+            emit(op + " rax, r10");
+        }
+    };
+
+    emit(loadInstruction(var->type, "[rbp - " + std::to_string(var->offset) + "]"));
+    uint64_t range = static_cast<uint64_t>(targets.back().first) - static_cast<uint64_t>(targets.front().first) + 1;
+    if (range != 0 && range <= 3 * targets.size())
+    {
+        std::string table = "..@" + m_scope_symbol + "_table" + std::to_string(m_label_counter++);
+        std::ostringstream entries;
+        entries << table << ":\n";
+        size_t next = 0;
+        for (uint64_t i = 0; i < range; ++i)
+        {
+            bool hit = static_cast<uint64_t>(targets[next].first) - static_cast<uint64_t>(targets.front().first) == i;
+            entries << "    dq " << (hit ? targets[next++].second : defaultLabel) << "\n";
+        }
+        m_jump_tables.push_back(entries.str());
+
+        if (targets.front().first != 0)
+        {
+            immediate("sub", targets.front().first);
+        }
+        emit("cmp rax, " + std::to_string(range - 1));
+        emit("ja " + defaultLabel);
+        emit("mov r10, " + table);
+        emit("jmp [r10 + rax*8]");
+    }
+    else
+    {
+        std::function<void(size_t, size_t)> search = [&](size_t low, size_t high)
+        {
+            if (high - low <= 3)
+            {
+                for (size_t i = low; i < high; ++i)
+                {
+                    immediate("cmp", targets[i].first);
+                    emit("je " + targets[i].second);
+                }
+                emit("jmp " + defaultLabel);
+                return;
+            }
+            size_t middle = low + (high - low) / 2;
+            std::string lower = newLabel();
+            immediate("cmp", targets[middle].first);
+            emit("je " + targets[middle].second);
+            emit("jl " + lower);
+            search(middle + 1, high);
+            emitLabel(lower);
+            search(low, middle);
+        };
+        search(0, targets.size());
+    }
+
+    for (size_t i = 0; i < cases.size(); ++i)
+    {
+        emitLabel(caseLabels[i]);
+        cases[i].second->accept(*this);
+        emit("jmp " + endLabel);
+    }
+    if (otherwise)
+    {
+        emitLabel(defaultLabel);
+        emitLine(*otherwise);
+        otherwise->accept(*this);
+    }
+    emitLabel(endLabel);
+    return true;
+}
+
+// Writes the jump tables of the scope's switches to .rodata. Their entries name the scope's
+// local labels, which '..@' table labels leave attached to the scope's symbol.
+void CodeGenerator::flushJumpTables()
+{
+    if (m_jump_tables.empty())
+    {
+        return;
+    }
+    m_out << "\nsection .rodata\n";
+    m_out << "align 8\n";
+    for (const auto& table : m_jump_tables)
+    {
+        m_out << table;
+    }
+    m_out << "\nsection " << (m_section.empty() ? ".text" : m_section) << "\n";
+    m_jump_tables.clear();
+}
+
+void CodeGenerator::flushFloatConstants()
+{
+    if (m_float_constants.empty())
+    {
+        return;
+    }
+    m_out << "\nsection .rodata\n";
+    m_out << "align 8\n";
+    for (const auto& constant : m_float_constants)
+    {
+        std::ostringstream bits;
+        bits << std::hex << constant.second;
+        emitLabel(constant.first);
+        emit("dq 0x" + bits.str());
+    }
+    m_out << "\nsection " << (m_section.empty() ? ".text" : m_section) << "\n";
+    m_float_constants.clear();
+}
+
+void CodeGenerator::flushArrays()
+{
+    if (m_arrays.empty())
+    {
+        return;
+    }
+    m_out << "\nsection .bss\n";
+    m_out << "alignb 32\n";
+    for (const auto& array : m_arrays)
+    {
+        emitLabel(array.first);
+        emit("resq " + std::to_string(array.second));
+    }
+    m_out << "\nsection " << (m_section.empty() ? ".text" : m_section) << "\n";
+    m_arrays.clear();
+}
+
+void CodeGenerator::visitWhileStmt(const WhileStmt& stmt) 
+{
+    std::string startLabel = newLabel();
+    std::string endLabel = newLabel();
+    int site = nextPgoSite();
+    countPgoSite(site, 0);
+    
+    m_break_labels.push_back(endLabel);
+
+    // A loop that ran more than once per entry in training is rotated: the test moves below the
+    // body, so each iteration takes one branch instead of two.
+    uint64_t entries = 0;
+    uint64_t iterations = 0;
+    if (pgoCounts(site, entries, iterations) && iterations > entries)
+    {
+        emit("jmp " + startLabel);
+        std::string bodyLabel = newLabel();
+        emitLabel(bodyLabel);
+        countPgoSite(site, 1);
+        stmt.body->accept(*this);
+        emitLabel(startLabel);
+        emitValue(*stmt.condition, "int");
+        emit("cmp rax, 0");
+        emit("jne " + bodyLabel);
+        emitLabel(endLabel);
+        m_break_labels.pop_back();
+        return;
+    }
+
+    emitLabel(startLabel);
+    
+    emitValue(*stmt.condition, "int");
+
+    emit("cmp rax, 0");
+    emit("je " + endLabel);
+    
+    countPgoSite(site, 1);
+    stmt.body->accept(*this);
+    emit("jmp " + startLabel);
+    emitLabel(endLabel);
+
+    m_break_labels.pop_back();
+}
+
+// A counted loop runs on a trip count taken on entry, kept in a counter register and counted
+// down to zero with 'dec'/'jnz', so the test costs nothing beyond the back edge. A body of at
+// most UNROLL_MAX_STATEMENTS statements that declares nothing is unrolled: unroll_factor copies
+// per trip, after the leftover trips. With constant bounds the split is made at compile time
+// and a loop of at most unroll_factor trips is emitted straight.
+void CodeGenerator::visitForStmt(const ForStmt& stmt) 
+{
+    const int UNROLL_MAX_STATEMENTS = 8;
+
+    VariableInfo* var = findScalar(stmt.variable.text);
+    if (!var)
+    {
+        m_stack_offset += 8;
+        var = &(m_symbol_scopes.back()[stmt.variable.text] = {m_stack_offset, "int"});
+    }
+    else if (!isWordInteger(var->type))
+    {
+        throw std::runtime_error("The counted value '" + stmt.variable.text + "' of a 'for each' has to be a full int.");
+    }
+    int variable = var->offset;
+    m_stack_offset += 8;
+    int trips_slot = m_stack_offset;
+    std::string counter;
+    if (m_counted_depth < m_counter_registers)
+    {
+        counter = COUNTER_REGISTERS[m_counted_depth];
+    }
+    else
+    {
+        m_stack_offset += 8;
+        counter = "qword [rbp - " + std::to_string(m_stack_offset) + "]";
+    }
+
+    LoopScanner scan;
+    stmt.body->accept(scan);
+    uint64_t factor = m_options.unroll_factor > 1 && !scan.declares && scan.max_depth == 0 && scan.statements <= UNROLL_MAX_STATEMENTS ? m_options.unroll_factor : 1;
+    int factor_bits = 0;
+    while ((uint64_t(1) << factor_bits) < factor)
+    {
+        ++factor_bits;
+    }
+
+    int64_t first = 0;
+    int64_t last = 0;
+    bool constant = false;
+    auto first_literal = dynamic_cast<const LiteralExpr*>(stmt.first.get());
+    auto last_literal = dynamic_cast<const LiteralExpr*>(stmt.last.get());
+    if (first_literal && last_literal && first_literal->value.type == TokenType::INT_LITERAL && last_literal->value.type == TokenType::INT_LITERAL)
+    {
+        try
+        {
+            first = std::stoll(first_literal->value.literal_value);
+            last = std::stoll(last_literal->value.literal_value);
+            constant = true;
+        }
+        catch (const std::exception&)
+        {
+        }
+    }
+
+    std::string endLabel = newLabel();
+    m_break_labels.push_back(endLabel);
+    m_counted_depth++;
+
+    uint64_t lanes = m_options.avx2 ? 4 : 2;
+    bool short_loop = constant && (last < first || static_cast<uint64_t>(last) - static_cast<uint64_t>(first) + 1 < lanes);
+    if (m_options.vectorize && !short_loop && emitVectorLoop(stmt, variable, trips_slot, counter, endLabel))
+    {
+        m_counted_depth--;
+        m_break_labels.pop_back();
+        emitLabel(endLabel);
+        return;
+    }
+
+    emitValue(*stmt.first, "int");
+    emit("mov [rbp - " + std::to_string(variable) + "], rax");
+    if (constant)
+    {
+        uint64_t trips = last < first ? 0 : static_cast<uint64_t>(last) - static_cast<uint64_t>(first) + 1;
+        // Every int64 value is 2^64 trips, which wraps to 0; so does a count of 2^64 blocks of
+        // one, which the counter then runs down from 0.
+        bool every_value = last >= first && trips == 0;
+        if (trips != 0 && trips <= factor)
+        {
+            emitCountedBody(stmt, variable, trips);
+        }
+        else if (trips != 0 || every_value)
+        {
+            emitCountedBody(stmt, variable, trips & (factor - 1));
+            uint64_t blocks = every_value && factor_bits > 0 ? uint64_t(1) << (64 - factor_bits) : trips >> factor_bits;
+            std::string loopLabel = newLabel();
+            emit("mov rax, " + std::to_string(blocks));
+            emit("mov " + counter + ", rax");
+            emitLabel(loopLabel);
+            emitCountedBody(stmt, variable, factor);
+            emit("dec " + counter);
+            emit("jnz " + loopLabel);
+        }
+    }
+    else
+    {
+        emitValue(*stmt.last, "int");
+        emit("sub rax, [rbp - " + std::to_string(variable) + "]");
+        emit("jl " + endLabel);
+        emit("inc rax");
+        std::string loopLabel = newLabel();
+        if (factor > 1)
+        {
+            std::string blocksLabel = newLabel();
+            std::string restLabel = newLabel();
+            emit("mov [rbp - " + std::to_string(trips_slot) + "], rax");
+            emit("and rax, " + std::to_string(factor - 1));
+            emit("jz " + blocksLabel);
+            emit("mov " + counter + ", rax");
+            emitLabel(restLabel);
+            emitCountedBody(stmt, variable, 1);
+            emit("dec " + counter);
+            emit("jnz " + restLabel);
+            emitLabel(blocksLabel);
+            emit("mov rax, [rbp - " + std::to_string(trips_slot) + "]");
+            emit("shr rax, " + std::to_string(factor_bits));
+            std::string countedLabel = newLabel();
+            emit("jnz " + countedLabel);
+            // No whole blocks, unless the loop takes every int64 value and its 2^64 trips
+            // wrapped to 0.
+            emit("cmp qword [rbp - " + std::to_string(trips_slot) + "], 0");
+            emit("jne " + endLabel);
+            emit("mov rax, " + std::to_string(uint64_t(1) << (64 - factor_bits)));
+            emitLabel(countedLabel);
+        }
+        emit("mov " + counter + ", rax");
+        emitLabel(loopLabel);
+        emitCountedBody(stmt, variable, factor);
+        emit("dec " + counter);
+        emit("jnz " + loopLabel);
+    }
+
+    m_counted_depth--;
+    m_break_labels.pop_back();
+    emitLabel(endLabel);
 }
 
-void CodeGenerator::visitProcedureDeclStmt(const ProcedureDeclStmt& stmt) 
+// A loop whose body is one statement of the form 'the element i of C continues as E', or
+// 'the value S continues as S plus E', where E reads elements at i only, runs lanes elements per
+// trip: rcx holds i, and the loop counter counts whole vectors. The leftover trips, and the
+// whole loop when i would leave an array, go through the scalar body. The trip count stays in
+// trips_slot throughout, so `counter` must be a register or a frame word of its own.
+bool CodeGenerator::emitVectorLoop(const ForStmt& stmt, int variable_offset, int trips_slot, const std::string& counter, const std::string& end_label)
 {
-    enterScope();
-    emitLabel("proc_" + stmt.name.text);
-    emit("push rbp");
-    emit("mov rbp, rsp");
-
-    StackSizeCalculator proc_stack_calc;
-    proc_stack_calc.calculate(*stmt.body);
-    int local_stack_size = (stmt.params.size() + proc_stack_calc.count) * 8;
-    
-    if (local_stack_size > 0) 
+    auto body = dynamic_cast<const ExpressionStmt*>(stmt.body.get());
+    if (auto block = dynamic_cast<const BlockStmt*>(stmt.body.get()))
     {
-        int aligned_size = (local_stack_size + 15) & ~15;
-        emit("sub rsp, " + std::to_string(aligned_size));
+        body = block->statements.size() == 1 ? dynamic_cast<const ExpressionStmt*>(block->statements[0].get()) : nullptr;
     }
-    
-    const char* arg_regs[] = {"rdi", "rsi", "rdx", "rcx", "r8", "r9"};
-    m_stack_offset = 0;
-    for(size_t i = 0; i < stmt.params.size(); ++i) 
+    if (!body)
     {
-        m_stack_offset += 8;
-        m_symbol_scopes.back()[stmt.params[i].name.text] = {m_stack_offset, stmt.params[i].type.text};
-        emit("mov [rbp - " + std::to_string(m_stack_offset) + "], " + arg_regs[i]);
+        return false;
     }
-    
-    stmt.body->accept(*this);
-
-    emit("mov rsp, rbp");
-    emit("pop rbp");
-    emit("ret");
-    exitScope();
-}
 
-void CodeGenerator::visitProcedureCallStmt(const ProcedureCallStmt& stmt) 
-{
-    const char* arg_regs[] = {"rdi", "rsi", "rdx", "rcx", "r8", "r9"};
-    if (stmt.arguments.size() > 6) 
+    VectorExprCompiler vector(m_options.avx2, stmt.variable.text, [this](const std::string& name) { return findVariable(name); });
+    std::string target;
+    VariableInfo* sum = nullptr;
+    int accumulator = 0;
+    if (auto store = dynamic_cast<const IndexAssignExpr*>(body->expression.get()))
     {
-        throw std::runtime_error("More than 6 arguments are not supported.");
+        auto index = dynamic_cast<const VariableExpr*>(store->index.get());
+        if (!index || index->name.text != stmt.variable.text)
+        {
+            return false;
+        }
+        target = vector.element(store->array);
+        vector.store(target, vector.compile(*store->value));
     }
-    
-    for (size_t i = 0; i < stmt.arguments.size(); ++i) 
+    else if (auto assign = dynamic_cast<const AssignExpr*>(body->expression.get()))
+    {
+        auto add = dynamic_cast<const BinaryExpr*>(assign->value.get());
+        if (!add || add->op.text != "plus" || assign->name.text == stmt.variable.text)
+        {
+            return false;
+        }
+        auto left = dynamic_cast<const VariableExpr*>(add->left.get());
+        auto right = dynamic_cast<const VariableExpr*>(add->right.get());
+        const Expr* term = left && left->name.text == assign->name.text ? add->right.get() : right && right->name.text == assign->name.text ? add->left.get() : nullptr;
+        sum = findVariable(assign->name.text);
+        if (!term || !sum || sum->length != 0 || !sum->key_type.empty() || !isWordInteger(sum->type))
+        {
+            return false;
+        }
+        vector.accumulate(assign->name.text);
+        accumulator = vector.reserve();
+        vector.op(vector.setup, "pxor", accumulator, accumulator, accumulator);
+        vector.op("paddq", accumulator, accumulator, vector.compile(*term));
+    }
+    if (!vector.ok || vector.min_length == UINT64_MAX)
     {
-        stmt.arguments[i]->accept(*this);
-        emit("mov " + std::string(arg_regs[i]) + ", rax");
+        return false;
     }
 
-    emit("call proc_" + stmt.callee_name.text);
-}
+    int lanes = vector.lanes();
+    int lanes_bits = lanes == 4 ? 2 : 1;
+    std::string variable = "[rbp - " + std::to_string(variable_offset) + "]";
+    std::string trips = "[rbp - " + std::to_string(trips_slot) + "]";
+    std::string scalarLabel = newLabel();
+    std::string restLabel = newLabel();
+    std::string loopLabel = newLabel();
 
-void CodeGenerator::visitBlockStmt(const BlockStmt& stmt) 
-{
-    for (const auto& statement : stmt.statements) 
+    emitValue(*stmt.first, "int");
+    emit("mov " + variable + ", rax");
+    emitValue(*stmt.last, "int");
+    emit("sub rax, " + variable);
+    emit("jl " + end_label);
+    emit("inc rax");
+    emit("mov " + trips + ", rax");
+    // Every index from first to first + trips - 1 has to be an element of every array.
+    emit("mov rcx, " + variable);
+    emit("cmp rcx, 1");
+    emit("jl " + scalarLabel);
+    emit("mov r11, " + std::to_string(vector.min_length + 1));
+    emit("sub r11, rax");
+    emit("cmp rcx, r11");
+    emit("jg " + scalarLabel);
+    emit("shr rax, " + std::to_string(lanes_bits));
+    emit("jz " + scalarLabel);
+    emit("mov " + counter + ", rax");
+    for (const auto& line : vector.setup)
     {
-        statement->accept(*this);
+        emit(line);
     }
-}
-
-void CodeGenerator::visitIfStmt(const IfStmt& stmt) 
-{
-    std::string endIfLabel = newLabel();
+    emitLabel(loopLabel);
+    for (const auto& line : vector.body)
+    {
+        emit(line);
+    }
+    emit("add rcx, " + std::to_string(lanes));
+    emit("dec " + counter);
+    emit("jnz " + loopLabel);
+    emit("mov " + variable + ", rcx");
+    if (sum)
+    {
+        std::string low = "xmm" + std::to_string(accumulator);
+        std::string scratch = "xmm" + std::to_string(accumulator - 1);
+        if (m_options.avx2)
+        {
+            emit("vextracti128 " + scratch + ", " + vector.reg(accumulator) + ", 1");
+            emit("vpaddq " + low + ", " + low + ", " + scratch);
+            emit("vpshufd " + scratch + ", " + low + ", 0x4E");
+            emit("vpaddq " + low + ", " + low + ", " + scratch);
+            emit("vmovq rax, " + low);
+        }
+        else
+        {
+            emit("pshufd " + scratch + ", " + low + ", 0x4E");
+            emit("paddq " + low + ", " + scratch);
+            emit("movq rax, " + low);
+        }
+        emit("add [rbp - " + std::to_string(sum->offset) + "], rax");
+    }
+    if (m_options.avx2)
+    {
+        emit("vzeroupper");
+    }
+    emit("mov rax, " + trips);
+    emit("and rax, " + std::to_string(lanes - 1));
+    emit("jz " + end_label);
+    emit("jmp " + restLabel);
 
-    stmt.condition->accept(*this);
-    
-    emit("cmp rax, 0");
-    emit("je " + endIfLabel);
-    
-    stmt.then_branch->accept(*this);
-    emitLabel(endIfLabel);
+    emitLabel(scalarLabel);
+    emit("mov rax, " + trips);
+    emitLabel(restLabel);
+    emit("mov " + counter + ", rax");
+    std::string scalarLoopLabel = newLabel();
+    emitLabel(scalarLoopLabel);
+    emitCountedBody(stmt, variable_offset, 1);
+    emit("dec " + counter);
+    emit("jnz " + scalarLoopLabel);
+    return true;
 }
 
-void CodeGenerator::visitWhileStmt(const WhileStmt& stmt) 
+// Emits the body of a counted loop `copies` times, each followed by the step to the next value.
+void CodeGenerator::emitCountedBody(const ForStmt& stmt, int variable_offset, uint64_t copies)
 {
-    std::string startLabel = newLabel();
-    std::string endLabel = newLabel();
-    
-    m_break_labels.push_back(endLabel);
-
-    emitLabel(startLabel);
-    
-    stmt.condition->accept(*this);
-
-    emit("cmp rax, 0");
-    emit("je " + endLabel);
-    
-    stmt.body->accept(*this);
-    emit("jmp " + startLabel);
-    emitLabel(endLabel);
-
-    m_break_labels.pop_back();
+    for (uint64_t i = 0; i < copies; ++i)
+    {
+        stmt.body->accept(*this);
+        emit("inc qword [rbp - " + std::to_string(variable_offset) + "]");
+    }
 }
 
 void CodeGenerator::visitPrintStmt(const PrintStmt& stmt) 
 {
+    // The strings built for the print are dropped once it is done, unless one was stored.
+    StringScanner scanner;
+    stmt.expression->accept(scanner);
+    bool reset = (scanner.builds || yieldsString(scanner.callees)) && !scanner.stores;
+    if (reset)
+    {
+        emit("call _string_mark");
+        emit("push rax");
+    }
+
     std::string expr_type = "int";
-    if (auto lit_expr = dynamic_cast<const LiteralExpr*>(stmt.expression.get())) 
+    if (isFloat(*stmt.expression))
+    {
+        expr_type = "float";
+    }
+    else if (auto lit_expr = dynamic_cast<const LiteralExpr*>(stmt.expression.get())) 
     {
         if (lit_expr->value.type == TokenType::STRING_LITERAL) expr_type = "string";
         else if (lit_expr->value.type == TokenType::BOOL_LITERAL) expr_type = "bool";
     } 
     else if (auto var_expr = dynamic_cast<const VariableExpr*>(stmt.expression.get())) 
     {
-        VariableInfo* var = findVariable(var_expr->name.text);
+        VariableInfo* var = findScalar(var_expr->name.text);
         if (var) 
         {
             expr_type = var->type;
@@ -401,10 +4710,26 @@ void CodeGenerator::visitPrintStmt(const PrintStmt& stmt)
             throw std::runtime_error("Undeclared variable '" + var_expr->name.text + "' in print statement.");
         }
     }
+    else if (auto index_expr = dynamic_cast<const IndexExpr*>(stmt.expression.get())) 
+    {
+        expr_type = findArray(index_expr->array).type;
+    }
+    else if (auto entry_expr = dynamic_cast<const EntryExpr*>(stmt.expression.get())) 
+    {
+        expr_type = findMap(entry_expr->map).type;
+    }
+    else if (isString(*stmt.expression))
+    {
+        expr_type = "string";
+    }
 
     stmt.expression->accept(*this);
 
-    if (expr_type == "string") 
+    if (expr_type == "float")
+    {
+        emit("call _print_float");
+    }
+    else if (expr_type == "string") 
     {
         emit("push rax");
         emit("mov rdi, rax");
@@ -420,6 +4745,12 @@ void CodeGenerator::visitPrintStmt(const PrintStmt& stmt)
         emit("mov r11, 0");
         emit("call _print_integer");
     }
+
+    if (reset)
+    {
+        emit("pop rdi");
+        emit("call _string_reset");
+    }
 }
 
 void CodeGenerator::visitNewlineStmt(const NewlineStmt& /*stmt*/) 
@@ -437,10 +4768,117 @@ void CodeGenerator::visitDeclarationStmt(const DeclarationStmt& stmt)
     {
         throw std::runtime_error("Variable '" + stmt.name.text + "' already declared in this scope.");
     }
-    m_stack_offset += 8;
-    m_symbol_scopes.back()[stmt.name.text] = {m_stack_offset, stmt.type.text};
-    stmt.initializer->accept(*this);
-    emit("mov [rbp - " + std::to_string(m_stack_offset) + "], rax");
+    if (!stmt.key_type.text.empty())
+    {
+        VariableInfo map{allocateSlot(8), stmt.type.text};
+        map.key_type = stmt.key_type.text;
+        m_symbol_scopes.back()[stmt.name.text] = map;
+        emitValue(*stmt.initializer, "int");
+        emit("mov rsi, rax");
+        emit(std::string("mov edi, ") + (map.key_type == "string" ? "1" : "0"));
+        emit("call _map_new");
+        emit("mov [rbp - " + std::to_string(map.offset) + "], rax");
+        return;
+    }
+    if (stmt.length == 0)
+    {
+        int offset = allocateSlot(typeWidth(stmt.type.text));
+        m_symbol_scopes.back()[stmt.name.text] = {offset, stmt.type.text};
+        emitValue(*stmt.initializer, stmt.type.text);
+        emitStore(stmt.type.text, "[rbp - " + std::to_string(offset) + "]");
+        return;
+    }
+
+    // Every element starts out as the initial value, repeated across each word: all ones or all
+    // zeros for bools, copies of the low bytes for narrow types.
+    VariableInfo array{0, stmt.type.text};
+    array.length = stmt.length;
+    uint64_t words = arrayWords(stmt.type.text, stmt.length);
+    int width = typeWidth(stmt.type.text);
+    if (m_static_arrays)
+    {
+        array.symbol = "..@" + m_scope_symbol + "_array" + std::to_string(m_label_counter++);
+        m_arrays.emplace_back(array.symbol, words);
+    }
+    else
+    {
+        m_stack_offset += 8 * words;
+        array.offset = m_stack_offset;
+    }
+    m_symbol_scopes.back()[stmt.name.text] = array;
+    emitValue(*stmt.initializer, stmt.type.text);
+    emitConvert(stmt.type.text);
+    if (stmt.type.text == "float")
+    {
+        emit("movq rax, xmm0");
+    }
+    else if (stmt.type.text == "bool")
+    {
+        emit("neg rax");
+    }
+    else if (width < 8)
+    {
+        emit(width == 4 ? "mov eax, eax" : "movzx eax, " + subRegister("rax", width));
+        emit("mov r10, " + std::to_string(UINT64_MAX / ((uint64_t(1) << (8 * width)) - 1)));
+        emit("imul rax, r10");
+    }
+    emit(array.symbol.empty() ? "lea rdi, [rbp - " + std::to_string(array.offset) + "]" : "mov rdi, " + array.symbol);
+    emit("mov rcx, " + std::to_string(words));
+    emit("rep stosq");
+}
+
+// Words of the frame are handed out whole to full-width variables. Narrower ones share a word
+// with others of the same width, so they stay aligned and a frame of small variables stays small.
+int CodeGenerator::allocateSlot(int width)
+{
+    if (width == 8)
+    {
+        m_stack_offset += 8;
+        return m_stack_offset;
+    }
+    std::pair<int, int>& word = m_packed_words[width / 2];
+    if (word.second + width > 8)
+    {
+        m_stack_offset += 8;
+        word = {m_stack_offset, 0};
+    }
+    int offset = word.first - word.second;
+    word.second += width;
+    return offset;
+}
+
+// Brings rax to the value a variable of the type holds: sign-extended from its width, or 0 or 1
+// for a bool.
+void CodeGenerator::emitConvert(const std::string& type)
+{
+    int width = typeWidth(type);
+    if (type == "bool")
+    {
+        emit("test rax, rax");
+        emit("setnz al");
+        emit("movzx eax, al");
+    }
+    else if (width == 4)
+    {
+        emit("movsxd rax, eax");
+    }
+    else if (width < 4)
+    {
+        emit("movsx rax, " + subRegister("rax", width));
+    }
+}
+
+// Stores rax, or xmm0 for a float, into a variable of the type. The register is left holding the
+// value as stored, which is the value of an assignment.
+void CodeGenerator::emitStore(const std::string& type, const std::string& address)
+{
+    if (type == "float")
+    {
+        emit("movsd " + address + ", xmm0");
+        return;
+    }
+    emitConvert(type);
+    emit("mov " + address + ", " + subRegister("rax", typeWidth(type)));
 }
 
 void CodeGenerator::visitExpressionStmt(const ExpressionStmt& stmt) 
@@ -450,10 +4888,16 @@ void CodeGenerator::visitExpressionStmt(const ExpressionStmt& stmt)
 
 void CodeGenerator::visitReturnStmt(const ReturnStmt& stmt) 
 {
-    stmt.value->accept(*this);
-    emit("mov rsp, rbp");
-    emit("pop rbp");
-    emit("ret");
+    emitValue(*stmt.value, m_return_type);
+    if (m_return_type == "float")
+    {
+        emit("movq rax, xmm0");
+    }
+    if (m_memo_keys)
+    {
+        emitMemoStore();
+    }
+    emitReturn();
 }
 
 void CodeGenerator::visitBreakStmt(const BreakStmt& /*stmt*/) 
@@ -465,22 +4909,56 @@ void CodeGenerator::visitBreakStmt(const BreakStmt& /*stmt*/)
     emit("jmp " + m_break_labels.back());
 }
 
+void CodeGenerator::visitImportStmt(const ImportStmt& /*stmt*/) 
+{
+    throw std::runtime_error("'the story recalls' is only allowed at the top level of a module.");
+}
+
 void CodeGenerator::visitAssignExpr(const AssignExpr& expr) 
 {
-    VariableInfo* var = findVariable(expr.name.text);
+    VariableInfo* var = findScalar(expr.name.text);
     if (!var) 
     {
         throw std::runtime_error("Undeclared variable '" + expr.name.text + "'.");
     }
-    expr.value->accept(*this);
-    emit("mov [rbp - " + std::to_string(var->offset) + "], rax");
+    emitValue(*expr.value, var->type);
+    emitStore(var->type, "[rbp - " + std::to_string(var->offset) + "]");
 }
 
 void CodeGenerator::visitBinaryExpr(const BinaryExpr& expr) 
 {
-    expr.left->accept(*this);
+    if (isFloat(expr))
+    {
+        // The left operand waits on the stack as raw bits while the right one is evaluated.
+        emitValue(*expr.left, "float");
+        emit("movq rax, xmm0");
+        emit("push rax");
+        emitValue(*expr.right, "float");
+        emit("movapd xmm1, xmm0");
+        emit("pop rax");
+        emit("movq xmm0, rax");
+        if (expr.op.text == "plus")
+        {
+            emit("addsd xmm0, xmm1");
+        }
+        else if (expr.op.text == "minus")
+        {
+            emit("subsd xmm0, xmm1");
+        }
+        else if (expr.op.text == "multiplied")
+        {
+            emit("mulsd xmm0, xmm1");
+        }
+        else
+        {
+            emit("divsd xmm0, xmm1");
+        }
+        return;
+    }
+
+    emitValue(*expr.left, "int");
     emit("push rax");
-    expr.right->accept(*this);
+    emitValue(*expr.right, "int");
     emit("pop rbx"); 
     
     if (expr.op.text == "plus")
@@ -515,6 +4993,68 @@ void CodeGenerator::visitBinaryExpr(const BinaryExpr& expr)
 
 void CodeGenerator::visitComparisonExpr(const ComparisonExpr& expr) 
 {
+    if (isString(*expr.left) || isString(*expr.right) || expr.op.text == "starts with" || expr.op.text == "contains")
+    {
+        if (!isString(*expr.left) || !isString(*expr.right) || expr.op.text == "is greater than" || expr.op.text == "is less than")
+        {
+            throw std::runtime_error("Strings are compared only with strings, by 'is equal to', 'starts with' or 'contains'.");
+        }
+        // The text is compared, not where it is kept.
+        expr.left->accept(*this);
+        emit("push rax");
+        expr.right->accept(*this);
+        emit("mov rsi, rax");
+        emit("pop rdi");
+        if (expr.op.text == "is equal to")
+        {
+            emit("call _string_equal");
+        }
+        else if (expr.op.text == "starts with")
+        {
+            emit("call _string_starts");
+        }
+        else
+        {
+            emit("call _string_contains");
+        }
+        return;
+    }
+
+    if (isFloat(*expr.left) || isFloat(*expr.right))
+    {
+        // ucomisd sets the flags like an unsigned compare, and the parity flag when either side
+        // is NaN, which compares unequal and unordered: 'above' is clear for it either way.
+        emitValue(*expr.left, "float");
+        emit("movq rax, xmm0");
+        emit("push rax");
+        emitValue(*expr.right, "float");
+        emit("pop rax");
+        emit("movq xmm1, rax");
+        if (expr.op.text == "is equal to")
+        {
+            emit("ucomisd xmm1, xmm0");
+            emit("sete al");
+            emit("setnp cl");
+            emit("and al, cl");
+        }
+        else if (expr.op.text == "is greater than")
+        {
+            emit("ucomisd xmm1, xmm0");
+            emit("seta al");
+        }
+        else if (expr.op.text == "is less than")
+        {
+            emit("ucomisd xmm0, xmm1");
+            emit("seta al");
+        }
+        else
+        {
+            throw std::runtime_error("Unsupported comparison operator.");
+        }
+        emit("movzx rax, al");
+        return;
+    }
+
     expr.left->accept(*this);
     emit("push rax");
     expr.right->accept(*this);
@@ -547,7 +5087,7 @@ void CodeGenerator::visitComparisonExpr(const ComparisonExpr& expr)
 
 void CodeGenerator::visitUnaryExpr(const UnaryExpr& expr) 
 {
-    expr.right->accept(*this);
+    emitValue(*expr.right, "int");
     if (expr.op.text == "not") 
     {
         emit("xor rax, 1");
@@ -556,19 +5096,20 @@ void CodeGenerator::visitUnaryExpr(const UnaryExpr& expr)
 
 void CodeGenerator::visitFunctionCallExpr(const FunctionCallExpr& expr) 
 {
-    const char* arg_regs[] = {"rdi", "rsi", "rdx", "rcx", "r8", "r9"};
-    if (expr.arguments.size() > 6) 
+    if (m_folded)
     {
-        throw std::runtime_error("More than 6 arguments are not supported.");
+        auto folded = m_folded->values.find(&expr);
+        if (folded != m_folded->values.end())
+        {
+            emit("mov rax, " + std::to_string(folded->second));
+            return;
+        }
     }
-    
-    for (size_t i = 0; i < expr.arguments.size(); ++i) 
+    emitCall(expr.callee_name, expr.arguments);
+    if (isFloat(expr))
     {
-        expr.arguments[i]->accept(*this);
-        emit("mov " + std::string(arg_regs[i]) + ", rax");
+        emit("movq xmm0, rax");
     }
-
-    emit("call proc_" + expr.callee_name.text);
 }
 
 void CodeGenerator::visitLiteralExpr(const LiteralExpr& expr) 
@@ -581,27 +5122,170 @@ void CodeGenerator::visitLiteralExpr(const LiteralExpr& expr)
     {
         emit(std::string("mov rax, ") + (expr.value.text == "true" ? "1" : "0"));
     }
+    else if (expr.value.type == TokenType::FLOAT_LITERAL) 
+    {
+        double value = std::strtod(expr.value.literal_value.c_str(), nullptr);
+        uint64_t bits;
+        std::memcpy(&bits, &value, sizeof(bits));
+        std::string label = "..@" + m_scope_symbol + "_float" + std::to_string(m_label_counter++);
+        m_float_constants.emplace_back(label, bits);
+        emit("mov rax, " + label);
+        emit("movsd xmm0, [rax]");
+    }
     else if (expr.value.type == TokenType::STRING_LITERAL) 
     {
-        for(size_t i = 0; i < m_string_literals.size(); ++i) 
+        auto it = m_string_indices->find(expr.value.literal_value);
+        if (it == m_string_indices->end()) 
         {
-            if (m_string_literals[i] == expr.value.literal_value) 
-            {
-                emit("mov rax, str" + std::to_string(i));
-                return;
-            }
+            throw std::runtime_error("Internal compiler error: string literal not found.");
+        }
+        if (m_string_placeholders) 
+        {
+            emit("mov rax, {str" + std::to_string(it->second) + "}");
+        }
+        else 
+        {
+            emit("mov rax, str" + std::to_string(it->second));
         }
-        throw std::runtime_error("Internal compiler error: string literal not found.");
     }
 }
 
 void CodeGenerator::visitVariableExpr(const VariableExpr& expr) 
 {
-    VariableInfo* var = findVariable(expr.name.text);
+    VariableInfo* var = findScalar(expr.name.text);
     if (!var)
     {
         throw std::runtime_error("Undeclared variable '" + expr.name.text + "'.");
     }
     
-    emit("mov rax, [rbp - " + std::to_string(var->offset) + "]");
-}
\ No newline at end of file
+    emit(loadInstruction(var->type, "[rbp - " + std::to_string(var->offset) + "]"));
+}
+
+// Element numbers are checked against the length with one unsigned compare: 0 wraps around to
+// the top of the range.
+void CodeGenerator::visitIndexExpr(const IndexExpr& expr) 
+{
+    const VariableInfo& array = findArray(expr.array);
+    emitValue(*expr.index, "int");
+    emit("lea r11, [rax - 1]");
+    emit("cmp r11, " + std::to_string(array.length));
+    emit("jae _index_error");
+    if (array.type == "bool")
+    {
+        emit("mov rcx, r11");
+        emit("shr r11, 6");
+        emit("mov rax, " + emitElementAddress(array, 8));
+        emit("shr rax, cl");
+        emit("and eax, 1");
+        return;
+    }
+    emit(loadInstruction(array.type, emitElementAddress(array, typeWidth(array.type))));
+}
+
+void CodeGenerator::visitIndexAssignExpr(const IndexAssignExpr& expr) 
+{
+    const VariableInfo& array = findArray(expr.array);
+    emitValue(*expr.index, "int");
+    emit("lea r11, [rax - 1]");
+    emit("cmp r11, " + std::to_string(array.length));
+    emit("jae _index_error");
+    emit("push r11");
+    emitValue(*expr.value, array.type);
+    emit("pop r11");
+    if (array.type == "bool")
+    {
+        // Clears the element's bit in its word and ors the new one in.
+        emitConvert("bool");
+        emit("mov rcx, r11");
+        emit("shr r11, 6");
+        std::string address = emitElementAddress(array, 8);
+        emit("mov rdx, 1");
+        emit("shl rdx, cl");
+        emit("not rdx");
+        emit("and rdx, " + address);
+        emit("mov r8, rax");
+        emit("shl r8, cl");
+        emit("or rdx, r8");
+        emit("mov " + address + ", rdx");
+        return;
+    }
+    emitStore(array.type, emitElementAddress(array, typeWidth(array.type)));
+}
+
+void CodeGenerator::visitLengthExpr(const LengthExpr& expr) 
+{
+    emit("mov rax, " + std::to_string(findArray(expr.array).length));
+}
+
+// Looks up the key in rax in the map: rax becomes the address of the entry's value, or 0 if there
+// is none and `insert` is not set.
+void CodeGenerator::emitMapSlot(const VariableInfo& map, bool insert)
+{
+    emit("mov rsi, rax");
+    emit("mov rdi, [rbp - " + std::to_string(map.offset) + "]");
+    emit(insert ? "mov edx, 1" : "xor edx, edx");
+    emit("call _map_slot");
+}
+
+void CodeGenerator::visitEntryExpr(const EntryExpr& expr) 
+{
+    const VariableInfo& map = findMap(expr.map);
+    emitValue(*expr.key, map.key_type);
+    emitMapSlot(map, false);
+    emit("test rax, rax");
+    emit("jz _map_key_error");
+    emit("mov rax, [rax]");
+}
+
+// The key and the value are both worked out before the entry is looked up: adding entries while
+// computing the value could move the table.
+void CodeGenerator::visitEntryAssignExpr(const EntryAssignExpr& expr) 
+{
+    const VariableInfo& map = findMap(expr.map);
+    emitValue(*expr.key, map.key_type);
+    emit("push rax");
+    emitValue(*expr.value, map.type);
+    emitConvert(map.type);
+    emit("pop rcx");
+    emit("push rax");
+    emit("mov rax, rcx");
+    emitMapSlot(map, true);
+    emit("pop rcx");
+    emit("mov [rax], rcx");
+    emit("mov rax, rcx");
+}
+
+void CodeGenerator::visitHasEntryExpr(const HasEntryExpr& expr) 
+{
+    const VariableInfo& map = findMap(expr.map);
+    emitValue(*expr.key, map.key_type);
+    emitMapSlot(map, false);
+    emit("test rax, rax");
+    emit("setnz al");
+    emit("movzx eax, al");
+}
+
+void CodeGenerator::visitJoinExpr(const JoinExpr& expr) 
+{
+    if (!isString(*expr.left) || !isString(*expr.right))
+    {
+        throw std::runtime_error("'followed by' joins strings; write 'the text of' before a number to join its digits.");
+    }
+    expr.left->accept(*this);
+    emit("push rax");
+    expr.right->accept(*this);
+    emit("mov rsi, rax");
+    emit("pop rdi");
+    emit("call _string_join");
+}
+
+void CodeGenerator::visitTextExpr(const TextExpr& expr) 
+{
+    if (isString(*expr.value) || isFloat(*expr.value))
+    {
+        throw std::runtime_error("'the text of' takes an integer.");
+    }
+    expr.value->accept(*this);
+    emit("mov rdi, rax");
+    emit("call _string_text");
+}
@@ -1,10 +1,15 @@
 #pragma once
 
 #include "AST.h"
+#include "CompileCache.h"
+#include "TimeReport.h"
+#include "ProfileData.h"
+#include "PureCalls.h"
 #include <iostream>
 #include <string>
 #include <vector>
 #include <unordered_map>
+#include <unordered_set>
 #include <stdexcept>
 #include <algorithm>
 
@@ -14,13 +19,81 @@ struct VariableInfo
 {
     int offset;
     std::string type;
+    // Arrays: the number of elements, and the .bss label of one declared by the main program.
+    // A procedure's array lives in its frame, element 1 at [rbp - offset].
+    uint64_t length = 0;
+    std::string symbol;
+    // Maps: the type of their keys. The variable's word holds the address of its table and
+    // `type` is the type of its values.
+    std::string key_type;
+};
+
+// The parameter and result types of a procedure, which its callers need to pass floats to it
+// and take one back.
+struct ProcedureSignature
+{
+    std::vector<std::string> params;
+    std::string result;
+};
+
+struct CodegenOptions
+{
+    // Runtime helpers and 'exit' are supplied by the host process instead of being emitted (lostrecordc --run).
+    bool host_runtime = false;
+    // Worker threads for per-procedure code generation; 0 uses every hardware core.
+    size_t jobs = 0;
+    // Separate compilation (lostrecordc -c / -o): procedures are exported with 'global', the
+    // procedures recalled from other modules are declared 'extern', and _start is only emitted
+    // for the entry module.
+    bool module = false;
+    bool entry = true;
+    std::vector<const ProcedureDeclStmt*> imported_procedures;
+    // Reuse generated procedure code across runs (lostrecordc --cache <dir>).
+    CompileCache* cache = nullptr;
+    // Times the string literal and stack size walks (lostrecordc --time-report).
+    TimeReport* time_report = nullptr;
+    // Instrument every procedure with rdtsc call counters and write a flat profile and collapsed
+    // stacks when the program exits (lostrecordc --profile).
+    bool profile = false;
+    // Count calls and branch outcomes and write them to this file at exit (-fprofile-generate).
+    std::string profile_generate;
+    // Counts from a training run, used to lay out branches, loops and procedures (-fprofile-use).
+    const ProfileData* profile_use = nullptr;
+    // Emit '%line' directives mapping the code back to the source (lostrecordc -g). Recalled
+    // procedures name their own file; everything else is attributed to source_path.
+    bool debug_info = false;
+    std::string source_path;
+    // Evaluate calls to pure procedures with constant arguments at compile time. Not done when
+    // streaming, since the procedures a call needs may not have been seen yet.
+    bool fold_pure_calls = true;
+    // Cache the results of pure recursive procedures in a direct-mapped table of memo_entries
+    // slots (-fmemoize), or of just the listed pure procedures (-fmemoize=<names>). Not done
+    // when streaming, for the same reason as folding.
+    bool memoize = false;
+    std::vector<std::string> memoize_only;
+    size_t memo_entries = 4096;
+    // Copies of a small counted loop body per trip through the loop (-funroll-loops=<factor>);
+    // a power of two, 1 turns unrolling off.
+    int unroll_factor = 4;
+    // Run counted loops that compute array elements or sum over them on whole vectors: two
+    // elements at a time with SSE2, or four with AVX2 (-mavx2). -fno-vectorize turns this off.
+    bool vectorize = true;
+    bool avx2 = false;
 };
 
 class CodeGenerator : public ExprVisitor, public StmtVisitor 
 {
 public:
+    explicit CodeGenerator(const CodegenOptions& options = {}, std::ostream& out = std::cout);
     void generate(const std::vector<std::unique_ptr<Stmt>>& statements);
 
+    // Streaming interface: statements are generated one at a time as the parser produces them,
+    // so the caller can free each one afterwards. Main program code goes to its own section and
+    // its frame size is resolved by an 'equ' at the end.
+    void beginStream();
+    void streamStatement(const Stmt& stmt);
+    void endStream();
+
     void visitBinaryExpr(const BinaryExpr& expr) override;
     void visitComparisonExpr(const ComparisonExpr& expr) override;
     void visitLiteralExpr(const LiteralExpr& expr) override;
@@ -28,11 +101,20 @@ public:
     void visitAssignExpr(const AssignExpr& expr) override;
     void visitFunctionCallExpr(const FunctionCallExpr& expr) override;
     void visitUnaryExpr(const UnaryExpr& expr) override;
+    void visitIndexExpr(const IndexExpr& expr) override;
+    void visitIndexAssignExpr(const IndexAssignExpr& expr) override;
+    void visitLengthExpr(const LengthExpr& expr) override;
+    void visitEntryExpr(const EntryExpr& expr) override;
+    void visitEntryAssignExpr(const EntryAssignExpr& expr) override;
+    void visitHasEntryExpr(const HasEntryExpr& expr) override;
+    void visitJoinExpr(const JoinExpr& expr) override;
+    void visitTextExpr(const TextExpr& expr) override;
 
     void visitDeclarationStmt(const DeclarationStmt& stmt) override;
     void visitExpressionStmt(const ExpressionStmt& stmt) override;
     void visitIfStmt(const IfStmt& stmt) override;
     void visitWhileStmt(const WhileStmt& stmt) override;
+    void visitForStmt(const ForStmt& stmt) override;
     void visitBlockStmt(const BlockStmt& stmt) override;
     void visitPrintStmt(const PrintStmt& stmt) override;
     void visitNewlineStmt(const NewlineStmt& stmt) override;
@@ -40,21 +122,130 @@ public:
     void visitProcedureCallStmt(const ProcedureCallStmt& stmt) override;
     void visitReturnStmt(const ReturnStmt& stmt) override;
     void visitBreakStmt(const BreakStmt& stmt) override;
+    void visitImportStmt(const ImportStmt& stmt) override;
 
 private:
+    void generateMain(const std::vector<std::unique_ptr<Stmt>>& statements);
     void enterScope();
     void exitScope();
     VariableInfo* findVariable(const std::string& name);
+    VariableInfo* findScalar(const std::string& name);
+    bool isFloat(const Expr& expr);
+    bool isString(const Expr& expr);
+    bool buildsStrings(const Stmt& stmt);
+    bool yieldsString(const std::vector<std::string>& procedures) const;
+    void emitValue(const Expr& expr, const std::string& type);
+    void emitCall(const Token& callee, const std::vector<std::unique_ptr<Expr>>& arguments);
+    const VariableInfo& findArray(const Token& name);
+    const VariableInfo& findMap(const Token& name);
+    void emitMapSlot(const VariableInfo& map, bool insert);
+    std::string emitElementAddress(const VariableInfo& array, int scale);
+    int allocateSlot(int width);
+    void emitConvert(const std::string& type);
+    void emitStore(const std::string& type, const std::string& address);
     void findStringLiterals(const std::vector<std::unique_ptr<Stmt>>& statements);
     void emit(const std::string& code);
     void emitLabel(const std::string& label);
     std::string newLabel();
+    void emitRuntimeHelpers();
+    void emitFloatPrinter();
+    void emitMapRuntime();
+    void emitStringRuntime();
+    void emitStringSearch(bool compare, bool length);
+    void emitRuntimeError(const std::string& label, const std::string& message);
+    void emitExit();
+    void emitReturn();
+    void emitMemoLookup(const ProcedureDeclStmt& stmt);
+    void emitMemoStore();
+    void emitCountedBody(const ForStmt& stmt, int variable_offset, uint64_t copies);
+    bool emitVectorLoop(const ForStmt& stmt, int variable_offset, int trips_slot, const std::string& counter, const std::string& end_label);
+    void emitRuntimeErrors();
+    void flushArrays();
+    void emitInstrumentation();
+    void emitReportWriter();
+    void emitProfileRuntime();
+    void emitPgoRuntime();
+    void beginPgoScope(const std::string& symbol, const std::string& shape);
+    void endPgoScope();
+    void flushColdBlocks();
+    bool emitSwitch(const IfStmt& stmt);
+    void flushJumpTables();
+    void flushFloatConstants();
+    void emitLine(const Stmt& stmt);
+    void beginMainLines();
+    int nextPgoSite();
+    void countPgoSite(int site, int counter);
+    bool pgoCounts(int site, uint64_t& first, uint64_t& second) const;
+    void switchSection(const std::string& section);
+    std::string generateProcedure(const ProcedureDeclStmt& stmt, const std::unordered_map<std::string, std::string>& signatures);
     
+    CodegenOptions m_options;
+    std::ostream& m_out;
+    // Where emit() and emitLabel() write: m_out, or a cold block being set aside.
+    std::ostream* m_text = &m_out;
     std::vector<std::unordered_map<std::string, VariableInfo>> m_symbol_scopes;
     int m_scope_level = 0;
     int m_stack_offset = 0;
 
     int m_label_counter = 0;
+    std::string m_label_prefix = ".L";
+    std::string m_section;
     std::vector<std::string> m_string_literals;
+    std::unordered_map<std::string, size_t> m_string_table;
+    const std::unordered_map<std::string, size_t>* m_string_indices = &m_string_table;
     std::vector<std::string> m_break_labels;
+    // Set while generating an instrumented procedure, whose returns must close its profile entry.
+    bool m_profiled_procedure = false;
+    // The scope being trained or optimized with a profile (proc_<name> or _start), its if and
+    // while statements so far, and its training counts.
+    std::string m_pgo_scope;
+    std::string m_pgo_shape;
+    int m_pgo_sites = 0;
+    const ScopeProfile* m_pgo_counts = nullptr;
+    std::vector<std::string> m_cold_blocks;
+    // The symbol whose local labels the current scope uses (proc_<name> or _start), and the
+    // jump tables of its switches, written to .rodata when the scope ends.
+    std::string m_scope_symbol;
+    std::vector<std::string> m_jump_tables;
+    // The float literals the scope loads, by label and bit pattern, also written to .rodata when
+    // the scope ends, and the type its 'the result shall be' hands back.
+    std::vector<std::pair<std::string, uint64_t>> m_float_constants;
+    std::string m_return_type = "int";
+    // The frame slot holding the string arena's position when the procedure was entered, which
+    // every return resets it to; 0 if the procedure leaves the arena alone.
+    int m_string_mark = 0;
+    // The signature of every procedure a call can reach, which tells calls where floats go.
+    std::unordered_map<std::string, ProcedureSignature> m_signature_table;
+    const std::unordered_map<std::string, ProcedureSignature>* m_signatures = &m_signature_table;
+    // The source position of the last '%line' written; 0 forces the next one out.
+    std::string m_source_file;
+    int m_source_line = 0;
+    // Calls replaced by their values; owned by the generator that ran the analysis.
+    FoldedCalls m_folded_calls;
+    const FoldedCalls* m_folded = nullptr;
+    // Procedures whose results are memoized, and while generating one of them the number of
+    // parameters and the frame slot holding its table entry; 0 otherwise.
+    std::unordered_set<std::string> m_memoized_procedures;
+    const std::unordered_set<std::string>* m_memoized = nullptr;
+    size_t m_memo_keys = 0;
+    int m_memo_slot = 0;
+    // Counted loops keep their trip counters in callee-saved registers, one per nesting level;
+    // m_counter_registers of them are free in this scope and m_saved_registers are restored by
+    // every return. Deeper loops count in their frame slot.
+    int m_counter_registers = 0;
+    int m_counted_depth = 0;
+    std::vector<std::pair<std::string, int>> m_saved_registers;
+    // Arrays of the main program go to .bss rather than the frame; their labels and lengths
+    // are reserved when the scope ends.
+    bool m_static_arrays = false;
+    std::vector<std::pair<std::string, uint64_t>> m_arrays;
+    // The words variables of 1, 2 and 4 bytes are being packed into: the word's frame offset
+    // and how many of its bytes are taken.
+    std::pair<int, int> m_packed_words[3] = {{0, 8}, {0, 8}, {0, 8}};
+    // Emit string references as {str<n>}, numbered within the procedure, so the code can be
+    // cached independently of the program's string table.
+    bool m_string_placeholders = false;
+    // The parts of the runtime the code generated so far calls into (RuntimePart bits), which
+    // emitRuntimeHelpers() emits once the rest of the program is done.
+    unsigned m_runtime_parts = 0;
 };
\ No newline at end of file
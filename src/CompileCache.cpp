@@ -0,0 +1,156 @@
+#include "CompileCache.h"
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+
+namespace fs = std::filesystem;
+
+void ContentHash::add(const void* data, size_t length)
+{
+    const unsigned __int128 prime = (static_cast<unsigned __int128>(1) << 88) | 0x13B;
+    const unsigned char* bytes = static_cast<const unsigned char*>(data);
+    for (size_t i = 0; i < length; ++i)
+    {
+        m_state ^= bytes[i];
+        m_state *= prime;
+    }
+}
+
+std::string ContentHash::hex() const
+{
+    static const char digits[] = "0123456789abcdef";
+    std::string text(32, '0');
+    unsigned __int128 state = m_state;
+    for (int i = 31; i >= 0; --i)
+    {
+        text[i] = digits[static_cast<unsigned>(state & 0xF)];
+        state >>= 4;
+    }
+    return text;
+}
+
+CompileCache::CompileCache(const std::string& directory, uint64_t limit_bytes) : m_directory(directory), m_limit(limit_bytes)
+{
+    std::error_code error;
+    fs::create_directories(m_directory, error);
+}
+
+std::string CompileCache::entryPath(const std::string& key) const
+{
+    return m_directory + "/" + key + ".s";
+}
+
+bool CompileCache::lookup(const std::string& key, std::string& code)
+{
+    std::ifstream file(entryPath(key), std::ios::binary);
+    if (!file)
+    {
+        m_misses++;
+        return false;
+    }
+    std::stringstream buffer;
+    buffer << file.rdbuf();
+    code = buffer.str();
+
+    std::error_code error;
+    fs::last_write_time(entryPath(key), fs::file_time_type::clock::now(), error);
+    m_hits++;
+    return true;
+}
+
+void CompileCache::store(const std::string& key, const std::string& code)
+{
+    // Named for this process and thread, so compilers sharing the cache never write the same file.
+    std::ostringstream temporary;
+    temporary << entryPath(key) << ".tmp" << getpid() << "." << std::this_thread::get_id();
+    std::error_code error;
+    {
+        std::ofstream file(temporary.str(), std::ios::binary);
+        if (!file.write(code.data(), code.size()))
+        {
+            file.close();
+            fs::remove(temporary.str(), error);
+            return;
+        }
+    }
+    fs::rename(temporary.str(), entryPath(key), error);
+    if (error)
+    {
+        fs::remove(temporary.str(), error);
+        return;
+    }
+    m_stores++;
+}
+
+void CompileCache::trim()
+{
+    std::lock_guard<std::mutex> lock(m_trim_mutex);
+
+    struct Entry
+    {
+        fs::path path;
+        fs::file_time_type used;
+        uint64_t size;
+    };
+    std::vector<Entry> entries;
+    uint64_t total = 0;
+    std::error_code error;
+    for (fs::directory_iterator it(m_directory, error), end; !error && it != end; it.increment(error))
+    {
+        if (it->path().extension() != ".s" || !it->is_regular_file(error))
+        {
+            continue;
+        }
+        Entry entry{it->path(), it->last_write_time(error), it->file_size(error)};
+        total += entry.size;
+        entries.push_back(entry);
+    }
+
+    std::sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b) 
+    { 
+        return a.used < b.used; 
+    });
+    size_t evicted = 0;
+    while (total > m_limit && evicted < entries.size())
+    {
+        fs::remove(entries[evicted].path, error);
+        total -= entries[evicted].size;
+        evicted++;
+    }
+
+    m_evictions += evicted;
+    m_bytes = total;
+    m_entries = entries.size() - evicted;
+}
+
+CacheStats CompileCache::stats() const
+{
+    std::lock_guard<std::mutex> lock(m_trim_mutex);
+    CacheStats stats;
+    stats.hits = m_hits;
+    stats.misses = m_misses;
+    stats.stores = m_stores;
+    stats.evictions = m_evictions;
+    stats.bytes = m_bytes;
+    stats.entries = m_entries;
+    return stats;
+}
+
+void CompileCache::printStats(std::ostream& out) const
+{
+    CacheStats s = stats();
+    size_t lookups = s.hits + s.misses;
+    out << "Compile cache (" << m_directory << "):\n";
+    out << "  lookups: " << lookups << ", hits: " << s.hits << ", misses: " << s.misses;
+    if (lookups > 0)
+    {
+        out << " (" << (100 * s.hits / lookups) << "% hit rate)";
+    }
+    out << "\n";
+    out << "  stored: " << s.stores << ", evicted: " << s.evictions << "\n";
+    out << "  size: " << s.entries << " entries, " << s.bytes << " of " << m_limit << " bytes\n";
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <ostream>
+#include <string>
+
+struct CacheStats
+{
+    size_t hits = 0;
+    size_t misses = 0;
+    size_t stores = 0;
+    size_t evictions = 0;
+    uint64_t bytes = 0;
+    size_t entries = 0;
+};
+
+// A persistent, content-addressed store of generated procedure code. Each entry is a file named
+// by its key; lookups refresh the file's modification time so trim() can evict the least
+// recently used entries once the directory grows past its size limit. Safe to use from several
+// threads and processes at once: entries are written to a temporary file and renamed into place.
+class CompileCache
+{
+public:
+    CompileCache(const std::string& directory, uint64_t limit_bytes);
+
+    bool lookup(const std::string& key, std::string& code);
+    void store(const std::string& key, const std::string& code);
+    // Evicts least recently used entries until the cache is within its size limit.
+    void trim();
+
+    CacheStats stats() const;
+    void printStats(std::ostream& out) const;
+
+private:
+    std::string m_directory;
+    uint64_t m_limit;
+    std::atomic<size_t> m_hits{0};
+    std::atomic<size_t> m_misses{0};
+    std::atomic<size_t> m_stores{0};
+    size_t m_evictions = 0;
+    uint64_t m_bytes = 0;
+    size_t m_entries = 0;
+    mutable std::mutex m_trim_mutex;
+
+    std::string entryPath(const std::string& key) const;
+};
+
+// 128-bit FNV-1a, used to build cache keys.
+class ContentHash
+{
+public:
+    void add(const void* data, size_t length);
+    void add(const std::string& text)
+    {
+        add(text.data(), text.size());
+        add("\0", 1);
+    }
+    void add(uint64_t value)
+    {
+        add(&value, sizeof(value));
+    }
+    std::string hex() const;
+
+private:
+    unsigned __int128 m_state = (static_cast<unsigned __int128>(0x6c62272e07bb0142ULL) << 64) | 0x62b821756295c58dULL;
+};
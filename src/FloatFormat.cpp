@@ -0,0 +1,98 @@
+#include "FloatFormat.h"
+#include <charconv>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+
+size_t formatFloat(double value, char* buffer)
+{
+    if (std::isnan(value))
+    {
+        std::memcpy(buffer, "nan", 3);
+        return 3;
+    }
+    char* out = buffer;
+    if (std::signbit(value))
+    {
+        *out++ = '-';
+        value = -value;
+    }
+    if (std::isinf(value))
+    {
+        std::memcpy(out, "inf", 3);
+        return out + 3 - buffer;
+    }
+    if (value == 0)
+    {
+        std::memcpy(out, "0.0", 3);
+        return out + 3 - buffer;
+    }
+
+    // The shortest digits come from to_chars as d.ddde<exponent>.
+    char scientific[FLOAT_TEXT_SIZE];
+    char* end = std::to_chars(scientific, scientific + sizeof(scientific) - 1, value, std::chars_format::scientific).ptr;
+    *end = '\0';
+    char digits[20];
+    size_t count = 0;
+    const char* p = scientific;
+    for (; p < end && *p != 'e'; ++p)
+    {
+        if (*p != '.')
+        {
+            digits[count++] = *p;
+        }
+    }
+    int exponent = std::atoi(p + 1);
+
+    if (exponent < -4 || exponent >= 16)
+    {
+        *out++ = digits[0];
+        if (count > 1)
+        {
+            *out++ = '.';
+            std::memcpy(out, digits + 1, count - 1);
+            out += count - 1;
+        }
+        *out++ = 'e';
+        *out++ = exponent < 0 ? '-' : '+';
+        int magnitude = std::abs(exponent);
+        if (magnitude >= 100)
+        {
+            *out++ = static_cast<char>('0' + magnitude / 100);
+            magnitude %= 100;
+        }
+        *out++ = static_cast<char>('0' + magnitude / 10);
+        *out++ = static_cast<char>('0' + magnitude % 10);
+        return out - buffer;
+    }
+
+    // The point goes after `whole` digits.
+    int whole = exponent + 1;
+    if (whole <= 0)
+    {
+        *out++ = '0';
+        *out++ = '.';
+        std::memset(out, '0', -whole);
+        out += -whole;
+        std::memcpy(out, digits, count);
+        out += count;
+    }
+    else if (static_cast<size_t>(whole) >= count)
+    {
+        std::memcpy(out, digits, count);
+        out += count;
+        std::memset(out, '0', whole - count);
+        out += whole - count;
+        *out++ = '.';
+        *out++ = '0';
+    }
+    else
+    {
+        std::memcpy(out, digits, whole);
+        out += whole;
+        *out++ = '.';
+        std::memcpy(out, digits + whole, count - whole);
+        out += count - whole;
+    }
+    return out - buffer;
+}
@@ -0,0 +1,16 @@
+#pragma once
+
+#include <cstddef>
+
+// Room for any formatted double: a sign, 17 digits, a point, up to 4 leading zeros and an
+// exponent.
+const size_t FLOAT_TEXT_SIZE = 32;
+
+// Writes the shortest decimal that reads back as exactly `value`, choosing the one nearest the
+// value when several are as short. Values with a decimal exponent from -4 to 15 are written
+// out in full with at least one digit after the point (0.001, 2.5, 100.0); the others in
+// scientific notation with at least two exponent digits (1e+16, 2.5e-07). Also writes nan,
+// inf, -inf and -0.0. Returns the length; the text is not terminated.
+//
+// The native runtime's _print_float produces the same text from the same digits.
+size_t formatFloat(double value, char* buffer);
@@ -0,0 +1,432 @@
+#include "Interpreter.h"
+#include "FloatFormat.h"
+#include "MapTable.h"
+#include "StringArena.h"
+#include "StringSearch.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include <unistd.h>
+
+namespace
+{
+    struct CallFrame
+    {
+        const Instruction* return_ip;
+        size_t base;
+        size_t array_base;
+        uint16_t function;
+        uint16_t result;
+    };
+
+    const size_t OUTPUT_CHUNK = 1 << 16;
+    const size_t MAX_CALL_DEPTH = 1 << 20;
+
+    double toFloat(int64_t bits)
+    {
+        double value;
+        std::memcpy(&value, &bits, sizeof(value));
+        return value;
+    }
+
+    int64_t fromFloat(double value)
+    {
+        int64_t bits;
+        std::memcpy(&bits, &value, sizeof(bits));
+        return bits;
+    }
+}
+
+void Interpreter::flush()
+{
+    const char* data = m_output.data();
+    size_t length = m_output.size();
+    while (length > 0)
+    {
+        ssize_t written = ::write(1, data, length);
+        if (written <= 0)
+        {
+            break;
+        }
+        data += written;
+        length -= written;
+    }
+    m_output.clear();
+}
+
+void Interpreter::printInteger(int64_t value)
+{
+    char buffer[21];
+    char* end = buffer + sizeof(buffer);
+    char* p = end;
+    uint64_t magnitude = value < 0 ? 0 - static_cast<uint64_t>(value) : static_cast<uint64_t>(value);
+    do
+    {
+        *--p = static_cast<char>('0' + magnitude % 10);
+        magnitude /= 10;
+    }
+    while (magnitude != 0);
+    if (value < 0)
+    {
+        *--p = '-';
+    }
+    m_output.append(p, end - p);
+}
+
+int Interpreter::run(const BytecodeProgram& program)
+{
+    const Instruction* code = program.code.data();
+    const int64_t* constants = program.constants.data();
+
+    std::vector<int64_t> stack(std::max<size_t>(program.functions[0].registers, 1) * 4 + 1024);
+    std::vector<CallFrame> frames;
+    size_t base = 0;
+    uint16_t function = 0;
+    int64_t* R = stack.data();
+    // Array elements, one block per active call like the registers.
+    const BytecodeArray* arrays = program.arrays.data();
+    std::vector<int64_t> elements(program.functions[0].array_words);
+    size_t array_base = 0;
+    int64_t* A = elements.data();
+    const Instruction* ip = code + program.functions[0].entry;
+    // String registers point at the text of the program's string table or of built strings.
+    const std::string* strings = program.strings.data();
+    MapArena maps;
+    StringArena built;
+
+#if defined(__GNUC__)
+    static const void* const dispatch[] = {
+        &&op_LOADI, &&op_LOADK, &&op_LOADS, &&op_MOV, &&op_ADD, &&op_SUB, &&op_MUL, &&op_DIV,
+        &&op_AND, &&op_OR, &&op_EQ, &&op_LT, &&op_GT, &&op_NOT, &&op_JMP, &&op_JMPF,
+        &&op_PRINTI, &&op_PRINTS, &&op_NEWLINE, &&op_CALL, &&op_RET, &&op_FILL, &&op_LOADX, &&op_STOREX,
+        &&op_NARROW, &&op_FADD, &&op_FSUB, &&op_FMUL, &&op_FDIV, &&op_FEQ, &&op_FLT, &&op_FGT,
+        &&op_ITOF, &&op_FTOI, &&op_PRINTF, &&op_MAPNEW, &&op_MAPGET, &&op_MAPSET, &&op_MAPHAS, &&op_JOIN, &&op_TEXT, &&op_MARK, &&op_RESET,
+        &&op_STREQ, &&op_STARTS, &&op_CONTAINS, &&op_HALT,
+    };
+    static_assert(sizeof(dispatch) / sizeof(dispatch[0]) == static_cast<size_t>(OpCode::HALT) + 1, "Dispatch table out of date.");
+    #define CASE(name) op_##name:
+    #define NEXT() goto *dispatch[static_cast<size_t>((++ip)->op)]
+    #define JUMP(target) do { ip = code + (target); goto *dispatch[static_cast<size_t>(ip->op)]; } while (0)
+    goto *dispatch[static_cast<size_t>(ip->op)];
+#else
+    #define CASE(name) case OpCode::name:
+    #define NEXT() ++ip; goto dispatch_loop
+    #define JUMP(target) do { ip = code + (target); goto dispatch_loop; } while (0)
+dispatch_loop:
+    switch (ip->op)
+    {
+#endif
+
+    CASE(LOADI)
+        R[ip->a] = ip->bx();
+        NEXT();
+    CASE(LOADK)
+        R[ip->a] = constants[ip->bx()];
+        NEXT();
+    CASE(LOADS)
+        R[ip->a] = reinterpret_cast<int64_t>(strings[ip->bx()].c_str());
+        NEXT();
+    CASE(MOV)
+        R[ip->a] = R[ip->b];
+        NEXT();
+    CASE(ADD)
+        R[ip->a] = static_cast<int64_t>(static_cast<uint64_t>(R[ip->b]) + static_cast<uint64_t>(R[ip->c]));
+        NEXT();
+    CASE(SUB)
+        R[ip->a] = static_cast<int64_t>(static_cast<uint64_t>(R[ip->b]) - static_cast<uint64_t>(R[ip->c]));
+        NEXT();
+    CASE(MUL)
+        R[ip->a] = static_cast<int64_t>(static_cast<uint64_t>(R[ip->b]) * static_cast<uint64_t>(R[ip->c]));
+        NEXT();
+    CASE(DIV)
+        if (R[ip->c] == 0 || (R[ip->c] == -1 && R[ip->b] == INT64_MIN))
+        {
+            flush();
+            std::cerr << "Runtime Error: integer division overflow or division by zero." << std::endl;
+            return 136;
+        }
+        R[ip->a] = R[ip->b] / R[ip->c];
+        NEXT();
+    CASE(AND)
+        R[ip->a] = R[ip->b] & R[ip->c];
+        NEXT();
+    CASE(OR)
+        R[ip->a] = R[ip->b] | R[ip->c];
+        NEXT();
+    CASE(EQ)
+        R[ip->a] = R[ip->b] == R[ip->c];
+        NEXT();
+    CASE(LT)
+        R[ip->a] = R[ip->b] < R[ip->c];
+        NEXT();
+    CASE(GT)
+        R[ip->a] = R[ip->b] > R[ip->c];
+        NEXT();
+    CASE(NOT)
+        R[ip->a] = R[ip->b] ^ 1;
+        NEXT();
+    CASE(JMP)
+        JUMP(ip->bx());
+    CASE(JMPF)
+        if (R[ip->a] == 0)
+        {
+            JUMP(ip->bx());
+        }
+        NEXT();
+    CASE(PRINTI)
+        printInteger(R[ip->a]);
+        if (m_output.size() >= OUTPUT_CHUNK)
+        {
+            flush();
+        }
+        NEXT();
+    CASE(PRINTS)
+        m_output += reinterpret_cast<const char*>(R[ip->a]);
+        if (m_output.size() >= OUTPUT_CHUNK)
+        {
+            flush();
+        }
+        NEXT();
+    CASE(NEWLINE)
+        m_output += '\n';
+        if (m_output.size() >= OUTPUT_CHUNK)
+        {
+            flush();
+        }
+        NEXT();
+    CASE(CALL)
+    {
+        const BytecodeFunction& callee = program.functions[ip->b];
+        size_t callee_base = base + program.functions[function].registers;
+        if (frames.size() >= MAX_CALL_DEPTH)
+        {
+            flush();
+            std::cerr << "Runtime Error: call stack exhausted in '" << callee.name << "'." << std::endl;
+            return 139;
+        }
+        if (callee_base + callee.registers > stack.size())
+        {
+            stack.resize((callee_base + callee.registers) * 2);
+            R = stack.data() + base;
+        }
+        for (uint16_t i = 0; i < callee.params; ++i)
+        {
+            stack[callee_base + i] = R[ip->c + i];
+        }
+        size_t callee_array_base = array_base + program.functions[function].array_words;
+        if (callee_array_base + callee.array_words > elements.size())
+        {
+            elements.resize((callee_array_base + callee.array_words) * 2);
+        }
+        frames.push_back({ip + 1, base, array_base, function, ip->a});
+        base = callee_base;
+        array_base = callee_array_base;
+        function = ip->b;
+        R = stack.data() + base;
+        A = elements.data() + array_base;
+        JUMP(callee.entry);
+    }
+    CASE(RET)
+    {
+        int64_t result = R[ip->a];
+        const CallFrame& frame = frames.back();
+        base = frame.base;
+        array_base = frame.array_base;
+        function = frame.function;
+        R = stack.data() + base;
+        A = elements.data() + array_base;
+        R[frame.result] = result;
+        ip = frame.return_ip;
+        frames.pop_back();
+        JUMP(ip - code);
+    }
+    CASE(FILL)
+    {
+        const BytecodeArray& array = arrays[ip->bx()];
+        std::fill(A + array.offset, A + array.offset + array.length, R[ip->a]);
+        NEXT();
+    }
+    CASE(LOADX)
+    {
+        const BytecodeArray& array = arrays[ip->b];
+        uint64_t element = static_cast<uint64_t>(R[ip->c]) - 1;
+        if (element >= array.length)
+        {
+            goto index_error;
+        }
+        R[ip->a] = A[array.offset + element];
+        NEXT();
+    }
+    CASE(STOREX)
+    {
+        const BytecodeArray& array = arrays[ip->b];
+        uint64_t element = static_cast<uint64_t>(R[ip->c]) - 1;
+        if (element >= array.length)
+        {
+            goto index_error;
+        }
+        A[array.offset + element] = R[ip->a];
+        NEXT();
+    }
+    CASE(NARROW)
+        if (ip->b == 0)
+        {
+            R[ip->a] = R[ip->a] != 0;
+        }
+        else if (ip->b == 1)
+        {
+            R[ip->a] = static_cast<int8_t>(R[ip->a]);
+        }
+        else if (ip->b == 2)
+        {
+            R[ip->a] = static_cast<int16_t>(R[ip->a]);
+        }
+        else
+        {
+            R[ip->a] = static_cast<int32_t>(R[ip->a]);
+        }
+        NEXT();
+    CASE(FADD)
+        R[ip->a] = fromFloat(toFloat(R[ip->b]) + toFloat(R[ip->c]));
+        NEXT();
+    CASE(FSUB)
+        R[ip->a] = fromFloat(toFloat(R[ip->b]) - toFloat(R[ip->c]));
+        NEXT();
+    CASE(FMUL)
+        R[ip->a] = fromFloat(toFloat(R[ip->b]) * toFloat(R[ip->c]));
+        NEXT();
+    CASE(FDIV)
+        R[ip->a] = fromFloat(toFloat(R[ip->b]) / toFloat(R[ip->c]));
+        NEXT();
+    CASE(FEQ)
+        R[ip->a] = toFloat(R[ip->b]) == toFloat(R[ip->c]);
+        NEXT();
+    CASE(FLT)
+        R[ip->a] = toFloat(R[ip->b]) < toFloat(R[ip->c]);
+        NEXT();
+    CASE(FGT)
+        R[ip->a] = toFloat(R[ip->b]) > toFloat(R[ip->c]);
+        NEXT();
+    CASE(ITOF)
+        R[ip->a] = fromFloat(static_cast<double>(R[ip->b]));
+        NEXT();
+    CASE(FTOI)
+    {
+        double value = toFloat(R[ip->b]);
+        R[ip->a] = std::isnan(value) || value >= 9223372036854775808.0 || value < -9223372036854775808.0 ? INT64_MIN : static_cast<int64_t>(value);
+        NEXT();
+    }
+    CASE(PRINTF)
+    {
+        char buffer[FLOAT_TEXT_SIZE];
+        m_output.append(buffer, formatFloat(toFloat(R[ip->a]), buffer));
+        if (m_output.size() >= OUTPUT_CHUNK)
+        {
+            flush();
+        }
+        NEXT();
+    }
+    CASE(MAPNEW)
+    {
+        MapTable* table = mapNew(maps, ip->c != 0, R[ip->b]);
+        if (!table)
+        {
+            goto memory_error;
+        }
+        R[ip->a] = reinterpret_cast<int64_t>(table);
+        NEXT();
+    }
+    CASE(MAPGET)
+    {
+        MapTable* table = reinterpret_cast<MapTable*>(R[ip->b]);
+        int64_t* value = mapSlot(maps, *table, static_cast<uint64_t>(R[ip->c]), false);
+        if (!value)
+        {
+            goto key_error;
+        }
+        R[ip->a] = *value;
+        NEXT();
+    }
+    CASE(MAPSET)
+    {
+        MapTable* table = reinterpret_cast<MapTable*>(R[ip->b]);
+        int64_t* value = mapSlot(maps, *table, static_cast<uint64_t>(R[ip->c]), true);
+        if (!value)
+        {
+            goto memory_error;
+        }
+        *value = R[ip->a];
+        NEXT();
+    }
+    CASE(MAPHAS)
+    {
+        MapTable* table = reinterpret_cast<MapTable*>(R[ip->b]);
+        R[ip->a] = mapSlot(maps, *table, static_cast<uint64_t>(R[ip->c]), false) != nullptr;
+        NEXT();
+    }
+    CASE(JOIN)
+    {
+        char* text = built.join(reinterpret_cast<const char*>(R[ip->b]), reinterpret_cast<const char*>(R[ip->c]));
+        if (!text)
+        {
+            goto memory_error;
+        }
+        R[ip->a] = reinterpret_cast<int64_t>(text);
+        NEXT();
+    }
+    CASE(TEXT)
+    {
+        char* text = built.text(R[ip->b]);
+        if (!text)
+        {
+            goto memory_error;
+        }
+        R[ip->a] = reinterpret_cast<int64_t>(text);
+        NEXT();
+    }
+    CASE(MARK)
+        R[ip->a] = reinterpret_cast<int64_t>(built.mark());
+        NEXT();
+    CASE(RESET)
+        built.reset(reinterpret_cast<char*>(R[ip->a]));
+        NEXT();
+    CASE(STREQ)
+        R[ip->a] = textEqual(reinterpret_cast<const char*>(R[ip->b]), reinterpret_cast<const char*>(R[ip->c]));
+        NEXT();
+    CASE(STARTS)
+        R[ip->a] = textStartsWith(reinterpret_cast<const char*>(R[ip->b]), reinterpret_cast<const char*>(R[ip->c]));
+        NEXT();
+    CASE(CONTAINS)
+        R[ip->a] = textContains(reinterpret_cast<const char*>(R[ip->b]), reinterpret_cast<const char*>(R[ip->c]));
+        NEXT();
+    CASE(HALT)
+        goto done;
+
+#if !defined(__GNUC__)
+    }
+#endif
+    #undef CASE
+    #undef NEXT
+    #undef JUMP
+
+index_error:
+    flush();
+    std::cerr << "Runtime Error: array index out of range." << std::endl;
+    return 1;
+
+key_error:
+    flush();
+    std::cerr << "Runtime Error: the map has no entry for the key." << std::endl;
+    return 1;
+
+memory_error:
+    flush();
+    std::cerr << "Runtime Error: out of memory." << std::endl;
+    return 1;
+
+done:
+    flush();
+    return 0;
+}
@@ -0,0 +1,17 @@
+#pragma once
+
+#include "Bytecode.h"
+#include <string>
+
+// Executes a BytecodeProgram with threaded dispatch. Output matches the native backend.
+class Interpreter
+{
+public:
+    int run(const BytecodeProgram& program);
+
+private:
+    std::string m_output;
+
+    void flush();
+    void printInteger(int64_t value);
+};
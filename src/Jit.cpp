@@ -0,0 +1,336 @@
+#include "Jit.h"
+#include "Assembler.h"
+#include "FloatFormat.h"
+#include "MapTable.h"
+#include "StringArena.h"
+#include "StringSearch.h"
+#include <csetjmp>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <unordered_map>
+#include <sys/mman.h>
+#include <unistd.h>
+
+namespace
+{
+    std::jmp_buf g_exit_point;
+    int g_exit_status = 0;
+    // The maps of the running program; live for the length of Jit::run.
+    MapArena* g_maps = nullptr;
+    // The strings it builds; likewise.
+    StringArena* g_strings = nullptr;
+
+    void writeAll(const char* data, size_t length, int fd = 1)
+    {
+        while (length > 0)
+        {
+            ssize_t written = ::write(fd, data, length);
+            if (written <= 0)
+            {
+                return;
+            }
+            data += written;
+            length -= written;
+        }
+    }
+
+    extern "C" void jitPrintInteger(int64_t value)
+    {
+        char buffer[21];
+        char* end = buffer + sizeof(buffer);
+        char* p = end;
+        uint64_t magnitude = value < 0 ? 0 - static_cast<uint64_t>(value) : static_cast<uint64_t>(value);
+        do
+        {
+            *--p = static_cast<char>('0' + magnitude % 10);
+            magnitude /= 10;
+        }
+        while (magnitude != 0);
+        if (value < 0)
+        {
+            *--p = '-';
+        }
+        writeAll(p, end - p);
+    }
+
+    extern "C" void jitPrintFloat(double value)
+    {
+        char buffer[FLOAT_TEXT_SIZE];
+        writeAll(buffer, formatFloat(value, buffer));
+    }
+
+    extern "C" uint64_t jitStrlen(const char* text)
+    {
+        return std::strlen(text);
+    }
+
+    extern "C" void jitExit(int64_t status)
+    {
+        g_exit_status = static_cast<int>(status);
+        std::longjmp(g_exit_point, 1);
+    }
+
+    void jitOutOfMemory()
+    {
+        const char message[] = "Runtime Error: out of memory.\n";
+        writeAll(message, sizeof(message) - 1, 2);
+        jitExit(1);
+    }
+
+    extern "C" MapTable* jitMapNew(int64_t string_keys, int64_t capacity)
+    {
+        MapTable* table = mapNew(*g_maps, string_keys != 0, capacity);
+        if (!table)
+        {
+            jitOutOfMemory();
+        }
+        return table;
+    }
+
+    extern "C" int64_t* jitMapSlot(MapTable* table, uint64_t key, int64_t insert)
+    {
+        int64_t* value = mapSlot(*g_maps, *table, key, insert != 0);
+        if (!value && insert)
+        {
+            jitOutOfMemory();
+        }
+        return value;
+    }
+
+    extern "C" char* jitStringJoin(const char* left, const char* right)
+    {
+        char* text = g_strings->join(left, right);
+        if (!text)
+        {
+            jitOutOfMemory();
+        }
+        return text;
+    }
+
+    extern "C" char* jitStringText(int64_t value)
+    {
+        char* text = g_strings->text(value);
+        if (!text)
+        {
+            jitOutOfMemory();
+        }
+        return text;
+    }
+
+    extern "C" char* jitStringMark()
+    {
+        return g_strings->mark();
+    }
+
+    extern "C" void jitStringReset(char* mark)
+    {
+        g_strings->reset(mark);
+    }
+
+    extern "C" int64_t jitStringEqual(const char* left, const char* right)
+    {
+        return textEqual(left, right);
+    }
+
+    extern "C" int64_t jitStringStarts(const char* text, const char* prefix)
+    {
+        return textStartsWith(text, prefix);
+    }
+
+    extern "C" int64_t jitStringContains(const char* text, const char* part)
+    {
+        return textContains(text, part);
+    }
+
+    // The generated code calls its helpers with a misaligned stack and its own register
+    // conventions; these thunks adapt them to the System V ABI of the host functions.
+    const char* const RUNTIME_THUNKS = R"(
+section .text
+_jit_ccall:
+    push rbp
+    mov rbp, rsp
+    and rsp, -16
+    call r10
+    mov rsp, rbp
+    pop rbp
+    ret
+_print_integer:
+    mov rdi, rax
+    mov r10, __jit_print_integer
+    jmp _jit_ccall
+_print_float:
+    mov r10, __jit_print_float
+    jmp _jit_ccall
+_strlen:
+    mov r10, __jit_strlen
+    jmp _jit_ccall
+_map_new:
+    mov r10, __jit_map_new
+    jmp _jit_ccall
+_map_slot:
+    mov r10, __jit_map_slot
+    jmp _jit_ccall
+_string_join:
+    mov r10, __jit_string_join
+    jmp _jit_ccall
+_string_text:
+    mov r10, __jit_string_text
+    jmp _jit_ccall
+_string_mark:
+    mov r10, __jit_string_mark
+    jmp _jit_ccall
+_string_reset:
+    mov r10, __jit_string_reset
+    jmp _jit_ccall
+_string_equal:
+    mov r10, __jit_string_equal
+    jmp _jit_ccall
+_string_starts:
+    mov r10, __jit_string_starts
+    jmp _jit_ccall
+_string_contains:
+    mov r10, __jit_string_contains
+    jmp _jit_ccall
+exit:
+    mov r10, __jit_exit
+    jmp _jit_ccall
+)";
+
+    const std::unordered_map<std::string, uint64_t>& hostSymbols()
+    {
+        static const std::unordered_map<std::string, uint64_t> symbols = {
+            {"__jit_print_integer", reinterpret_cast<uint64_t>(&jitPrintInteger)},
+            {"__jit_print_float", reinterpret_cast<uint64_t>(&jitPrintFloat)},
+            {"__jit_strlen", reinterpret_cast<uint64_t>(&jitStrlen)},
+            {"__jit_map_new", reinterpret_cast<uint64_t>(&jitMapNew)},
+            {"__jit_map_slot", reinterpret_cast<uint64_t>(&jitMapSlot)},
+            {"__jit_string_join", reinterpret_cast<uint64_t>(&jitStringJoin)},
+            {"__jit_string_text", reinterpret_cast<uint64_t>(&jitStringText)},
+            {"__jit_string_mark", reinterpret_cast<uint64_t>(&jitStringMark)},
+            {"__jit_string_reset", reinterpret_cast<uint64_t>(&jitStringReset)},
+            {"__jit_string_equal", reinterpret_cast<uint64_t>(&jitStringEqual)},
+            {"__jit_string_starts", reinterpret_cast<uint64_t>(&jitStringStarts)},
+            {"__jit_string_contains", reinterpret_cast<uint64_t>(&jitStringContains)},
+            {"__jit_exit", reinterpret_cast<uint64_t>(&jitExit)},
+        };
+        return symbols;
+    }
+
+    uint64_t alignUp(uint64_t value, uint64_t alignment)
+    {
+        return (value + alignment - 1) & ~(alignment - 1);
+    }
+}
+
+int Jit::run(const std::string& assembly)
+{
+    Assembler assembler;
+    assembler.assemble(assembly);
+    assembler.assemble(RUNTIME_THUNKS);
+
+    // Host symbols are reached through absolute-jump stubs so that rel32 calls from
+    // the buffer never need to span the distance to the compiler's own text.
+    std::vector<std::string> externs = assembler.undefinedSymbols();
+    for (const auto& name : externs)
+    {
+        if (!hostSymbols().count(name))
+        {
+            throw std::runtime_error("Undefined symbol '" + name + "'.");
+        }
+    }
+
+    std::vector<AsmSection>& sections = assembler.sections();
+    const uint64_t page = static_cast<uint64_t>(sysconf(_SC_PAGESIZE));
+    std::vector<uint64_t> offsets(sections.size());
+    uint64_t cursor = 0;
+    for (size_t i = 0; i < sections.size(); ++i)
+    {
+        if (sections[i].executable)
+        {
+            cursor = alignUp(cursor, sections[i].alignment);
+            offsets[i] = cursor;
+            cursor += sections[i].size();
+        }
+    }
+    const uint64_t stub_size = 16;
+    uint64_t stubs_offset = alignUp(cursor, 16);
+    cursor = stubs_offset + externs.size() * stub_size;
+    const uint64_t text_size = alignUp(cursor, page);
+    cursor = text_size;
+    for (size_t i = 0; i < sections.size(); ++i)
+    {
+        if (!sections[i].executable)
+        {
+            cursor = alignUp(cursor, sections[i].alignment);
+            offsets[i] = cursor;
+            cursor += sections[i].size();
+        }
+    }
+    const uint64_t total_size = alignUp(std::max<uint64_t>(cursor, page), page);
+
+    void* memory = mmap(nullptr, total_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_32BIT, -1, 0);
+    if (memory == MAP_FAILED)
+    {
+        throw std::runtime_error("Could not map memory for the generated code.");
+    }
+    uint8_t* base = static_cast<uint8_t*>(memory);
+    const uint64_t base_address = reinterpret_cast<uint64_t>(base);
+
+    std::vector<uint64_t> addresses(sections.size());
+    for (size_t i = 0; i < sections.size(); ++i)
+    {
+        addresses[i] = base_address + offsets[i];
+    }
+
+    std::unordered_map<std::string, uint64_t> stubs;
+    for (size_t i = 0; i < externs.size(); ++i)
+    {
+        uint8_t* stub = base + stubs_offset + i * stub_size;
+        const uint8_t jump[] = {0xFF, 0x25, 0x00, 0x00, 0x00, 0x00};
+        std::memcpy(stub, jump, sizeof(jump));
+        uint64_t target = hostSymbols().at(externs[i]);
+        std::memcpy(stub + sizeof(jump), &target, sizeof(target));
+        stubs[externs[i]] = reinterpret_cast<uint64_t>(stub);
+    }
+
+    try
+    {
+        assembler.link(addresses, [&](const std::string& name) { return stubs.at(name); });
+    }
+    catch (...)
+    {
+        munmap(memory, total_size);
+        throw;
+    }
+
+    for (size_t i = 0; i < sections.size(); ++i)
+    {
+        if (!sections[i].nobits)
+        {
+            std::memcpy(base + offsets[i], sections[i].bytes.data(), sections[i].bytes.size());
+        }
+    }
+
+    if (mprotect(memory, text_size, PROT_READ | PROT_EXEC) != 0)
+    {
+        munmap(memory, total_size);
+        throw std::runtime_error("Could not make the generated code executable.");
+    }
+
+    auto entry = reinterpret_cast<void (*)()>(assembler.symbolAddress("_start", addresses));
+    MapArena maps;
+    StringArena strings;
+    g_maps = &maps;
+    g_strings = &strings;
+    g_exit_status = 0;
+    if (setjmp(g_exit_point) == 0)
+    {
+        entry();
+    }
+    g_maps = nullptr;
+    g_strings = nullptr;
+
+    munmap(memory, total_size);
+    return g_exit_status;
+}
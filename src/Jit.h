@@ -0,0 +1,10 @@
+#pragma once
+
+#include <string>
+
+// Assembles generated code into an executable buffer and runs it inside the compiler process.
+class Jit
+{
+public:
+    int run(const std::string& assembly);
+};
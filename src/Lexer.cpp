@@ -23,22 +23,66 @@ std::string to_string(TokenType type) {
     return it == typeStrings.end() ? "UNKNOWN" : it->second;
 }
 
+namespace
+{
+    const size_t READ_CHUNK = 1 << 16;
+}
+
 Lexer::Lexer(const std::string& source) : m_source(source) {}
 
+Lexer::Lexer(std::istream& input) : m_input(&input) {}
+
 std::vector<Token> Lexer::scanTokens() 
 {
-    while (!isAtEnd()) 
+    std::vector<Token> tokens;
+    do
+    {
+        tokens.push_back(nextToken());
+    }
+    while (tokens.back().type != TokenType::END_OF_FILE);
+    return tokens;
+}
+
+Token Lexer::nextToken()
+{
+    while (m_next_token == m_tokens.size())
     {
+        m_tokens.clear();
+        m_next_token = 0;
+        if (isAtEnd())
+        {
+            return {TokenType::END_OF_FILE, "", "", m_line};
+        }
         m_start = m_current;
         scanToken();
     }
-    m_tokens.push_back({TokenType::END_OF_FILE, "", "", m_line});
-    return m_tokens;
+    return std::move(m_tokens[m_next_token++]);
+}
+
+// Makes at least `needed` characters available past m_current, dropping everything before the
+// token being scanned. Returns false if the input runs out first.
+bool Lexer::refill(size_t needed)
+{
+    while (m_current + needed > m_source.length())
+    {
+        if (!m_input || !*m_input)
+        {
+            return false;
+        }
+        m_source.erase(0, m_start);
+        m_current -= m_start;
+        m_start = 0;
+        size_t length = m_source.length();
+        m_source.resize(length + READ_CHUNK);
+        m_input->read(&m_source[length], READ_CHUNK);
+        m_source.resize(length + static_cast<size_t>(m_input->gcount()));
+    }
+    return true;
 }
 
 bool Lexer::isAtEnd() 
 { 
-    return m_current >= m_source.length(); 
+    return m_current >= m_source.length() && !refill(1); 
 }
 char Lexer::advance() 
 {
@@ -55,7 +99,7 @@ char Lexer::peek()
 }
 char Lexer::peekNext() 
 { 
-    if (m_current + 1 >= m_source.length())
+    if (m_current + 1 >= m_source.length() && !refill(2))
     { 
         return '\0'; 
     }
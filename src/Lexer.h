@@ -1,5 +1,6 @@
 #pragma once
 
+#include <istream>
 #include <string>
 #include <vector>
 #include "Token.h"
@@ -8,15 +9,22 @@ class Lexer
 {
 public:
     Lexer(const std::string& source);
+    // Reads the source incrementally, holding only the unconsumed part of the current chunk.
+    explicit Lexer(std::istream& input);
     std::vector<Token> scanTokens();
+    // Returns the next token, or END_OF_FILE once the source is exhausted.
+    Token nextToken();
 
 private:
-    const std::string m_source;
+    std::string m_source;
+    std::istream* m_input = nullptr;
+    size_t m_next_token = 0;
     size_t m_start = 0;
     size_t m_current = 0;
     int m_line = 1;
     std::vector<Token> m_tokens;
 
+    bool refill(size_t needed);
     bool isAtEnd();
     void scanToken();
     char advance();
@@ -0,0 +1,188 @@
+#include "MapTable.h"
+#include <algorithm>
+#include <cstring>
+#include <sys/mman.h>
+
+namespace
+{
+    const uint64_t FNV_OFFSET = 0xcbf29ce484222325ull;
+    const uint64_t FNV_PRIME = 0x100000001b3ull;
+    const uint64_t HASH_MULTIPLIER = 0x9e3779b97f4a7c15ull;
+    const uint64_t MIN_CAPACITY = 8;
+    // Larger requests could only fail to map; this keeps the doubling below from overflowing.
+    const int64_t MAX_CAPACITY = int64_t(1) << 40;
+
+    // FNV-1a over the text of a string key, then a multiplicative mix so that the low bits,
+    // which pick the slot, depend on every bit of the key.
+    uint64_t hashKey(const MapTable& table, uint64_t key)
+    {
+        if (table.string_keys)
+        {
+            uint64_t hash = FNV_OFFSET;
+            for (const unsigned char* p = reinterpret_cast<const unsigned char*>(key); *p; ++p)
+            {
+                hash = (hash ^ *p) * FNV_PRIME;
+            }
+            key = hash;
+        }
+        uint64_t hash = key * HASH_MULTIPLIER;
+        return hash ^ (hash >> 32);
+    }
+
+    bool sameKey(const MapTable& table, uint64_t stored, uint64_t key)
+    {
+        return stored == key || (table.string_keys && std::strcmp(reinterpret_cast<const char*>(stored), reinterpret_cast<const char*>(key)) == 0);
+    }
+
+    size_t slotBytes(uint64_t capacity)
+    {
+        return capacity * (2 * sizeof(uint64_t) + 1);
+    }
+
+    bool allocateSlots(MapArena& arena, MapTable& table, uint64_t capacity)
+    {
+        void* block = arena.allocate(slotBytes(capacity));
+        if (!block)
+        {
+            return false;
+        }
+        table.entries = static_cast<uint64_t*>(block);
+        table.control = reinterpret_cast<uint8_t*>(table.entries + 2 * capacity);
+        table.mask = capacity - 1;
+        table.limit = capacity / 4 * 3;
+        return true;
+    }
+
+    // Moves every entry into a table twice the size. Keys are unique, so each goes into the
+    // first empty slot of its probe sequence.
+    bool grow(MapArena& arena, MapTable& table)
+    {
+        MapTable old = table;
+        if (!allocateSlots(arena, table, 2 * (old.mask + 1)))
+        {
+            return false;
+        }
+        for (uint64_t i = 0; i <= old.mask; ++i)
+        {
+            if (old.control[i] == 0)
+            {
+                continue;
+            }
+            uint64_t slot = hashKey(table, old.entries[2 * i]) & table.mask;
+            while (table.control[slot] != 0)
+            {
+                slot = (slot + 1) & table.mask;
+            }
+            table.control[slot] = old.control[i];
+            table.entries[2 * slot] = old.entries[2 * i];
+            table.entries[2 * slot + 1] = old.entries[2 * i + 1];
+        }
+        arena.release(old.entries, slotBytes(old.mask + 1));
+        return true;
+    }
+}
+
+MapArena::~MapArena()
+{
+    for (const auto& mapping : m_mappings)
+    {
+        munmap(mapping.first, mapping.second);
+    }
+}
+
+void* MapArena::allocate(size_t bytes)
+{
+    bytes = (bytes + 15) & ~size_t(15);
+    if (bytes >= LARGE_BLOCK || bytes > static_cast<size_t>(m_end - m_next))
+    {
+        size_t length = std::max(bytes, CHUNK);
+        void* mapping = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (mapping == MAP_FAILED)
+        {
+            return nullptr;
+        }
+        m_mappings.emplace_back(mapping, length);
+        if (bytes >= LARGE_BLOCK)
+        {
+            return mapping;
+        }
+        m_next = static_cast<char*>(mapping);
+        m_end = m_next + CHUNK;
+    }
+    void* block = m_next;
+    m_next += bytes;
+    return block;
+}
+
+void MapArena::release(void* block, size_t bytes)
+{
+    bytes = (bytes + 15) & ~size_t(15);
+    if (bytes < LARGE_BLOCK)
+    {
+        return;
+    }
+    for (auto& mapping : m_mappings)
+    {
+        if (mapping.first == block)
+        {
+            munmap(mapping.first, mapping.second);
+            mapping = m_mappings.back();
+            m_mappings.pop_back();
+            return;
+        }
+    }
+}
+
+MapTable* mapNew(MapArena& arena, bool string_keys, int64_t capacity)
+{
+    capacity = std::min(std::max<int64_t>(capacity, 0), MAX_CAPACITY);
+    uint64_t slots = MIN_CAPACITY;
+    while (slots / 4 * 3 < static_cast<uint64_t>(capacity))
+    {
+        slots *= 2;
+    }
+    MapTable* table = static_cast<MapTable*>(arena.allocate(sizeof(MapTable)));
+    if (!table)
+    {
+        return nullptr;
+    }
+    table->count = 0;
+    table->string_keys = string_keys ? 1 : 0;
+    return allocateSlots(arena, *table, slots) ? table : nullptr;
+}
+
+int64_t* mapSlot(MapArena& arena, MapTable& table, uint64_t key, bool insert)
+{
+    uint64_t hash = hashKey(table, key);
+    uint8_t tag = static_cast<uint8_t>(0x80 | (hash >> 57));
+    while (true)
+    {
+        for (uint64_t slot = hash & table.mask;; slot = (slot + 1) & table.mask)
+        {
+            uint64_t* entry = table.entries + 2 * slot;
+            if (table.control[slot] == 0)
+            {
+                if (!insert)
+                {
+                    return nullptr;
+                }
+                if (table.count == table.limit)
+                {
+                    break;
+                }
+                table.count++;
+                table.control[slot] = tag;
+                entry[0] = key;
+                return reinterpret_cast<int64_t*>(entry + 1);
+            }
+            if (table.control[slot] == tag && sameKey(table, entry[0], key))
+            {
+                return reinterpret_cast<int64_t*>(entry + 1);
+            }
+        }
+        if (!grow(arena, table))
+        {
+            return nullptr;
+        }
+    }
+}
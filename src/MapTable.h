@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+// Memory for map tables, taken from anonymous mappings and given back all at once when the arena
+// goes. A block of LARGE_BLOCK bytes or more gets a mapping of its own, which release() unmaps;
+// smaller ones are cut from CHUNK-byte mappings and stay until the end.
+class MapArena
+{
+public:
+    static constexpr size_t CHUNK = size_t(1) << 20;
+    static constexpr size_t LARGE_BLOCK = CHUNK / 4;
+
+    MapArena() = default;
+    MapArena(const MapArena&) = delete;
+    MapArena& operator=(const MapArena&) = delete;
+    ~MapArena();
+
+    // Zeroed and 16-byte aligned; nullptr if the memory cannot be mapped.
+    void* allocate(size_t bytes);
+    void release(void* block, size_t bytes);
+
+private:
+    std::vector<std::pair<void*, size_t>> m_mappings;
+    char* m_next = nullptr;
+    char* m_end = nullptr;
+};
+
+// A hash table from 64-bit keys to 64-bit values with open addressing and linear probing. Each
+// slot's key and value sit side by side in `entries`, and `control` has a byte per slot: 0 while
+// it is empty, otherwise 0x80 and the top 7 bits of the key's hash, so a probe passes over most
+// other keys without touching their entries. String keys are pointers to NUL-terminated text and
+// are hashed and compared by the text. The table doubles before it gets more than 3/4 full.
+//
+// The native runtime's _map_new and _map_slot use the same layout, hash and probing.
+struct MapTable
+{
+    uint64_t* entries;
+    uint8_t* control;
+    uint64_t mask;
+    uint64_t count;
+    uint64_t string_keys;
+    // The count at which the next new key grows the table.
+    uint64_t limit;
+};
+
+// An empty table with room for `capacity` entries before it has to grow; nullptr if out of memory.
+MapTable* mapNew(MapArena& arena, bool string_keys, int64_t capacity);
+
+// The value of the entry for `key`. A missing entry is added, holding 0, if `insert` is set;
+// otherwise, or if the table cannot grow, the result is nullptr.
+int64_t* mapSlot(MapArena& arena, MapTable& table, uint64_t key, bool insert);
@@ -0,0 +1,150 @@
+#include "Module.h"
+#include "ModuleFormat.h"
+#include "Lexer.h"
+#include "Parser.h"
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+std::string resolveImport(const std::string& from, const std::string& name)
+{
+    size_t slash = from.rfind('/');
+    std::string path = name.empty() || name[0] == '/' || slash == std::string::npos ? name : from.substr(0, slash + 1) + name;
+    while (path.compare(0, 2, "./") == 0)
+    {
+        path.erase(0, 2);
+    }
+    return path;
+}
+
+std::string moduleKey(const std::string& path)
+{
+    std::error_code error;
+    std::filesystem::path canonical = std::filesystem::weakly_canonical(path, error);
+    return error ? path : canonical.string();
+}
+
+namespace
+{
+    void collectImports(Module& module)
+    {
+        for (const auto& stmt : module.statements)
+        {
+            if (auto import = dynamic_cast<const ImportStmt*>(stmt.get()))
+            {
+                module.imports.push_back(resolveImport(module.path, import->path.literal_value));
+            }
+        }
+    }
+}
+
+std::unique_ptr<Module> loadModule(const std::string& path, size_t jobs)
+{
+    auto module = std::make_unique<Module>();
+    module->path = path;
+
+    // A saved .lrm is used instead of the source as long as it was written from this exact file,
+    // or if there is no source at all.
+    std::string saved = path.size() > 4 && path.compare(path.size() - 4, 4, ".lrm") == 0 ? path : modulePathFor(path);
+    ModuleSource current;
+    ModuleSource recorded;
+    bool has_source = saved != path && statSource(path, current);
+    bool has_saved = statSource(saved, recorded);
+    if (!has_source && !has_saved)
+    {
+        throw std::runtime_error("Could not open file " + path);
+    }
+    if (has_saved)
+    {
+        try
+        {
+            module->statements = readModuleFile(saved, &recorded);
+        }
+        catch (const std::runtime_error&)
+        {
+            if (!has_source)
+            {
+                throw;
+            }
+        }
+        if (!has_source || (recorded.size == current.size && recorded.mtime == current.mtime))
+        {
+            collectImports(*module);
+            return module;
+        }
+        module->statements.clear();
+    }
+
+    std::ifstream file(path);
+    if (!file.is_open())
+    {
+        throw std::runtime_error("Could not open file " + path);
+    }
+    std::stringstream buffer;
+    buffer << file.rdbuf();
+    std::string source = buffer.str();
+
+    Lexer lexer(source);
+    std::vector<Token> tokens = lexer.scanTokens();
+    Parser parser(tokens);
+
+    module->statements = parser.parseParallel(jobs);
+    module->had_error = parser.hadError();
+    collectImports(*module);
+    return module;
+}
+
+ImportResolver::ImportResolver(const std::string& root, size_t jobs) : m_root(root), m_jobs(jobs) 
+{
+    m_included.insert(moduleKey(root));
+}
+
+std::vector<std::unique_ptr<Stmt>> ImportResolver::resolve(const ImportStmt& stmt, const std::string& from)
+{
+    std::vector<std::unique_ptr<Stmt>> procedures;
+    collect(resolveImport(from, stmt.path.literal_value), procedures);
+    return procedures;
+}
+
+void ImportResolver::collect(const std::string& path, std::vector<std::unique_ptr<Stmt>>& procedures)
+{
+    if (!m_included.insert(moduleKey(path)).second)
+    {
+        return;
+    }
+
+    std::unique_ptr<Module> module = loadModule(path, m_jobs);
+    for (auto& stmt : module->statements)
+    {
+        if (auto import = dynamic_cast<const ImportStmt*>(stmt.get()))
+        {
+            collect(resolveImport(path, import->path.literal_value), procedures);
+        }
+        else if (auto procedure = dynamic_cast<ProcedureDeclStmt*>(stmt.get()))
+        {
+            procedure->source = path;
+            procedures.push_back(std::move(stmt));
+        }
+    }
+}
+
+void ImportResolver::splice(std::vector<std::unique_ptr<Stmt>>& statements)
+{
+    std::vector<std::unique_ptr<Stmt>> result;
+    for (auto& stmt : statements)
+    {
+        if (auto import = dynamic_cast<const ImportStmt*>(stmt.get()))
+        {
+            for (auto& procedure : resolve(*import, m_root))
+            {
+                result.push_back(std::move(procedure));
+            }
+        }
+        else
+        {
+            result.push_back(std::move(stmt));
+        }
+    }
+    statements = std::move(result);
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include "AST.h"
+#include <memory>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+// One parsed .lr source file.
+struct Module
+{
+    std::string path;
+    std::vector<std::unique_ptr<Stmt>> statements;
+    // Paths of the modules named by its 'the story recalls "..."' statements, in source order.
+    std::vector<std::string> imports;
+    bool had_error = false;
+};
+
+// Resolves a recalled module path relative to the directory of the module that recalls it.
+std::string resolveImport(const std::string& from, const std::string& name);
+// Names a module file the same however its path is spelled ("a.lr", "./a.lr", "lib/../a.lr"),
+// so it is loaded once. This is the weakly canonical path.
+std::string moduleKey(const std::string& path);
+
+// Reads, lexes and parses a module. A .lrm path, or an up-to-date .lrm next to a .lr source, is
+// loaded directly instead. Throws std::runtime_error if the file cannot be opened.
+std::unique_ptr<Module> loadModule(const std::string& path, size_t jobs);
+
+// Splices recalled procedures into a single program for the whole-program backends (native
+// assembly, --run, --interpret). Only procedures are taken from a recalled module; its own
+// top-level story is not part of the program. Each module is included once, however often it
+// is recalled, and cycles are allowed.
+class ImportResolver
+{
+public:
+    ImportResolver(const std::string& root, size_t jobs);
+
+    // Returns the procedures of the module recalled by `stmt` and of the modules it recalls in
+    // turn, skipping any module that was already included.
+    std::vector<std::unique_ptr<Stmt>> resolve(const ImportStmt& stmt, const std::string& from);
+    // Replaces every top-level import in `statements` with the procedures it brings in.
+    void splice(std::vector<std::unique_ptr<Stmt>>& statements);
+
+private:
+    std::string m_root;
+    size_t m_jobs;
+    // moduleKey() of every module already spliced in, including the root.
+    std::unordered_set<std::string> m_included;
+
+    void collect(const std::string& path, std::vector<std::unique_ptr<Stmt>>& procedures);
+};
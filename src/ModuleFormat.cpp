@@ -0,0 +1,711 @@
+#include "ModuleFormat.h"
+#include "Parser.h"
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <unordered_map>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace
+{
+    const char MAGIC[4] = {'L', 'R', 'M', '\0'};
+    const size_t HEADER_WORDS = 11;
+    // Nodes nested deeper than this are rejected before the recursive decoder runs out of stack.
+    // The writer itself gives up well before a module gets this deep.
+    const size_t MAX_DEPTH = 10000;
+
+    enum NodeTag : uint32_t
+    {
+        NULL_NODE,
+        BLOCK_STMT,
+        DECLARATION_STMT,
+        EXPRESSION_STMT,
+        IF_STMT,
+        WHILE_STMT,
+        PRINT_STMT,
+        NEWLINE_STMT,
+        PROCEDURE_DECL_STMT,
+        PROCEDURE_CALL_STMT,
+        RETURN_STMT,
+        BREAK_STMT,
+        IMPORT_STMT,
+        FOR_STMT,
+        BINARY_EXPR = 32,
+        COMPARISON_EXPR,
+        LITERAL_EXPR,
+        VARIABLE_EXPR,
+        ASSIGN_EXPR,
+        FUNCTION_CALL_EXPR,
+        UNARY_EXPR,
+        INDEX_EXPR,
+        INDEX_ASSIGN_EXPR,
+        LENGTH_EXPR,
+        ENTRY_EXPR,
+        ENTRY_ASSIGN_EXPR,
+        HAS_ENTRY_EXPR,
+        JOIN_EXPR,
+        TEXT_EXPR,
+    };
+
+    class ModuleWriter : public StmtVisitor, public ExprVisitor
+    {
+    public:
+        std::vector<uint32_t> nodes;
+        std::vector<std::string> strings;
+
+        void write(const Stmt* stmt)
+        {
+            if (stmt)
+            {
+                stmt->accept(*this);
+            }
+            else
+            {
+                nodes.push_back(NULL_NODE);
+            }
+        }
+        void write(const Expr* expr)
+        {
+            if (expr)
+            {
+                expr->accept(*this);
+            }
+            else
+            {
+                nodes.push_back(NULL_NODE);
+            }
+        }
+
+        // Statement nodes start with their tag and source line.
+        void begin(NodeTag tag, const Stmt& stmt)
+        {
+            nodes.push_back(tag);
+            nodes.push_back(static_cast<uint32_t>(stmt.line));
+        }
+
+        void visitBlockStmt(const BlockStmt& stmt) override
+        {
+            begin(BLOCK_STMT, stmt);
+            nodes.push_back(static_cast<uint32_t>(stmt.statements.size()));
+            for (const auto& s : stmt.statements)
+            {
+                write(s.get());
+            }
+        }
+        void visitDeclarationStmt(const DeclarationStmt& stmt) override
+        {
+            begin(DECLARATION_STMT, stmt);
+            token(stmt.name);
+            token(stmt.type);
+            nodes.push_back(stmt.is_mutable ? 1 : 0);
+            nodes.push_back(static_cast<uint32_t>(stmt.length));
+            token(stmt.key_type);
+            write(stmt.initializer.get());
+        }
+        void visitExpressionStmt(const ExpressionStmt& stmt) override
+        {
+            begin(EXPRESSION_STMT, stmt);
+            write(stmt.expression.get());
+        }
+        void visitIfStmt(const IfStmt& stmt) override
+        {
+            begin(IF_STMT, stmt);
+            write(stmt.condition.get());
+            write(stmt.then_branch.get());
+            nodes.push_back(stmt.else_branch ? 1 : 0);
+            if (stmt.else_branch)
+            {
+                write(stmt.else_branch.get());
+            }
+        }
+        void visitWhileStmt(const WhileStmt& stmt) override
+        {
+            begin(WHILE_STMT, stmt);
+            write(stmt.condition.get());
+            write(stmt.body.get());
+        }
+        void visitForStmt(const ForStmt& stmt) override
+        {
+            begin(FOR_STMT, stmt);
+            token(stmt.variable);
+            write(stmt.first.get());
+            write(stmt.last.get());
+            write(stmt.body.get());
+        }
+        void visitPrintStmt(const PrintStmt& stmt) override
+        {
+            begin(PRINT_STMT, stmt);
+            write(stmt.expression.get());
+        }
+        void visitNewlineStmt(const NewlineStmt& stmt) override
+        {
+            begin(NEWLINE_STMT, stmt);
+        }
+        void visitProcedureDeclStmt(const ProcedureDeclStmt& stmt) override
+        {
+            begin(PROCEDURE_DECL_STMT, stmt);
+            token(stmt.name);
+            nodes.push_back(static_cast<uint32_t>(stmt.params.size()));
+            for (const auto& param : stmt.params)
+            {
+                token(param.name);
+                token(param.type);
+            }
+            token(stmt.return_type);
+            write(stmt.body.get());
+        }
+        void visitProcedureCallStmt(const ProcedureCallStmt& stmt) override
+        {
+            begin(PROCEDURE_CALL_STMT, stmt);
+            call(stmt.callee_name, stmt.arguments);
+        }
+        void visitReturnStmt(const ReturnStmt& stmt) override
+        {
+            begin(RETURN_STMT, stmt);
+            write(stmt.value.get());
+        }
+        void visitBreakStmt(const BreakStmt& stmt) override
+        {
+            begin(BREAK_STMT, stmt);
+        }
+        void visitImportStmt(const ImportStmt& stmt) override
+        {
+            begin(IMPORT_STMT, stmt);
+            token(stmt.path);
+        }
+
+        void visitBinaryExpr(const BinaryExpr& expr) override
+        {
+            nodes.push_back(BINARY_EXPR);
+            write(expr.left.get());
+            token(expr.op);
+            write(expr.right.get());
+        }
+        void visitComparisonExpr(const ComparisonExpr& expr) override
+        {
+            nodes.push_back(COMPARISON_EXPR);
+            write(expr.left.get());
+            token(expr.op);
+            write(expr.right.get());
+        }
+        void visitLiteralExpr(const LiteralExpr& expr) override
+        {
+            nodes.push_back(LITERAL_EXPR);
+            token(expr.value);
+        }
+        void visitVariableExpr(const VariableExpr& expr) override
+        {
+            nodes.push_back(VARIABLE_EXPR);
+            token(expr.name);
+        }
+        void visitAssignExpr(const AssignExpr& expr) override
+        {
+            nodes.push_back(ASSIGN_EXPR);
+            token(expr.name);
+            write(expr.value.get());
+        }
+        void visitFunctionCallExpr(const FunctionCallExpr& expr) override
+        {
+            nodes.push_back(FUNCTION_CALL_EXPR);
+            call(expr.callee_name, expr.arguments);
+        }
+        void visitUnaryExpr(const UnaryExpr& expr) override
+        {
+            nodes.push_back(UNARY_EXPR);
+            token(expr.op);
+            write(expr.right.get());
+        }
+        void visitIndexExpr(const IndexExpr& expr) override
+        {
+            nodes.push_back(INDEX_EXPR);
+            token(expr.array);
+            write(expr.index.get());
+        }
+        void visitIndexAssignExpr(const IndexAssignExpr& expr) override
+        {
+            nodes.push_back(INDEX_ASSIGN_EXPR);
+            token(expr.array);
+            write(expr.index.get());
+            write(expr.value.get());
+        }
+        void visitLengthExpr(const LengthExpr& expr) override
+        {
+            nodes.push_back(LENGTH_EXPR);
+            token(expr.array);
+        }
+        void visitEntryExpr(const EntryExpr& expr) override
+        {
+            nodes.push_back(ENTRY_EXPR);
+            token(expr.map);
+            write(expr.key.get());
+        }
+        void visitEntryAssignExpr(const EntryAssignExpr& expr) override
+        {
+            nodes.push_back(ENTRY_ASSIGN_EXPR);
+            token(expr.map);
+            write(expr.key.get());
+            write(expr.value.get());
+        }
+        void visitHasEntryExpr(const HasEntryExpr& expr) override
+        {
+            nodes.push_back(HAS_ENTRY_EXPR);
+            token(expr.map);
+            write(expr.key.get());
+        }
+        void visitJoinExpr(const JoinExpr& expr) override
+        {
+            nodes.push_back(JOIN_EXPR);
+            write(expr.left.get());
+            write(expr.right.get());
+        }
+        void visitTextExpr(const TextExpr& expr) override
+        {
+            nodes.push_back(TEXT_EXPR);
+            write(expr.value.get());
+        }
+
+    private:
+        std::unordered_map<std::string, uint32_t> m_string_ids;
+
+        uint32_t intern(const std::string& text)
+        {
+            auto it = m_string_ids.emplace(text, static_cast<uint32_t>(strings.size()));
+            if (it.second)
+            {
+                strings.push_back(text);
+            }
+            return it.first->second;
+        }
+        void token(const Token& token)
+        {
+            nodes.push_back(static_cast<uint32_t>(token.type));
+            nodes.push_back(intern(token.text));
+            nodes.push_back(intern(token.literal_value));
+            nodes.push_back(static_cast<uint32_t>(token.line));
+        }
+        void call(const Token& callee, const std::vector<std::unique_ptr<Expr>>& arguments)
+        {
+            token(callee);
+            nodes.push_back(static_cast<uint32_t>(arguments.size()));
+            for (const auto& arg : arguments)
+            {
+                write(arg.get());
+            }
+        }
+    };
+
+    class ModuleReader
+    {
+    public:
+        ModuleReader(const uint32_t* nodes, size_t node_words, const uint32_t* string_table, size_t string_count, const char* string_bytes, size_t string_size)
+            : m_nodes(nodes), m_node_words(node_words), m_table(string_table), m_string_count(string_count), m_bytes(string_bytes), m_bytes_size(string_size) {}
+
+        bool done() const
+        {
+            return m_cursor == m_node_words;
+        }
+
+        std::unique_ptr<Stmt> stmt()
+        {
+            Nesting nesting(m_depth);
+            uint32_t tag = word();
+            int line = static_cast<int>(word());
+            std::unique_ptr<Stmt> result = stmtFields(tag);
+            result->line = line;
+            return result;
+        }
+
+        std::unique_ptr<Stmt> stmtFields(uint32_t tag)
+        {
+            switch (tag)
+            {
+                case BLOCK_STMT:
+                {
+                    std::vector<std::unique_ptr<Stmt>> statements(count());
+                    for (auto& s : statements)
+                    {
+                        s = stmt();
+                    }
+                    return std::make_unique<BlockStmt>(std::move(statements));
+                }
+                case DECLARATION_STMT:
+                {
+                    Token name = token();
+                    Token type = token();
+                    bool is_mutable = word() != 0;
+                    uint64_t length = word();
+                    if (length > Parser::MAX_ARRAY_LENGTH)
+                    {
+                        throw std::runtime_error("array length out of range");
+                    }
+                    Token key_type = token();
+                    return std::make_unique<DeclarationStmt>(name, type, expr(), is_mutable, length, key_type);
+                }
+                case EXPRESSION_STMT:
+                    return std::make_unique<ExpressionStmt>(expr());
+                case IF_STMT:
+                {
+                    auto condition = expr();
+                    auto then_branch = stmt();
+                    std::unique_ptr<Stmt> else_branch = word() != 0 ? stmt() : nullptr;
+                    return std::make_unique<IfStmt>(std::move(condition), std::move(then_branch), std::move(else_branch));
+                }
+                case WHILE_STMT:
+                {
+                    auto condition = expr();
+                    return std::make_unique<WhileStmt>(std::move(condition), stmt());
+                }
+                case FOR_STMT:
+                {
+                    Token variable = token();
+                    auto first = expr();
+                    auto last = expr();
+                    return std::make_unique<ForStmt>(variable, std::move(first), std::move(last), stmt());
+                }
+                case PRINT_STMT:
+                    return std::make_unique<PrintStmt>(expr());
+                case NEWLINE_STMT:
+                    return std::make_unique<NewlineStmt>();
+                case PROCEDURE_DECL_STMT:
+                {
+                    Token name = token();
+                    std::vector<Param> params(count());
+                    for (auto& param : params)
+                    {
+                        param.name = token();
+                        param.type = token();
+                    }
+                    Token return_type = token();
+                    return std::make_unique<ProcedureDeclStmt>(name, std::move(params), return_type, stmt());
+                }
+                case PROCEDURE_CALL_STMT:
+                {
+                    Token callee = token();
+                    return std::make_unique<ProcedureCallStmt>(callee, arguments());
+                }
+                case RETURN_STMT:
+                    return std::make_unique<ReturnStmt>(expr());
+                case BREAK_STMT:
+                    return std::make_unique<BreakStmt>();
+                case IMPORT_STMT:
+                    return std::make_unique<ImportStmt>(token());
+            }
+            throw std::runtime_error("unknown statement tag " + std::to_string(tag));
+        }
+
+        std::unique_ptr<Expr> expr()
+        {
+            Nesting nesting(m_depth);
+            uint32_t tag = word();
+            switch (tag)
+            {
+                case BINARY_EXPR:
+                case COMPARISON_EXPR:
+                {
+                    auto left = expr();
+                    Token op = token();
+                    auto right = expr();
+                    if (tag == BINARY_EXPR)
+                    {
+                        return std::make_unique<BinaryExpr>(std::move(left), op, std::move(right));
+                    }
+                    return std::make_unique<ComparisonExpr>(std::move(left), op, std::move(right));
+                }
+                case LITERAL_EXPR:
+                    return std::make_unique<LiteralExpr>(token());
+                case VARIABLE_EXPR:
+                    return std::make_unique<VariableExpr>(token());
+                case ASSIGN_EXPR:
+                {
+                    Token name = token();
+                    return std::make_unique<AssignExpr>(name, expr());
+                }
+                case FUNCTION_CALL_EXPR:
+                {
+                    Token callee = token();
+                    return std::make_unique<FunctionCallExpr>(callee, arguments());
+                }
+                case UNARY_EXPR:
+                {
+                    Token op = token();
+                    return std::make_unique<UnaryExpr>(op, expr());
+                }
+                case INDEX_EXPR:
+                {
+                    Token array = token();
+                    return std::make_unique<IndexExpr>(array, expr());
+                }
+                case INDEX_ASSIGN_EXPR:
+                {
+                    Token array = token();
+                    auto index = expr();
+                    return std::make_unique<IndexAssignExpr>(array, std::move(index), expr());
+                }
+                case LENGTH_EXPR:
+                    return std::make_unique<LengthExpr>(token());
+                case ENTRY_EXPR:
+                case HAS_ENTRY_EXPR:
+                {
+                    Token map = token();
+                    if (tag == ENTRY_EXPR)
+                    {
+                        return std::make_unique<EntryExpr>(map, expr());
+                    }
+                    return std::make_unique<HasEntryExpr>(map, expr());
+                }
+                case ENTRY_ASSIGN_EXPR:
+                {
+                    Token map = token();
+                    auto key = expr();
+                    return std::make_unique<EntryAssignExpr>(map, std::move(key), expr());
+                }
+                case JOIN_EXPR:
+                {
+                    auto left = expr();
+                    return std::make_unique<JoinExpr>(std::move(left), expr());
+                }
+                case TEXT_EXPR:
+                    return std::make_unique<TextExpr>(expr());
+            }
+            throw std::runtime_error("unknown expression tag " + std::to_string(tag));
+        }
+
+    private:
+        // Counts a node for as long as it is being decoded.
+        struct Nesting
+        {
+            size_t& depth;
+            explicit Nesting(size_t& d) : depth(d)
+            {
+                if (++depth > MAX_DEPTH)
+                {
+                    throw std::runtime_error("nodes nested too deeply");
+                }
+            }
+            ~Nesting()
+            {
+                --depth;
+            }
+        };
+
+        const uint32_t* m_nodes;
+        size_t m_node_words;
+        size_t m_cursor = 0;
+        size_t m_depth = 0;
+        const uint32_t* m_table;
+        size_t m_string_count;
+        const char* m_bytes;
+        size_t m_bytes_size;
+
+        uint32_t word()
+        {
+            if (m_cursor >= m_node_words)
+            {
+                throw std::runtime_error("node data is truncated");
+            }
+            return m_nodes[m_cursor++];
+        }
+        // A list length can never exceed the words that remain, which bounds allocations.
+        size_t count()
+        {
+            uint32_t n = word();
+            if (n > m_node_words - m_cursor)
+            {
+                throw std::runtime_error("list length out of range");
+            }
+            return n;
+        }
+        std::string string(uint32_t id) const
+        {
+            if (id >= m_string_count)
+            {
+                throw std::runtime_error("string index out of range");
+            }
+            uint32_t offset = m_table[2 * id];
+            uint32_t length = m_table[2 * id + 1];
+            if (offset > m_bytes_size || length > m_bytes_size - offset)
+            {
+                throw std::runtime_error("string out of range");
+            }
+            return std::string(m_bytes + offset, length);
+        }
+        Token token()
+        {
+            Token token;
+            token.type = static_cast<TokenType>(word());
+            token.text = string(word());
+            token.literal_value = string(word());
+            token.line = static_cast<int>(word());
+            return token;
+        }
+        std::vector<std::unique_ptr<Expr>> arguments()
+        {
+            std::vector<std::unique_ptr<Expr>> args(count());
+            for (auto& arg : args)
+            {
+                arg = expr();
+            }
+            return args;
+        }
+    };
+
+    void appendWords(std::string& out, const uint32_t* words, size_t count)
+    {
+        out.append(reinterpret_cast<const char*>(words), count * sizeof(uint32_t));
+    }
+}
+
+bool statSource(const std::string& path, ModuleSource& source)
+{
+    struct stat info;
+    if (stat(path.c_str(), &info) != 0)
+    {
+        return false;
+    }
+    source.size = static_cast<uint64_t>(info.st_size);
+    source.mtime = static_cast<int64_t>(info.st_mtim.tv_sec) * 1000000000 + info.st_mtim.tv_nsec;
+    return true;
+}
+
+std::string modulePathFor(const std::string& source)
+{
+    size_t slash = source.rfind('/');
+    size_t dot = source.rfind('.');
+    if (dot == std::string::npos || (slash != std::string::npos && dot < slash))
+    {
+        return source + ".lrm";
+    }
+    return source.substr(0, dot) + ".lrm";
+}
+
+void writeModuleFile(const std::string& path, const std::vector<std::unique_ptr<Stmt>>& statements, const ModuleSource& source)
+{
+    ModuleWriter writer;
+    for (const auto& stmt : statements)
+    {
+        writer.write(stmt.get());
+    }
+
+    std::vector<uint32_t> table;
+    std::string bytes;
+    for (const auto& text : writer.strings)
+    {
+        table.push_back(static_cast<uint32_t>(bytes.size()));
+        table.push_back(static_cast<uint32_t>(text.size()));
+        bytes += text;
+    }
+    bytes.resize((bytes.size() + 3) & ~size_t(3), '\0');
+
+    uint32_t header[HEADER_WORDS];
+    std::memcpy(&header[0], MAGIC, 4);
+    header[1] = MODULE_FORMAT_VERSION;
+    header[2] = static_cast<uint32_t>(writer.strings.size());
+    header[3] = static_cast<uint32_t>(bytes.size());
+    header[4] = static_cast<uint32_t>(writer.nodes.size());
+    header[5] = static_cast<uint32_t>(statements.size());
+    header[6] = static_cast<uint32_t>(source.size);
+    header[7] = static_cast<uint32_t>(source.size >> 32);
+    header[8] = static_cast<uint32_t>(static_cast<uint64_t>(source.mtime));
+    header[9] = static_cast<uint32_t>(static_cast<uint64_t>(source.mtime) >> 32);
+    header[10] = 0;
+
+    std::string out;
+    appendWords(out, header, HEADER_WORDS);
+    appendWords(out, table.data(), table.size());
+    out += bytes;
+    appendWords(out, writer.nodes.data(), writer.nodes.size());
+
+    std::string temporary = path + ".tmp";
+    {
+        std::ofstream file(temporary, std::ios::binary);
+        if (!file.write(out.data(), out.size()))
+        {
+            throw std::runtime_error("Could not write " + path);
+        }
+    }
+    if (std::rename(temporary.c_str(), path.c_str()) != 0)
+    {
+        std::remove(temporary.c_str());
+        throw std::runtime_error("Could not write " + path);
+    }
+}
+
+std::vector<std::unique_ptr<Stmt>> readModuleFile(const std::string& path, ModuleSource* source)
+{
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        throw std::runtime_error("Could not open file " + path);
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size < static_cast<off_t>(HEADER_WORDS * sizeof(uint32_t)))
+    {
+        close(fd);
+        throw std::runtime_error(path + " is not a LostRecord module.");
+    }
+    size_t size = static_cast<size_t>(info.st_size);
+    void* mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED)
+    {
+        throw std::runtime_error("Could not map " + path);
+    }
+
+    std::vector<std::unique_ptr<Stmt>> statements;
+    try
+    {
+        const uint32_t* words = static_cast<const uint32_t*>(mapping);
+        if (std::memcmp(words, MAGIC, 4) != 0)
+        {
+            throw std::runtime_error("bad magic");
+        }
+        if (words[1] != MODULE_FORMAT_VERSION)
+        {
+            throw std::runtime_error("format version " + std::to_string(words[1]) + ", expected " + std::to_string(MODULE_FORMAT_VERSION));
+        }
+        uint64_t string_count = words[2];
+        uint64_t string_bytes = words[3];
+        uint64_t node_words = words[4];
+        uint64_t statement_count = words[5];
+        if (source)
+        {
+            source->size = words[6] | static_cast<uint64_t>(words[7]) << 32;
+            source->mtime = static_cast<int64_t>(words[8] | static_cast<uint64_t>(words[9]) << 32);
+        }
+        uint64_t expected = (HEADER_WORDS + 2 * string_count + node_words) * sizeof(uint32_t) + string_bytes;
+        if (expected != size || string_bytes % 4 != 0)
+        {
+            throw std::runtime_error("file size does not match its header");
+        }
+
+        const uint32_t* table = words + HEADER_WORDS;
+        const char* bytes = reinterpret_cast<const char*>(table + 2 * string_count);
+        const uint32_t* nodes = reinterpret_cast<const uint32_t*>(bytes + string_bytes);
+        // Every statement takes at least its tag and line, so a larger count cannot be right.
+        if (statement_count > node_words / 2)
+        {
+            throw std::runtime_error("statement count out of range");
+        }
+        ModuleReader reader(nodes, node_words, table, string_count, bytes, string_bytes);
+        statements.reserve(statement_count);
+        while (!reader.done())
+        {
+            statements.push_back(reader.stmt());
+        }
+        if (statements.size() != statement_count)
+        {
+            throw std::runtime_error("statement count does not match its header");
+        }
+    }
+    catch (const std::runtime_error& e)
+    {
+        munmap(mapping, size);
+        throw std::runtime_error(path + " is not a valid LostRecord module: " + e.what());
+    }
+
+    munmap(mapping, size);
+    return statements;
+}
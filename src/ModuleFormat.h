@@ -0,0 +1,41 @@
+#pragma once
+
+#include "AST.h"
+#include <memory>
+#include <string>
+#include <vector>
+
+// Binary module format (.lrm): a parsed module saved so it can be loaded without lexing or
+// parsing. All fields are little-endian 32-bit words:
+//
+//   header    "LRM\0", version, string count, string bytes, node words, statement count,
+//             source size (2 words), source mtime (2 words)
+//   strings   (offset, length) per pooled string, then the string bytes
+//   nodes     the statements in pre-order; each node is a tag followed by its fields, tokens
+//             are (type, text id, literal id, line) and child lists are a count and the children.
+//             Statement nodes carry their source line right after the tag, and an if has a
+//             flag word after its then branch saying whether an 'otherwise' branch follows.
+//             A declaration's length word is 0 unless it declares an array, and the key type
+//             token after it is empty unless it declares a map.
+//
+// The file is mapped read-only and decoded in one pass with every read bounds-checked. Counts
+// and array lengths are checked against what the file and the language allow, and the nesting
+// depth is capped, so a corrupt file is reported rather than exhausting memory or the stack.
+const uint32_t MODULE_FORMAT_VERSION = 7;
+
+struct ModuleSource
+{
+    uint64_t size = 0;
+    int64_t mtime = 0;
+};
+
+// Size and modification time of a source file, recorded in the .lrm so a stale one is ignored.
+bool statSource(const std::string& path, ModuleSource& source);
+
+void writeModuleFile(const std::string& path, const std::vector<std::unique_ptr<Stmt>>& statements, const ModuleSource& source);
+
+// Throws std::runtime_error if the file is missing, truncated, or from another format version.
+std::vector<std::unique_ptr<Stmt>> readModuleFile(const std::string& path, ModuleSource* source = nullptr);
+
+// The .lrm that sits next to a .lr source (story.lr -> story.lrm).
+std::string modulePathFor(const std::string& source);
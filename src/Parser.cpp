@@ -1,4 +1,6 @@
 #include "Parser.h"
+#include "ThreadPool.h"
+#include <sstream>
 #include <stdexcept>
 #include <iostream>
 #include <memory>
@@ -9,35 +11,185 @@ bool is_in(const std::string& token_text, const std::vector<std::string>& texts)
     return std::find(texts.begin(), texts.end(), token_text) != texts.end();
 }
 
-Parser::Parser(const std::vector<Token>& tokens) : m_tokens(tokens) {}
+Parser::Parser(const std::vector<Token>& tokens) : m_tokens(&tokens), m_end(tokens.size()), m_errors(std::cerr) {}
+
+Parser::Parser(const std::vector<Token>& tokens, size_t begin, size_t end, std::ostream& errors) 
+    : m_tokens(&tokens), m_current(begin), m_end(end), m_errors(errors) {}
+
+Parser::Parser(Lexer& lexer) : m_next_token([&lexer] { return lexer.nextToken(); }), m_errors(std::cerr) {}
+
+Parser::Parser(std::function<Token()> next_token) : m_next_token(std::move(next_token)), m_errors(std::cerr) {}
 
 std::vector<std::unique_ptr<Stmt>> Parser::parse()
 {
     std::vector<std::unique_ptr<Stmt>> statements;
 
+    while (auto stmt = parseNext()) 
+    {
+        statements.push_back(std::move(stmt));
+    }
+
+    return statements;
+}
+
+std::unique_ptr<Stmt> Parser::parseNext()
+{
     while (!isAtEnd()) 
     {
         try 
         {
-            statements.push_back(statement());
+            return statement();
         } 
         catch (const std::runtime_error& e) 
         {
-            std::cerr << "Line " << peek().line << ": Parse Error: " << e.what() << std::endl;
+            m_errors << "Line " << peek().line << ": Parse Error: " << e.what() << std::endl;
+            m_had_error = true;
             synchronize();
         }
     }
 
+    return nullptr;
+}
+
+namespace
+{
+    bool textsAt(const std::vector<Token>& tokens, size_t at, std::initializer_list<const char*> texts)
+    {
+        for (const char* text : texts)
+        {
+            if (at >= tokens.size() || tokens[at].text != text)
+            {
+                return false;
+            }
+            at++;
+        }
+        return true;
+    }
+
+    // Splits the token stream into alternating runs of ordinary top-level statements and
+    // single top-level procedure declarations, using 'beginning'/'end of the story' depth.
+    std::vector<std::pair<size_t, size_t>> splitTopLevel(const std::vector<Token>& tokens)
+    {
+        std::vector<std::pair<size_t, size_t>> slices;
+        size_t end = tokens.empty() ? 0 : tokens.size() - 1;
+        size_t gap_start = 0;
+        size_t i = 0;
+
+        while (i < end)
+        {
+            if (!textsAt(tokens, i, {"for", "procedure"}))
+            {
+                i++;
+                continue;
+            }
+
+            size_t start = i;
+            int depth = 0;
+            bool entered = false;
+            while (i < end)
+            {
+                if (textsAt(tokens, i, {"beginning", "of", "the", "story"}))
+                {
+                    depth++;
+                    entered = true;
+                    i += 4;
+                }
+                else if (textsAt(tokens, i, {"end", "of", "the", "story"}))
+                {
+                    depth--;
+                    i += 4;
+                    if (entered && depth == 0)
+                    {
+                        if (i < end && tokens[i].text == ".")
+                        {
+                            i++;
+                        }
+                        break;
+                    }
+                }
+                else
+                {
+                    i++;
+                }
+            }
+
+            if (gap_start < start)
+            {
+                slices.push_back({gap_start, start});
+            }
+            slices.push_back({start, i});
+            gap_start = i;
+        }
+
+        if (gap_start < end)
+        {
+            slices.push_back({gap_start, end});
+        }
+        return slices;
+    }
+}
+
+std::vector<std::unique_ptr<Stmt>> Parser::parseParallel(size_t jobs)
+{
+    if (!m_tokens)
+    {
+        return parse();
+    }
+
+    const std::vector<Token>& tokens = *m_tokens;
+    std::vector<std::pair<size_t, size_t>> slices = splitTopLevel(tokens);
+    if (jobs == 1 || slices.size() < 2)
+    {
+        return parse();
+    }
+
+    std::vector<std::vector<std::unique_ptr<Stmt>>> results(slices.size());
+    std::vector<char> clean(slices.size(), 0);
+    ThreadPool pool(jobs);
+    pool.parallelFor(slices.size(), [&](size_t i) 
+    {
+        std::ostringstream errors;
+        Parser slice(tokens, slices[i].first, slices[i].second, errors);
+        results[i] = slice.parse();
+        clean[i] = !slice.m_had_error && slice.m_current == slices[i].second;
+    });
+
+    // Any diagnostic falls back to a serial parse, so error recovery behaves exactly as before.
+    for (char ok : clean)
+    {
+        if (!ok)
+        {
+            return parse();
+        }
+    }
+
+    std::vector<std::unique_ptr<Stmt>> statements;
+    for (auto& result : results)
+    {
+        for (auto& stmt : result)
+        {
+            statements.push_back(std::move(stmt));
+        }
+    }
+    m_current = tokens.size() - 1;
     return statements;
 }
 
 std::unique_ptr<Stmt> Parser::statement() 
 {
-    if (peek().text == "a" && m_tokens[m_current + 1].text == "value") 
+    int line = peek().line;
+    std::unique_ptr<Stmt> stmt = statementBody();
+    stmt->line = line;
+    return stmt;
+}
+
+std::unique_ptr<Stmt> Parser::statementBody() 
+{
+    if (peek().text == "a" && peekAt(1).text == "value") 
     { 
         return declaration(); 
     }
-    if (peek().text == "for" && m_tokens.size() > 1 && m_tokens[m_current + 1].text == "procedure") 
+    if (peek().text == "for" && peekAt(1).text == "procedure") 
     { 
         return procedureDeclaration(); 
     }
@@ -45,20 +197,24 @@ std::unique_ptr<Stmt> Parser::statement()
     { 
         return procedureCallStatement(); 
     }
-    if (peek().text == "the" && m_tokens.size() > 1 && m_tokens[m_current + 1].text == "result") 
+    if (peek().text == "the" && peekAt(1).text == "result") 
     { 
         return returnStatement(); 
     }
-    if (peek().text == "the" && m_tokens.size() > 1 && m_tokens[m_current + 1].text == "story" && m_tokens[m_current + 2].text == "ends") 
+    if (peek().text == "the" && peekAt(1).text == "story" && peekAt(2).text == "ends") 
     {
-        if (m_tokens.size() > 3 && m_tokens[m_current + 3].text == "at") 
+        if (peekAt(3).text == "at") 
         { 
             return breakStatement();
         }
 
         return printStatement();
     }
-    if (peek().text == "the" && m_tokens.size() > 1 && m_tokens[m_current + 1].text == "story") 
+    if (peek().text == "the" && peekAt(1).text == "story" && peekAt(2).text == "recalls") 
+    { 
+        return importStatement(); 
+    }
+    if (peek().text == "the" && peekAt(1).text == "story") 
     { 
         return printStatement(); 
     }
@@ -70,6 +226,10 @@ std::unique_ptr<Stmt> Parser::statement()
     { 
         return whileStatement(); 
     }
+    if (peek().text == "for" && peekAt(1).text == "each") 
+    { 
+        return forStatement(); 
+    }
 
     return expressionStatement();
 }
@@ -87,6 +247,21 @@ std::unique_ptr<Stmt> Parser::breakStatement()
     return std::make_unique<BreakStmt>();
 }
 
+std::unique_ptr<Stmt> Parser::importStatement() 
+{
+    consume("the", "Expected 'the'.");
+    consume("story", "Expected 'story'.");
+    consume("recalls", "Expected 'recalls'.");
+    if (peek().type != TokenType::STRING_LITERAL) 
+    {
+        throw std::runtime_error("Expected a quoted module path after 'recalls'.");
+    }
+    Token path = advance();
+    consume(".", "Expected '.' after the recalled module path.");
+
+    return std::make_unique<ImportStmt>(path);
+}
+
 std::unique_ptr<Stmt> Parser::returnStatement() 
 {
     consume("the", "Expected 'the'.");
@@ -140,7 +315,27 @@ std::unique_ptr<Stmt> Parser::ifStatement()
     consume(":", "Expected ':' after 'story'.");
     auto thenBranch = block();
 
-    return std::make_unique<IfStmt>(std::move(condition), std::move(thenBranch));
+    std::unique_ptr<Stmt> elseBranch;
+    if (peek().text == "otherwise") 
+    {
+        advance();
+        consume(",", "Expected ',' after 'otherwise'.");
+        if (peek().text == "if") 
+        {
+            elseBranch = statement();
+        }
+        else 
+        {
+            consume("tell", "Expected 'tell' or 'if' after 'otherwise,'.");
+            consume("the", "Expected 'the'.");
+            consume("following", "Expected 'following'.");
+            consume("story", "Expected 'story'.");
+            consume(":", "Expected ':' after 'story'.");
+            elseBranch = block();
+        }
+    }
+
+    return std::make_unique<IfStmt>(std::move(condition), std::move(thenBranch), std::move(elseBranch));
 }
 
 std::unique_ptr<Stmt> Parser::whileStatement() 
@@ -159,6 +354,37 @@ std::unique_ptr<Stmt> Parser::whileStatement()
     return std::make_unique<WhileStmt>(std::move(condition), std::move(body));
 }
 
+std::unique_ptr<Stmt> Parser::forStatement() 
+{
+    consume("for", "Expected 'for'.");
+    consume("each", "Expected 'each'.");
+    Token variable = consume("KEYWORD", "Expected the name of the counted value after 'for each'.");
+    consume("from", "Expected 'from' after the counted value.");
+    auto first = expression();
+    consume("to", "Expected 'to' after the first value.");
+    auto last = expression();
+    consume(",", "Expected ',' after the last value.");
+    consume("tell", "Expected 'tell'.");
+    consume("the", "Expected 'the'.");
+    consume("following", "Expected 'following'.");
+    consume("story", "Expected 'story'.");
+    consume(":", "Expected ':' after 'story'.");
+    m_loop_variables.push_back(variable.text);
+    std::unique_ptr<Stmt> body;
+    try 
+    {
+        body = block();
+    } 
+    catch (...) 
+    {
+        m_loop_variables.pop_back();
+        throw;
+    }
+    m_loop_variables.pop_back();
+
+    return std::make_unique<ForStmt>(variable, std::move(first), std::move(last), std::move(body));
+}
+
 std::unique_ptr<Stmt> Parser::block() 
 {
     consume("beginning", "Expected 'beginning'.");
@@ -195,6 +421,28 @@ std::unique_ptr<Stmt> Parser::declaration()
     consume("type", "Expected 'type'.");
     Token type = consume("KEYWORD", "Expected type name.");
     consume(",", "Expected ','.");
+    uint64_t length = 0;
+
+    if (match({"keyed", "by"})) 
+    {
+        return mapDeclaration(name, type);
+    }
+    if (match({"holds"})) 
+    {
+        Token count = advance();
+        if (count.type != TokenType::INT_LITERAL) 
+        {
+            throw std::runtime_error("Expected the number of values after 'holds'.");
+        }
+        length = count.literal_value.size() > 9 ? 0 : std::stoull(count.literal_value);
+        if (length == 0 || length > MAX_ARRAY_LENGTH) 
+        {
+            throw std::runtime_error("An array holds from 1 to " + std::to_string(MAX_ARRAY_LENGTH) + " values.");
+        }
+        consume("values", "Expected 'values' after the number of values.");
+        consume(",", "Expected ','.");
+    }
+
     bool is_mutable = false;
 
     if (match({"begins", "at"})) 
@@ -213,7 +461,45 @@ std::unique_ptr<Stmt> Parser::declaration()
     auto initializer = expression();
     consume(".", "Expected '.' after declaration.");
 
-    return std::make_unique<DeclarationStmt>(name, type, std::move(initializer), is_mutable);
+    return std::make_unique<DeclarationStmt>(name, type, std::move(initializer), is_mutable, length);
+}
+
+// 'a value <name>, type <value type>, keyed by <key type>, begins empty.' or '..., begins with
+// room for <count> entries.', after the value type.
+std::unique_ptr<Stmt> Parser::mapDeclaration(const Token& name, const Token& type) 
+{
+    Token key_type = consume("KEYWORD", "Expected the key type after 'keyed by'.");
+    if (!is_in(key_type.text, {"int", "string"})) 
+    {
+        throw std::runtime_error("A map is keyed by int or string, not '" + key_type.text + "'.");
+    }
+    if (!is_in(type.text, {"int", "string", "bool"})) 
+    {
+        throw std::runtime_error("A map holds int, string or bool values, not '" + type.text + "'.");
+    }
+    consume(",", "Expected ','.");
+    consume("begins", "Expected 'begins empty' or 'begins with room for' after the key type.");
+
+    std::unique_ptr<Expr> room;
+    if (peek().text == "empty") 
+    {
+        Token none = advance();
+        none.type = TokenType::INT_LITERAL;
+        none.text = "0";
+        none.literal_value = "0";
+        room = std::make_unique<LiteralExpr>(none);
+    }
+    else 
+    {
+        consume("with", "Expected 'empty' or 'with room for' after 'begins'.");
+        consume("room", "Expected 'room'.");
+        consume("for", "Expected 'for'.");
+        room = addition();
+        consume("entries", "Expected 'entries' after the number of entries.");
+    }
+    consume(".", "Expected '.' after declaration.");
+
+    return std::make_unique<DeclarationStmt>(name, type, std::move(room), true, 0, key_type);
 }
 
 std::unique_ptr<Stmt> Parser::procedureDeclaration() 
@@ -297,12 +583,16 @@ std::unique_ptr<Stmt> Parser::expressionStatement()
 
 std::unique_ptr<Expr> Parser::expression() 
 {
-    if (peek().text == "the" && m_tokens.size() > m_current + 4 && m_tokens[m_current + 1].text == "value" &&
-        m_tokens[m_current + 3].text == "continues" && m_tokens[m_current + 4].text == "as") 
+    if (peek().text == "the" && peekAt(1).text == "value" &&
+        peekAt(3).text == "continues" && peekAt(4).text == "as") 
     {
         advance();
         advance();
         Token name = consume("KEYWORD", "Expected variable name in assignment.");
+        if (is_in(name.text, m_loop_variables)) 
+        {
+            throw std::runtime_error("The value '" + name.text + "' counts a 'for each' loop and cannot be changed inside it.");
+        }
         consume("continues", "Expected 'continues as'.");
         consume("as", "Expected 'continues as'.");
         auto value = expression();
@@ -310,7 +600,27 @@ std::unique_ptr<Expr> Parser::expression()
         return std::make_unique<AssignExpr>(name, std::move(value));
     }
 
-    return logic_or();
+    auto expr = logic_or();
+
+    if (peek().text == "continues" && peekAt(1).text == "as") 
+    {
+        if (auto element = dynamic_cast<IndexExpr*>(expr.get())) 
+        {
+            advance();
+            advance();
+            auto value = expression();
+            return std::make_unique<IndexAssignExpr>(element->array, std::move(element->index), std::move(value));
+        }
+        if (auto entry = dynamic_cast<EntryExpr*>(expr.get())) 
+        {
+            advance();
+            advance();
+            auto value = expression();
+            return std::make_unique<EntryAssignExpr>(entry->map, std::move(entry->key), std::move(value));
+        }
+    }
+
+    return expr;
 }
 
 std::unique_ptr<Expr> Parser::logic_or() 
@@ -343,10 +653,22 @@ std::unique_ptr<Expr> Parser::logic_and()
 
 std::unique_ptr<Expr> Parser::comparison() 
 {
-    auto expr = addition();
-    while (peek().text == "is") 
+    auto expr = join();
+    while (peek().text == "is" || (peek().text == "starts" && peekAt(1).text == "with") || peek().text == "contains") 
     {
-        if (m_tokens.size() > m_current + 1 && m_tokens[m_current + 1].text == "met") 
+        if (peek().text != "is") 
+        {
+            Token op = advance();
+            if (op.text == "starts") 
+            {
+                advance();
+                op.text += " with";
+            }
+            auto right = join();
+            expr = std::make_unique<ComparisonExpr>(std::move(expr), op, std::move(right));
+            continue;
+        }
+        if (peekAt(1).text == "met") 
         {
             break; 
         }
@@ -369,7 +691,7 @@ std::unique_ptr<Expr> Parser::comparison()
                 op.text += " to";
             }
 
-            auto right = addition();
+            auto right = join();
             expr = std::make_unique<ComparisonExpr>(std::move(expr), op, std::move(right));
         } 
         else 
@@ -382,6 +704,21 @@ std::unique_ptr<Expr> Parser::comparison()
     return expr;
 }
 
+std::unique_ptr<Expr> Parser::join() 
+{
+    auto expr = addition();
+
+    while (peek().text == "followed" && peekAt(1).text == "by") 
+    {
+        advance();
+        advance();
+        auto right = addition();
+        expr = std::make_unique<JoinExpr>(std::move(expr), std::move(right));
+    }
+
+    return expr;
+}
+
 std::unique_ptr<Expr> Parser::addition() 
 {
     auto expr = multiplication();
@@ -430,10 +767,52 @@ std::unique_ptr<Expr> Parser::primary()
     {
         return std::make_unique<LiteralExpr>(advance());
     }
-    if (peek().text == "the" && m_tokens.size() > 1 && m_tokens[m_current + 1].text == "story") 
+    if (peek().text == "the" && peekAt(1).text == "story") 
     {
         return functionCallExpression();
     }
+    if (peek().text == "the" && peekAt(1).text == "element") 
+    {
+        advance();
+        advance();
+        auto index = addition();
+        consume("of", "Expected 'of' after the element's index.");
+        Token array = consume("KEYWORD", "Expected an array name after 'of'.");
+        return std::make_unique<IndexExpr>(array, std::move(index));
+    }
+    if (peek().text == "the" && peekAt(1).text == "length" && peekAt(2).text == "of") 
+    {
+        advance();
+        advance();
+        advance();
+        Token array = consume("KEYWORD", "Expected an array name after 'the length of'.");
+        return std::make_unique<LengthExpr>(array);
+    }
+    if (peek().text == "the" && peekAt(1).text == "text" && peekAt(2).text == "of") 
+    {
+        advance();
+        advance();
+        advance();
+        return std::make_unique<TextExpr>(addition());
+    }
+    if (peek().text == "the" && peekAt(1).text == "entry") 
+    {
+        advance();
+        advance();
+        auto key = join();
+        consume("of", "Expected 'of' after the entry's key.");
+        Token map = consume("KEYWORD", "Expected a map name after 'of'.");
+        return std::make_unique<EntryExpr>(map, std::move(key));
+    }
+    if (peek().type == TokenType::KEYWORD && peekAt(1).text == "has" && peekAt(2).text == "an" && peekAt(3).text == "entry") 
+    {
+        Token map = advance();
+        advance();
+        advance();
+        advance();
+        consume("for", "Expected 'for' after 'has an entry'.");
+        return std::make_unique<HasEntryExpr>(map, join());
+    }
     if (peek().type == TokenType::KEYWORD) 
     {
         return std::make_unique<VariableExpr>(advance());
@@ -472,7 +851,7 @@ bool Parser::match(const std::vector<std::string>& texts)
 {
     for (size_t i = 0; i < texts.size(); ++i) 
     {
-        if (m_current + i >= m_tokens.size() || m_tokens[m_current + i].text != texts[i]) 
+        if (peekAt(i).text != texts[i]) 
         {
             return false;
         }
@@ -533,17 +912,41 @@ Token Parser::advance()
     return previous(); 
 }
 
-Token Parser::previous() 
+const Token& Parser::tokenAt(size_t index) 
+{
+    if (m_next_token) 
+    {
+        while (m_filled <= index) 
+        {
+            m_window[m_filled % WINDOW_SIZE] = m_next_token();
+            m_filled++;
+        }
+        if (index + WINDOW_SIZE < m_filled) 
+        {
+            throw std::logic_error("Parser looked back past its token window.");
+        }
+        return m_window[index % WINDOW_SIZE];
+    }
+
+    return index < m_tokens->size() ? (*m_tokens)[index] : m_tokens->back();
+}
+
+const Token& Parser::peekAt(size_t distance) 
+{ 
+    return tokenAt(m_current + distance); 
+}
+
+const Token& Parser::previous() 
 { 
-    return m_tokens[m_current - 1]; 
+    return tokenAt(m_current - 1); 
 }
 
-Token Parser::peek() 
+const Token& Parser::peek() 
 { 
-    return m_tokens[m_current]; 
+    return tokenAt(m_current); 
 }
 
 bool Parser::isAtEnd() 
 { 
-    return peek().type == TokenType::END_OF_FILE; 
+    return m_current >= m_end || peek().type == TokenType::END_OF_FILE; 
 }
\ No newline at end of file
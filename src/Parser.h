@@ -1,24 +1,58 @@
 #pragma once
 
+#include <array>
+#include <functional>
 #include <vector>
 #include <memory>
+#include <iostream>
 #include "Token.h"
+#include "Lexer.h"
 #include "AST.h"
 
 class Parser 
 {
 public:
+    // The most values an array can hold; loaded modules are held to it too.
+    static const uint64_t MAX_ARRAY_LENGTH = uint64_t(1) << 24;
+
     Parser(const std::vector<Token>& tokens);
+    // Pulls tokens from the lexer on demand, keeping only a small lookahead window.
+    explicit Parser(Lexer& lexer);
+    // Same, but tokens come from an arbitrary source that yields END_OF_FILE when done.
+    explicit Parser(std::function<Token()> next_token);
     std::vector<std::unique_ptr<Stmt>> parse();
+    // Returns the next top-level statement, or nullptr at the end of the input.
+    std::unique_ptr<Stmt> parseNext();
+    // Parses top-level procedure declarations concurrently. Diagnostics are identical to parse().
+    std::vector<std::unique_ptr<Stmt>> parseParallel(size_t jobs);
+    bool hadError() const 
+    { 
+        return m_had_error; 
+    }
 
 private:
-    const std::vector<Token>& m_tokens;
+    Parser(const std::vector<Token>& tokens, size_t begin, size_t end, std::ostream& errors);
+
+    static const size_t WINDOW_SIZE = 16;
+
+    const std::vector<Token>* m_tokens = nullptr;
+    std::function<Token()> m_next_token;
+    std::array<Token, WINDOW_SIZE> m_window;
+    size_t m_filled = 0;
     size_t m_current = 0;
+    size_t m_end = SIZE_MAX;
+    std::ostream& m_errors;
+    bool m_had_error = false;
+    // The counted values of the enclosing 'for each' loops, which the body may not assign.
+    std::vector<std::string> m_loop_variables;
 
     std::unique_ptr<Stmt> statement();
+    std::unique_ptr<Stmt> statementBody();
     std::unique_ptr<Stmt> declaration();
+    std::unique_ptr<Stmt> mapDeclaration(const Token& name, const Token& type);
     std::unique_ptr<Stmt> ifStatement();
     std::unique_ptr<Stmt> whileStatement();
+    std::unique_ptr<Stmt> forStatement();
     std::unique_ptr<Stmt> block();
     std::unique_ptr<Stmt> expressionStatement();
     std::unique_ptr<Stmt> printStatement();
@@ -26,11 +60,13 @@ private:
     std::unique_ptr<Stmt> procedureCallStatement();
     std::unique_ptr<Stmt> returnStatement();
     std::unique_ptr<Stmt> breakStatement();
+    std::unique_ptr<Stmt> importStatement();
     
     std::unique_ptr<Expr> expression();
     std::unique_ptr<Expr> logic_or();
     std::unique_ptr<Expr> logic_and();
     std::unique_ptr<Expr> comparison();
+    std::unique_ptr<Expr> join();
     std::unique_ptr<Expr> addition();
     std::unique_ptr<Expr> multiplication();
     std::unique_ptr<Expr> unary();
@@ -41,7 +77,9 @@ private:
     Token consume(const std::string& expected_text, const std::string& error_message);
     void synchronize();
     Token advance();
-    Token previous();
-    Token peek();
+    const Token& tokenAt(size_t index);
+    const Token& peekAt(size_t distance);
+    const Token& previous();
+    const Token& peek();
     bool isAtEnd();
 };
\ No newline at end of file
@@ -0,0 +1,135 @@
+#include "Pipeline.h"
+#include "Lexer.h"
+#include "Parser.h"
+#include <exception>
+#include <thread>
+
+namespace
+{
+    const size_t TOKEN_BATCH = 512;
+    const size_t TOKEN_QUEUE_BATCHES = 64;
+    const size_t STATEMENT_QUEUE_SIZE = 256;
+
+    void printQueue(const char* name, const QueueStats& stats, std::ostream& out)
+    {
+        double average = stats.pushes ? static_cast<double>(stats.depth_total) / stats.pushes : 0.0;
+        out << "  " << name << ": " << stats.pushes << " pushed, depth avg " << average
+            << " max " << stats.max_depth << ", producer waits " << stats.full_waits
+            << ", consumer waits " << stats.empty_waits << "\n";
+    }
+}
+
+PipelineStats runPipeline(std::istream& input, const std::function<void(const Stmt&)>& consume)
+{
+    SpscQueue<std::vector<Token>> tokens(TOKEN_QUEUE_BATCHES);
+    SpscQueue<std::unique_ptr<Stmt>> statements(STATEMENT_QUEUE_SIZE);
+
+    // An exception in a stage closes its queues, which winds the other stages down, and is
+    // rethrown here once they have joined.
+    std::exception_ptr lexer_failure;
+    std::thread lexer_thread([&] 
+    {
+        try
+        {
+            Lexer lexer(input);
+            bool done = false;
+            while (!done)
+            {
+                std::vector<Token> batch;
+                batch.reserve(TOKEN_BATCH);
+                while (!done && batch.size() < TOKEN_BATCH)
+                {
+                    batch.push_back(lexer.nextToken());
+                    done = batch.back().type == TokenType::END_OF_FILE;
+                }
+                if (!tokens.push(std::move(batch)))
+                {
+                    break;
+                }
+            }
+        }
+        catch (...)
+        {
+            lexer_failure = std::current_exception();
+        }
+        tokens.close();
+    });
+
+    std::exception_ptr parser_failure;
+    std::thread parser_thread([&] 
+    {
+        std::vector<Token> batch;
+        size_t next = 0;
+        Token end_of_file{TokenType::END_OF_FILE, "", "", 0};
+        try
+        {
+            Parser parser([&]() -> Token 
+            {
+                while (next == batch.size())
+                {
+                    next = 0;
+                    if (!tokens.pop(batch))
+                    {
+                        batch.clear();
+                        return end_of_file;
+                    }
+                }
+                if (batch[next].type == TokenType::END_OF_FILE)
+                {
+                    end_of_file = batch[next];
+                }
+                return std::move(batch[next++]);
+            });
+
+            while (auto stmt = parser.parseNext())
+            {
+                if (!statements.push(std::move(stmt)))
+                {
+                    break;
+                }
+            }
+        }
+        catch (...)
+        {
+            parser_failure = std::current_exception();
+        }
+        tokens.close();
+        statements.close();
+    });
+
+    std::exception_ptr failure;
+    try
+    {
+        std::unique_ptr<Stmt> stmt;
+        while (statements.pop(stmt))
+        {
+            consume(*stmt);
+            stmt.reset();
+        }
+    }
+    catch (...)
+    {
+        failure = std::current_exception();
+        statements.close();
+    }
+
+    parser_thread.join();
+    lexer_thread.join();
+    // The earliest stage to fail is the cause; the later ones only saw their input cut short.
+    for (const std::exception_ptr& stage_failure : {lexer_failure, parser_failure, failure})
+    {
+        if (stage_failure)
+        {
+            std::rethrow_exception(stage_failure);
+        }
+    }
+
+    return {tokens.stats(), statements.stats()};
+}
+
+void printPipelineStats(const PipelineStats& stats, std::ostream& out)
+{
+    out << "Pipeline queues:\n";
+    printQueue("lexer -> parser (token batches)", stats.tokens, out);
+    printQueue("parser -> codegen (statements)", stats.statements, out);
+}
@@ -0,0 +1,20 @@
+#pragma once
+
+#include "AST.h"
+#include "SpscQueue.h"
+#include <functional>
+#include <istream>
+#include <ostream>
+
+struct PipelineStats
+{
+    QueueStats tokens;
+    QueueStats statements;
+};
+
+// Streams a program through the compiler with the lexer and the parser on their own threads.
+// Token batches and parsed top-level statements are handed over through bounded SPSC queues,
+// and the calling thread hands each statement to `consume` (usually CodeGenerator::streamStatement).
+PipelineStats runPipeline(std::istream& input, const std::function<void(const Stmt&)>& consume);
+
+void printPipelineStats(const PipelineStats& stats, std::ostream& out);
@@ -0,0 +1,60 @@
+#include "ProfileData.h"
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+ProfileData ProfileData::load(const std::string& path)
+{
+    std::ifstream file(path);
+    if (!file.is_open())
+    {
+        throw std::runtime_error("Could not open profile " + path + ".");
+    }
+
+    ProfileData data;
+    std::string line;
+    size_t number = 0;
+    while (std::getline(file, line))
+    {
+        number++;
+        if (line.empty() || line[0] == '#')
+        {
+            continue;
+        }
+
+        // <symbol> <shape> <calls> <counter count> <counters>...
+        std::istringstream fields(line);
+        std::string symbol;
+        ScopeProfile scope;
+        size_t count = 0;
+        fields >> symbol >> scope.shape >> scope.calls >> count;
+        scope.counters.resize(count);
+        for (auto& counter : scope.counters)
+        {
+            fields >> counter;
+        }
+        if (!fields)
+        {
+            throw std::runtime_error("Malformed profile " + path + " at line " + std::to_string(number) + ".");
+        }
+
+        auto existing = data.m_scopes.find(symbol);
+        if (existing == data.m_scopes.end() || existing->second.shape != scope.shape || existing->second.counters.size() != count)
+        {
+            data.m_scopes[symbol] = std::move(scope);
+            continue;
+        }
+        existing->second.calls += scope.calls;
+        for (size_t i = 0; i < count; ++i)
+        {
+            existing->second.counters[i] += scope.counters[i];
+        }
+    }
+    return data;
+}
+
+const ScopeProfile* ProfileData::find(const std::string& symbol, const std::string& shape) const
+{
+    auto scope = m_scopes.find(symbol);
+    return scope == m_scopes.end() || scope->second.shape != shape ? nullptr : &scope->second;
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Counts recorded for one procedure (proc_<name>) or the main story (_start) by a program built
+// with -fprofile-generate. Counters come in pairs, one pair per if and while statement in the
+// order code generation reaches them: executions and times taken for an if, entries and
+// iterations for a loop.
+struct ScopeProfile
+{
+    std::string shape;
+    uint64_t calls = 0;
+    std::vector<uint64_t> counters;
+};
+
+// A training profile read back for -fprofile-use. Several runs can be concatenated into one file;
+// their counts are added up.
+class ProfileData
+{
+public:
+    // Throws std::runtime_error if the file cannot be read or is malformed.
+    static ProfileData load(const std::string& path);
+
+    // The counts for the scope, or null if it was not run or its code has changed since: the
+    // shape is the hash of the scope's statements when the profile was recorded.
+    const ScopeProfile* find(const std::string& symbol, const std::string& shape) const;
+
+private:
+    std::unordered_map<std::string, ScopeProfile> m_scopes;
+};
@@ -0,0 +1,795 @@
+#include "PureCalls.h"
+#include <stdexcept>
+
+namespace
+{
+    // Abandons an evaluation; the call is then left to run at runtime.
+    struct GiveUp {};
+
+    // Finds what a procedure body does besides computing: printing or declaring procedures,
+    // and the procedures it calls.
+    class EffectScanner : public StmtVisitor, public ExprVisitor
+    {
+    public:
+        bool effects = false;
+        std::vector<std::string> callees;
+
+        void visitDeclarationStmt(const DeclarationStmt& stmt) override
+        {
+            stmt.initializer->accept(*this);
+        }
+        void visitExpressionStmt(const ExpressionStmt& stmt) override
+        {
+            stmt.expression->accept(*this);
+        }
+        void visitIfStmt(const IfStmt& stmt) override
+        {
+            stmt.condition->accept(*this);
+            stmt.then_branch->accept(*this);
+            if (stmt.else_branch)
+            {
+                stmt.else_branch->accept(*this);
+            }
+        }
+        void visitWhileStmt(const WhileStmt& stmt) override
+        {
+            stmt.condition->accept(*this);
+            stmt.body->accept(*this);
+        }
+        void visitForStmt(const ForStmt& stmt) override
+        {
+            stmt.first->accept(*this);
+            stmt.last->accept(*this);
+            stmt.body->accept(*this);
+        }
+        void visitBlockStmt(const BlockStmt& stmt) override
+        {
+            for (const auto& s : stmt.statements)
+            {
+                s->accept(*this);
+            }
+        }
+        void visitPrintStmt(const PrintStmt& /*stmt*/) override
+        {
+            effects = true;
+        }
+        void visitNewlineStmt(const NewlineStmt& /*stmt*/) override
+        {
+            effects = true;
+        }
+        void visitProcedureDeclStmt(const ProcedureDeclStmt& /*stmt*/) override
+        {
+            effects = true;
+        }
+        void visitProcedureCallStmt(const ProcedureCallStmt& stmt) override
+        {
+            call(stmt.callee_name.text, stmt.arguments);
+        }
+        void visitReturnStmt(const ReturnStmt& stmt) override
+        {
+            stmt.value->accept(*this);
+        }
+        void visitBreakStmt(const BreakStmt& /*stmt*/) override {}
+        void visitImportStmt(const ImportStmt& /*stmt*/) override
+        {
+            effects = true;
+        }
+
+        void visitBinaryExpr(const BinaryExpr& expr) override
+        {
+            expr.left->accept(*this);
+            expr.right->accept(*this);
+        }
+        void visitComparisonExpr(const ComparisonExpr& expr) override
+        {
+            expr.left->accept(*this);
+            expr.right->accept(*this);
+        }
+        void visitLiteralExpr(const LiteralExpr& /*expr*/) override {}
+        void visitVariableExpr(const VariableExpr& /*expr*/) override {}
+        void visitAssignExpr(const AssignExpr& expr) override
+        {
+            expr.value->accept(*this);
+        }
+        void visitFunctionCallExpr(const FunctionCallExpr& expr) override
+        {
+            call(expr.callee_name.text, expr.arguments);
+        }
+        void visitUnaryExpr(const UnaryExpr& expr) override
+        {
+            expr.right->accept(*this);
+        }
+        void visitIndexExpr(const IndexExpr& expr) override
+        {
+            expr.index->accept(*this);
+        }
+        void visitIndexAssignExpr(const IndexAssignExpr& expr) override
+        {
+            expr.index->accept(*this);
+            expr.value->accept(*this);
+        }
+        void visitLengthExpr(const LengthExpr& /*expr*/) override {}
+        void visitEntryExpr(const EntryExpr& expr) override
+        {
+            expr.key->accept(*this);
+        }
+        void visitEntryAssignExpr(const EntryAssignExpr& expr) override
+        {
+            expr.key->accept(*this);
+            expr.value->accept(*this);
+        }
+        void visitHasEntryExpr(const HasEntryExpr& expr) override
+        {
+            expr.key->accept(*this);
+        }
+        // New strings live until the arena they come from is reset, too soon for a memo table.
+        void visitJoinExpr(const JoinExpr& /*expr*/) override
+        {
+            effects = true;
+        }
+        void visitTextExpr(const TextExpr& /*expr*/) override
+        {
+            effects = true;
+        }
+
+    private:
+        void call(const std::string& callee, const std::vector<std::unique_ptr<Expr>>& arguments)
+        {
+            callees.push_back(callee);
+            for (const auto& arg : arguments)
+            {
+                arg->accept(*this);
+            }
+        }
+    };
+}
+
+// Runs pure procedures on constant arguments. Each evaluator serves one call site and counts
+// its steps against the per-call limit and the program's total budget.
+class PureEvaluator : public StmtVisitor, public ExprVisitor
+{
+public:
+    explicit PureEvaluator(PureCalls& calls) : m_calls(calls) {}
+
+    int64_t evaluate(const Expr& expr)
+    {
+        expr.accept(*this);
+        return m_value;
+    }
+
+    int64_t call(const std::string& callee, const std::vector<int64_t>& arguments)
+    {
+        step();
+        auto key = std::make_pair(callee, arguments);
+        auto memo = m_calls.m_memo.find(key);
+        if (memo != m_calls.m_memo.end())
+        {
+            return memo->second;
+        }
+        auto procedure = m_calls.m_procedures.find(callee);
+        if (!m_calls.isPure(callee) || procedure == m_calls.m_procedures.end() || m_calls.m_failed.count(key) ||
+            m_depth >= m_calls.m_limits.max_depth)
+        {
+            throw GiveUp();
+        }
+        const ProcedureDeclStmt& proc = *procedure->second;
+        if (proc.params.size() != arguments.size() || arguments.size() > 6 || proc.return_type.text == "float")
+        {
+            throw GiveUp();
+        }
+        for (const auto& param : proc.params)
+        {
+            if (param.type.text == "float")
+            {
+                throw GiveUp();
+            }
+        }
+
+        std::unordered_map<std::string, Slot> frame;
+        for (size_t i = 0; i < arguments.size(); ++i)
+        {
+            const std::string& type = proc.params[i].type.text;
+            frame[proc.params[i].name.text] = {storedValue(type, arguments[i]), &type};
+        }
+        std::unordered_map<std::string, Slot>* caller = m_frame;
+        m_frame = &frame;
+        m_depth++;
+        proc.body->accept(*this);
+        m_depth--;
+        m_frame = caller;
+
+        // Falling off the end leaves whatever rax held, which is not worth reproducing.
+        if (!m_returning || m_breaking)
+        {
+            throw GiveUp();
+        }
+        m_returning = false;
+        m_calls.m_memo.emplace(std::move(key), m_value);
+        return m_value;
+    }
+
+    void visitDeclarationStmt(const DeclarationStmt& stmt) override
+    {
+        if (stmt.length != 0 || !stmt.key_type.text.empty() || stmt.type.text == "float")
+        {
+            throw GiveUp();
+        }
+        variables()[stmt.name.text] = {storedValue(stmt.type.text, evaluate(*stmt.initializer)), &stmt.type.text};
+    }
+    void visitExpressionStmt(const ExpressionStmt& stmt) override
+    {
+        evaluate(*stmt.expression);
+    }
+    void visitIfStmt(const IfStmt& stmt) override
+    {
+        if (evaluate(*stmt.condition) != 0)
+        {
+            stmt.then_branch->accept(*this);
+        }
+        else if (stmt.else_branch)
+        {
+            stmt.else_branch->accept(*this);
+        }
+    }
+    void visitWhileStmt(const WhileStmt& stmt) override
+    {
+        while (true)
+        {
+            step();
+            if (evaluate(*stmt.condition) == 0)
+            {
+                break;
+            }
+            stmt.body->accept(*this);
+            if (m_returning)
+            {
+                return;
+            }
+            if (m_breaking)
+            {
+                m_breaking = false;
+                break;
+            }
+        }
+    }
+    void visitForStmt(const ForStmt& stmt) override
+    {
+        static const std::string counted_type = "int";
+        int64_t first = evaluate(*stmt.first);
+        auto counted = variables().find(stmt.variable.text);
+        if (counted != variables().end() && !isWordInteger(*counted->second.type))
+        {
+            throw GiveUp();
+        }
+        variables()[stmt.variable.text] = {first, &counted_type};
+        int64_t last = evaluate(*stmt.last);
+        if (last < first)
+        {
+            return;
+        }
+        // The trip count is fixed on entry and wraps like the native counter.
+        uint64_t trips = static_cast<uint64_t>(last) - static_cast<uint64_t>(first) + 1;
+        while (true)
+        {
+            step();
+            stmt.body->accept(*this);
+            if (m_returning)
+            {
+                return;
+            }
+            if (m_breaking)
+            {
+                m_breaking = false;
+                break;
+            }
+            int64_t& value = variables()[stmt.variable.text].value;
+            value = static_cast<int64_t>(static_cast<uint64_t>(value) + 1);
+            if (--trips == 0)
+            {
+                break;
+            }
+        }
+    }
+    void visitBlockStmt(const BlockStmt& stmt) override
+    {
+        for (const auto& s : stmt.statements)
+        {
+            step();
+            s->accept(*this);
+            if (m_returning || m_breaking)
+            {
+                return;
+            }
+        }
+    }
+    void visitPrintStmt(const PrintStmt& /*stmt*/) override
+    {
+        throw GiveUp();
+    }
+    void visitNewlineStmt(const NewlineStmt& /*stmt*/) override
+    {
+        throw GiveUp();
+    }
+    void visitProcedureDeclStmt(const ProcedureDeclStmt& /*stmt*/) override
+    {
+        throw GiveUp();
+    }
+    void visitProcedureCallStmt(const ProcedureCallStmt& stmt) override
+    {
+        call(stmt.callee_name.text, arguments(stmt.arguments));
+    }
+    void visitReturnStmt(const ReturnStmt& stmt) override
+    {
+        evaluate(*stmt.value);
+        m_returning = true;
+    }
+    void visitBreakStmt(const BreakStmt& /*stmt*/) override
+    {
+        m_breaking = true;
+    }
+    void visitImportStmt(const ImportStmt& /*stmt*/) override
+    {
+        throw GiveUp();
+    }
+
+    void visitBinaryExpr(const BinaryExpr& expr) override
+    {
+        uint64_t left = static_cast<uint64_t>(evaluate(*expr.left));
+        uint64_t right = static_cast<uint64_t>(evaluate(*expr.right));
+        const std::string& op = expr.op.text;
+        if (op == "plus")
+        {
+            m_value = static_cast<int64_t>(left + right);
+        }
+        else if (op == "minus")
+        {
+            m_value = static_cast<int64_t>(left - right);
+        }
+        else if (op == "multiplied")
+        {
+            m_value = static_cast<int64_t>(left * right);
+        }
+        else if (op == "divided")
+        {
+            // idiv faults on these, so the program has to see them happen.
+            if (right == 0 || (static_cast<int64_t>(left) == INT64_MIN && static_cast<int64_t>(right) == -1))
+            {
+                throw GiveUp();
+            }
+            m_value = static_cast<int64_t>(left) / static_cast<int64_t>(right);
+        }
+        else if (op == "and")
+        {
+            m_value = static_cast<int64_t>(left & right);
+        }
+        else if (op == "or")
+        {
+            m_value = static_cast<int64_t>(left | right);
+        }
+        else
+        {
+            throw GiveUp();
+        }
+    }
+    void visitComparisonExpr(const ComparisonExpr& expr) override
+    {
+        int64_t left = evaluate(*expr.left);
+        int64_t right = evaluate(*expr.right);
+        const std::string& op = expr.op.text;
+        if (op == "is equal to")
+        {
+            m_value = left == right;
+        }
+        else if (op == "is greater than")
+        {
+            m_value = left > right;
+        }
+        else if (op == "is less than")
+        {
+            m_value = left < right;
+        }
+        else
+        {
+            throw GiveUp();
+        }
+    }
+    void visitLiteralExpr(const LiteralExpr& expr) override
+    {
+        if (expr.value.type == TokenType::INT_LITERAL)
+        {
+            try
+            {
+                m_value = std::stoll(expr.value.literal_value);
+            }
+            catch (const std::exception&)
+            {
+                throw GiveUp();
+            }
+        }
+        else if (expr.value.type == TokenType::BOOL_LITERAL)
+        {
+            m_value = expr.value.text == "true";
+        }
+        else
+        {
+            throw GiveUp();
+        }
+    }
+    void visitVariableExpr(const VariableExpr& expr) override
+    {
+        auto& frame = variables();
+        auto it = frame.find(expr.name.text);
+        if (it == frame.end())
+        {
+            throw GiveUp();
+        }
+        m_value = it->second.value;
+    }
+    void visitAssignExpr(const AssignExpr& expr) override
+    {
+        auto& frame = variables();
+        auto it = frame.find(expr.name.text);
+        if (it == frame.end())
+        {
+            throw GiveUp();
+        }
+        m_value = storedValue(*it->second.type, evaluate(*expr.value));
+        it->second.value = m_value;
+    }
+    void visitFunctionCallExpr(const FunctionCallExpr& expr) override
+    {
+        m_value = call(expr.callee_name.text, arguments(expr.arguments));
+    }
+    void visitUnaryExpr(const UnaryExpr& expr) override
+    {
+        evaluate(*expr.right);
+        if (expr.op.text == "not")
+        {
+            m_value ^= 1;
+        }
+    }
+    void visitIndexExpr(const IndexExpr& /*expr*/) override
+    {
+        throw GiveUp();
+    }
+    void visitIndexAssignExpr(const IndexAssignExpr& /*expr*/) override
+    {
+        throw GiveUp();
+    }
+    void visitLengthExpr(const LengthExpr& /*expr*/) override
+    {
+        throw GiveUp();
+    }
+    void visitEntryExpr(const EntryExpr& /*expr*/) override
+    {
+        throw GiveUp();
+    }
+    void visitEntryAssignExpr(const EntryAssignExpr& /*expr*/) override
+    {
+        throw GiveUp();
+    }
+    void visitHasEntryExpr(const HasEntryExpr& /*expr*/) override
+    {
+        throw GiveUp();
+    }
+    void visitJoinExpr(const JoinExpr& /*expr*/) override
+    {
+        throw GiveUp();
+    }
+    void visitTextExpr(const TextExpr& /*expr*/) override
+    {
+        throw GiveUp();
+    }
+
+private:
+    // A variable's value, kept as its type stores it.
+    struct Slot
+    {
+        int64_t value;
+        const std::string* type;
+    };
+
+    PureCalls& m_calls;
+    uint64_t m_steps = 0;
+    int m_depth = 0;
+    // Variables of the procedure being run; none while evaluating a call site's arguments.
+    std::unordered_map<std::string, Slot>* m_frame = nullptr;
+    int64_t m_value = 0;
+    bool m_returning = false;
+    bool m_breaking = false;
+
+    void step()
+    {
+        if (++m_steps > m_calls.m_limits.steps_per_call || ++m_calls.m_total_steps > m_calls.m_limits.total_steps)
+        {
+            throw GiveUp();
+        }
+    }
+    std::unordered_map<std::string, Slot>& variables()
+    {
+        if (!m_frame)
+        {
+            throw GiveUp();
+        }
+        return *m_frame;
+    }
+    std::vector<int64_t> arguments(const std::vector<std::unique_ptr<Expr>>& exprs)
+    {
+        std::vector<int64_t> values;
+        for (const auto& expr : exprs)
+        {
+            values.push_back(evaluate(*expr));
+        }
+        return values;
+    }
+};
+
+namespace
+{
+    // Records the value of every call that can be evaluated. A folded call is not searched
+    // further; the arguments of one that cannot be folded may still contain calls that can.
+    class CallFolder : public StmtVisitor, public ExprVisitor
+    {
+    public:
+        CallFolder(PureCalls& calls, FoldedCalls& folded) : m_calls(calls), m_folded(folded) {}
+
+        void visitDeclarationStmt(const DeclarationStmt& stmt) override
+        {
+            stmt.initializer->accept(*this);
+        }
+        void visitExpressionStmt(const ExpressionStmt& stmt) override
+        {
+            stmt.expression->accept(*this);
+        }
+        void visitIfStmt(const IfStmt& stmt) override
+        {
+            stmt.condition->accept(*this);
+            stmt.then_branch->accept(*this);
+            if (stmt.else_branch)
+            {
+                stmt.else_branch->accept(*this);
+            }
+        }
+        void visitWhileStmt(const WhileStmt& stmt) override
+        {
+            stmt.condition->accept(*this);
+            stmt.body->accept(*this);
+        }
+        void visitForStmt(const ForStmt& stmt) override
+        {
+            stmt.first->accept(*this);
+            stmt.last->accept(*this);
+            stmt.body->accept(*this);
+        }
+        void visitBlockStmt(const BlockStmt& stmt) override
+        {
+            for (const auto& s : stmt.statements)
+            {
+                s->accept(*this);
+            }
+        }
+        void visitPrintStmt(const PrintStmt& stmt) override
+        {
+            stmt.expression->accept(*this);
+        }
+        void visitNewlineStmt(const NewlineStmt& /*stmt*/) override {}
+        void visitProcedureDeclStmt(const ProcedureDeclStmt& stmt) override
+        {
+            stmt.body->accept(*this);
+        }
+        void visitProcedureCallStmt(const ProcedureCallStmt& stmt) override
+        {
+            int64_t value = 0;
+            if (m_calls.evaluate(stmt.callee_name.text, stmt.arguments, value))
+            {
+                m_folded.removed.insert(&stmt);
+                return;
+            }
+            arguments(stmt.arguments);
+        }
+        void visitReturnStmt(const ReturnStmt& stmt) override
+        {
+            stmt.value->accept(*this);
+        }
+        void visitBreakStmt(const BreakStmt& /*stmt*/) override {}
+        void visitImportStmt(const ImportStmt& /*stmt*/) override {}
+
+        void visitBinaryExpr(const BinaryExpr& expr) override
+        {
+            expr.left->accept(*this);
+            expr.right->accept(*this);
+        }
+        void visitComparisonExpr(const ComparisonExpr& expr) override
+        {
+            expr.left->accept(*this);
+            expr.right->accept(*this);
+        }
+        void visitLiteralExpr(const LiteralExpr& /*expr*/) override {}
+        void visitVariableExpr(const VariableExpr& /*expr*/) override {}
+        void visitAssignExpr(const AssignExpr& expr) override
+        {
+            expr.value->accept(*this);
+        }
+        void visitFunctionCallExpr(const FunctionCallExpr& expr) override
+        {
+            int64_t value = 0;
+            if (m_calls.evaluate(expr.callee_name.text, expr.arguments, value))
+            {
+                m_folded.values[&expr] = value;
+                return;
+            }
+            arguments(expr.arguments);
+        }
+        void visitUnaryExpr(const UnaryExpr& expr) override
+        {
+            expr.right->accept(*this);
+        }
+        void visitIndexExpr(const IndexExpr& expr) override
+        {
+            expr.index->accept(*this);
+        }
+        void visitIndexAssignExpr(const IndexAssignExpr& expr) override
+        {
+            expr.index->accept(*this);
+            expr.value->accept(*this);
+        }
+        void visitLengthExpr(const LengthExpr& /*expr*/) override {}
+        void visitEntryExpr(const EntryExpr& expr) override
+        {
+            expr.key->accept(*this);
+        }
+        void visitEntryAssignExpr(const EntryAssignExpr& expr) override
+        {
+            expr.key->accept(*this);
+            expr.value->accept(*this);
+        }
+        void visitHasEntryExpr(const HasEntryExpr& expr) override
+        {
+            expr.key->accept(*this);
+        }
+        void visitJoinExpr(const JoinExpr& expr) override
+        {
+            expr.left->accept(*this);
+            expr.right->accept(*this);
+        }
+        void visitTextExpr(const TextExpr& expr) override
+        {
+            expr.value->accept(*this);
+        }
+
+    private:
+        PureCalls& m_calls;
+        FoldedCalls& m_folded;
+
+        void arguments(const std::vector<std::unique_ptr<Expr>>& exprs)
+        {
+            for (const auto& expr : exprs)
+            {
+                expr->accept(*this);
+            }
+        }
+    };
+}
+
+PureCalls::PureCalls(const std::vector<std::unique_ptr<Stmt>>& statements) : PureCalls(statements, Limits()) {}
+
+PureCalls::PureCalls(const std::vector<std::unique_ptr<Stmt>>& statements, Limits limits) : m_limits(limits)
+{
+    std::unordered_set<std::string> duplicates;
+    for (const auto& stmt : statements)
+    {
+        if (auto proc = dynamic_cast<const ProcedureDeclStmt*>(stmt.get()))
+        {
+            if (!m_procedures.emplace(proc->name.text, proc).second)
+            {
+                duplicates.insert(proc->name.text);
+            }
+        }
+    }
+
+    // Every procedure starts out pure, so recursion does not disqualify itself; any that print
+    // or call something impure or unknown are removed until nothing changes.
+    for (const auto& entry : m_procedures)
+    {
+        EffectScanner scanner;
+        entry.second->body->accept(scanner);
+        if (!scanner.effects && !duplicates.count(entry.first))
+        {
+            m_pure.insert(entry.first);
+            m_callees[entry.first] = std::move(scanner.callees);
+        }
+    }
+    bool changed = true;
+    while (changed)
+    {
+        changed = false;
+        for (auto it = m_pure.begin(); it != m_pure.end(); )
+        {
+            bool pure = true;
+            for (const auto& callee : m_callees[*it])
+            {
+                if (!m_pure.count(callee))
+                {
+                    pure = false;
+                    break;
+                }
+            }
+            if (pure)
+            {
+                ++it;
+            }
+            else
+            {
+                it = m_pure.erase(it);
+                changed = true;
+            }
+        }
+    }
+}
+
+bool PureCalls::isRecursive(const std::string& procedure) const
+{
+    if (!isPure(procedure))
+    {
+        return false;
+    }
+    std::unordered_set<std::string> seen;
+    std::vector<std::string> pending = m_callees.at(procedure);
+    while (!pending.empty())
+    {
+        std::string callee = std::move(pending.back());
+        pending.pop_back();
+        if (callee == procedure)
+        {
+            return true;
+        }
+        if (seen.insert(callee).second)
+        {
+            const auto& next = m_callees.at(callee);
+            pending.insert(pending.end(), next.begin(), next.end());
+        }
+    }
+    return false;
+}
+
+FoldedCalls PureCalls::fold(const std::vector<std::unique_ptr<Stmt>>& statements)
+{
+    FoldedCalls folded;
+    CallFolder folder(*this, folded);
+    for (const auto& stmt : statements)
+    {
+        stmt->accept(folder);
+    }
+    return folded;
+}
+
+bool PureCalls::evaluate(const std::string& callee, const std::vector<std::unique_ptr<Expr>>& arguments, int64_t& value)
+{
+    if (!isPure(callee))
+    {
+        return false;
+    }
+    PureEvaluator evaluator(*this);
+    std::vector<int64_t> values;
+    try
+    {
+        for (const auto& arg : arguments)
+        {
+            values.push_back(evaluator.evaluate(*arg));
+        }
+    }
+    catch (const GiveUp&)
+    {
+        return false;
+    }
+    try
+    {
+        value = evaluator.call(callee, values);
+        return true;
+    }
+    catch (const GiveUp&)
+    {
+        m_failed.emplace(callee, std::move(values));
+        return false;
+    }
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include "AST.h"
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+// Calls resolved at compile time: the value of each folded call expression, and the 'perform'
+// statements that can be dropped because the procedure they run has no effect.
+struct FoldedCalls
+{
+    std::unordered_map<const FunctionCallExpr*, int64_t> values;
+    std::unordered_set<const ProcedureCallStmt*> removed;
+};
+
+// Purity analysis and compile-time evaluation of procedure calls. A procedure is pure if its body
+// prints nothing, builds no strings, declares no procedures and calls only pure procedures of the
+// same program; recursion is allowed. A call to a pure procedure whose arguments are constants is
+// evaluated by walking the AST with the native code's semantics (64-bit wrapping arithmetic,
+// bitwise and/or) and is replaced by its value. Evaluation gives up, leaving the call to run at
+// runtime, on anything the generated code would not compute the same way: division by zero or
+// overflow, strings, arrays, maps, reading a variable before it is set, falling off the end of a
+// procedure, or exceeding the step and recursion limits.
+class PureCalls
+{
+public:
+    struct Limits
+    {
+        // Statements and calls evaluated for one call site, and for the whole program.
+        uint64_t steps_per_call = 1 << 20;
+        uint64_t total_steps = 1 << 22;
+        int max_depth = 512;
+    };
+
+    explicit PureCalls(const std::vector<std::unique_ptr<Stmt>>& statements);
+    PureCalls(const std::vector<std::unique_ptr<Stmt>>& statements, Limits limits);
+
+    bool isPure(const std::string& procedure) const
+    {
+        return m_pure.count(procedure) != 0;
+    }
+
+    // Whether a pure procedure can reach itself through the procedures it calls.
+    bool isRecursive(const std::string& procedure) const;
+
+    // Evaluates every call with constant arguments to a pure procedure, in the main story and
+    // in procedure bodies. The arguments of calls that cannot be folded are tried in turn.
+    FoldedCalls fold(const std::vector<std::unique_ptr<Stmt>>& statements);
+
+    // The value of a call whose arguments are constant expressions, or false if the callee is
+    // not pure, an argument is not constant, or the call cannot be evaluated within the limits.
+    bool evaluate(const std::string& callee, const std::vector<std::unique_ptr<Expr>>& arguments, int64_t& value);
+
+private:
+    friend class PureEvaluator;
+
+    Limits m_limits;
+    std::unordered_map<std::string, const ProcedureDeclStmt*> m_procedures;
+    std::unordered_set<std::string> m_pure;
+    // The procedures each pure procedure calls.
+    std::unordered_map<std::string, std::vector<std::string>> m_callees;
+    // Results of completed calls, and calls known not to evaluate, shared by every call site.
+    std::map<std::pair<std::string, std::vector<int64_t>>, int64_t> m_memo;
+    std::set<std::pair<std::string, std::vector<int64_t>>> m_failed;
+    uint64_t m_total_steps = 0;
+};
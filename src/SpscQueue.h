@@ -0,0 +1,110 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <thread>
+#include <vector>
+
+struct QueueStats
+{
+    size_t pushes = 0;
+    size_t max_depth = 0;
+    // Sum of the queue depth seen by each push; divide by pushes for the average.
+    size_t depth_total = 0;
+    // Times the producer found the queue full, or the consumer found it empty.
+    size_t full_waits = 0;
+    size_t empty_waits = 0;
+};
+
+// A bounded single-producer/single-consumer ring buffer. Both ends are lock-free and spin with
+// yield() while they wait. Either side may close() the queue: pushes then fail, and pops fail
+// once the remaining items are drained. Counters are owned by their side and should be read
+// after both threads have been joined.
+template <typename T>
+class SpscQueue
+{
+public:
+    explicit SpscQueue(size_t capacity)
+    {
+        size_t size = 2;
+        while (size < capacity)
+        {
+            size <<= 1;
+        }
+        m_slots.resize(size);
+        m_mask = size - 1;
+    }
+
+    SpscQueue(const SpscQueue&) = delete;
+    SpscQueue& operator=(const SpscQueue&) = delete;
+
+    bool push(T&& value)
+    {
+        size_t tail = m_tail.load(std::memory_order_relaxed);
+        size_t head = m_head.load(std::memory_order_acquire);
+        while (tail - head == m_slots.size())
+        {
+            if (m_closed.load(std::memory_order_acquire))
+            {
+                return false;
+            }
+            m_stats.full_waits++;
+            std::this_thread::yield();
+            head = m_head.load(std::memory_order_acquire);
+        }
+        if (m_closed.load(std::memory_order_relaxed))
+        {
+            return false;
+        }
+
+        size_t depth = tail - head + 1;
+        m_stats.pushes++;
+        m_stats.depth_total += depth;
+        m_stats.max_depth = depth > m_stats.max_depth ? depth : m_stats.max_depth;
+
+        m_slots[tail & m_mask] = std::move(value);
+        m_tail.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool pop(T& value)
+    {
+        size_t head = m_head.load(std::memory_order_relaxed);
+        while (m_tail.load(std::memory_order_acquire) == head)
+        {
+            if (m_closed.load(std::memory_order_acquire) && m_tail.load(std::memory_order_acquire) == head)
+            {
+                return false;
+            }
+            m_empty_waits++;
+            std::this_thread::yield();
+        }
+
+        value = std::move(m_slots[head & m_mask]);
+        m_head.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    void close()
+    {
+        m_closed.store(true, std::memory_order_release);
+    }
+
+    QueueStats stats() const
+    {
+        QueueStats stats = m_stats;
+        stats.empty_waits = m_empty_waits;
+        return stats;
+    }
+
+private:
+    std::vector<T> m_slots;
+    size_t m_mask = 0;
+    std::atomic<bool> m_closed{false};
+
+    alignas(64) std::atomic<size_t> m_head{0};
+    size_t m_empty_waits = 0;
+
+    alignas(64) std::atomic<size_t> m_tail{0};
+    QueueStats m_stats;
+};
@@ -0,0 +1,102 @@
+#include "StringArena.h"
+#include <algorithm>
+#include <cstring>
+#include <sys/mman.h>
+
+StringArena::~StringArena()
+{
+    reset(nullptr);
+    if (m_spare)
+    {
+        munmap(m_spare, m_spare->size);
+    }
+}
+
+char* StringArena::allocate(size_t bytes)
+{
+    if (bytes > static_cast<size_t>(m_end - m_next))
+    {
+        size_t size = std::max(bytes + sizeof(Chunk), CHUNK);
+        Chunk* chunk = m_spare;
+        if (chunk && chunk->size >= size)
+        {
+            m_spare = nullptr;
+        }
+        else
+        {
+            void* mapping = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (mapping == MAP_FAILED)
+            {
+                return nullptr;
+            }
+            chunk = static_cast<Chunk*>(mapping);
+            chunk->size = size;
+        }
+        chunk->previous = m_chunk;
+        m_chunk = chunk;
+        m_next = reinterpret_cast<char*>(chunk + 1);
+        m_end = reinterpret_cast<char*>(chunk) + chunk->size;
+    }
+    char* block = m_next;
+    m_next += bytes;
+    return block;
+}
+
+void StringArena::reset(char* mark)
+{
+    // Marks are reset in the reverse order they were taken, so the chunk the mark is in is still
+    // in the list and every chunk after it was added since.
+    while (m_chunk && (mark < reinterpret_cast<char*>(m_chunk + 1) || mark > m_end))
+    {
+        Chunk* chunk = m_chunk;
+        m_chunk = chunk->previous;
+        m_end = m_chunk ? reinterpret_cast<char*>(m_chunk) + m_chunk->size : nullptr;
+        if (m_spare)
+        {
+            munmap(chunk, chunk->size);
+        }
+        else
+        {
+            m_spare = chunk;
+        }
+    }
+    m_next = mark;
+}
+
+char* StringArena::join(const char* left, const char* right)
+{
+    size_t left_length = std::strlen(left);
+    size_t right_length = std::strlen(right);
+    char* text = allocate(left_length + right_length + 1);
+    if (text)
+    {
+        std::memcpy(text, left, left_length);
+        std::memcpy(text + left_length, right, right_length + 1);
+    }
+    return text;
+}
+
+char* StringArena::text(int64_t value)
+{
+    char buffer[21];
+    char* end = buffer + sizeof(buffer);
+    char* p = end;
+    *--p = '\0';
+    uint64_t magnitude = value < 0 ? 0 - static_cast<uint64_t>(value) : static_cast<uint64_t>(value);
+    do
+    {
+        *--p = static_cast<char>('0' + magnitude % 10);
+        magnitude /= 10;
+    }
+    while (magnitude != 0);
+    if (value < 0)
+    {
+        *--p = '-';
+    }
+    char* text = allocate(end - p);
+    if (text)
+    {
+        std::memcpy(text, p, end - p);
+    }
+    return text;
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Memory for the strings a program builds with 'followed by' and 'the text of'. Strings are cut
+// one after another from anonymous mappings of CHUNK bytes, or from one of their own if they are
+// longer, and are never freed one by one: reset() drops everything cut since mark() returned the
+// position it is given. The generated code marks and resets around a print statement that builds
+// strings, and around the body of a procedure that builds strings but does not yield one, since
+// nothing built there can be reached afterwards. The last chunk a reset drops is kept to be cut
+// from again.
+//
+// The native runtime's _string_join, _string_text, _string_mark and _string_reset do the same
+// with their own copy of the arena.
+class StringArena
+{
+public:
+    static constexpr size_t CHUNK = size_t(1) << 20;
+
+    StringArena() = default;
+    StringArena(const StringArena&) = delete;
+    StringArena& operator=(const StringArena&) = delete;
+    ~StringArena();
+
+    // A new string holding the text of `left` then `right`; nullptr if out of memory.
+    char* join(const char* left, const char* right);
+    // The decimal digits of `value`, with a '-' if it is negative; nullptr if out of memory.
+    char* text(int64_t value);
+
+    char* mark() const
+    {
+        return m_next;
+    }
+    void reset(char* mark);
+
+private:
+    // The start of every mapping: the mapping the arena was cutting from before it, and its size.
+    struct Chunk
+    {
+        Chunk* previous;
+        size_t size;
+    };
+
+    Chunk* m_chunk = nullptr;
+    char* m_next = nullptr;
+    char* m_end = nullptr;
+    Chunk* m_spare = nullptr;
+
+    char* allocate(size_t bytes);
+};
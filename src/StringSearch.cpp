@@ -0,0 +1,170 @@
+#include "StringSearch.h"
+#include <cstddef>
+#include <cstdint>
+#include <immintrin.h>
+
+namespace
+{
+    const uintptr_t PAGE = 4096;
+
+    // Whether the `size` bytes from `p` are all in its page.
+    bool inPage(const char* p, uintptr_t size)
+    {
+        return (reinterpret_cast<uintptr_t>(p) & (PAGE - 1)) <= PAGE - size;
+    }
+
+    // Each processor gets two kernels: `differ` gives the offset of the first byte where `a` and
+    // `b` differ or `b` ends, and `find` the first byte of `text` that is `c` or ends it. In
+    // `differ`, comparing the bytes gives all ones where they are equal, and the minimum of that
+    // and `b` is zero exactly where they differ or `b` ends. Both strings may be anywhere in a
+    // page, so blocks that would cross into the next one are done a byte at a time. `find` reads
+    // aligned blocks from the one `text` starts in, dropping the bytes before it.
+    size_t differSse2(const char* a, const char* b)
+    {
+        const __m128i zero = _mm_setzero_si128();
+        size_t i = 0;
+        for (;;)
+        {
+            if (inPage(a + i, 16) && inPage(b + i, 16))
+            {
+                __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i));
+                __m128i y = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i));
+                __m128i kept = _mm_min_epu8(_mm_cmpeq_epi8(x, y), y);
+                unsigned mask = static_cast<unsigned>(_mm_movemask_epi8(_mm_cmpeq_epi8(kept, zero)));
+                if (mask)
+                {
+                    return i + __builtin_ctz(mask);
+                }
+                i += 16;
+            }
+            else if (b[i] == '\0' || a[i] != b[i])
+            {
+                return i;
+            }
+            else
+            {
+                ++i;
+            }
+        }
+    }
+
+    const char* findSse2(const char* text, char c)
+    {
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i wanted = _mm_set1_epi8(c);
+        const char* block = text - (reinterpret_cast<uintptr_t>(text) & 15);
+        __m128i x = _mm_load_si128(reinterpret_cast<const __m128i*>(block));
+        unsigned mask = static_cast<unsigned>(_mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(x, zero), _mm_cmpeq_epi8(x, wanted))));
+        mask >>= text - block;
+        while (!mask)
+        {
+            block += 16;
+            text = block;
+            x = _mm_load_si128(reinterpret_cast<const __m128i*>(block));
+            mask = static_cast<unsigned>(_mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(x, zero), _mm_cmpeq_epi8(x, wanted))));
+        }
+        return text + __builtin_ctz(mask);
+    }
+
+    __attribute__((target("avx2"))) size_t differAvx2(const char* a, const char* b)
+    {
+        const __m256i zero = _mm256_setzero_si256();
+        size_t i = 0;
+        for (;;)
+        {
+            if (inPage(a + i, 32) && inPage(b + i, 32))
+            {
+                __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + i));
+                __m256i y = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + i));
+                __m256i kept = _mm256_min_epu8(_mm256_cmpeq_epi8(x, y), y);
+                unsigned mask = static_cast<unsigned>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(kept, zero)));
+                if (mask)
+                {
+                    return i + __builtin_ctz(mask);
+                }
+                i += 32;
+            }
+            else if (b[i] == '\0' || a[i] != b[i])
+            {
+                return i;
+            }
+            else
+            {
+                ++i;
+            }
+        }
+    }
+
+    __attribute__((target("avx2"))) const char* findAvx2(const char* text, char c)
+    {
+        const __m256i zero = _mm256_setzero_si256();
+        const __m256i wanted = _mm256_set1_epi8(c);
+        const char* block = text - (reinterpret_cast<uintptr_t>(text) & 31);
+        __m256i x = _mm256_load_si256(reinterpret_cast<const __m256i*>(block));
+        unsigned mask = static_cast<unsigned>(_mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(x, zero), _mm256_cmpeq_epi8(x, wanted))));
+        mask >>= text - block;
+        while (!mask)
+        {
+            block += 32;
+            text = block;
+            x = _mm256_load_si256(reinterpret_cast<const __m256i*>(block));
+            mask = static_cast<unsigned>(_mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(x, zero), _mm256_cmpeq_epi8(x, wanted))));
+        }
+        return text + __builtin_ctz(mask);
+    }
+
+    struct Kernels
+    {
+        size_t (*differ)(const char* a, const char* b);
+        const char* (*find)(const char* text, char c);
+    };
+
+    Kernels pickKernels()
+    {
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2"))
+        {
+            return {differAvx2, findAvx2};
+        }
+        return {differSse2, findSse2};
+    }
+
+    const Kernels g_kernels = pickKernels();
+}
+
+bool textEqual(const char* left, const char* right)
+{
+    if (left == right)
+    {
+        return true;
+    }
+    size_t i = g_kernels.differ(left, right);
+    return left[i] == right[i];
+}
+
+bool textStartsWith(const char* text, const char* prefix)
+{
+    return prefix[g_kernels.differ(text, prefix)] == '\0';
+}
+
+bool textContains(const char* text, const char* part)
+{
+    if (*part == '\0')
+    {
+        return true;
+    }
+    // Every place the first byte of `part` turns up is checked for the rest of it.
+    for (;;)
+    {
+        text = g_kernels.find(text, *part);
+        if (*text == '\0')
+        {
+            return false;
+        }
+        ++text;
+        if (part[1 + g_kernels.differ(text, part + 1)] == '\0')
+        {
+            return true;
+        }
+    }
+}
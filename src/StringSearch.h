@@ -0,0 +1,12 @@
+#pragma once
+
+// Comparisons of the text of two strings, for 'is equal to', 'starts with' and 'contains'. They
+// work on 16 bytes at a time with SSE2, or 32 with AVX2 when the processor has it, which is
+// checked once. Blocks are read whole, so a read may run past the end of a string, but never
+// into the next page.
+//
+// The native runtime's _string_equal, _string_starts and _string_contains do the same, picking
+// between their own SSE2 and AVX2 versions the first time one of them runs.
+bool textEqual(const char* left, const char* right);
+bool textStartsWith(const char* text, const char* prefix);
+bool textContains(const char* text, const char* part);
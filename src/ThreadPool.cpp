@@ -0,0 +1,108 @@
+#include "ThreadPool.h"
+
+ThreadPool::ThreadPool(size_t threads)
+{
+    if (threads == 0)
+    {
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    for (size_t i = 1; i < threads; ++i)
+    {
+        m_workers.emplace_back(&ThreadPool::workerLoop, this);
+    }
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = true;
+    }
+    m_wake.notify_all();
+    for (auto& worker : m_workers)
+    {
+        worker.join();
+    }
+}
+
+void ThreadPool::drain()
+{
+    for (size_t i = m_next.fetch_add(1); i < m_count; i = m_next.fetch_add(1))
+    {
+        try
+        {
+            (*m_task)(i);
+        }
+        catch (...)
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            if (!m_failure || i < m_failed_index)
+            {
+                m_failure = std::current_exception();
+                m_failed_index = i;
+            }
+        }
+    }
+}
+
+void ThreadPool::workerLoop()
+{
+    unsigned long seen = 0;
+    for (;;)
+    {
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_wake.wait(lock, [&] { return m_stop || m_generation != seen; });
+            if (m_stop)
+            {
+                return;
+            }
+            seen = m_generation;
+            m_busy++;
+        }
+
+        drain();
+
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_busy--;
+        }
+        m_finished.notify_all();
+    }
+}
+
+void ThreadPool::parallelFor(size_t count, const std::function<void(size_t)>& task)
+{
+    if (count == 0)
+    {
+        return;
+    }
+
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_finished.wait(lock, [&] { return m_busy == 0; });
+        m_task = &task;
+        m_count = count;
+        m_next = 0;
+        m_failure = nullptr;
+        m_generation++;
+    }
+    if (count > 1)
+    {
+        m_wake.notify_all();
+    }
+
+    drain();
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_finished.wait(lock, [&] { return m_busy == 0; });
+    m_task = nullptr;
+    m_count = 0;
+
+    if (m_failure)
+    {
+        std::exception_ptr failure = m_failure;
+        m_failure = nullptr;
+        std::rethrow_exception(failure);
+    }
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// A fixed set of worker threads that split index ranges between themselves and the caller.
+class ThreadPool
+{
+public:
+    // A thread count of 0 uses one thread per hardware core.
+    explicit ThreadPool(size_t threads = 0);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    size_t size() const
+    {
+        return m_workers.size() + 1;
+    }
+
+    // Runs task(0) .. task(count - 1) and returns once all have finished. Exceptions are
+    // collected per index and the one with the lowest index is rethrown.
+    void parallelFor(size_t count, const std::function<void(size_t)>& task);
+
+private:
+    std::vector<std::thread> m_workers;
+    std::mutex m_mutex;
+    std::condition_variable m_wake;
+    std::condition_variable m_finished;
+
+    const std::function<void(size_t)>* m_task = nullptr;
+    size_t m_count = 0;
+    std::atomic<size_t> m_next{0};
+    size_t m_busy = 0;
+    unsigned long m_generation = 0;
+    bool m_stop = false;
+
+    size_t m_failed_index = 0;
+    std::exception_ptr m_failure;
+
+    void workerLoop();
+    void drain();
+};
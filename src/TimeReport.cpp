@@ -0,0 +1,314 @@
+#include "TimeReport.h"
+#include <cstdio>
+#include <ctime>
+#include <sys/resource.h>
+
+namespace
+{
+    const char* const PHASE_NAMES[] = {
+        "read", "lex", "parse", "imports", "string_walk", "stack_walk", "pure_eval", "codegen", "output", "run",
+    };
+    const char* const COUNTER_NAMES[] = {
+        "source_bytes", "source_lines", "tokens", "ast_nodes", "instructions", "output_bytes",
+    };
+    static_assert(sizeof(PHASE_NAMES) / sizeof(PHASE_NAMES[0]) == TimeReport::PHASE_COUNT, "Phase names out of date.");
+    static_assert(sizeof(COUNTER_NAMES) / sizeof(COUNTER_NAMES[0]) == TimeReport::COUNTER_COUNT, "Counter names out of date.");
+
+    int64_t now(clockid_t clock)
+    {
+        timespec ts;
+        clock_gettime(clock, &ts);
+        return static_cast<int64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+    }
+
+    class NodeCounter : public StmtVisitor, public ExprVisitor
+    {
+    public:
+        size_t count = 0;
+
+        void visitDeclarationStmt(const DeclarationStmt& stmt) override 
+        { 
+            count++; 
+            stmt.initializer->accept(*this); 
+        }
+        void visitExpressionStmt(const ExpressionStmt& stmt) override 
+        { 
+            count++; 
+            stmt.expression->accept(*this); 
+        }
+        void visitIfStmt(const IfStmt& stmt) override 
+        { 
+            count++; 
+            stmt.condition->accept(*this); 
+            stmt.then_branch->accept(*this); 
+            if (stmt.else_branch)
+            {
+                stmt.else_branch->accept(*this);
+            }
+        }
+        void visitWhileStmt(const WhileStmt& stmt) override 
+        { 
+            count++; 
+            stmt.condition->accept(*this); 
+            stmt.body->accept(*this); 
+        }
+        void visitForStmt(const ForStmt& stmt) override 
+        { 
+            count++; 
+            stmt.first->accept(*this); 
+            stmt.last->accept(*this); 
+            stmt.body->accept(*this); 
+        }
+        void visitBlockStmt(const BlockStmt& stmt) override 
+        { 
+            count++; 
+            for (const auto& s : stmt.statements) 
+            {
+                s->accept(*this);
+            }
+        }
+        void visitPrintStmt(const PrintStmt& stmt) override 
+        { 
+            count++; 
+            stmt.expression->accept(*this); 
+        }
+        void visitNewlineStmt(const NewlineStmt& /*stmt*/) override 
+        { 
+            count++; 
+        }
+        void visitProcedureDeclStmt(const ProcedureDeclStmt& stmt) override 
+        { 
+            count++; 
+            stmt.body->accept(*this); 
+        }
+        void visitProcedureCallStmt(const ProcedureCallStmt& stmt) override 
+        { 
+            count++; 
+            for (const auto& arg : stmt.arguments) 
+            {
+                arg->accept(*this);
+            }
+        }
+        void visitReturnStmt(const ReturnStmt& stmt) override 
+        { 
+            count++; 
+            stmt.value->accept(*this); 
+        }
+        void visitBreakStmt(const BreakStmt& /*stmt*/) override 
+        { 
+            count++; 
+        }
+        void visitImportStmt(const ImportStmt& /*stmt*/) override 
+        { 
+            count++; 
+        }
+
+        void visitBinaryExpr(const BinaryExpr& expr) override 
+        { 
+            count++; 
+            expr.left->accept(*this); 
+            expr.right->accept(*this); 
+        }
+        void visitComparisonExpr(const ComparisonExpr& expr) override 
+        { 
+            count++; 
+            expr.left->accept(*this); 
+            expr.right->accept(*this); 
+        }
+        void visitLiteralExpr(const LiteralExpr& /*expr*/) override 
+        { 
+            count++; 
+        }
+        void visitVariableExpr(const VariableExpr& /*expr*/) override 
+        { 
+            count++; 
+        }
+        void visitAssignExpr(const AssignExpr& expr) override 
+        { 
+            count++; 
+            expr.value->accept(*this); 
+        }
+        void visitFunctionCallExpr(const FunctionCallExpr& expr) override 
+        { 
+            count++; 
+            for (const auto& arg : expr.arguments) 
+            {
+                arg->accept(*this);
+            }
+        }
+        void visitUnaryExpr(const UnaryExpr& expr) override 
+        { 
+            count++; 
+            expr.right->accept(*this); 
+        }
+        void visitIndexExpr(const IndexExpr& expr) override 
+        { 
+            count++; 
+            expr.index->accept(*this); 
+        }
+        void visitIndexAssignExpr(const IndexAssignExpr& expr) override 
+        { 
+            count++; 
+            expr.index->accept(*this); 
+            expr.value->accept(*this); 
+        }
+        void visitLengthExpr(const LengthExpr& /*expr*/) override 
+        { 
+            count++; 
+        }
+        void visitEntryExpr(const EntryExpr& expr) override 
+        { 
+            count++; 
+            expr.key->accept(*this); 
+        }
+        void visitEntryAssignExpr(const EntryAssignExpr& expr) override 
+        { 
+            count++; 
+            expr.key->accept(*this); 
+            expr.value->accept(*this); 
+        }
+        void visitHasEntryExpr(const HasEntryExpr& expr) override 
+        { 
+            count++; 
+            expr.key->accept(*this); 
+        }
+        void visitJoinExpr(const JoinExpr& expr) override 
+        { 
+            count++; 
+            expr.left->accept(*this); 
+            expr.right->accept(*this); 
+        }
+        void visitTextExpr(const TextExpr& expr) override 
+        { 
+            count++; 
+            expr.value->accept(*this); 
+        }
+    };
+}
+
+TimeReport::Scope::Scope(TimeReport* report, Phase phase, bool nested) : m_report(report), m_phase(phase), m_nested(nested)
+{
+    if (m_report)
+    {
+        m_wall = now(CLOCK_MONOTONIC);
+        m_cpu = now(m_nested ? CLOCK_THREAD_CPUTIME_ID : CLOCK_PROCESS_CPUTIME_ID);
+    }
+}
+
+TimeReport::Scope::~Scope()
+{
+    if (m_report)
+    {
+        int64_t cpu = now(m_nested ? CLOCK_THREAD_CPUTIME_ID : CLOCK_PROCESS_CPUTIME_ID) - m_cpu;
+        m_report->add(m_phase, now(CLOCK_MONOTONIC) - m_wall, cpu);
+    }
+}
+
+void TimeReport::add(Phase phase, int64_t wall_ns, int64_t cpu_ns)
+{
+    m_wall[phase] += wall_ns;
+    m_cpu[phase] += cpu_ns;
+    m_calls[phase]++;
+}
+
+size_t TimeReport::countNodes(const std::vector<std::unique_ptr<Stmt>>& statements)
+{
+    NodeCounter counter;
+    for (const auto& stmt : statements)
+    {
+        stmt->accept(counter);
+    }
+    return counter.count;
+}
+
+size_t TimeReport::countInstructions(const std::string& assembly)
+{
+    static const char* const data[] = {"db ", "dw ", "dd ", "dq ", "resb ", "resw ", "resd ", "resq ", "align "};
+    size_t count = 0;
+    size_t line = 0;
+    while (line < assembly.size())
+    {
+        size_t end = assembly.find('\n', line);
+        end = end == std::string::npos ? assembly.size() : end;
+        if (assembly.compare(line, 4, "    ") == 0 && end > line + 4 && assembly[line + 4] != ';' && assembly[line + 4] != ' ')
+        {
+            bool is_data = false;
+            for (const char* directive : data)
+            {
+                is_data = is_data || assembly.compare(line + 4, std::char_traits<char>::length(directive), directive) == 0;
+            }
+            count += is_data ? 0 : 1;
+        }
+        line = end + 1;
+    }
+    return count;
+}
+
+void TimeReport::print(std::ostream& out, bool json) const
+{
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    long peak_rss_kb = usage.ru_maxrss;
+
+    char line[160];
+    if (json)
+    {
+        out << "{\"phases\": {";
+        const char* separator = "";
+        for (int i = 0; i < PHASE_COUNT; ++i)
+        {
+            if (m_calls[i] == 0)
+            {
+                continue;
+            }
+            std::snprintf(line, sizeof(line), "%s\"%s\": {\"wall_ms\": %.3f, \"cpu_ms\": %.3f, \"calls\": %llu}", separator, PHASE_NAMES[i],
+                          m_wall[i] / 1e6, m_cpu[i] / 1e6, static_cast<unsigned long long>(m_calls[i]));
+            out << line;
+            separator = ", ";
+        }
+        out << "}";
+        for (int i = 0; i < COUNTER_COUNT; ++i)
+        {
+            out << ", \"" << COUNTER_NAMES[i] << "\": " << m_counters[i];
+        }
+        out << ", \"peak_rss_kb\": " << peak_rss_kb << "}\n";
+        return;
+    }
+
+    out << "Time report:\n";
+    std::snprintf(line, sizeof(line), "  %-14s %12s %12s\n", "phase", "wall ms", "cpu ms");
+    out << line;
+    int64_t wall = 0;
+    int64_t cpu = 0;
+    for (int i = 0; i < PHASE_COUNT; ++i)
+    {
+        if (m_calls[i] == 0)
+        {
+            continue;
+        }
+        bool nested = i == STRING_WALK || i == STACK_WALK || i == PURE_EVAL;
+        std::snprintf(line, sizeof(line), "  %-14s %12.3f %12.3f%s\n", PHASE_NAMES[i], m_wall[i] / 1e6, m_cpu[i] / 1e6,
+                      nested ? "   (within codegen, summed over threads)" : "");
+        out << line;
+        if (!nested)
+        {
+            wall += m_wall[i];
+            cpu += m_cpu[i];
+        }
+    }
+    std::snprintf(line, sizeof(line), "  %-14s %12.3f %12.3f\n", "total", wall / 1e6, cpu / 1e6);
+    out << line;
+
+    for (int i = 0; i < COUNTER_COUNT; ++i)
+    {
+        // Streamed compilation never holds the whole program, so it leaves the counters unset.
+        if (m_counters[i] == 0)
+        {
+            continue;
+        }
+        std::snprintf(line, sizeof(line), "  %-14s %12llu\n", COUNTER_NAMES[i], static_cast<unsigned long long>(m_counters[i]));
+        out << line;
+    }
+    std::snprintf(line, sizeof(line), "  %-14s %12ld\n", "peak_rss_kb", peak_rss_kb);
+    out << line;
+}
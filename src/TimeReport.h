@@ -0,0 +1,77 @@
+#pragma once
+
+#include "AST.h"
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// Wall and CPU time per compiler phase plus size counters, printed by lostrecordc --time-report.
+// Phases can be timed from any thread; nested phases (the walks inside codegen) add up the time
+// of every thread that ran them.
+class TimeReport
+{
+public:
+    enum Phase
+    {
+        READ,
+        LEX,
+        PARSE,
+        IMPORTS,
+        STRING_WALK,
+        STACK_WALK,
+        PURE_EVAL,
+        CODEGEN,
+        OUTPUT,
+        RUN,
+        PHASE_COUNT,
+    };
+
+    enum Counter
+    {
+        SOURCE_BYTES,
+        SOURCE_LINES,
+        TOKENS,
+        AST_NODES,
+        INSTRUCTIONS,
+        OUTPUT_BYTES,
+        COUNTER_COUNT,
+    };
+
+    // Times the enclosing block. With a null report it does nothing. Top-level phases measure
+    // the CPU time of the whole process, so work handed to other threads is included; nested
+    // phases measure only the calling thread.
+    class Scope
+    {
+    public:
+        Scope(TimeReport* report, Phase phase, bool nested = false);
+        ~Scope();
+
+    private:
+        TimeReport* m_report;
+        Phase m_phase;
+        bool m_nested;
+        int64_t m_wall;
+        int64_t m_cpu;
+    };
+
+    void set(Counter counter, uint64_t value)
+    {
+        m_counters[counter] = value;
+    }
+    void add(Phase phase, int64_t wall_ns, int64_t cpu_ns);
+
+    void print(std::ostream& out, bool json) const;
+
+    static size_t countNodes(const std::vector<std::unique_ptr<Stmt>>& statements);
+    // Instruction lines in generated assembly, not counting labels, directives and data.
+    static size_t countInstructions(const std::string& assembly);
+
+private:
+    std::atomic<int64_t> m_wall[PHASE_COUNT] = {};
+    std::atomic<int64_t> m_cpu[PHASE_COUNT] = {};
+    std::atomic<uint64_t> m_calls[PHASE_COUNT] = {};
+    uint64_t m_counters[COUNTER_COUNT] = {};
+};
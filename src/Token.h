@@ -25,8 +25,8 @@ enum class TokenType {
 std::string to_string(TokenType type);
 
 struct Token {
-    TokenType type;
+    TokenType type = TokenType::UNKNOWN;
     std::string text;
     std::string literal_value;
-    int line;
+    int line = 0;
 };
\ No newline at end of file
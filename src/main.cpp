@@ -5,46 +5,553 @@
 #include "Lexer.h"
 #include "Parser.h"
 #include "CodeGenerator.h"
+#include "Jit.h"
+#include "Bytecode.h"
+#include "Interpreter.h"
+#include "Pipeline.h"
+#include "Module.h"
+#include "Build.h"
+#include "CompileCache.h"
+#include "TimeReport.h"
+#include "ProfileData.h"
+#include <memory>
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
 
-void runFile(const std::string& path) 
+struct Options
 {
-    std::ifstream file(path);
+    std::string path;
+    std::vector<std::string> sources;
+    std::string output;
+    bool compile_only = false;
+    bool emit_lrm = false;
+    bool run = false;
+    bool interpret = false;
+    bool stream = false;
+    bool pipeline = false;
+    bool pipeline_stats = false;
+    std::string cache_dir;
+    uint64_t cache_size = 64ull << 20;
+    bool cache_stats = false;
+    CompileCache* cache = nullptr;
+    size_t jobs = 0;
+    bool profile = false;
+    std::string profile_generate;
+    std::string profile_use_path;
+    const ProfileData* profile_use = nullptr;
+    bool time_report = false;
+    bool time_report_json = false;
+    TimeReport* report = nullptr;
+    bool debug_info = false;
+    bool fold_pure_calls = true;
+    bool memoize = false;
+    std::vector<std::string> memoize_only;
+    size_t memo_entries = 4096;
+    int unroll_factor = 4;
+    bool vectorize = true;
+    bool avx2 = false;
+};
 
-    if (!file.is_open()) 
+// Reads the whole number given to an option. False when it is missing, has anything but digits
+// or does not fit, so the caller can fall through to the usage message.
+bool parseCount(const std::string& text, unsigned long long& value)
+{
+    if (text.empty() || text.find_first_not_of("0123456789") != std::string::npos)
     {
-        std::cerr << "Error: Could not open file " << path << std::endl;
-        return;
+        return false;
     }
+    errno = 0;
+    value = std::strtoull(text.c_str(), nullptr, 10);
+    return errno != ERANGE;
+}
 
-    std::stringstream buffer;
-    buffer << file.rdbuf();
-    std::string source = buffer.str();
-
-    Lexer lexer(source);
-    std::vector<Token> tokens = lexer.scanTokens();
+// Lexes, parses and generates one top-level statement at a time, freeing each as soon as its
+// code is written. Memory stays bounded by the largest statement rather than the whole program.
+int streamFile(const Options& options, std::istream& file)
+{
+    CodegenOptions codegen_options;
+    codegen_options.host_runtime = options.run;
+    codegen_options.profile = options.profile;
+    codegen_options.profile_generate = options.profile_generate;
+    codegen_options.profile_use = options.profile_use;
+    codegen_options.time_report = options.report;
+    codegen_options.debug_info = options.debug_info;
+    codegen_options.source_path = options.path;
+    codegen_options.unroll_factor = options.unroll_factor;
+    codegen_options.vectorize = options.vectorize;
+    codegen_options.avx2 = options.avx2;
+    std::ostringstream assembly;
+    CodeGenerator generator(codegen_options, options.run ? static_cast<std::ostream&>(assembly) : std::cout);
+    ImportResolver imports(options.path, options.jobs);
+    auto consume = [&](const Stmt& stmt) 
+    {
+        if (auto import = dynamic_cast<const ImportStmt*>(&stmt))
+        {
+            for (const auto& procedure : imports.resolve(*import, options.path))
+            {
+                generator.streamStatement(*procedure);
+            }
+            return;
+        }
+        generator.streamStatement(stmt);
+    };
 
-    Parser parser(tokens);
-    auto statements = parser.parse();
-    
-    CodeGenerator generator;
-    try 
+    try
     {
-        generator.generate(statements);
-    } 
-    catch (const std::runtime_error& e) 
+        // Lexing, parsing and code generation are interleaved here, so all three are timed as codegen.
+        TimeReport::Scope timer(options.report, TimeReport::CODEGEN);
+        generator.beginStream();
+        if (options.pipeline)
+        {
+            PipelineStats stats = runPipeline(file, consume);
+            if (options.pipeline_stats)
+            {
+                printPipelineStats(stats, std::cerr);
+            }
+        }
+        else
+        {
+            Lexer lexer(file);
+            Parser parser(lexer);
+            while (auto stmt = parser.parseNext())
+            {
+                consume(*stmt);
+            }
+        }
+        generator.endStream();
+    }
+    catch (const std::runtime_error& e)
     {
         std::cerr << "Runtime Error during code generation: " << e.what() << std::endl;
+        return options.run ? 1 : 0;
+    }
+
+    if (!options.run)
+    {
+        TimeReport::Scope timer(options.report, TimeReport::OUTPUT);
+        std::cout.flush();
+        return 0;
+    }
+
+    try
+    {
+        TimeReport::Scope timer(options.report, TimeReport::RUN);
+        return Jit().run(assembly.str());
+    }
+    catch (const std::runtime_error& e)
+    {
+        std::cerr << "JIT Error: " << e.what() << std::endl;
+        return 1;
     }
 }
 
-int main(int argc, char* argv[]) 
+int runFile(const Options& options)
 {
-    if (argc != 2) 
+    std::ifstream file(options.path);
+
+    if (!file.is_open())
+    {
+        std::cerr << "Error: Could not open file " << options.path << std::endl;
+        return 1;
+    }
+
+    if (options.stream && !options.interpret)
+    {
+        return streamFile(options, file);
+    }
+
+    TimeReport* report = options.report;
+    std::string source;
+    {
+        TimeReport::Scope timer(report, TimeReport::READ);
+        std::stringstream buffer;
+        buffer << file.rdbuf();
+        source = buffer.str();
+    }
+
+    std::vector<Token> tokens;
+    {
+        TimeReport::Scope timer(report, TimeReport::LEX);
+        Lexer lexer(source);
+        tokens = lexer.scanTokens();
+    }
+
+    std::vector<std::unique_ptr<Stmt>> statements;
+    {
+        TimeReport::Scope timer(report, TimeReport::PARSE);
+        Parser parser(tokens);
+        statements = parser.parseParallel(options.jobs);
+    }
+
+    try
+    {
+        TimeReport::Scope timer(report, TimeReport::IMPORTS);
+        ImportResolver(options.path, options.jobs).splice(statements);
+    }
+    catch (const std::runtime_error& e)
+    {
+        std::cerr << "Error: " << e.what() << std::endl;
+        return 1;
+    }
+
+    if (report)
+    {
+        report->set(TimeReport::SOURCE_BYTES, source.size());
+        report->set(TimeReport::SOURCE_LINES, std::count(source.begin(), source.end(), '\n'));
+        report->set(TimeReport::TOKENS, tokens.size());
+        report->set(TimeReport::AST_NODES, TimeReport::countNodes(statements));
+    }
+
+    if (options.interpret && (options.profile || !options.profile_generate.empty()))
     {
-        std::cout << "Usage: " << argv[0] << " <filename.lr>" << std::endl;
+        std::cerr << "Error: --profile and -fprofile-generate instrument native code and cannot be used with --interpret." << std::endl;
         return 1;
     }
 
-    runFile(argv[1]);
+    if (options.interpret)
+    {
+        BytecodeProgram program;
+        try
+        {
+            TimeReport::Scope timer(report, TimeReport::CODEGEN);
+            program = BytecodeCompiler().compile(statements);
+        }
+        catch (const std::runtime_error& e)
+        {
+            std::cerr << "Runtime Error during code generation: " << e.what() << std::endl;
+            return 1;
+        }
+        if (report)
+        {
+            report->set(TimeReport::INSTRUCTIONS, program.code.size());
+            report->set(TimeReport::OUTPUT_BYTES, program.code.size() * sizeof(Instruction));
+        }
+        TimeReport::Scope timer(report, TimeReport::RUN);
+        return Interpreter().run(program);
+    }
+
+    if (options.run)
+    {
+        CodegenOptions codegen_options;
+        codegen_options.host_runtime = true;
+        codegen_options.jobs = options.jobs;
+        codegen_options.cache = options.cache;
+        codegen_options.profile = options.profile;
+        codegen_options.profile_generate = options.profile_generate;
+        codegen_options.profile_use = options.profile_use;
+        codegen_options.time_report = report;
+        codegen_options.debug_info = options.debug_info;
+        codegen_options.source_path = options.path;
+        codegen_options.fold_pure_calls = options.fold_pure_calls;
+        codegen_options.memoize = options.memoize;
+        codegen_options.memoize_only = options.memoize_only;
+        codegen_options.memo_entries = options.memo_entries;
+        codegen_options.unroll_factor = options.unroll_factor;
+        codegen_options.vectorize = options.vectorize;
+        codegen_options.avx2 = options.avx2;
+        std::ostringstream assembly;
+        CodeGenerator generator(codegen_options, assembly);
+        try
+        {
+            TimeReport::Scope timer(report, TimeReport::CODEGEN);
+            generator.generate(statements);
+        }
+        catch (const std::runtime_error& e)
+        {
+            std::cerr << "Runtime Error during code generation: " << e.what() << std::endl;
+            return 1;
+        }
+        if (report)
+        {
+            report->set(TimeReport::INSTRUCTIONS, TimeReport::countInstructions(assembly.str()));
+            report->set(TimeReport::OUTPUT_BYTES, assembly.str().size());
+        }
+
+        try
+        {
+            TimeReport::Scope timer(report, TimeReport::RUN);
+            return Jit().run(assembly.str());
+        }
+        catch (const std::runtime_error& e)
+        {
+            std::cerr << "JIT Error: " << e.what() << std::endl;
+            return 1;
+        }
+    }
+
+    CodegenOptions codegen_options;
+    codegen_options.jobs = options.jobs;
+    codegen_options.cache = options.cache;
+    codegen_options.profile = options.profile;
+    codegen_options.profile_generate = options.profile_generate;
+    codegen_options.profile_use = options.profile_use;
+    codegen_options.time_report = report;
+    codegen_options.debug_info = options.debug_info;
+    codegen_options.source_path = options.path;
+    codegen_options.fold_pure_calls = options.fold_pure_calls;
+    codegen_options.memoize = options.memoize;
+    codegen_options.memoize_only = options.memoize_only;
+    codegen_options.memo_entries = options.memo_entries;
+    codegen_options.unroll_factor = options.unroll_factor;
+    codegen_options.vectorize = options.vectorize;
+    codegen_options.avx2 = options.avx2;
+    // With a time report the assembly is buffered so that writing it out can be timed on its own.
+    std::ostringstream assembly;
+    CodeGenerator generator(codegen_options, report ? static_cast<std::ostream&>(assembly) : std::cout);
+    try
+    {
+        TimeReport::Scope timer(report, TimeReport::CODEGEN);
+        generator.generate(statements);
+    }
+    catch (const std::runtime_error& e)
+    {
+        std::cerr << "Runtime Error during code generation: " << e.what() << std::endl;
+    }
+    if (report)
+    {
+        std::string text = assembly.str();
+        report->set(TimeReport::INSTRUCTIONS, TimeReport::countInstructions(text));
+        report->set(TimeReport::OUTPUT_BYTES, text.size());
+        TimeReport::Scope timer(report, TimeReport::OUTPUT);
+        std::cout.write(text.data(), text.size());
+        std::cout.flush();
+        return 0;
+    }
+    std::cout.flush();
     return 0;
-}
\ No newline at end of file
+}
+
+int main(int argc, char* argv[])
+{
+    Options options;
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        if (arg == "--run")
+        {
+            options.run = true;
+        }
+        else if (arg == "--interpret")
+        {
+            options.interpret = true;
+        }
+        else if (arg == "--stream")
+        {
+            options.stream = true;
+        }
+        else if (arg == "--pipeline" || arg == "--pipeline-stats")
+        {
+            options.stream = true;
+            options.pipeline = true;
+            options.pipeline_stats = options.pipeline_stats || arg == "--pipeline-stats";
+        }
+        else if (arg.compare(0, 2, "-j") == 0)
+        {
+            std::string count = arg.size() > 2 ? arg.substr(2) : (i + 1 < argc ? argv[++i] : "");
+            unsigned long long jobs;
+            if (!parseCount(count, jobs))
+            {
+                options.sources.clear();
+                break;
+            }
+            options.jobs = jobs;
+        }
+        else if (arg == "--cache" && i + 1 < argc)
+        {
+            options.cache_dir = argv[++i];
+        }
+        else if (arg == "--cache-size" && i + 1 < argc)
+        {
+            unsigned long long mebibytes;
+            if (!parseCount(argv[++i], mebibytes) || mebibytes > (UINT64_MAX >> 20))
+            {
+                options.sources.clear();
+                break;
+            }
+            options.cache_size = mebibytes << 20;
+        }
+        else if (arg == "--cache-stats")
+        {
+            options.cache_stats = true;
+        }
+        else if (arg == "--profile")
+        {
+            options.profile = true;
+        }
+        else if (arg == "-fprofile-generate" || arg.compare(0, 19, "-fprofile-generate=") == 0)
+        {
+            options.profile_generate = arg.size() > 19 ? arg.substr(19) : "lostrecord.pgo";
+        }
+        else if (arg == "-fprofile-use" || arg.compare(0, 14, "-fprofile-use=") == 0)
+        {
+            options.profile_use_path = arg.size() > 14 ? arg.substr(14) : "lostrecord.pgo";
+        }
+        else if (arg == "--time-report" || arg == "--time-report=json")
+        {
+            options.time_report = true;
+            options.time_report_json = arg == "--time-report=json";
+        }
+        else if (arg == "-fno-fold-pure-calls")
+        {
+            options.fold_pure_calls = false;
+        }
+        else if (arg == "-fmemoize" || arg.compare(0, 10, "-fmemoize=") == 0)
+        {
+            options.memoize = true;
+            std::stringstream names(arg.size() > 10 ? arg.substr(10) : "");
+            for (std::string name; std::getline(names, name, ',');)
+            {
+                options.memoize_only.push_back(name);
+            }
+        }
+        else if (arg.compare(0, 12, "-fmemo-size=") == 0)
+        {
+            // Entries per table; a power of two, so the hash can be shifted into an index. At most
+            // 2^24, which keeps a table of the widest entries (8 quadwords) within a 1 GiB resq.
+            unsigned long long entries;
+            if (!parseCount(arg.substr(12), entries) || entries == 0 || entries > (1ull << 24) || (entries & (entries - 1)) != 0)
+            {
+                options.sources.clear();
+                break;
+            }
+            options.memo_entries = entries;
+        }
+        else if (arg == "-fno-unroll-loops")
+        {
+            options.unroll_factor = 1;
+        }
+        else if (arg.compare(0, 15, "-funroll-loops=") == 0)
+        {
+            // A power of two, so the leftover trips are a mask and the unrolled ones a shift.
+            unsigned long long factor;
+            if (!parseCount(arg.substr(15), factor) || factor < 1 || factor > 64 || (factor & (factor - 1)) != 0)
+            {
+                options.sources.clear();
+                break;
+            }
+            options.unroll_factor = static_cast<int>(factor);
+        }
+        else if (arg == "-fno-vectorize")
+        {
+            options.vectorize = false;
+        }
+        else if (arg == "-mavx2")
+        {
+            options.avx2 = true;
+        }
+        else if (arg == "-g")
+        {
+            options.debug_info = true;
+        }
+        else if (arg == "--emit-lrm")
+        {
+            options.emit_lrm = true;
+        }
+        else if (arg == "-c")
+        {
+            options.compile_only = true;
+        }
+        else if (arg == "-o" && i + 1 < argc)
+        {
+            options.output = argv[++i];
+        }
+        else if (!arg.empty() && arg[0] != '-')
+        {
+            options.sources.push_back(arg);
+        }
+        else
+        {
+            options.sources.clear();
+            break;
+        }
+    }
+
+    std::unique_ptr<CompileCache> cache;
+    if (!options.cache_dir.empty() || options.cache_stats)
+    {
+        cache = std::make_unique<CompileCache>(options.cache_dir.empty() ? ".lrcache" : options.cache_dir, options.cache_size);
+        options.cache = cache.get();
+    }
+
+    ProfileData training;
+    if (!options.profile_use_path.empty())
+    {
+        try
+        {
+            training = ProfileData::load(options.profile_use_path);
+            options.profile_use = &training;
+        }
+        catch (const std::runtime_error& e)
+        {
+            std::cerr << "Error: " << e.what() << std::endl;
+            return 1;
+        }
+    }
+
+    std::unique_ptr<TimeReport> report;
+    if (options.time_report)
+    {
+        report = std::make_unique<TimeReport>();
+        options.report = report.get();
+    }
+
+    int status = 1;
+    if (!options.sources.empty() && options.emit_lrm)
+    {
+        BuildOptions build;
+        build.sources = options.sources;
+        build.jobs = options.jobs;
+        status = emitModules(build);
+    }
+    else if (!options.sources.empty() && (options.compile_only || !options.output.empty()))
+    {
+        BuildOptions build;
+        build.sources = options.sources;
+        build.output = options.output.empty() ? build.output : options.output;
+        build.compile_only = options.compile_only;
+        build.jobs = options.jobs;
+        build.cache = options.cache;
+        build.profile = options.profile;
+        build.profile_generate = options.profile_generate;
+        build.profile_use = options.profile_use;
+        build.debug_info = options.debug_info;
+        build.fold_pure_calls = options.fold_pure_calls;
+        build.memoize = options.memoize;
+        build.memoize_only = options.memoize_only;
+        build.memo_entries = options.memo_entries;
+        build.unroll_factor = options.unroll_factor;
+        build.vectorize = options.vectorize;
+        build.avx2 = options.avx2;
+        status = buildModules(build);
+    }
+    else
+    {
+        if (options.sources.size() == 1)
+        {
+            options.path = options.sources[0];
+        }
+        if (options.path.empty())
+        {
+            std::cout << "Usage: " << argv[0] << " [--run | --interpret] [--stream | --pipeline] [--pipeline-stats] [--cache <dir>] [--cache-size <MiB>] [--cache-stats] [--profile] [-fprofile-generate[=<file>] | -fprofile-use[=<file>]] [--time-report[=json]] [-g] [-fno-fold-pure-calls] [-fmemoize[=<procedures>]] [-fmemo-size=<entries>] [-funroll-loops=<factor> | -fno-unroll-loops] [-fno-vectorize] [-mavx2] [-j <threads>] <filename.lr>" << std::endl;
+            std::cout << "       " << argv[0] << " (-c | -o <program>) [--cache <dir>] [--cache-stats] [--profile] [-fprofile-generate[=<file>] | -fprofile-use[=<file>]] [-g] [-fno-fold-pure-calls] [-fmemoize[=<procedures>]] [-fmemo-size=<entries>] [-funroll-loops=<factor> | -fno-unroll-loops] [-fno-vectorize] [-mavx2] [-j <threads>] <module.lr>..." << std::endl;
+            std::cout << "       " << argv[0] << " --emit-lrm [-j <threads>] <module.lr>..." << std::endl;
+            return 1;
+        }
+        status = runFile(options);
+    }
+
+    if (cache)
+    {
+        cache->trim();
+        if (options.cache_stats)
+        {
+            cache->printStats(std::cerr);
+        }
+    }
+    if (report)
+    {
+        report->print(std::cerr, options.time_report_json);
+    }
+    return status;
+}
@@ -0,0 +1,122 @@
+#!/usr/bin/env python3
+"""Finds the loop length at which compiling natively beats the bytecode interpreter.
+
+Each size runs the same LostRecord loop through:
+  interpret  lostrecordc --interpret
+  jit        lostrecordc --run
+  native     lostrecordc > .s, nasm, ld, then the program (skipped without nasm/ld)
+
+A line t = fixed + per_iteration * N is fitted per backend and the break-even N is
+where the interpreter's line crosses the native one.
+"""
+
+import argparse
+import os
+import shutil
+import subprocess
+import sys
+import tempfile
+import time
+
+PROGRAM = """for procedure named 'step' accepting (x as int) and yielding int, tell the following story:
+beginning of the story
+    the result shall be x multiplied by 3 plus 1 divided by 2.
+end of the story.
+a value i, type int, begins at 0.
+a value acc, type int, begins at 0.
+while i is less than {n} holds, tell the following story:
+beginning of the story
+    the value acc continues as acc plus the story of 'step' using (i).
+    the value i continues as i plus 1.
+end of the story.
+the story tells: acc.
+the story ends a line.
+"""
+
+
+def timed(command, repeat):
+    best = None
+    output = None
+    for _ in range(repeat):
+        start = time.perf_counter()
+        result = subprocess.run(command, stdout=subprocess.PIPE, check=True)
+        elapsed = time.perf_counter() - start
+        best = elapsed if best is None else min(best, elapsed)
+        output = result.stdout
+    return best, output
+
+
+def native(compiler, source, workdir, repeat):
+    asm = os.path.join(workdir, "bench.s")
+    obj = os.path.join(workdir, "bench.o")
+    exe = os.path.join(workdir, "bench")
+    best = None
+    output = None
+    for _ in range(repeat):
+        start = time.perf_counter()
+        with open(asm, "wb") as out:
+            subprocess.run([compiler, source], stdout=out, check=True)
+        subprocess.run(["nasm", "-f", "elf64", asm, "-o", obj], check=True)
+        subprocess.run(["ld", obj, "-o", exe], check=True)
+        output = subprocess.run([exe], stdout=subprocess.PIPE, check=True).stdout
+        elapsed = time.perf_counter() - start
+        best = elapsed if best is None else min(best, elapsed)
+    return best, output
+
+
+def fit(points):
+    n = len(points)
+    mean_x = sum(x for x, _ in points) / n
+    mean_y = sum(y for _, y in points) / n
+    var = sum((x - mean_x) ** 2 for x, _ in points)
+    slope = sum((x - mean_x) * (y - mean_y) for x, y in points) / var if var else 0.0
+    return mean_y - slope * mean_x, slope
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--compiler", default="bin/lostrecordc_release")
+    parser.add_argument("--sizes", default="1000,10000,100000,1000000,5000000")
+    parser.add_argument("--repeat", type=int, default=3)
+    args = parser.parse_args()
+
+    have_native = shutil.which("nasm") is not None and shutil.which("ld") is not None
+    sizes = [int(s) for s in args.sizes.split(",")]
+    backends = ["interpret", "jit"] + (["native"] if have_native else [])
+    samples = {name: [] for name in backends}
+
+    print(f"{'N':>10} " + " ".join(f"{name + ' (ms)':>16}" for name in backends))
+    with tempfile.TemporaryDirectory() as workdir:
+        source = os.path.join(workdir, "bench.lr")
+        for n in sizes:
+            with open(source, "w") as f:
+                f.write(PROGRAM.format(n=n))
+            results = {
+                "interpret": timed([args.compiler, "--interpret", source], args.repeat),
+                "jit": timed([args.compiler, "--run", source], args.repeat),
+            }
+            if have_native:
+                results["native"] = native(args.compiler, source, workdir, args.repeat)
+            expected = results["interpret"][1]
+            for name, (_, output) in results.items():
+                if output != expected:
+                    sys.exit(f"output mismatch between interpret and {name} at N={n}")
+            for name in backends:
+                samples[name].append((n, results[name][0]))
+            print(f"{n:>10} " + " ".join(f"{results[name][0] * 1000:>16.2f}" for name in backends))
+
+    fixed_i, per_i = fit(samples["interpret"])
+    print()
+    for name in backends[1:]:
+        fixed, per = fit(samples[name])
+        if per_i <= per:
+            print(f"interpret vs {name}: interpreter is never slower in this range")
+            continue
+        crossover = max(0.0, (fixed - fixed_i) / (per_i - per))
+        print(f"interpret vs {name}: break-even at ~{crossover:,.0f} loop iterations")
+    if not have_native:
+        print("native: skipped (nasm/ld not found)")
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,179 @@
+#!/usr/bin/env python3
+"""Runs the programs in tests/bench/runtime/ and compares their speed with a saved baseline.
+
+Each program is built the normal way: lostrecordc > .s, nasm, ld. Without nasm the
+compiler's own assembler is used (lostrecordc -o). Its output is checked against the
+hash stored in the baseline and against lostrecordc --interpret. Options a program must be
+compiled with, such as -fmemoize, go in runtime/<name>.flags.
+
+With perf available, programs run under 'perf stat' and cycles and instructions are
+reported; otherwise the best wall and CPU time of --repeat runs is used.
+
+--update rewrites runtime/baseline.json with this run's results. Otherwise the run is
+compared with the baseline and the harness exits with status 1 when a program's output
+changed or it is slower than the baseline by more than --tolerance. Instruction counts are
+nearly deterministic and are always compared. Timings swing by tens of percent between
+runs on a shared or virtual machine, so they are only reported unless --compare-times is
+given, and even then only on the machine that recorded the baseline (same CPU model,
+family, stepping, microcode, core count, host and kernel) and only for programs whose
+baseline CPU time is at least --min-ms.
+"""
+
+import argparse
+import hashlib
+import json
+import os
+import platform
+import shutil
+import subprocess
+import sys
+import tempfile
+import time
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+CORPUS = os.path.join(HERE, "runtime")
+BASELINE = os.path.join(CORPUS, "baseline.json")
+
+
+def machine():
+    info = {}
+    try:
+        with open("/proc/cpuinfo") as f:
+            for line in f:
+                key, _, value = line.partition(":")
+                key = key.strip()
+                if key in ("model name", "cpu family", "model", "stepping", "microcode") and key not in info:
+                    info[key] = value.strip()
+    except OSError:
+        pass
+    info["cpus"] = os.cpu_count()
+    info["host"] = platform.node()
+    info["kernel"] = platform.release()
+    return info
+
+
+def build(compiler, source, workdir):
+    name = os.path.splitext(os.path.basename(source))[0]
+    exe = os.path.join(workdir, name)
+    flags = []
+    if os.path.exists(os.path.splitext(source)[0] + ".flags"):
+        with open(os.path.splitext(source)[0] + ".flags") as f:
+            flags = f.read().split()
+    if shutil.which("nasm"):
+        asm = os.path.join(workdir, name + ".s")
+        obj = os.path.join(workdir, name + ".o")
+        with open(asm, "wb") as out:
+            subprocess.run([compiler, *flags, source], stdout=out, check=True)
+        subprocess.run(["nasm", "-f", "elf64", asm, "-o", obj], check=True)
+        subprocess.run(["ld", obj, "-o", exe], check=True)
+    else:
+        # The compiler writes its object file next to the source, so build from a copy.
+        copy = os.path.join(workdir, os.path.basename(source))
+        shutil.copyfile(source, copy)
+        subprocess.run([compiler, *flags, "-o", exe, copy], check=True)
+    return exe
+
+
+def run_timed(exe, repeat):
+    best_wall = None
+    best_cpu = None
+    output = None
+    for _ in range(repeat):
+        with tempfile.TemporaryFile() as out:
+            start = time.perf_counter()
+            process = subprocess.Popen([exe], stdout=out)
+            _, status, usage = os.wait4(process.pid, 0)
+            wall = time.perf_counter() - start
+            if os.waitstatus_to_exitcode(status) != 0:
+                sys.exit(f"{exe} exited with status {os.waitstatus_to_exitcode(status)}")
+            out.seek(0)
+            output = out.read()
+        cpu = usage.ru_utime + usage.ru_stime
+        best_wall = wall if best_wall is None else min(best_wall, wall)
+        best_cpu = cpu if best_cpu is None else min(best_cpu, cpu)
+    return {"wall_ms": round(best_wall * 1000, 3), "cpu_ms": round(best_cpu * 1000, 3)}, output
+
+
+def run_perf(exe, repeat):
+    with tempfile.NamedTemporaryFile("r") as stats:
+        result = subprocess.run(["perf", "stat", "-x,", "-o", stats.name, "-r", str(repeat), "-e", "cycles,instructions", exe],
+                                stdout=subprocess.PIPE, check=True)
+        counters = {}
+        for line in stats.read().splitlines():
+            fields = line.split(",")
+            if len(fields) > 2 and fields[0].strip().isdigit():
+                counters[fields[2].split(":")[0]] = int(fields[0])
+    metrics, _ = run_timed(exe, repeat)
+    metrics.update(counters)
+    return metrics, result.stdout
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--compiler", default="bin/lostrecordc_release")
+    parser.add_argument("--repeat", type=int, default=10)
+    parser.add_argument("--tolerance", type=float, default=0.10, help="allowed slowdown against the baseline")
+    parser.add_argument("--compare-times", action="store_true", help="fail on slower timings, not just instruction counts")
+    parser.add_argument("--min-ms", type=float, default=50.0, help="shortest baseline CPU time whose timing is compared")
+    parser.add_argument("--update", action="store_true", help="save this run as the new baseline")
+    parser.add_argument("names", nargs="*", help="benchmarks to run (default: all)")
+    args = parser.parse_args()
+
+    compiler = os.path.abspath(args.compiler)
+    names = args.names or sorted(os.path.splitext(f)[0] for f in os.listdir(CORPUS) if f.endswith(".lr"))
+    use_perf = shutil.which("perf") is not None
+    baseline = {}
+    if os.path.exists(BASELINE):
+        with open(BASELINE) as f:
+            baseline = json.load(f)
+    same_machine = baseline.get("machine") == machine()
+    old = baseline.get("benchmarks", {})
+
+    results = {}
+    failures = []
+    print(f"{'benchmark':<14} {'wall ms':>9} {'cpu ms':>9} {'cycles':>14} {'instructions':>14} {'vs baseline':>12}")
+    with tempfile.TemporaryDirectory() as workdir:
+        for name in names:
+            source = os.path.join(CORPUS, name + ".lr")
+            exe = build(compiler, source, workdir)
+            metrics, output = run_perf(exe, args.repeat) if use_perf else run_timed(exe, args.repeat)
+            digest = hashlib.sha256(output).hexdigest()
+            interpreted = subprocess.run([compiler, "--interpret", source], stdout=subprocess.PIPE, check=True).stdout
+            if interpreted != output:
+                failures.append(f"{name}: native output differs from --interpret")
+            if name in old and old[name]["output_sha256"] != digest:
+                failures.append(f"{name}: output differs from the baseline")
+            metrics["output_sha256"] = digest
+            results[name] = metrics
+
+            # Report the most stable metric both runs have; fail on it only when it is trustworthy here.
+            ratio = None
+            previous = old.get(name, {})
+            for key in ["instructions", "cycles", "cpu_ms"]:
+                if key in metrics and key in previous:
+                    ratio = metrics[key] / previous[key]
+                    compare = key == "instructions" or (args.compare_times and same_machine and previous["cpu_ms"] >= args.min_ms)
+                    if compare and ratio > 1.0 + args.tolerance:
+                        failures.append(f"{name}: {key} {previous[key]:.0f} -> {metrics[key]:.0f} ({ratio - 1:+.1%})")
+                    break
+            compared = f"{ratio - 1:+.1%}" if ratio is not None else "-"
+            cycles = f"{metrics['cycles']:,}" if "cycles" in metrics else "-"
+            instructions = f"{metrics['instructions']:,}" if "instructions" in metrics else "-"
+            print(f"{name:<14} {metrics['wall_ms']:>9.2f} {metrics['cpu_ms']:>9.2f} {cycles:>14} {instructions:>14} {compared:>12}")
+
+    if old and args.compare_times and not same_machine:
+        print(f"\nBaseline was recorded on {baseline.get('machine')}; timings are not compared on this machine.")
+    if args.update:
+        with open(BASELINE, "w") as f:
+            json.dump({"machine": machine(), "benchmarks": results}, f, indent=1, sort_keys=True)
+            f.write("\n")
+        print(f"\nSaved baseline to {os.path.relpath(BASELINE)}.")
+    if failures:
+        print()
+        for line in failures:
+            print(line)
+        sys.exit(1)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,156 @@
+#!/usr/bin/env python3
+"""Measures compiler throughput per phase on synthetic programs of increasing size.
+
+Each size is generated by gen_program.py and compiled with lostrecordc --time-report=json
+(assembly is written to a temporary file). For every phase the best wall time over --repeat runs is turned into
+tokens, lines and bytes of source per second. The scaling table divides each phase's time by
+its time at the smallest size and fits an exponent: 1.00 is linear, larger values mean the
+phase grows faster than the input.
+
+--save writes the results as JSON; --baseline compares against a saved file and exits with
+status 1 when any phase at any size is slower than the baseline by more than --tolerance.
+"""
+
+import argparse
+import json
+import math
+import os
+import subprocess
+import sys
+import tempfile
+
+import gen_program
+
+PHASES = ["read", "lex", "parse", "imports", "string_walk", "stack_walk", "pure_eval", "codegen", "output"]
+# Phases whose time is a share of codegen (and summed over threads) are shown but not totalled.
+NESTED = {"string_walk", "stack_walk", "pure_eval"}
+
+
+def compile_once(compiler, source, jobs):
+    command = [compiler, "--time-report=json", "-j", str(jobs), source]
+    with open(source + ".s", "w") as out:
+        result = subprocess.run(command, stdout=out, stderr=subprocess.PIPE, check=True, text=True)
+    lines = result.stderr.strip().splitlines()
+    if len(lines) != 1:
+        sys.exit(f"unexpected compiler diagnostics for {source}:\n{result.stderr}")
+    return json.loads(lines[0])
+
+
+def measure(compiler, source, jobs, repeat):
+    best = None
+    for _ in range(repeat):
+        report = compile_once(compiler, source, jobs)
+        if best is None:
+            best = report
+            continue
+        for name, phase in report["phases"].items():
+            if phase["wall_ms"] < best["phases"][name]["wall_ms"]:
+                best["phases"][name] = phase
+        best["peak_rss_kb"] = min(best["peak_rss_kb"], report["peak_rss_kb"])
+    best["total_ms"] = sum(p["wall_ms"] for name, p in best["phases"].items() if name not in NESTED)
+    return best
+
+
+def rate(amount, ms):
+    return amount / (ms / 1000.0) if ms > 0 else float("inf")
+
+
+def human(value):
+    for unit in ["", "K", "M", "G"]:
+        if abs(value) < 1000:
+            return f"{value:.1f}{unit}"
+        value /= 1000.0
+    return f"{value:.1f}T"
+
+
+def exponent(points):
+    logs = [(math.log(x), math.log(y)) for x, y in points if x > 0 and y > 0]
+    if len(logs) < 2:
+        return float("nan")
+    mean_x = sum(x for x, _ in logs) / len(logs)
+    mean_y = sum(y for _, y in logs) / len(logs)
+    var = sum((x - mean_x) ** 2 for x, _ in logs)
+    return sum((x - mean_x) * (y - mean_y) for x, y in logs) / var if var else float("nan")
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--compiler", default="bin/lostrecordc_release")
+    parser.add_argument("--sizes", default="100,300,1000,3000", help="procedure counts to generate")
+    parser.add_argument("--depth", type=int, default=8)
+    parser.add_argument("--terms", type=int, default=16)
+    parser.add_argument("--strings-per-procedure", type=float, default=1.0)
+    parser.add_argument("--iterations", type=int, default=1000)
+    parser.add_argument("--repeat", type=int, default=5)
+    parser.add_argument("-j", "--jobs", type=int, default=1)
+    parser.add_argument("--save", help="write results to this JSON file")
+    parser.add_argument("--baseline", help="compare against results saved with --save")
+    parser.add_argument("--tolerance", type=float, default=0.15, help="allowed slowdown against the baseline")
+    args = parser.parse_args()
+
+    sizes = [int(s) for s in args.sizes.split(",")]
+    results = []
+    with tempfile.TemporaryDirectory() as workdir:
+        source = os.path.join(workdir, "bench.lr")
+        for size in sizes:
+            text = gen_program.generate(size, args.depth, args.terms, int(size * args.strings_per_procedure), args.iterations)
+            with open(source, "w") as f:
+                f.write(text)
+            report = measure(args.compiler, source, args.jobs, args.repeat)
+            report["procedures"] = size
+            results.append(report)
+
+    print(f"{'procs':>7} {'lines':>9} {'tokens':>10} {'bytes':>10} {'total ms':>10} {'rss MiB':>8}")
+    for r in results:
+        print(f"{r['procedures']:>7} {r['source_lines']:>9} {r['tokens']:>10} {r['source_bytes']:>10} "
+              f"{r['total_ms']:>10.2f} {r['peak_rss_kb'] / 1024:>8.1f}")
+
+    phases = [p for p in PHASES if any(p in r["phases"] for r in results)]
+    print()
+    print(f"{'phase':<12} {'procs':>7} {'wall ms':>10} {'tokens/s':>10} {'lines/s':>10} {'bytes/s':>10}")
+    for phase in phases:
+        for r in results:
+            ms = r["phases"].get(phase, {}).get("wall_ms", 0.0)
+            print(f"{phase:<12} {r['procedures']:>7} {ms:>10.2f} {human(rate(r['tokens'], ms)):>10} "
+                  f"{human(rate(r['source_lines'], ms)):>10} {human(rate(r['source_bytes'], ms)):>10}")
+
+    print()
+    base = results[0]
+    print(f"{'scaling':<12} " + " ".join(f"{'x' + format(r['tokens'] / base['tokens'], '.0f'):>8}" for r in results) + f" {'exponent':>9}")
+    for phase in phases + ["total"]:
+        times = [r["total_ms"] if phase == "total" else r["phases"].get(phase, {}).get("wall_ms", 0.0) for r in results]
+        if times[0] <= 0:
+            continue
+        curve = " ".join(f"{t / times[0]:>8.1f}" for t in times)
+        slope = exponent([(r["tokens"], t) for r, t in zip(results, times)])
+        print(f"{phase:<12} {curve} {slope:>9.2f}")
+
+    if args.save:
+        with open(args.save, "w") as f:
+            json.dump(results, f, indent=1)
+
+    if args.baseline:
+        with open(args.baseline) as f:
+            baseline = {r["procedures"]: r for r in json.load(f)}
+        regressions = []
+        for r in results:
+            old = baseline.get(r["procedures"])
+            if old is None:
+                continue
+            for phase in phases + ["total"]:
+                new_ms = r["total_ms"] if phase == "total" else r["phases"].get(phase, {}).get("wall_ms", 0.0)
+                old_ms = old["total_ms"] if phase == "total" else old["phases"].get(phase, {}).get("wall_ms", 0.0)
+                # Phases shorter than a few milliseconds are dominated by noise.
+                if old_ms >= 5.0 and new_ms > old_ms * (1.0 + args.tolerance):
+                    regressions.append(f"{phase} at {r['procedures']} procedures: {old_ms:.2f} ms -> {new_ms:.2f} ms")
+        print()
+        if regressions:
+            print("Regressions against " + args.baseline + ":")
+            for line in regressions:
+                print("  " + line)
+            sys.exit(1)
+        print(f"No phase slower than {args.baseline} by more than {args.tolerance:.0%}.")
+
+
+if __name__ == "__main__":
+    main()